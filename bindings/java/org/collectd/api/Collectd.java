@@ -170,6 +170,17 @@ public class Collectd
   native public static int registerWrite (String name,
       CollectdWriteInterface object);
 
+  /**
+   * Registers a write callback which is passed up to <code>batchSize</code>
+   * value lists at once. Values are held back at most one interval, or
+   * until the callback is flushed.
+   *
+   * @return Zero when successful, non-zero otherwise.
+   * @see CollectdWriteBatchInterface
+   */
+  native public static int registerWriteBatch (String name,
+      CollectdWriteBatchInterface object, int batchSize);
+
   /**
    * Java representation of collectd/src/plugin.h:plugin_register_flush
    *
@@ -30,6 +30,7 @@
 #include "configfile.h"
 #include "meta_data.h"
 #include "utils_cache.h" /* for uc_get_rate() */
+#include "utils_ident.h"
 #include "utils_vl_lookup.h"
 
 #include <pthread.h>
@@ -205,10 +206,10 @@ static int agg_instance_update (agg_instance_t *inst, /* {{{ */
   rate = uc_get_rate (ds, vl);
   if (rate == NULL)
   {
-    char ident[6 * DATA_MAX_NAME_LEN];
-    FORMAT_VL (ident, sizeof (ident), vl);
+    char buffer[6 * DATA_MAX_NAME_LEN];
+    const char *ident = ident_vl_name (vl, buffer, sizeof (buffer));
     ERROR ("aggregation plugin: Unable to read the current rate of \"%s\".",
-        ident);
+        (ident != NULL) ? ident : vl->type);
     return (ENOENT);
   }
 
@@ -30,6 +30,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_cmd_putval.h"
+#include "utils_complain.h"
 #include "utils_format_json.h"
 #include "utils_format_graphite.h"
 
@@ -49,9 +50,29 @@
 
 #define CAMQP_CHANNEL 1
 
+#define CAMQP_DEFAULT_BATCH_BYTES 65536
+/* Leaves room for at least one formatted value list. */
+#define CAMQP_MIN_BATCH_BYTES      8192
+#define CAMQP_DEFAULT_ROUTING_KEY "collectd"
+
+#define CAMQP_RECONNECT_DELAY_MIN TIME_T_TO_CDTIME_T (1)
+#define CAMQP_RECONNECT_DELAY_MAX TIME_T_TO_CDTIME_T (64)
+
 /*
  * Data types
  */
+/* Body of a message carrying one or more value lists. "data" points right
+ * behind the structure. */
+struct camqp_message_s
+{
+    char   *data;
+    size_t  fill;
+    size_t  size;
+    size_t  values_num;
+    struct camqp_message_s *next;
+};
+typedef struct camqp_message_s camqp_message_t;
+
 struct camqp_config_s
 {
     _Bool   publish;
@@ -75,9 +96,31 @@ struct camqp_config_s
     char    *postfix;
     char    escape_char;
 
+    /* publish & batching only. When batching, value lists are collected in
+     * "batch" and a separate thread publishes the queued messages, so the
+     * write threads never wait for the broker. */
+    size_t   batch_size;
+    size_t   batch_bytes;
+    cdtime_t flush_interval;
+    size_t   queue_max;
+
+    camqp_message_t *batch;
+    cdtime_t batch_init_time;
+
+    camqp_message_t *queue_head;
+    camqp_message_t *queue_tail;
+    size_t   queue_values;
+    c_complain_t queue_complaint;
+
+    pthread_cond_t publish_cond;
+    pthread_t      publish_thread;
+    _Bool          publish_thread_running;
+    _Bool          publish_thread_stop;
+
     /* subscribe only */
     char   *exchange_type;
     char   *queue;
+    int     threads_num;
 
     amqp_connection_state_t connection;
     pthread_mutex_t lock;
@@ -117,6 +160,16 @@ static void camqp_close_connection (camqp_config_t *conf) /* {{{ */
     conf->connection = NULL;
 } /* }}} void camqp_close_connection */
 
+static void camqp_messages_free (camqp_message_t *msg) /* {{{ */
+{
+    while (msg != NULL)
+    {
+        camqp_message_t *next = msg->next;
+        sfree (msg);
+        msg = next;
+    }
+} /* }}} void camqp_messages_free */
+
 static void camqp_config_free (void *ptr) /* {{{ */
 {
     camqp_config_t *conf = ptr;
@@ -126,6 +179,11 @@ static void camqp_config_free (void *ptr) /* {{{ */
 
     camqp_close_connection (conf);
 
+    camqp_messages_free (conf->batch);
+    camqp_messages_free (conf->queue_head);
+    pthread_cond_destroy (&conf->publish_cond);
+    pthread_mutex_destroy (&conf->lock);
+
     sfree (conf->name);
     sfree (conf->host);
     sfree (conf->vhost);
@@ -484,16 +542,50 @@ static int camqp_shutdown (void) /* {{{ */
 /*
  * Subscribing code
  */
+/* Handles a "text/collectd" body, which may hold several PUTVAL commands, one
+ * per line, if the publisher batches value lists. */
+static int camqp_handle_putvals (char *body) /* {{{ */
+{
+    char *line;
+    char *saveptr;
+    int status = 0;
+
+    saveptr = NULL;
+    for (line = strtok_r (body, "\r\n", &saveptr);
+            line != NULL;
+            line = strtok_r (NULL, "\r\n", &saveptr))
+    {
+        int tmp;
+
+        tmp = handle_putval (stderr, line);
+        if (tmp != 0)
+        {
+            ERROR ("amqp plugin: handle_putval failed with status %i.",
+                    tmp);
+            status = tmp;
+        }
+    }
+
+    return (status);
+} /* }}} int camqp_handle_putvals */
+
 static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         size_t body_size, const char *content_type)
 {
-    char body[body_size + 1];
+    char *body;
     char *body_ptr;
     size_t received;
     amqp_frame_t frame;
     int status;
 
-    memset (body, 0, sizeof (body));
+    /* Batched messages may be much larger than a single value list, so don't
+     * put the body on the stack. */
+    body = calloc (1, body_size + 1);
+    if (body == NULL)
+    {
+        ERROR ("amqp plugin: calloc failed.");
+        return (ENOMEM);
+    }
     body_ptr = &body[0];
     received = 0;
 
@@ -507,6 +599,7 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
             ERROR ("amqp plugin: amqp_simple_wait_frame failed: %s",
                     sstrerror (status, errbuf, sizeof (errbuf)));
             camqp_close_connection (conf);
+            sfree (body);
             return (status);
         }
 
@@ -514,12 +607,14 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         {
             NOTICE ("amqp plugin: Unexpected frame type: %#"PRIx8,
                     frame.frame_type);
+            sfree (body);
             return (-1);
         }
 
         if ((body_size - received) < frame.payload.body_fragment.len)
         {
             WARNING ("amqp plugin: Body is larger than indicated by header.");
+            sfree (body);
             return (-1);
         }
 
@@ -531,27 +626,23 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
 
     if (strcasecmp ("text/collectd", content_type) == 0)
     {
-        status = handle_putval (stderr, body);
-        if (status != 0)
-            ERROR ("amqp plugin: handle_putval failed with status %i.",
-                    status);
-        return (status);
+        status = camqp_handle_putvals (body);
     }
     else if (strcasecmp ("application/json", content_type) == 0)
     {
         ERROR ("amqp plugin: camqp_read_body: Parsing JSON data has not "
                 "been implemented yet. FIXME!");
-        return (0);
+        status = 0;
     }
     else
     {
         ERROR ("amqp plugin: camqp_read_body: Unknown content type \"%s\".",
                 content_type);
-        return (EINVAL);
+        status = EINVAL;
     }
 
-    /* not reached */
-    return (0);
+    sfree (body);
+    return (status);
 } /* }}} int camqp_read_body */
 
 static int camqp_read_header (camqp_config_t *conf) /* {{{ */
@@ -655,6 +746,39 @@ static void *camqp_subscribe_thread (void *user_data) /* {{{ */
     return (NULL);
 } /* }}} void *camqp_subscribe_thread */
 
+/* Copies the configuration of a <Subscribe> block, so that each subscriber
+ * thread has a connection of its own. */
+static camqp_config_t *camqp_config_dup (camqp_config_t const *src) /* {{{ */
+{
+    camqp_config_t *dst;
+
+    dst = malloc (sizeof (*dst));
+    if (dst == NULL)
+        return (NULL);
+    memcpy (dst, src, sizeof (*dst));
+
+    dst->name          = sstrdup (src->name);
+    dst->host          = sstrdup (src->host);
+    dst->vhost         = sstrdup (src->vhost);
+    dst->user          = sstrdup (src->user);
+    dst->password      = sstrdup (src->password);
+    dst->exchange      = sstrdup (src->exchange);
+    dst->routing_key   = sstrdup (src->routing_key);
+    dst->prefix        = sstrdup (src->prefix);
+    dst->postfix       = sstrdup (src->postfix);
+    dst->exchange_type = sstrdup (src->exchange_type);
+    dst->queue         = sstrdup (src->queue);
+
+    dst->batch = NULL;
+    dst->queue_head = NULL;
+    dst->queue_tail = NULL;
+    dst->connection = NULL;
+    pthread_mutex_init (&dst->lock, /* attr = */ NULL);
+    pthread_cond_init (&dst->publish_cond, /* attr = */ NULL);
+
+    return (dst);
+} /* }}} camqp_config_t *camqp_config_dup */
+
 static int camqp_subscribe_init (camqp_config_t *conf) /* {{{ */
 {
     int status;
@@ -691,11 +815,13 @@ static int camqp_subscribe_init (camqp_config_t *conf) /* {{{ */
 /*
  * Publishing code
  */
-/* XXX: You must hold "conf->lock" when calling this function! */
+/* XXX: You must hold "conf->lock" when calling this function, unless the
+ * connection is owned by the publisher thread! */
 static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
-        const char *buffer, const char *routing_key)
+        const char *buffer, size_t buffer_size, const char *routing_key)
 {
     amqp_basic_properties_t props;
+    amqp_bytes_t body;
     int status;
 
     status = camqp_connect (conf);
@@ -717,6 +843,9 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
     props.delivery_mode = conf->delivery_mode;
     props.app_id = amqp_cstring_bytes("collectd");
 
+    body.len = buffer_size;
+    body.bytes = (void *) buffer;
+
     status = amqp_basic_publish(conf->connection,
                 /* channel = */ 1,
                 amqp_cstring_bytes(CONF(conf, exchange)),
@@ -724,7 +853,7 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
                 /* mandatory = */ 0,
                 /* immediate = */ 0,
                 &props,
-                amqp_cstring_bytes(buffer));
+                body);
     if (status != 0)
     {
         ERROR ("amqp plugin: amqp_basic_publish failed with status %i.",
@@ -735,42 +864,346 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
     return (status);
 } /* }}} int camqp_write_locked */
 
-static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
-        user_data_t *user_data)
+/* Drops the oldest queued messages until the backlog is within its limit.
+ * NOTE: You must hold conf->lock when calling this function! */
+static void camqp_queue_limit_nolock (camqp_config_t *conf) /* {{{ */
 {
-    camqp_config_t *conf = user_data->data;
-    char routing_key[6 * DATA_MAX_NAME_LEN];
-    char buffer[4096];
-    int status;
+    size_t dropped = 0;
 
-    if ((ds == NULL) || (vl == NULL) || (conf == NULL))
-        return (EINVAL);
+    if (conf->queue_max == 0)
+        return;
 
-    memset (buffer, 0, sizeof (buffer));
+    while ((conf->queue_values > conf->queue_max)
+            && (conf->queue_head != NULL))
+    {
+        camqp_message_t *msg = conf->queue_head;
 
-    if (conf->routing_key != NULL)
+        conf->queue_head = msg->next;
+        if (conf->queue_head == NULL)
+            conf->queue_tail = NULL;
+        conf->queue_values -= msg->values_num;
+
+        dropped += msg->values_num;
+        sfree (msg);
+    }
+
+    if (dropped > 0)
+        c_complain (LOG_WARNING, &conf->queue_complaint,
+                "amqp plugin: Publish \"%s\": Backlog is full, "
+                "dropping the oldest data.", conf->name);
+} /* }}} void camqp_queue_limit_nolock */
+
+/* Completes the current message, moves it to the queue and wakes up the
+ * publisher thread.
+ * NOTE: You must hold conf->lock when calling this function! */
+static void camqp_enqueue_nolock (camqp_config_t *conf) /* {{{ */
+{
+    camqp_message_t *msg = conf->batch;
+
+    if ((msg == NULL) || (msg->values_num == 0))
+        return;
+
+    conf->batch = NULL;
+
+    /* Turn the comma separated JSON objects into an array. Space for the
+     * closing bracket has been reserved in camqp_batch_append_nolock(). */
+    if (conf->format == CAMQP_FORMAT_JSON)
     {
-        sstrncpy (routing_key, conf->routing_key, sizeof (routing_key));
+        assert (msg->data[0] == ',');
+        msg->data[0] = '[';
+        msg->data[msg->fill] = ']';
+        msg->fill++;
+        msg->data[msg->fill] = 0;
     }
+
+    msg->next = NULL;
+    if (conf->queue_tail == NULL)
+        conf->queue_head = msg;
     else
+        conf->queue_tail->next = msg;
+    conf->queue_tail = msg;
+    conf->queue_values += msg->values_num;
+
+    camqp_queue_limit_nolock (conf);
+
+    pthread_cond_signal (&conf->publish_cond);
+} /* }}} void camqp_enqueue_nolock */
+
+static void *camqp_publish_thread (void *arg) /* {{{ */
+{
+    camqp_config_t *conf = arg;
+    const char *routing_key;
+    cdtime_t reconnect_delay = CAMQP_RECONNECT_DELAY_MIN;
+    cdtime_t next_attempt = 0;
+
+    /* Messages carry value lists with different identifiers, so the routing
+     * key can't be computed from the identifier. */
+    routing_key = (conf->routing_key != NULL)
+        ? conf->routing_key : CAMQP_DEFAULT_ROUTING_KEY;
+
+    pthread_mutex_lock (&conf->lock);
+    while (42)
     {
-        size_t i;
-        ssnprintf (routing_key, sizeof (routing_key), "collectd/%s/%s/%s/%s/%s",
-                vl->host,
-                vl->plugin, vl->plugin_instance,
-                vl->type, vl->type_instance);
+        camqp_message_t *msgs;
+        camqp_message_t *last;
+        size_t values_num;
+        int status;
+
+        /* Wait for a queued message or for the current message to become
+         * older than `FlushInterval', and after a failure for the reconnect
+         * delay to pass. When shutting down, one last attempt is made right
+         * away. */
+        while (!conf->publish_thread_stop)
+        {
+            cdtime_t now = cdtime ();
+            cdtime_t wakeup = 0;
 
-        /* Switch slashes (the only character forbidden by collectd) and dots
-         * (the separation character used by AMQP). */
-        for (i = 0; routing_key[i] != 0; i++)
+            if ((conf->batch != NULL)
+                    && ((conf->batch_init_time + conf->flush_interval) <= now))
+                camqp_enqueue_nolock (conf);
+
+            if (conf->queue_head != NULL)
+            {
+                if (now >= next_attempt)
+                    break;
+                wakeup = next_attempt;
+            }
+            else if (conf->batch != NULL)
+            {
+                wakeup = conf->batch_init_time + conf->flush_interval;
+            }
+
+            if (wakeup == 0)
+            {
+                pthread_cond_wait (&conf->publish_cond, &conf->lock);
+            }
+            else
+            {
+                struct timespec ts;
+
+                CDTIME_T_TO_TIMESPEC (wakeup, &ts);
+                pthread_cond_timedwait (&conf->publish_cond, &conf->lock, &ts);
+            }
+        }
+
+        if (conf->queue_head == NULL)
+            break;
+
+        /* Take all queued messages. Publishing is asynchronous in AMQP, so
+         * they are written to the socket back to back without waiting for
+         * the broker in between. */
+        msgs = conf->queue_head;
+        conf->queue_head = NULL;
+        conf->queue_tail = NULL;
+        conf->queue_values = 0;
+
+        pthread_mutex_unlock (&conf->lock);
+
+        status = 0;
+        while (msgs != NULL)
         {
-            if (routing_key[i] == '.')
-                routing_key[i] = '/';
-            else if (routing_key[i] == '/')
-                routing_key[i] = '.';
+            camqp_message_t *next = msgs->next;
+
+            status = camqp_write_locked (conf, msgs->data, msgs->fill,
+                    routing_key);
+            if (status != 0)
+                break;
+
+            sfree (msgs);
+            msgs = next;
+        }
+
+        pthread_mutex_lock (&conf->lock);
+
+        if (status == 0)
+        {
+            reconnect_delay = CAMQP_RECONNECT_DELAY_MIN;
+            next_attempt = 0;
+            continue;
+        }
+
+        if (conf->publish_thread_stop)
+        {
+            ERROR ("amqp plugin: Publish \"%s\": Discarding unsent data "
+                    "on shutdown.", conf->name);
+            camqp_messages_free (msgs);
+            camqp_messages_free (conf->queue_head);
+            conf->queue_head = NULL;
+            conf->queue_tail = NULL;
+            conf->queue_values = 0;
+            break;
         }
+
+        /* Put the unsent messages back to the front of the queue. The message
+         * which failed may have reached the broker nonetheless, so it may be
+         * delivered twice. */
+        values_num = 0;
+        for (last = msgs; last->next != NULL; last = last->next)
+            values_num += last->values_num;
+        values_num += last->values_num;
+
+        last->next = conf->queue_head;
+        conf->queue_head = msgs;
+        if (conf->queue_tail == NULL)
+            conf->queue_tail = last;
+        conf->queue_values += values_num;
+        camqp_queue_limit_nolock (conf);
+
+        next_attempt = cdtime () + reconnect_delay;
+        reconnect_delay *= 2;
+        if (reconnect_delay > CAMQP_RECONNECT_DELAY_MAX)
+            reconnect_delay = CAMQP_RECONNECT_DELAY_MAX;
+    }
+    pthread_mutex_unlock (&conf->lock);
+
+    return (NULL);
+} /* }}} void *camqp_publish_thread */
+
+/* NOTE: You must hold conf->lock when calling this function! */
+static int camqp_start_thread_nolock (camqp_config_t *conf) /* {{{ */
+{
+    int status;
+
+    if (conf->publish_thread_running)
+        return (0);
+
+    status = plugin_thread_create (&conf->publish_thread, /* attr = */ NULL,
+            camqp_publish_thread, conf);
+    if (status != 0)
+    {
+        char errbuf[1024];
+        ERROR ("amqp plugin: pthread_create failed: %s",
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        return (-1);
     }
 
+    conf->publish_thread_running = 1;
+    return (0);
+} /* }}} int camqp_start_thread_nolock */
+
+/* Appends a formatted value list to the current message, starting a new
+ * message if it doesn't fit.
+ * NOTE: You must hold conf->lock when calling this function! */
+static int camqp_batch_append_nolock (camqp_config_t *conf, /* {{{ */
+        const char *buffer)
+{
+    camqp_message_t *msg;
+    size_t buffer_len;
+    size_t required;
+
+    /* Besides the terminating null byte, one more byte is needed for the
+     * newline separating commands or the closing bracket of a JSON array. */
+    buffer_len = strlen (buffer);
+    required = buffer_len + 2;
+    if (required > conf->batch_bytes)
+    {
+        ERROR ("amqp plugin: Publish \"%s\": Value list of %zu bytes is "
+                "too large for a message of at most %zu bytes.",
+                conf->name, buffer_len, conf->batch_bytes);
+        return (-1);
+    }
+
+    if ((conf->batch != NULL)
+            && ((conf->batch->fill + required) > conf->batch->size))
+        camqp_enqueue_nolock (conf);
+
+    if (conf->batch == NULL)
+    {
+        msg = malloc (sizeof (*msg) + conf->batch_bytes);
+        if (msg == NULL)
+        {
+            ERROR ("amqp plugin: malloc failed.");
+            return (ENOMEM);
+        }
+        msg->data = (char *) (msg + 1);
+        msg->fill = 0;
+        msg->size = conf->batch_bytes;
+        msg->values_num = 0;
+        msg->next = NULL;
+
+        conf->batch = msg;
+        conf->batch_init_time = cdtime ();
+    }
+    msg = conf->batch;
+
+    memcpy (msg->data + msg->fill, buffer, buffer_len);
+    msg->fill += buffer_len;
+    if (conf->format == CAMQP_FORMAT_COMMAND)
+    {
+        msg->data[msg->fill] = '\n';
+        msg->fill++;
+    }
+    msg->data[msg->fill] = 0;
+    msg->values_num++;
+
+    if (msg->values_num >= conf->batch_size)
+        camqp_enqueue_nolock (conf);
+
+    return (0);
+} /* }}} int camqp_batch_append_nolock */
+
+static int camqp_flush (cdtime_t timeout, /* {{{ */
+        const char *identifier __attribute__((unused)),
+        user_data_t *user_data)
+{
+    camqp_config_t *conf;
+
+    if (user_data == NULL)
+        return (-EINVAL);
+
+    conf = user_data->data;
+
+    pthread_mutex_lock (&conf->lock);
+    /* timeout == 0  => flush unconditionally */
+    if ((conf->batch != NULL)
+            && ((timeout == 0)
+                || ((conf->batch_init_time + timeout) <= cdtime ())))
+        camqp_enqueue_nolock (conf);
+    pthread_mutex_unlock (&conf->lock);
+
+    return (0);
+} /* }}} int camqp_flush */
+
+/* Free function of <Publish> blocks with batching enabled: Hands the current
+ * message to the publisher thread and waits for it to exit. */
+static void camqp_publish_free (void *ptr) /* {{{ */
+{
+    camqp_config_t *conf = ptr;
+
+    if (conf == NULL)
+        return;
+
+    pthread_mutex_lock (&conf->lock);
+    camqp_enqueue_nolock (conf);
+    conf->publish_thread_stop = 1;
+    pthread_cond_broadcast (&conf->publish_cond);
+    pthread_mutex_unlock (&conf->lock);
+
+    if (conf->publish_thread_running)
+    {
+        pthread_join (conf->publish_thread, /* retval = */ NULL);
+        conf->publish_thread_running = 0;
+    }
+
+    camqp_config_free (conf);
+} /* }}} void camqp_publish_free */
+
+static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+        user_data_t *user_data)
+{
+    camqp_config_t *conf = user_data->data;
+    char routing_key[6 * DATA_MAX_NAME_LEN];
+    char buffer[4096];
+    _Bool batching;
+    int status;
+
+    if ((ds == NULL) || (vl == NULL) || (conf == NULL))
+        return (EINVAL);
+
+    batching = (conf->batch_size > 1);
+
+    memset (buffer, 0, sizeof (buffer));
+
     if (conf->format == CAMQP_FORMAT_COMMAND)
     {
         status = create_putval (buffer, sizeof (buffer), ds, vl);
@@ -787,8 +1220,17 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         size_t bfill = 0;
 
         format_json_initialize (buffer, &bfill, &bfree);
-        format_json_value_list (buffer, &bfill, &bfree, ds, vl, conf->store_rates);
-        format_json_finalize (buffer, &bfill, &bfree);
+        status = format_json_value_list (buffer, &bfill, &bfree, ds, vl,
+                conf->store_rates);
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: format_json_value_list failed with "
+                    "status %i.", status);
+            return (status);
+        }
+        /* When batching, the array is closed when the message is complete. */
+        if (!batching)
+            format_json_finalize (buffer, &bfill, &bfree);
     }
     else if (conf->format == CAMQP_FORMAT_GRAPHITE)
     {
@@ -808,8 +1250,42 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         return (-1);
     }
 
+    if (batching)
+    {
+        pthread_mutex_lock (&conf->lock);
+        status = camqp_start_thread_nolock (conf);
+        if (status == 0)
+            status = camqp_batch_append_nolock (conf, buffer);
+        pthread_mutex_unlock (&conf->lock);
+
+        return (status);
+    }
+
+    if (conf->routing_key != NULL)
+    {
+        sstrncpy (routing_key, conf->routing_key, sizeof (routing_key));
+    }
+    else
+    {
+        size_t i;
+        ssnprintf (routing_key, sizeof (routing_key), "collectd/%s/%s/%s/%s/%s",
+                vl->host,
+                vl->plugin, vl->plugin_instance,
+                vl->type, vl->type_instance);
+
+        /* Switch slashes (the only character forbidden by collectd) and dots
+         * (the separation character used by AMQP). */
+        for (i = 0; routing_key[i] != 0; i++)
+        {
+            if (routing_key[i] == '.')
+                routing_key[i] = '/';
+            else if (routing_key[i] == '/')
+                routing_key[i] = '.';
+        }
+    }
+
     pthread_mutex_lock (&conf->lock);
-    status = camqp_write_locked (conf, buffer, routing_key);
+    status = camqp_write_locked (conf, buffer, strlen (buffer), routing_key);
     pthread_mutex_unlock (&conf->lock);
 
     return (status);
@@ -847,6 +1323,27 @@ static int camqp_config_set_format (oconfig_item_t *ci, /* {{{ */
     return (0);
 } /* }}} int config_set_string */
 
+static int camqp_config_get_size (oconfig_item_t *ci, /* {{{ */
+        size_t *ret_value)
+{
+    int tmp = 0;
+    int status;
+
+    status = cf_util_get_int (ci, &tmp);
+    if (status != 0)
+        return (status);
+
+    if (tmp < 0)
+    {
+        WARNING ("amqp plugin: The \"%s\" option requires a non-negative "
+                "integer.", ci->key);
+        return (-1);
+    }
+
+    *ret_value = (size_t) tmp;
+    return (0);
+} /* }}} int camqp_config_get_size */
+
 static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
         _Bool publish)
 {
@@ -880,12 +1377,26 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
     conf->prefix = NULL;
     conf->postfix = NULL;
     conf->escape_char = '_';
+    /* publish & batching only */
+    conf->batch_size = 0;
+    conf->batch_bytes = CAMQP_DEFAULT_BATCH_BYTES;
+    conf->flush_interval = TIME_T_TO_CDTIME_T (1);
+    conf->queue_max = 0;
+    conf->batch = NULL;
+    conf->queue_head = NULL;
+    conf->queue_tail = NULL;
+    conf->queue_values = 0;
+    C_COMPLAIN_INIT (&conf->queue_complaint);
+    conf->publish_thread_running = 0;
+    conf->publish_thread_stop = 0;
     /* subscribe only */
     conf->exchange_type = NULL;
     conf->queue = NULL;
+    conf->threads_num = 1;
     /* general */
     conf->connection = NULL;
     pthread_mutex_init (&conf->lock, /* attr = */ NULL);
+    pthread_cond_init (&conf->publish_cond, /* attr = */ NULL);
     /* }}} */
 
     status = cf_util_get_string (ci, &conf->name);
@@ -951,6 +1462,24 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
             conf->escape_char = tmp_buff[0];
             sfree (tmp_buff);
         }
+        else if ((strcasecmp ("BatchSize", child->key) == 0) && publish)
+            status = camqp_config_get_size (child, &conf->batch_size);
+        else if ((strcasecmp ("BatchBytes", child->key) == 0) && publish)
+            status = camqp_config_get_size (child, &conf->batch_bytes);
+        else if ((strcasecmp ("FlushInterval", child->key) == 0) && publish)
+            status = cf_util_get_cdtime (child, &conf->flush_interval);
+        else if ((strcasecmp ("MaxBacklog", child->key) == 0) && publish)
+            status = camqp_config_get_size (child, &conf->queue_max);
+        else if ((strcasecmp ("Threads", child->key) == 0) && !publish)
+        {
+            status = cf_util_get_int (child, &conf->threads_num);
+            if ((status == 0) && (conf->threads_num < 1))
+            {
+                WARNING ("amqp plugin: The \"Threads\" option requires a "
+                        "positive integer.");
+                status = -1;
+            }
+        }
         else
             WARNING ("amqp plugin: Ignoring unknown "
                     "configuration option \"%s\".", child->key);
@@ -971,6 +1500,25 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
 
     }
 
+    /* A server generated queue would differ for each connection, i.e. each
+     * thread would receive all of the values. */
+    if ((status == 0) && (conf->threads_num > 1) && (conf->queue == NULL))
+    {
+        WARNING ("amqp plugin: Subscribe \"%s\": The \"Threads\" option "
+                "requires the \"Queue\" option. Only one thread will be "
+                "started.", conf->name);
+        conf->threads_num = 1;
+    }
+
+    if ((status == 0) && (conf->batch_size > 1)
+            && (conf->batch_bytes < CAMQP_MIN_BATCH_BYTES))
+    {
+        WARNING ("amqp plugin: Publish \"%s\": \"BatchBytes\" must be at "
+                "least %i. Using that value instead.", conf->name,
+                CAMQP_MIN_BATCH_BYTES);
+        conf->batch_bytes = CAMQP_MIN_BATCH_BYTES;
+    }
+
     if (status != 0)
     {
         camqp_config_free (conf);
@@ -990,21 +1538,46 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
 
         ssnprintf (cbname, sizeof (cbname), "amqp/%s", conf->name);
 
+        if (conf->batch_size > 1)
+            ud.free_func = camqp_publish_free;
+
         status = plugin_register_write (cbname, camqp_write, &ud);
         if (status != 0)
         {
             camqp_config_free (conf);
             return (status);
         }
+
+        if (conf->batch_size > 1)
+        {
+            ud.free_func = NULL;
+            plugin_register_flush (cbname, camqp_flush, &ud);
+        }
     }
     else
     {
+        /* Each thread uses a connection of its own. The broker distributes
+         * the messages of the queue among them. */
+        for (i = 1; i < conf->threads_num; i++)
+        {
+            camqp_config_t *copy;
+
+            copy = camqp_config_dup (conf);
+            if (copy == NULL)
+            {
+                ERROR ("amqp plugin: camqp_config_dup failed.");
+                break;
+            }
+
+            /* camqp_subscribe_init frees "copy" on failure. */
+            if (camqp_subscribe_init (copy) != 0)
+                break;
+        }
+
+        /* camqp_subscribe_init frees "conf" on failure. */
         status = camqp_subscribe_init (conf);
         if (status != 0)
-        {
-            camqp_config_free (conf);
             return (status);
-        }
     }
 
     return (0);
@@ -100,6 +100,9 @@ static cf_global_option_t cf_global_options[] =
 	{"FQDNLookup",  NULL, "true"},
 	{"Interval",    NULL, NULL},
 	{"ReadThreads", NULL, "5"},
+	{"WriteThreads", NULL, "5"},
+	{"WriteQueueLimitHigh", NULL, "0"},
+	{"WriteQueueLimitLow",  NULL, NULL},
 	{"Timeout",     NULL, "2"},
 	{"PreCacheChain",  NULL, "PreCache"},
 	{"PostCacheChain", NULL, "PostCache"}
@@ -161,6 +161,14 @@ static inline PyObject *cpy_string_to_unicode_or_bytes(const char *buf) {
 
 void cpy_log_exception(const char *context);
 
+/* Converts a collectd.Values object into a value list. On success the caller
+ * has to free the "values" and "meta" members, on failure an exception is set.
+ * The GIL has to be held. */
+int cpy_values_to_value_list(PyObject *obj, value_list_t *value_list);
+
+/* Releases the strings cached for the host, plugin and type members. */
+void cpy_string_cache_free(void);
+
 /* Python object declarations. */
 
 typedef struct {
@@ -26,6 +26,54 @@
 #include "common.h"
 #include "utils_cache.h"
 #include "utils_parse_option.h"
+#include "utils_avltree.h"
+
+#include <pthread.h>
+
+#if HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
+/*
+ * Private data types
+ */
+#define CSV_BUFFER_SIZE 8192
+/* Lower bound of the default for `MaxOpenFiles'. */
+#define CSV_MIN_OPEN_FILES 128
+
+/* An open CSV file and the lines which have not been written yet.
+ *
+ * `files_lock' protects the cache (`files_tree' and the LRU list) and the
+ * members `date_generation', `stale', `refcount', `prev' and `next'. It is
+ * only held while looking up, adding or removing entries. `lock' protects the
+ * buffer and is held while the file is written. Entries are only removed from
+ * the cache while `refcount' is zero, so a file which is being written is
+ * never closed. */
+struct csv_file_s
+{
+	char    *filename;
+	int      fd;
+
+	pthread_mutex_t lock;
+	char     buffer[CSV_BUFFER_SIZE];
+	size_t   buffer_fill;
+	/* Time the first line currently in the buffer was added. */
+	cdtime_t first_write;
+	/* Set by csv_file_write_out when the file has been removed. */
+	_Bool    unlinked;
+
+	/* Value of `date_generation' when the file name was built. */
+	unsigned int date_generation;
+	/* Set when the file should be closed: it has been removed or its name
+	 * contains a past date. */
+	_Bool    stale;
+	int      refcount;
+	/* Doubly linked list, most recently used file first. Also used to
+	 * chain files which are about to be closed. */
+	struct csv_file_s *prev;
+	struct csv_file_s *next;
+};
+typedef struct csv_file_s csv_file_t;
 
 /*
  * Private variables
@@ -33,13 +81,35 @@
 static const char *config_keys[] =
 {
 	"DataDir",
-	"StoreRates"
+	"StoreRates",
+	"MaxOpenFiles",
+	"FlushInterval"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static char *datadir   = NULL;
 static int store_rates = 0;
 static int use_stdio   = 0;
+static int max_open_files = 0; /* 0 => determined in csv_init */
+static cdtime_t flush_interval = 0;
+
+static c_avl_tree_t   *files_tree = NULL;
+static csv_file_t     *files_head = NULL;
+static csv_file_t     *files_tail = NULL;
+static int             files_num = 0;
+/* Latest `date_generation' seen by csv_file_acquire. */
+static unsigned int    files_date_generation = 0;
+/* Set when the cache may contain stale files. */
+static _Bool           files_sweep = 0;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* `localtime_r' is pretty expensive, so the date appended to the file names is
+ * only re-computed once per second. `date_generation' is incremented whenever
+ * the date changes, so files of past days can be closed. */
+static time_t          date_time = 0;
+static char            date_suffix[16];
+static unsigned int    date_generation = 0;
+static pthread_mutex_t date_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int value_list_to_string (char *buffer, int buffer_len,
 		const data_set_t *ds, const value_list_t *vl)
@@ -122,6 +192,7 @@ static int value_list_to_string (char *buffer, int buffer_len,
 } /* int value_list_to_string */
 
 static int value_list_to_filename (char *buffer, int buffer_len,
+		unsigned int *generation,
 		const data_set_t *ds, const value_list_t *vl)
 {
 	int offset = 0;
@@ -167,19 +238,33 @@ static int value_list_to_filename (char *buffer, int buffer_len,
 	if (!use_stdio)
 	{
 		time_t now;
-		struct tm stm;
 
-		/* TODO: Find a way to minimize the calls to `localtime_r',
-		 * since they are pretty expensive.. */
 		now = time (NULL);
-		if (localtime_r (&now, &stm) == NULL)
+
+		pthread_mutex_lock (&date_lock);
+		if (now != date_time)
 		{
-			ERROR ("csv plugin: localtime_r failed");
-			return (1);
-		}
+			struct tm stm;
+			char suffix[sizeof (date_suffix)];
+
+			if (localtime_r (&now, &stm) == NULL)
+			{
+				pthread_mutex_unlock (&date_lock);
+				ERROR ("csv plugin: localtime_r failed");
+				return (1);
+			}
 
-		strftime (buffer + offset, buffer_len - offset,
-				"-%Y-%m-%d", &stm);
+			strftime (suffix, sizeof (suffix), "-%Y-%m-%d", &stm);
+			if (strcmp (suffix, date_suffix) != 0)
+			{
+				sstrncpy (date_suffix, suffix, sizeof (date_suffix));
+				date_generation++;
+			}
+			date_time = now;
+		}
+		sstrncpy (buffer + offset, date_suffix, buffer_len - offset);
+		*generation = date_generation;
+		pthread_mutex_unlock (&date_lock);
 	}
 
 	return (0);
@@ -213,6 +298,334 @@ static int csv_create_file (const char *filename, const data_set_t *ds)
 	return 0;
 } /* int csv_create_file */
 
+/* Writes the buffered lines of `cf' to disk. Must be called with `cf->lock'
+ * held. */
+static int csv_file_write_out (csv_file_t *cf) /* {{{ */
+{
+	struct flock fl;
+	struct stat statbuf;
+	size_t offset;
+	size_t fill;
+	int status;
+
+	fill = cf->buffer_fill;
+	if (fill == 0)
+		return (0);
+
+	memset (&fl, '\0', sizeof (fl));
+	fl.l_start  = 0;
+	fl.l_len    = 0; /* till end of file */
+	fl.l_pid    = getpid ();
+	fl.l_type   = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+
+	status = fcntl (cf->fd, F_SETLK, &fl);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		/* Keep the buffer; it is written with the next flush. */
+		ERROR ("csv plugin: flock (%s) failed: %s", cf->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	offset = 0;
+	while (offset < fill)
+	{
+		ssize_t written;
+
+		written = write (cf->fd, cf->buffer + offset, fill - offset);
+		if (written < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("csv plugin: write (%s) failed: %s", cf->filename,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		offset += (size_t) written;
+	}
+
+	fl.l_type = F_UNLCK;
+	fcntl (cf->fd, F_SETLK, &fl);
+
+	/* If the user removed the file, it is closed and re-created. */
+	if ((fstat (cf->fd, &statbuf) == 0) && (statbuf.st_nlink == 0))
+		cf->unlinked = 1;
+
+	/* Keep what hasn't been written for the next attempt. */
+	if (offset < fill)
+		memmove (cf->buffer, cf->buffer + offset, fill - offset);
+	cf->buffer_fill = fill - offset;
+
+	return ((offset < fill) ? -1 : 0);
+} /* }}} int csv_file_write_out */
+
+/* Writes out and closes `cf'. The file must have been removed from the cache
+ * with csv_file_detach. */
+static void csv_file_close (csv_file_t *cf) /* {{{ */
+{
+	if (csv_file_write_out (cf) != 0)
+		ERROR ("csv plugin: Closing `%s' discards %zu bytes which could "
+				"not be written.", cf->filename, cf->buffer_fill);
+
+	close (cf->fd);
+	pthread_mutex_destroy (&cf->lock);
+	sfree (cf->filename);
+	sfree (cf);
+} /* }}} void csv_file_close */
+
+/* Closes all files in the list `close_list', chained by `next'. Must be called
+ * without `files_lock' held. */
+static void csv_file_close_list (csv_file_t *close_list) /* {{{ */
+{
+	while (close_list != NULL)
+	{
+		csv_file_t *next = close_list->next;
+		csv_file_close (close_list);
+		close_list = next;
+	}
+} /* }}} void csv_file_close_list */
+
+/* Removes `cf' from the cache and prepends it to `close_list'. Must be called
+ * with `files_lock' held and `cf->refcount' being zero. */
+static void csv_file_detach (csv_file_t *cf, /* {{{ */
+		csv_file_t **close_list)
+{
+	assert (cf->refcount == 0);
+
+	c_avl_remove (files_tree, cf->filename, NULL, NULL);
+
+	if (cf->prev != NULL)
+		cf->prev->next = cf->next;
+	else
+		files_head = cf->next;
+	if (cf->next != NULL)
+		cf->next->prev = cf->prev;
+	else
+		files_tail = cf->prev;
+	files_num--;
+
+	cf->prev = NULL;
+	cf->next = *close_list;
+	*close_list = cf;
+} /* }}} void csv_file_detach */
+
+/* Detaches stale files and, if more than `max_open_files' are open, the least
+ * recently used ones. Files in use are skipped. Must be called with
+ * `files_lock' held. */
+static void csv_file_evict (csv_file_t **close_list) /* {{{ */
+{
+	csv_file_t *cf;
+	csv_file_t *prev;
+
+	if (files_sweep)
+	{
+		files_sweep = 0;
+		for (cf = files_tail; cf != NULL; cf = prev)
+		{
+			prev = cf->prev;
+
+			if (cf->date_generation != files_date_generation)
+				cf->stale = 1;
+			if (!cf->stale)
+				continue;
+
+			if (cf->refcount == 0)
+				csv_file_detach (cf, close_list);
+			else
+				files_sweep = 1;
+		}
+	}
+
+	for (cf = files_tail; (cf != NULL) && (files_num > max_open_files);
+			cf = prev)
+	{
+		prev = cf->prev;
+		if (cf->refcount == 0)
+			csv_file_detach (cf, close_list);
+	}
+} /* }}} void csv_file_evict */
+
+/* Opens `filename', creating it if necessary. The returned file is not in the
+ * cache yet. Must be called without `files_lock' held. */
+static csv_file_t *csv_file_open (const char *filename, /* {{{ */
+		const data_set_t *ds)
+{
+	struct stat statbuf;
+	csv_file_t *cf;
+	int fd;
+
+	fd = open (filename, O_WRONLY | O_APPEND);
+	if ((fd < 0) && (errno == ENOENT))
+	{
+		if (csv_create_file (filename, ds))
+			return (NULL);
+		fd = open (filename, O_WRONLY | O_APPEND);
+	}
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: open (%s) failed: %s", filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (NULL);
+	}
+
+	if (fstat (fd, &statbuf) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("stat(%s) failed: %s", filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (NULL);
+	}
+	else if (!S_ISREG (statbuf.st_mode))
+	{
+		ERROR ("stat(%s): Not a regular file!", filename);
+		close (fd);
+		return (NULL);
+	}
+
+	cf = malloc (sizeof (*cf));
+	if (cf == NULL)
+	{
+		ERROR ("csv plugin: malloc failed.");
+		close (fd);
+		return (NULL);
+	}
+	memset (cf, 0, sizeof (*cf));
+	cf->fd = fd;
+	pthread_mutex_init (&cf->lock, /* attr = */ NULL);
+
+	cf->filename = strdup (filename);
+	if (cf->filename == NULL)
+	{
+		ERROR ("csv plugin: strdup failed.");
+		csv_file_close (cf);
+		return (NULL);
+	}
+
+	return (cf);
+} /* }}} csv_file_t *csv_file_open */
+
+/* Returns the cache entry for `filename', opening the file if necessary, and
+ * takes a reference. The reference has to be returned with csv_file_release.
+ * The file is opened and closed without `files_lock' held. */
+static csv_file_t *csv_file_acquire (const char *filename, /* {{{ */
+		unsigned int generation, const data_set_t *ds)
+{
+	csv_file_t *close_list = NULL;
+	csv_file_t *new_cf = NULL;
+	csv_file_t *cf = NULL;
+
+	pthread_mutex_lock (&files_lock);
+
+	if (files_tree == NULL)
+	{
+		files_tree = c_avl_create ((void *) strcmp);
+		if (files_tree == NULL)
+		{
+			pthread_mutex_unlock (&files_lock);
+			ERROR ("csv plugin: c_avl_create failed.");
+			return (NULL);
+		}
+	}
+
+	/* The date changed, close the files of the previous day. A thread may
+	 * still be writing with the previous date, so don't go back. */
+	if (generation > files_date_generation)
+	{
+		files_date_generation = generation;
+		files_sweep = 1;
+	}
+	csv_file_evict (&close_list);
+
+	while (c_avl_get (files_tree, filename, (void *) &cf) != 0)
+	{
+		if (new_cf != NULL)
+		{
+			if (c_avl_insert (files_tree, new_cf->filename, new_cf) != 0)
+			{
+				pthread_mutex_unlock (&files_lock);
+				ERROR ("csv plugin: Adding `%s' to the cache failed.",
+						filename);
+				csv_file_close (new_cf);
+				return (NULL);
+			}
+
+			cf = new_cf;
+			new_cf = NULL;
+
+			cf->date_generation = generation;
+			if (generation != files_date_generation)
+				files_sweep = 1;
+			cf->prev = NULL;
+			cf->next = files_head;
+			if (files_head != NULL)
+				files_head->prev = cf;
+			files_head = cf;
+			if (files_tail == NULL)
+				files_tail = cf;
+			files_num++;
+			break;
+		}
+
+		pthread_mutex_unlock (&files_lock);
+		new_cf = csv_file_open (filename, ds);
+		if (new_cf == NULL)
+			return (NULL);
+		pthread_mutex_lock (&files_lock);
+	}
+
+	cf->refcount++;
+
+	/* Move to the front of the LRU list. */
+	if (cf->prev != NULL)
+	{
+		cf->prev->next = cf->next;
+		if (cf->next != NULL)
+			cf->next->prev = cf->prev;
+		else
+			files_tail = cf->prev;
+
+		cf->prev = NULL;
+		cf->next = files_head;
+		files_head->prev = cf;
+		files_head = cf;
+	}
+
+	/* Make room for a newly opened file. */
+	csv_file_evict (&close_list);
+
+	pthread_mutex_unlock (&files_lock);
+
+	/* Another thread opened the file in the meantime. */
+	if (new_cf != NULL)
+		csv_file_close (new_cf);
+	csv_file_close_list (close_list);
+
+	return (cf);
+} /* }}} csv_file_t *csv_file_acquire */
+
+/* Returns a reference taken by csv_file_acquire. `unlinked' is the value of
+ * `cf->unlinked', read while `cf->lock' was held. */
+static void csv_file_release (csv_file_t *cf, _Bool unlinked) /* {{{ */
+{
+	pthread_mutex_lock (&files_lock);
+	assert (cf->refcount > 0);
+	cf->refcount--;
+	if (unlinked)
+	{
+		cf->stale = 1;
+		files_sweep = 1;
+	}
+	pthread_mutex_unlock (&files_lock);
+} /* }}} void csv_file_release */
+
 static int csv_config (const char *key, const char *value)
 {
 	if (strcasecmp ("DataDir", key) == 0)
@@ -252,6 +665,26 @@ static int csv_config (const char *key, const char *value)
 		else
 			store_rates = 0;
 	}
+	else if (strcasecmp ("MaxOpenFiles", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			ERROR ("csv plugin: MaxOpenFiles must be positive.");
+			return (-1);
+		}
+		max_open_files = tmp;
+	}
+	else if (strcasecmp ("FlushInterval", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp < 0.0)
+		{
+			ERROR ("csv plugin: FlushInterval must not be negative.");
+			return (-1);
+		}
+		flush_interval = DOUBLE_TO_CDTIME_T (tmp);
+	}
 	else
 	{
 		return (-1);
@@ -262,12 +695,13 @@ static int csv_config (const char *key, const char *value)
 static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	struct stat  statbuf;
 	char         filename[512];
 	char         values[4096];
-	FILE        *csv;
-	int          csv_fd;
-	struct flock fl;
+	size_t       values_len;
+	unsigned int generation = 0;
+	csv_file_t  *cf;
+	cdtime_t     now;
+	_Bool        unlinked;
 	int          status;
 
 	if (0 != strcmp (ds->type, vl->type)) {
@@ -275,7 +709,8 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		return -1;
 	}
 
-	if (value_list_to_filename (filename, sizeof (filename), ds, vl) != 0)
+	if (value_list_to_filename (filename, sizeof (filename), &generation,
+				ds, vl) != 0)
 		return (-1);
 
 	DEBUG ("csv plugin: csv_write: filename = %s;", filename);
@@ -306,68 +741,154 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		return (0);
 	}
 
-	if (stat (filename, &statbuf) == -1)
+	now = cdtime ();
+	values_len = strlen (values);
+
+	cf = csv_file_acquire (filename, generation, ds);
+	if (cf == NULL)
+		return (-1);
+
+	pthread_mutex_lock (&cf->lock);
+
+	if ((cf->buffer_fill + values_len + 1) > sizeof (cf->buffer))
+		csv_file_write_out (cf);
+	if ((cf->buffer_fill + values_len + 1) > sizeof (cf->buffer))
 	{
-		if (errno == ENOENT)
-		{
-			if (csv_create_file (filename, ds))
-				return (-1);
-		}
-		else
-		{
-			char errbuf[1024];
-			ERROR ("stat(%s) failed: %s", filename,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			return (-1);
-		}
+		/* The buffered lines couldn't be written, e.g. because another
+		 * process holds the lock. Drop the new line, not the buffer. */
+		unlinked = cf->unlinked;
+		pthread_mutex_unlock (&cf->lock);
+		csv_file_release (cf, unlinked);
+		ERROR ("csv plugin: The buffer for `%s' is full, dropping a "
+				"line.", filename);
+		return (-1);
 	}
-	else if (!S_ISREG (statbuf.st_mode))
+
+	if (cf->buffer_fill == 0)
+		cf->first_write = now;
+	memcpy (cf->buffer + cf->buffer_fill, values, values_len);
+	cf->buffer_fill += values_len;
+	cf->buffer[cf->buffer_fill] = '\n';
+	cf->buffer_fill++;
+
+	status = 0;
+	if ((now - cf->first_write) >= flush_interval)
+		status = csv_file_write_out (cf);
+
+	unlinked = cf->unlinked;
+	pthread_mutex_unlock (&cf->lock);
+	csv_file_release (cf, unlinked);
+
+	return (status);
+} /* int csv_write */
+
+static int csv_init (void) /* {{{ */
+{
+#if HAVE_SYS_RESOURCE_H && defined(RLIMIT_NOFILE)
+	struct rlimit rl;
+#endif
+
+	if (max_open_files > 0)
+		return (0);
+
+	/* Use up to half of the file descriptors the process may open, leaving
+	 * the rest to the other plugins. */
+	max_open_files = CSV_MIN_OPEN_FILES;
+#if HAVE_SYS_RESOURCE_H && defined(RLIMIT_NOFILE)
+	if ((getrlimit (RLIMIT_NOFILE, &rl) == 0)
+			&& (rl.rlim_cur != RLIM_INFINITY)
+			&& ((rl.rlim_cur / 2) > CSV_MIN_OPEN_FILES))
+		max_open_files = (int) ((rl.rlim_cur / 2 < INT_MAX)
+				? rl.rlim_cur / 2 : INT_MAX);
+#endif
+
+	return (0);
+} /* }}} int csv_init */
+
+static int csv_flush (cdtime_t timeout, /* {{{ */
+		const char __attribute__((unused)) *identifier,
+		user_data_t __attribute__((unused)) *user_data)
+{
+	csv_file_t **files;
+	csv_file_t *cf;
+	int files_len;
+	cdtime_t now;
+	int i;
+
+	now = cdtime ();
+
+	/* Take a reference to each file, so the files can be written without
+	 * holding `files_lock'. */
+	pthread_mutex_lock (&files_lock);
+	if (files_num == 0)
 	{
-		ERROR ("stat(%s): Not a regular file!",
-				filename);
-		return (-1);
+		pthread_mutex_unlock (&files_lock);
+		return (0);
 	}
 
-	csv = fopen (filename, "a");
-	if (csv == NULL)
+	files = calloc ((size_t) files_num, sizeof (*files));
+	if (files == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("csv plugin: fopen (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		pthread_mutex_unlock (&files_lock);
+		ERROR ("csv plugin: calloc failed.");
 		return (-1);
 	}
-	csv_fd = fileno (csv);
 
-	memset (&fl, '\0', sizeof (fl));
-	fl.l_start  = 0;
-	fl.l_len    = 0; /* till end of file */
-	fl.l_pid    = getpid ();
-	fl.l_type   = F_WRLCK;
-	fl.l_whence = SEEK_SET;
+	files_len = 0;
+	for (cf = files_head; cf != NULL; cf = cf->next)
+	{
+		cf->refcount++;
+		files[files_len] = cf;
+		files_len++;
+	}
+	pthread_mutex_unlock (&files_lock);
 
-	status = fcntl (csv_fd, F_SETLK, &fl);
-	if (status != 0)
+	for (i = 0; i < files_len; i++)
 	{
-		char errbuf[1024];
-		ERROR ("csv plugin: flock (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (csv);
-		return (-1);
+		_Bool unlinked;
+
+		cf = files[i];
+
+		pthread_mutex_lock (&cf->lock);
+		if ((timeout == 0) || ((now - cf->first_write) >= timeout))
+			csv_file_write_out (cf);
+		unlinked = cf->unlinked;
+		pthread_mutex_unlock (&cf->lock);
+
+		csv_file_release (cf, unlinked);
 	}
 
-	fprintf (csv, "%s\n", values);
+	sfree (files);
+	return (0);
+} /* }}} int csv_flush */
+
+static int csv_shutdown (void) /* {{{ */
+{
+	csv_file_t *close_list = NULL;
+
+	/* The write and flush callbacks aren't called anymore, so no file is in
+	 * use. */
+	pthread_mutex_lock (&files_lock);
+	while (files_head != NULL)
+		csv_file_detach (files_head, &close_list);
+	if (files_tree != NULL)
+	{
+		c_avl_destroy (files_tree);
+		files_tree = NULL;
+	}
+	pthread_mutex_unlock (&files_lock);
 
-	/* The lock is implicitely released. I we don't release it explicitely
-	 * because the `FILE *' may need to flush a cache first */
-	fclose (csv);
+	csv_file_close_list (close_list);
 
 	return (0);
-} /* int csv_write */
+} /* }}} int csv_shutdown */
 
 void module_register (void)
 {
 	plugin_register_config ("csv", csv_config,
 			config_keys, config_keys_num);
+	plugin_register_init ("csv", csv_init);
 	plugin_register_write ("csv", csv_write, /* user_data = */ NULL);
+	plugin_register_flush ("csv", csv_flush, /* user_data = */ NULL);
+	plugin_register_shutdown ("csv", csv_shutdown);
 } /* void module_register */
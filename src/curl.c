@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_match.h"
+#include "utils_curl_multi.h"
 
 #include <curl/curl.h>
 
@@ -64,6 +65,9 @@ struct web_page_s /* {{{ */
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
+  ucm_request_t *request;
+  /* Result of the previous transfer, returned by the next read. */
+  int read_status;
   char *buffer;
   size_t buffer_size;
   size_t buffer_fill;
@@ -82,6 +86,8 @@ static web_page_t *pages_g = NULL;
 /*
  * Private functions
  */
+static void cc_read_page_done (CURL *curl, CURLcode status, void *user_data);
+
 static size_t cc_curl_callback (void *buf, /* {{{ */
     size_t size, size_t nmemb, void *user_data)
 {
@@ -137,6 +143,9 @@ static void cc_web_page_free (web_page_t *wp) /* {{{ */
   if (wp == NULL)
     return;
 
+  ucm_request_destroy (wp->request);
+  wp->request = NULL;
+
   if (wp->curl != NULL)
     curl_easy_cleanup (wp->curl);
   wp->curl = NULL;
@@ -405,6 +414,13 @@ static int cc_page_init_curl (web_page_t *wp) /* {{{ */
   if (wp->cacert != NULL)
     curl_easy_setopt (wp->curl, CURLOPT_CAINFO, wp->cacert);
 
+  wp->request = ucm_request_create (wp->curl, cc_read_page_done, wp);
+  if (wp->request == NULL)
+  {
+    ERROR ("curl plugin: ucm_request_create failed.");
+    return (-1);
+  }
+
   return (0);
 } /* }}} int cc_page_init_curl */
 
@@ -604,36 +620,37 @@ static void cc_submit_response_time (const web_page_t *wp, double seconds) /* {{
   plugin_dispatch_values (&vl);
 } /* }}} void cc_submit_response_time */
 
-static int cc_read_page (web_page_t *wp) /* {{{ */
+/* Called from the transfer thread once the page has been received. */
+static void cc_read_page_done (CURL *curl, CURLcode result, /* {{{ */
+    void *user_data)
 {
+  web_page_t *wp = user_data;
   web_match_t *wm;
-  int status;
-  struct timeval start, end;
-
-  if (wp->response_time)
-    gettimeofday (&start, NULL);
 
-  wp->buffer_fill = 0;
-  status = curl_easy_perform (wp->curl);
-  if (status != 0)
+  if (result != CURLE_OK)
   {
-    ERROR ("curl plugin: curl_easy_perform failed with staus %i: %s",
-        status, wp->curl_errbuf);
-    return (-1);
+    ERROR ("curl plugin: Transfer failed with status %i: %s",
+        (int) result, wp->curl_errbuf);
+    wp->read_status = -1;
+    return;
   }
+  wp->read_status = 0;
 
   if (wp->response_time)
   {
     double secs = 0;
-    gettimeofday (&end, NULL);
-    secs += end.tv_sec - start.tv_sec;
-    secs += (end.tv_usec - start.tv_usec) / 1000000.0;
+    curl_easy_getinfo (curl, CURLINFO_TOTAL_TIME, &secs);
     cc_submit_response_time (wp, secs);
   }
 
+  /* An empty response leaves the buffer unallocated. */
+  if (wp->buffer == NULL)
+    return;
+
   for (wm = wp->matches; wm != NULL; wm = wm->next)
   {
     cu_match_value_t *mv;
+    int status;
 
     status = match_apply (wm->match, wp->buffer);
     if (status != 0)
@@ -651,22 +668,64 @@ static int cc_read_page (web_page_t *wp) /* {{{ */
 
     cc_submit (wp, wm, mv);
   } /* for (wm = wp->matches; wm != NULL; wm = wm->next) */
+} /* }}} void cc_read_page_done */
 
-  return (0);
+/* Starts the transfer of the page in the background. Since its values
+ * arrive later, the result of the previous transfer is returned. */
+static int cc_read_page (web_page_t *wp) /* {{{ */
+{
+  int read_status;
+  int status;
+
+  /* Only this function submits the request, so once the previous transfer
+   * is done, the transfer thread doesn't touch `wp' until it's submitted
+   * again. */
+  if (ucm_request_busy (wp->request))
+  {
+    WARNING ("curl plugin: The previous request for %s is still in "
+        "progress.", wp->url);
+    return (-1);
+  }
+
+  /* Once submitted, the transfer thread may overwrite the status at any
+   * time. */
+  read_status = wp->read_status;
+
+  wp->buffer_fill = 0;
+  if (wp->buffer != NULL)
+    wp->buffer[0] = 0;
+
+  status = ucm_submit (wp->request);
+  if (status != 0)
+  {
+    ERROR ("curl plugin: ucm_submit failed with status %i.", status);
+    return (-1);
+  }
+
+  return (read_status);
 } /* }}} int cc_read_page */
 
 static int cc_read (void) /* {{{ */
 {
   web_page_t *wp;
+  int success = 0;
 
   for (wp = pages_g; wp != NULL; wp = wp->next)
-    cc_read_page (wp);
+    if (cc_read_page (wp) == 0)
+      success++;
+
+  /* All pages share this callback, so only fail if none of them could be
+   * read. */
+  if ((pages_g != NULL) && (success == 0))
+    return (-1);
 
   return (0);
 } /* }}} int cc_read */
 
 static int cc_shutdown (void) /* {{{ */
 {
+  ucm_shutdown ();
+
   cc_web_page_free (pages_g);
   pages_g = NULL;
 
@@ -27,6 +27,7 @@
 #include "configfile.h"
 #include "utils_avltree.h"
 #include "utils_complain.h"
+#include "utils_curl_multi.h"
 
 #include <curl/curl.h>
 #include <yajl/yajl_parse.h>
@@ -70,6 +71,9 @@ struct cj_s /* {{{ */
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
+  ucm_request_t *request;
+  /* Result of the previous transfer, returned by the next read. */
+  int read_status;
 
   yajl_handle yajl;
   c_avl_tree_t *tree;
@@ -92,7 +96,7 @@ typedef unsigned int yajl_len_t;
 #endif
 
 static int cj_read (user_data_t *ud);
-static int cj_curl_perform (cj_t *db, CURL *curl);
+static void cj_curl_done (CURL *curl, CURLcode status, void *user_data);
 static void cj_submit (cj_t *db, cj_key_t *key, value_t *value);
 
 static size_t cj_curl_callback (void *buf, /* {{{ */
@@ -358,10 +362,20 @@ static void cj_free (void *arg) /* {{{ */
   if (db == NULL)
     return;
 
+  /* Make sure no transfer of this URL is in flight anymore. */
+  ucm_request_cancel (db->request);
+
+  ucm_request_destroy (db->request);
+  db->request = NULL;
+
   if (db->curl != NULL)
     curl_easy_cleanup (db->curl);
   db->curl = NULL;
 
+  if (db->yajl != NULL)
+    yajl_free (db->yajl);
+  db->yajl = NULL;
+
   if (db->tree != NULL)
     cj_tree_free (db->tree);
   db->tree = NULL;
@@ -555,6 +569,13 @@ static int cj_init_curl (cj_t *db) /* {{{ */
   if (db->cacert != NULL)
     curl_easy_setopt (db->curl, CURLOPT_CAINFO, db->cacert);
 
+  db->request = ucm_request_create (db->curl, cj_curl_done, db);
+  if (db->request == NULL)
+  {
+    ERROR ("curl_json plugin: ucm_request_create failed.");
+    return (-1);
+  }
+
   return (0);
 } /* }}} int cj_init_curl */
 
@@ -745,37 +766,20 @@ static void cj_submit (cj_t *db, cj_key_t *key, value_t *value) /* {{{ */
   plugin_dispatch_values (&vl);
 } /* }}} int cj_submit */
 
-static int cj_curl_perform (cj_t *db, CURL *curl) /* {{{ */
+/* Checks the outcome of a transfer and finishes parsing the response. */
+static int cj_curl_finish (cj_t *db, CURL *curl, CURLcode status) /* {{{ */
 {
-  int status;
   long rc;
   char *url;
-  yajl_handle yprev = db->yajl;
-
-  db->yajl = yajl_alloc (&ycallbacks,
-#if HAVE_YAJL_V2
-      /* alloc funcs = */ NULL,
-#else
-      /* alloc funcs = */ NULL, NULL,
-#endif
-      /* context = */ (void *)db);
-  if (db->yajl == NULL)
-  {
-    ERROR ("curl_json plugin: yajl_alloc failed.");
-    db->yajl = yprev;
-    return (-1);
-  }
+  yajl_status ystatus;
 
   url = NULL;
   curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
 
-  status = curl_easy_perform (curl);
-  if (status != 0)
+  if (status != CURLE_OK)
   {
-    ERROR ("curl_json plugin: curl_easy_perform failed with status %i: %s (%s)",
-           status, db->curl_errbuf, (url != NULL) ? url : "<null>");
-    yajl_free (db->yajl);
-    db->yajl = yprev;
+    ERROR ("curl_json plugin: Transfer failed with status %i: %s (%s)",
+           (int) status, db->curl_errbuf, (url != NULL) ? url : "<null>");
     return (-1);
   }
 
@@ -784,19 +788,17 @@ static int cj_curl_perform (cj_t *db, CURL *curl) /* {{{ */
   /* The response code is zero if a non-HTTP transport was used. */
   if ((rc != 0) && (rc != 200))
   {
-    ERROR ("curl_json plugin: curl_easy_perform failed with "
+    ERROR ("curl_json plugin: Transfer failed with "
         "response code %ld (%s)", rc, url);
-    yajl_free (db->yajl);
-    db->yajl = yprev;
     return (-1);
   }
 
 #if HAVE_YAJL_V2
-    status = yajl_complete_parse(db->yajl);
+    ystatus = yajl_complete_parse(db->yajl);
 #else
-    status = yajl_parse_complete(db->yajl);
+    ystatus = yajl_parse_complete(db->yajl);
 #endif
-  if (status != yajl_status_ok)
+  if (ystatus != yajl_status_ok)
   {
     unsigned char *errmsg;
 
@@ -805,19 +807,60 @@ static int cj_curl_perform (cj_t *db, CURL *curl) /* {{{ */
     ERROR ("curl_json plugin: yajl_parse_complete failed: %s",
         (char *) errmsg);
     yajl_free_error (db->yajl, errmsg);
-    yajl_free (db->yajl);
-    db->yajl = yprev;
     return (-1);
   }
 
+  return (0);
+} /* }}} int cj_curl_finish */
+
+/* Called from the transfer thread once the response has been received. The
+ * values have been dispatched from `cj_curl_callback' by then. */
+static void cj_curl_done (CURL *curl, CURLcode status, /* {{{ */
+    void *user_data)
+{
+  cj_t *db = user_data;
+
+  db->read_status = cj_curl_finish (db, curl, status);
+
   yajl_free (db->yajl);
-  db->yajl = yprev;
+  db->yajl = NULL;
+} /* }}} void cj_curl_done */
+
+/* Starts the transfer in the background. The response is parsed by the
+ * transfer thread while it's being received. */
+static int cj_curl_perform (cj_t *db) /* {{{ */
+{
+  int status;
+
+  db->yajl = yajl_alloc (&ycallbacks,
+#if HAVE_YAJL_V2
+      /* alloc funcs = */ NULL,
+#else
+      /* alloc funcs = */ NULL, NULL,
+#endif
+      /* context = */ (void *)db);
+  if (db->yajl == NULL)
+  {
+    ERROR ("curl_json plugin: yajl_alloc failed.");
+    return (-1);
+  }
+
+  status = ucm_submit (db->request);
+  if (status != 0)
+  {
+    ERROR ("curl_json plugin: ucm_submit failed with status %i.", status);
+    yajl_free (db->yajl);
+    db->yajl = NULL;
+    return (-1);
+  }
+
   return (0);
 } /* }}} int cj_curl_perform */
 
 static int cj_read (user_data_t *ud) /* {{{ */
 {
   cj_t *db;
+  int read_status;
 
   if ((ud == NULL) || (ud->data == NULL))
   {
@@ -827,12 +870,30 @@ static int cj_read (user_data_t *ud) /* {{{ */
 
   db = (cj_t *) ud->data;
 
+  /* Only this callback submits the request, so once the previous transfer
+   * is done, the transfer thread doesn't touch `db' until it's submitted
+   * again. */
+  if (ucm_request_busy (db->request))
+  {
+    WARNING ("curl_json plugin: The previous request for %s is still in "
+        "progress.", db->url);
+    return (-1);
+  }
+
   db->depth = 0;
   memset (&db->state, 0, sizeof(db->state));
   db->state[db->depth].tree = db->tree;
   db->key = NULL;
 
-  return cj_curl_perform (db, db->curl);
+  /* The values of this read arrive later. Report whether the previous
+   * transfer succeeded, so that failing URLs are still noticed. The status
+   * is copied first, since the transfer thread sets it once the request has
+   * been submitted. */
+  read_status = db->read_status;
+  if (cj_curl_perform (db) != 0)
+    return (-1);
+
+  return (read_status);
 } /* }}} int cj_read */
 
 void module_register (void)
@@ -24,6 +24,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_llist.h"
+#include "utils_curl_multi.h"
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -73,6 +74,9 @@ struct cx_s /* {{{ */
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
+  ucm_request_t *request;
+  /* Result of the previous transfer, returned by the next read. */
+  int read_status;
   char *buffer;
   size_t buffer_size;
   size_t buffer_fill;
@@ -84,6 +88,8 @@ typedef struct cx_s cx_t; /* }}} */
 /*
  * Private functions
  */
+static void cx_curl_done (CURL *curl, CURLcode status, void *user_data);
+
 static size_t cx_curl_callback (void *buf, /* {{{ */
     size_t size, size_t nmemb, void *user_data)
 {
@@ -168,6 +174,12 @@ static void cx_free (void *arg) /* {{{ */
   if (db == NULL)
     return;
 
+  /* Make sure no transfer of this URL is in flight anymore. */
+  ucm_request_cancel (db->request);
+
+  ucm_request_destroy (db->request);
+  db->request = NULL;
+
   if (db->curl != NULL)
     curl_easy_cleanup (db->curl);
   db->curl = NULL;
@@ -544,45 +556,64 @@ static int cx_parse_stats_xml(xmlChar* xml, cx_t *db) /* {{{ */
   return status;
 } /* }}} cx_parse_stats_xml */
 
-static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
+/* Called from the transfer thread once the response has been received. */
+static void cx_curl_done (CURL *curl, CURLcode status, /* {{{ */
+    void *user_data)
 {
-  int status;
+  cx_t *db = user_data;
   long rc;
   char *ptr;
   char *url;
 
-  db->buffer_fill = 0; 
-  status = curl_easy_perform (curl);
-
   curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &rc);
 
   /* The response code is zero if a non-HTTP transport was used. */
   if ((rc != 0) && (rc != 200))
   {
-    ERROR ("curl_xml plugin: curl_easy_perform failed with response code %ld (%s)",
+    ERROR ("curl_xml plugin: Transfer failed with response code %ld (%s)",
            rc, url);
-    return (-1);
+    db->read_status = -1;
+    return;
   }
 
-  if (status != 0)
+  if (status != CURLE_OK)
   {
-    ERROR ("curl_xml plugin: curl_easy_perform failed with status %i: %s (%s)",
-           status, db->curl_errbuf, url);
-    return (-1);
+    ERROR ("curl_xml plugin: Transfer failed with status %i: %s (%s)",
+           (int) status, db->curl_errbuf, url);
+    db->read_status = -1;
+    return;
   }
 
   ptr = db->buffer;
 
-  status = cx_parse_stats_xml(BAD_CAST ptr, db);
+  db->read_status = cx_parse_stats_xml(BAD_CAST ptr, db);
   db->buffer_fill = 0;
+} /* }}} void cx_curl_done */
 
-  return status;
+/* Starts the transfer in the background. */
+static int cx_curl_perform (cx_t *db) /* {{{ */
+{
+  int status;
+
+  db->buffer_fill = 0;
+  if (db->buffer != NULL)
+    db->buffer[0] = 0;
+
+  status = ucm_submit (db->request);
+  if (status != 0)
+  {
+    ERROR ("curl_xml plugin: ucm_submit failed with status %i.", status);
+    return (-1);
+  }
+
+  return (0);
 } /* }}} int cx_curl_perform */
 
 static int cx_read (user_data_t *ud) /* {{{ */
 {
   cx_t *db;
+  int read_status;
 
   if ((ud == NULL) || (ud->data == NULL))
   {
@@ -592,7 +623,25 @@ static int cx_read (user_data_t *ud) /* {{{ */
 
   db = (cx_t *) ud->data;
 
-  return cx_curl_perform (db, db->curl);
+  /* Only this callback submits the request, so once the previous transfer
+   * is done, the transfer thread doesn't touch `db' until it's submitted
+   * again. */
+  if (ucm_request_busy (db->request))
+  {
+    WARNING ("curl_xml plugin: The previous request for %s is still in "
+        "progress.", db->url);
+    return (-1);
+  }
+
+  /* The values of this read arrive later. Report whether the previous
+   * transfer succeeded, so that failing URLs are still noticed. The status
+   * is copied first, since the transfer thread sets it once the request has
+   * been submitted. */
+  read_status = db->read_status;
+  if (cx_curl_perform (db) != 0)
+    return (-1);
+
+  return (read_status);
 } /* }}} int cx_read */
 
 /* Configuration handling functions {{{ */
@@ -771,6 +820,13 @@ static int cx_init_curl (cx_t *db) /* {{{ */
   if (db->cacert != NULL)
     curl_easy_setopt (db->curl, CURLOPT_CAINFO, db->cacert);
 
+  db->request = ucm_request_create (db->curl, cx_curl_done, db);
+  if (db->request == NULL)
+  {
+    ERROR ("curl_xml plugin: ucm_request_create failed.");
+    return (-1);
+  }
+
   return (0);
 } /* }}} int cx_init_curl */
 
@@ -23,9 +23,12 @@
 #include "configfile.h"
 #include "plugin.h"
 #include "utils_complain.h"
+#include "utils_avltree.h"
 #include "common.h"
 #include "filter_chain.h"
 
+#include <pthread.h>
+
 /*
  * Data types
  */
@@ -62,6 +65,18 @@ struct fc_rule_s
   fc_match_t  *matches;
   fc_target_t *targets;
   fc_rule_t *next;
+
+  /* Filled in by fc_chain_compile(): The position of the rule within the
+   * chain and the plugin and type names the rule is restricted to. */
+  size_t position;
+  match_hint_t hint;
+  /* Set if the matches contradict each other, i.e. the rule can't match. */
+  _Bool never;
+
+  /* Number of value lists the matches have been tested with and number of
+   * value lists that matched. Only counted if `collect_stats' is set. */
+  uint64_t evaluated_num;
+  uint64_t matched_num;
 }; /* }}} */
 
 /* List of chains, used for `chain_list_head' */
@@ -71,6 +86,17 @@ struct fc_chain_s /* {{{ */
   fc_rule_t   *rules;
   fc_target_t *targets;
   fc_chain_t  *next;
+
+  /* NULL terminated arrays of the rules to check for a value list, in
+   * configuration order: `rules_any' holds the rules which are not restricted
+   * to a plugin, `rules_by_plugin' maps a plugin name to the rules restricted
+   * to that plugin merged with `rules_any'. */
+  fc_rule_t   **rules_any;
+  c_avl_tree_t *rules_by_plugin;
+
+  _Bool collect_stats;
+  uint64_t values_num;
+  pthread_mutex_t stats_lock;
 }; /* }}} */
 
 /*
@@ -79,6 +105,7 @@ struct fc_chain_s /* {{{ */
 static fc_match_t  *match_list_head;
 static fc_target_t *target_list_head;
 static fc_chain_t  *chain_list_head;
+static _Bool        stats_read_registered = 0;
 
 /*
  * Private functions
@@ -145,6 +172,19 @@ static void fc_free_chains (fc_chain_t *c) /* {{{ */
   fc_free_rules (c->rules);
   fc_free_targets (c->targets);
 
+  if (c->rules_by_plugin != NULL)
+  {
+    char *key;
+    fc_rule_t **rules;
+
+    while (c_avl_pick (c->rules_by_plugin,
+          (void *) &key, (void *) &rules) == 0)
+      free (rules);
+    c_avl_destroy (c->rules_by_plugin);
+  }
+  free (c->rules_any);
+  pthread_mutex_destroy (&c->stats_lock);
+
   if (c->next != NULL)
     fc_free_chains (c->next);
 
@@ -433,6 +473,206 @@ static int fc_config_add_rule (fc_chain_t *chain, /* {{{ */
   return (0);
 } /* }}} int fc_config_add_rule */
 
+/* Merges the hints of all matches of `rule' into `rule->hint'. */
+static void fc_rule_hint (fc_rule_t *rule) /* {{{ */
+{
+  fc_match_t *m;
+
+  memset (&rule->hint, 0, sizeof (rule->hint));
+  rule->never = 0;
+
+  for (m = rule->matches; m != NULL; m = m->next)
+  {
+    match_hint_t hint;
+
+    if (m->proc.hint == NULL)
+      continue;
+
+    memset (&hint, 0, sizeof (hint));
+    if ((*m->proc.hint) (&hint, &m->user_data) != 0)
+      continue;
+
+    if (hint.plugin[0] != 0)
+    {
+      if (rule->hint.plugin[0] == 0)
+        sstrncpy (rule->hint.plugin, hint.plugin, sizeof (rule->hint.plugin));
+      else if (strcmp (rule->hint.plugin, hint.plugin) != 0)
+        rule->never = 1;
+    }
+
+    if (hint.type[0] != 0)
+    {
+      if (rule->hint.type[0] == 0)
+        sstrncpy (rule->hint.type, hint.type, sizeof (rule->hint.type));
+      else if (strcmp (rule->hint.type, hint.type) != 0)
+        rule->never = 1;
+    }
+  }
+} /* }}} void fc_rule_hint */
+
+/* Returns a NULL terminated array of the rules of `chain' which can match
+ * value lists of the given plugin, i.e. the rules not restricted to some
+ * plugin and, if `plugin' is not NULL, the rules restricted to `plugin'. */
+static fc_rule_t **fc_chain_select_rules (fc_chain_t *chain, /* {{{ */
+    size_t rules_num, const char *plugin)
+{
+  fc_rule_t **rules;
+  fc_rule_t *rule;
+  size_t i;
+
+  rules = calloc (rules_num + 1, sizeof (*rules));
+  if (rules == NULL)
+    return (NULL);
+
+  i = 0;
+  for (rule = chain->rules; rule != NULL; rule = rule->next)
+  {
+    if (rule->never)
+      continue;
+
+    if ((rule->hint.plugin[0] == 0)
+        || ((plugin != NULL) && (strcmp (rule->hint.plugin, plugin) == 0)))
+    {
+      rules[i] = rule;
+      i++;
+    }
+  }
+  rules[i] = NULL;
+
+  return (rules);
+} /* }}} fc_rule_t **fc_chain_select_rules */
+
+/* Builds the lookup structures used by fc_process_chain() from the list of
+ * rules. Must be called once all rules have been added. */
+static int fc_chain_compile (fc_chain_t *chain) /* {{{ */
+{
+  fc_rule_t *rule;
+  size_t rules_num;
+
+  rules_num = 0;
+  for (rule = chain->rules; rule != NULL; rule = rule->next)
+  {
+    rule->position = rules_num;
+    rules_num++;
+
+    fc_rule_hint (rule);
+    if (rule->never)
+      WARNING ("Filter subsystem: Chain %s: The matches of rule #%zu "
+          "contradict each other, so the rule will never match.",
+          chain->name, rule->position + 1);
+  }
+
+  chain->rules_any = fc_chain_select_rules (chain, rules_num,
+      /* plugin = */ NULL);
+  chain->rules_by_plugin = c_avl_create ((void *) strcmp);
+  if ((chain->rules_any == NULL) || (chain->rules_by_plugin == NULL))
+  {
+    ERROR ("fc_chain_compile: Allocating memory failed.");
+    return (-1);
+  }
+
+  for (rule = chain->rules; rule != NULL; rule = rule->next)
+  {
+    fc_rule_t **rules;
+    int status;
+
+    if (rule->never || (rule->hint.plugin[0] == 0))
+      continue;
+
+    if (c_avl_get (chain->rules_by_plugin, rule->hint.plugin, NULL) == 0)
+      continue;
+
+    rules = fc_chain_select_rules (chain, rules_num, rule->hint.plugin);
+    if (rules == NULL)
+    {
+      ERROR ("fc_chain_compile: Allocating memory failed.");
+      return (-1);
+    }
+
+    status = c_avl_insert (chain->rules_by_plugin, rule->hint.plugin, rules);
+    if (status != 0)
+    {
+      ERROR ("fc_chain_compile: c_avl_insert failed.");
+      free (rules);
+      return (-1);
+    }
+  }
+
+  return (0);
+} /* }}} int fc_chain_compile */
+
+static fc_rule_t **fc_chain_get_rules (fc_chain_t *chain, /* {{{ */
+    const char *plugin)
+{
+  fc_rule_t **rules;
+
+  if (c_avl_get (chain->rules_by_plugin, plugin, (void *) &rules) == 0)
+    return (rules);
+
+  return (chain->rules_any);
+} /* }}} fc_rule_t **fc_chain_get_rules */
+
+static void fc_stats_submit (const char *chain_name, /* {{{ */
+    const char *type, const char *type_instance,
+    value_t *values, size_t values_num)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = values;
+  vl.values_len = (int) values_num;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "filter_chain", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, chain_name, sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, type, sizeof (vl.type));
+  if (type_instance != NULL)
+    sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+  plugin_dispatch_values (&vl);
+} /* }}} void fc_stats_submit */
+
+/* Read callback dispatching the counters of all chains with the
+ * `CollectStatistics' option. The lock is not held while dispatching, since
+ * the values may be processed by the very same chain in this thread. */
+static int fc_stats_read (void) /* {{{ */
+{
+  fc_chain_t *chain;
+
+  for (chain = chain_list_head; chain != NULL; chain = chain->next)
+  {
+    fc_rule_t *rule;
+    value_t values[2];
+
+    if (!chain->collect_stats)
+      continue;
+
+    pthread_mutex_lock (&chain->stats_lock);
+    values[0].derive = (derive_t) chain->values_num;
+    pthread_mutex_unlock (&chain->stats_lock);
+
+    fc_stats_submit (chain->name, "total_values", /* type_instance = */ NULL,
+        values, 1);
+
+    for (rule = chain->rules; rule != NULL; rule = rule->next)
+    {
+      char name[DATA_MAX_NAME_LEN];
+
+      if (rule->name[0] != 0)
+        sstrncpy (name, rule->name, sizeof (name));
+      else
+        ssnprintf (name, sizeof (name), "rule%zu", rule->position + 1);
+
+      pthread_mutex_lock (&chain->stats_lock);
+      values[0].derive = (derive_t) rule->evaluated_num;
+      values[1].derive = (derive_t) rule->matched_num;
+      pthread_mutex_unlock (&chain->stats_lock);
+
+      fc_stats_submit (chain->name, "filter_rule", name, values, 2);
+    }
+  }
+
+  return (0);
+} /* }}} int fc_stats_read */
+
 static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
 {
   fc_chain_t *chain;
@@ -458,6 +698,7 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
   chain->rules = NULL;
   chain->targets = NULL;
   chain->next = NULL;
+  pthread_mutex_init (&chain->stats_lock, /* attr = */ NULL);
 
   for (i = 0; i < ci->children_num; i++)
   {
@@ -468,6 +709,8 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
       status = fc_config_add_rule (chain, option);
     else if (strcasecmp ("Target", option->key) == 0)
       status = fc_config_add_target (&chain->targets, option);
+    else if (strcasecmp ("CollectStatistics", option->key) == 0)
+      status = cf_util_get_boolean (option, &chain->collect_stats);
     else
     {
       WARNING ("Filter subsystem: Chain %s: Option `%s' not allowed "
@@ -479,12 +722,21 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
       break;
   } /* for (ci->children) */
 
+  if (status == 0)
+    status = fc_chain_compile (chain);
+
   if (status != 0)
   {
     fc_free_chains (chain);
     return (-1);
   }
 
+  if (chain->collect_stats && !stats_read_registered)
+  {
+    plugin_register_read ("filter_chain", fc_stats_read);
+    stats_read_registered = 1;
+  }
+
   if (chain_list_head != NULL)
   {
     fc_chain_t *ptr;
@@ -861,8 +1113,10 @@ fc_chain_t *fc_chain_get_by_name (const char *chain_name) /* {{{ */
 int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
     fc_chain_t *chain)
 {
+  fc_rule_t **rules;
   fc_rule_t *rule;
   fc_target_t *target;
+  size_t i;
   int status;
 
   if (chain == NULL)
@@ -870,17 +1124,43 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
 
   DEBUG ("fc_process_chain (chain = %s);", chain->name);
 
+  if (chain->collect_stats)
+  {
+    pthread_mutex_lock (&chain->stats_lock);
+    chain->values_num++;
+    pthread_mutex_unlock (&chain->stats_lock);
+  }
+
+  /* Only look at the rules which can match this plugin at all. */
+  rules = fc_chain_get_rules (chain, vl->plugin);
+
   status = FC_TARGET_CONTINUE;
-  for (rule = chain->rules; rule != NULL; rule = rule->next)
+  i = 0;
+  while (rules[i] != NULL)
   {
+    fc_rule_t **rules_new;
     fc_match_t *match;
 
+    rule = rules[i];
+    i++;
+
+    if ((rule->hint.type[0] != 0)
+        && (strcmp (rule->hint.type, vl->type) != 0))
+      continue;
+
     if (rule->name[0] != 0)
     {
       DEBUG ("fc_process_chain (%s): Testing the `%s' rule.",
           chain->name, rule->name);
     }
 
+    if (chain->collect_stats)
+    {
+      pthread_mutex_lock (&chain->stats_lock);
+      rule->evaluated_num++;
+      pthread_mutex_unlock (&chain->stats_lock);
+    }
+
     /* N. B.: rule->matches may be NULL. */
     for (match = rule->matches; match != NULL; match = match->next)
     {
@@ -909,6 +1189,13 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
           chain->name, rule->name);
     }
 
+    if (chain->collect_stats)
+    {
+      pthread_mutex_lock (&chain->stats_lock);
+      rule->matched_num++;
+      pthread_mutex_unlock (&chain->stats_lock);
+    }
+
     for (target = rule->targets; target != NULL; target = target->next)
     {
       /* If we get here, all matches have matched the value. Execute the
@@ -951,17 +1238,24 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
     {
       status = FC_TARGET_CONTINUE;
     }
-  } /* for (rule) */
+
+    /* The targets may have changed the plugin name. In that case continue
+     * with the rules for the new name after the current position. */
+    rules_new = fc_chain_get_rules (chain, vl->plugin);
+    if (rules_new != rules)
+    {
+      rules = rules_new;
+      for (i = 0; rules[i] != NULL; i++)
+        if (rules[i]->position > rule->position)
+          break;
+    }
+  } /* while (rules[i] != NULL) */
 
   if (status == FC_TARGET_STOP)
     return (FC_TARGET_STOP);
   else if (status == FC_TARGET_RETURN)
     return (FC_TARGET_CONTINUE);
 
-  /* for-loop has been aborted: A target returned `FC_TARGET_STOP' */
-  if (rule != NULL)
-    return (FC_TARGET_CONTINUE);
-
   DEBUG ("fc_process_chain (%s): Executing the default targets.",
       chain->name);
 
@@ -35,12 +35,25 @@
 /*
  * Match functions
  */
+/* Describes which value lists a match can possibly match. Empty fields mean
+ * "any". The filter chain uses this to skip rules without calling their
+ * matches. */
+struct match_hint_s
+{
+  char plugin[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+};
+typedef struct match_hint_s match_hint_t;
+
 struct match_proc_s
 {
   int (*create) (const oconfig_item_t *ci, void **user_data);
   int (*destroy) (void **user_data);
   int (*match) (const data_set_t *ds, const value_list_t *vl,
       notification_meta_t **meta, void **user_data);
+  /* Optional. Fills in `hint' if the match can only match value lists with a
+   * certain plugin or type name. `hint' is zeroed by the caller. */
+  int (*hint) (match_hint_t *hint, void **user_data);
 };
 typedef struct match_proc_s match_proc_t;
 
@@ -49,6 +62,10 @@ int fc_register_match (const char *name, match_proc_t proc);
 /*
  * Target functions
  */
+/* `invoke' may change `vl'. `vl->values' is always dynamically allocated, so
+ * a target replacing the values may free the array and set `vl->values' to a
+ * new one allocated with malloc(3). `vl->ident' belongs to the daemon and
+ * must be kept; call ident_vl_update() after changing the identifier fields. */
 struct target_proc_s
 {
   int (*create) (const oconfig_item_t *ci, void **user_data);
@@ -25,6 +25,8 @@
 #include "plugin.h"
 #include "common.h"
 #include "filter_chain.h"
+#include "utils_avltree.h"
+#include "utils_ident.h"
 
 #include <pthread.h>
 #include <jni.h>
@@ -63,6 +65,7 @@ typedef struct java_plugin_class_s java_plugin_class_t;
 #define CB_TYPE_NOTIFICATION 8
 #define CB_TYPE_MATCH        9
 #define CB_TYPE_TARGET      10
+#define CB_TYPE_WRITE_BATCH 11
 struct cjni_callback_info_s /* {{{ */
 {
   char     *name;
@@ -74,6 +77,82 @@ struct cjni_callback_info_s /* {{{ */
 typedef struct cjni_callback_info_s cjni_callback_info_t;
 /* }}} */
 
+/* A CB_TYPE_WRITE_BATCH callback. Value lists are converted to Java objects
+ * right away and collected in `batch', which is handed to Java once it holds
+ * `batch_size' elements or is older than the interval. A read callback passes
+ * on the pending values once per interval, so they don't wait for the next
+ * value to arrive. */
+struct cjni_write_batch_s /* {{{ */
+{
+  cjni_callback_info_t *cbi;
+
+  jobjectArray batch;
+  jsize        batch_size;
+  jsize        batch_fill;
+  cdtime_t     batch_init_time;
+
+  pthread_mutex_t lock;
+};
+typedef struct cjni_write_batch_s cjni_write_batch_t;
+/* }}} */
+
+/* Classes and methods needed to convert values and notifications to Java
+ * objects. They're looked up once, right after the JVM has been created. */
+struct cjni_cache_s /* {{{ */
+{
+  jclass    c_long;
+  jmethodID m_long_constructor;
+
+  jclass    c_double;
+  jmethodID m_double_constructor;
+
+  jclass    c_datasource;
+  jmethodID m_datasource_constructor;
+  jmethodID m_datasource_setname;
+  jmethodID m_datasource_settype;
+  jmethodID m_datasource_setmin;
+  jmethodID m_datasource_setmax;
+
+  jclass    c_dataset;
+  jmethodID m_dataset_constructor;
+  jmethodID m_dataset_adddatasource;
+
+  jclass    c_valuelist;
+  jmethodID m_valuelist_constructor;
+  jmethodID m_valuelist_sethost;
+  jmethodID m_valuelist_setplugin;
+  jmethodID m_valuelist_setplugininstance;
+  jmethodID m_valuelist_settype;
+  jmethodID m_valuelist_settypeinstance;
+  jmethodID m_valuelist_settime;
+  jmethodID m_valuelist_setinterval;
+  jmethodID m_valuelist_addvalue;
+  jmethodID m_valuelist_setdataset;
+
+  jclass    c_notification;
+  jmethodID m_notification_constructor;
+  jmethodID m_notification_sethost;
+  jmethodID m_notification_setplugin;
+  jmethodID m_notification_setplugininstance;
+  jmethodID m_notification_settype;
+  jmethodID m_notification_settypeinstance;
+  jmethodID m_notification_setmessage;
+  jmethodID m_notification_settime;
+  jmethodID m_notification_setseverity;
+};
+typedef struct cjni_cache_s cjni_cache_t;
+/* }}} */
+
+/* Element of `data_set_cache': A DataSet object shared by all ValueList
+ * objects of one type. */
+struct cjni_data_set_s /* {{{ */
+{
+  jobject object;
+  int     ds_num;
+};
+typedef struct cjni_data_set_s cjni_data_set_t;
+/* }}} */
+
 /*
  * Global variables
  */
@@ -95,6 +174,12 @@ static pthread_mutex_t       java_callbacks_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static oconfig_item_t       *config_block = NULL;
 
+static cjni_cache_t          cache;
+
+/* DataSet objects by type, so that they're not created for each value. */
+static c_avl_tree_t         *data_set_cache      = NULL;
+static pthread_mutex_t       data_set_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Prototypes
  *
@@ -112,6 +197,12 @@ static int cjni_write (const data_set_t *ds, const value_list_t *vl,
 static int cjni_flush (cdtime_t timeout, const char *identifier, user_data_t *ud);
 static void cjni_log (int severity, const char *message, user_data_t *ud);
 static int cjni_notification (const notification_t *n, user_data_t *ud);
+static int cjni_write_batch (const data_set_t *ds, const value_list_t *vl,
+    user_data_t *ud);
+static int cjni_write_batch_flush (cdtime_t timeout, const char *identifier,
+    user_data_t *ud);
+static int cjni_write_batch_read (user_data_t *ud);
+static void cjni_write_batch_destroy (void *arg);
 
 /* Create, destroy, and match/invoke functions, used by both, matches AND
  * targets. */
@@ -124,10 +215,8 @@ static int cjni_match_target_invoke (const data_set_t *ds, value_list_t *vl,
  * C to Java conversion functions
  */
 static int ctoj_string (JNIEnv *jvm_env, /* {{{ */
-    const char *string,
-    jclass class_ptr, jobject object_ptr, const char *method_name)
+    const char *string, jobject object_ptr, jmethodID m_set)
 {
-  jmethodID m_set;
   jstring o_string;
 
   /* Create a java.lang.String */
@@ -139,18 +228,7 @@ static int ctoj_string (JNIEnv *jvm_env, /* {{{ */
     return (-1);
   }
 
-  /* Search for the `void setFoo (String s)' method. */
-  m_set = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      method_name, "(Ljava/lang/String;)V");
-  if (m_set == NULL)
-  {
-    ERROR ("java plugin: ctoj_string: Cannot find method `void %s (String)'.",
-        method_name);
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_string);
-    return (-1);
-  }
-
-  /* Call the method. */
+  /* Call the `void setFoo (String s)' method. */
   (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_set, o_string);
 
   /* Decrease reference counter on the java.lang.String object. */
@@ -159,123 +237,18 @@ static int ctoj_string (JNIEnv *jvm_env, /* {{{ */
   return (0);
 } /* }}} int ctoj_string */
 
-static int ctoj_int (JNIEnv *jvm_env, /* {{{ */
-    jint value,
-    jclass class_ptr, jobject object_ptr, const char *method_name)
-{
-  jmethodID m_set;
-
-  /* Search for the `void setFoo (int i)' method. */
-  m_set = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      method_name, "(I)V");
-  if (m_set == NULL)
-  {
-    ERROR ("java plugin: ctoj_int: Cannot find method `void %s (int)'.",
-        method_name);
-    return (-1);
-  }
-
-  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_set, value);
-
-  return (0);
-} /* }}} int ctoj_int */
-
-static int ctoj_long (JNIEnv *jvm_env, /* {{{ */
-    jlong value,
-    jclass class_ptr, jobject object_ptr, const char *method_name)
-{
-  jmethodID m_set;
-
-  /* Search for the `void setFoo (long l)' method. */
-  m_set = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      method_name, "(J)V");
-  if (m_set == NULL)
-  {
-    ERROR ("java plugin: ctoj_long: Cannot find method `void %s (long)'.",
-        method_name);
-    return (-1);
-  }
-
-  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_set, value);
-
-  return (0);
-} /* }}} int ctoj_long */
-
-static int ctoj_double (JNIEnv *jvm_env, /* {{{ */
-    jdouble value,
-    jclass class_ptr, jobject object_ptr, const char *method_name)
-{
-  jmethodID m_set;
-
-  /* Search for the `void setFoo (double d)' method. */
-  m_set = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      method_name, "(D)V");
-  if (m_set == NULL)
-  {
-    ERROR ("java plugin: ctoj_double: Cannot find method `void %s (double)'.",
-        method_name);
-    return (-1);
-  }
-
-  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_set, value);
-
-  return (0);
-} /* }}} int ctoj_double */
-
 /* Convert a jlong to a java.lang.Number */
 static jobject ctoj_jlong_to_number (JNIEnv *jvm_env, jlong value) /* {{{ */
 {
-  jclass c_long;
-  jmethodID m_long_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_long = (*jvm_env)->FindClass (jvm_env, "java/lang/Long");
-  if (c_long == NULL)
-  {
-    ERROR ("java plugin: ctoj_jlong_to_number: Looking up the "
-        "java.lang.Long class failed.");
-    return (NULL);
-  }
-
-  m_long_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_long, "<init>", "(J)V");
-  if (m_long_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_jlong_to_number: Looking up the "
-        "`Long (long)' constructor failed.");
-    return (NULL);
-  }
-
   return ((*jvm_env)->NewObject (jvm_env,
-        c_long, m_long_constructor, value));
+        cache.c_long, cache.m_long_constructor, value));
 } /* }}} jobject ctoj_jlong_to_number */
 
 /* Convert a jdouble to a java.lang.Number */
 static jobject ctoj_jdouble_to_number (JNIEnv *jvm_env, jdouble value) /* {{{ */
 {
-  jclass c_double;
-  jmethodID m_double_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_double = (*jvm_env)->FindClass (jvm_env, "java/lang/Double");
-  if (c_double == NULL)
-  {
-    ERROR ("java plugin: ctoj_jdouble_to_number: Looking up the "
-        "java.lang.Double class failed.");
-    return (NULL);
-  }
-
-  m_double_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_double, "<init>", "(D)V");
-  if (m_double_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_jdouble_to_number: Looking up the "
-        "`Double (double)' constructor failed.");
-    return (NULL);
-  }
-
   return ((*jvm_env)->NewObject (jvm_env,
-        c_double, m_double_constructor, value));
+        cache.c_double, cache.m_double_constructor, value));
 } /* }}} jobject ctoj_jdouble_to_number */
 
 /* Convert a value_t to a java.lang.Number */
@@ -298,34 +271,12 @@ static jobject ctoj_value_to_number (JNIEnv *jvm_env, /* {{{ */
 static jobject ctoj_data_source (JNIEnv *jvm_env, /* {{{ */
     const data_source_t *dsrc)
 {
-  jclass c_datasource;
-  jmethodID m_datasource_constructor;
   jobject o_datasource;
   int status;
 
-  /* Look up the DataSource class */
-  c_datasource = (*jvm_env)->FindClass (jvm_env,
-      "org/collectd/api/DataSource");
-  if (c_datasource == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "FindClass (org/collectd/api/DataSource) failed.");
-    return (NULL);
-  }
-
-  /* Lookup the `ValueList ()' constructor. */
-  m_datasource_constructor = (*jvm_env)->GetMethodID (jvm_env, c_datasource,
-      "<init>", "()V");
-  if (m_datasource_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_source: Cannot find the "
-        "`DataSource ()' constructor.");
-    return (NULL);
-  }
-
   /* Create a new instance. */
-  o_datasource = (*jvm_env)->NewObject (jvm_env, c_datasource,
-      m_datasource_constructor);
+  o_datasource = (*jvm_env)->NewObject (jvm_env, cache.c_datasource,
+      cache.m_datasource_constructor);
   if (o_datasource == NULL)
   {
     ERROR ("java plugin: ctoj_data_source: "
@@ -335,7 +286,7 @@ static jobject ctoj_data_source (JNIEnv *jvm_env, /* {{{ */
 
   /* Set name via `void setName (String name)' */
   status = ctoj_string (jvm_env, dsrc->name,
-      c_datasource, o_datasource, "setName");
+      o_datasource, cache.m_datasource_setname);
   if (status != 0)
   {
     ERROR ("java plugin: ctoj_data_source: "
@@ -345,37 +296,15 @@ static jobject ctoj_data_source (JNIEnv *jvm_env, /* {{{ */
   }
 
   /* Set type via `void setType (int type)' */
-  status = ctoj_int (jvm_env, dsrc->type,
-      c_datasource, o_datasource, "setType");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_int (setType) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
-
-  /* Set min via `void setMin (double min)' */
-  status = ctoj_double (jvm_env, dsrc->min,
-      c_datasource, o_datasource, "setMin");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_double (setMin) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      cache.m_datasource_settype, (jint) dsrc->type);
 
-  /* Set max via `void setMax (double max)' */
-  status = ctoj_double (jvm_env, dsrc->max,
-      c_datasource, o_datasource, "setMax");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_data_source: "
-        "ctoj_double (setMax) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
-    return (NULL);
-  }
+  /* Set min and max via `void setMin (double min)' and
+   * `void setMax (double max)' */
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      cache.m_datasource_setmin, (jdouble) dsrc->min);
+  (*jvm_env)->CallVoidMethod (jvm_env, o_datasource,
+      cache.m_datasource_setmax, (jdouble) dsrc->max);
 
   return (o_datasource);
 } /* }}} jobject ctoj_data_source */
@@ -596,42 +525,10 @@ static jobject ctoj_oconfig_item (JNIEnv *jvm_env, /* {{{ */
 /* Convert a data_set_t to a org/collectd/api/DataSet */
 static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
 {
-  jclass c_dataset;
-  jmethodID m_constructor;
-  jmethodID m_add;
   jobject o_type;
   jobject o_dataset;
   int i;
 
-  /* Look up the org/collectd/api/DataSet class */
-  c_dataset = (*jvm_env)->FindClass (jvm_env, "org/collectd/api/DataSet");
-  if (c_dataset == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "org/collectd/api/DataSet class failed.");
-    return (NULL);
-  }
-
-  /* Search for the `DataSet (String type)' constructor. */
-  m_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_dataset, "<init>", "(Ljava/lang/String;)V");
-  if (m_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "`DataSet (String)' constructor failed.");
-    return (NULL);
-  }
-
-  /* Search for the `void addDataSource (DataSource)' method. */
-  m_add = (*jvm_env)->GetMethodID (jvm_env,
-      c_dataset, "addDataSource", "(Lorg/collectd/api/DataSource;)V");
-  if (m_add == NULL)
-  {
-    ERROR ("java plugin: ctoj_data_set: Looking up the "
-        "`addDataSource (DataSource)' method failed.");
-    return (NULL);
-  }
-
   o_type = (*jvm_env)->NewStringUTF (jvm_env, ds->type);
   if (o_type == NULL)
   {
@@ -639,8 +536,9 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
     return (NULL);
   }
 
+  /* Call the `DataSet (String type)' constructor. */
   o_dataset = (*jvm_env)->NewObject (jvm_env,
-      c_dataset, m_constructor, o_type);
+      cache.c_dataset, cache.m_dataset_constructor, o_type);
   if (o_dataset == NULL)
   {
     ERROR ("java plugin: ctoj_data_set: Creating a DataSet object failed.");
@@ -664,7 +562,8 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
       return (NULL);
     }
 
-    (*jvm_env)->CallVoidMethod (jvm_env, o_dataset, m_add, o_datasource);
+    (*jvm_env)->CallVoidMethod (jvm_env, o_dataset,
+        cache.m_dataset_adddatasource, o_datasource);
 
     (*jvm_env)->DeleteLocalRef (jvm_env, o_datasource);
   } /* for (i = 0; i < ds->ds_num; i++) */
@@ -672,22 +571,84 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
   return (o_dataset);
 } /* }}} jobject ctoj_data_set */
 
-static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
-    value_t value, int ds_type,
-    jclass class_ptr, jobject object_ptr)
+/* Returns the shared DataSet object for `ds', creating it if necessary. The
+ * returned object is a global reference owned by `data_set_cache', i. e. the
+ * caller must not delete it. */
+static jobject ctoj_data_set_cached (JNIEnv *jvm_env, /* {{{ */
+    const data_set_t *ds)
 {
-  jmethodID m_addvalue;
-  jobject o_number;
+  cjni_data_set_t *entry = NULL;
+  jobject o_dataset;
+  char *key;
+  int status;
 
-  m_addvalue = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      "addValue", "(Ljava/lang/Number;)V");
-  if (m_addvalue == NULL)
+  pthread_mutex_lock (&data_set_cache_lock);
+
+  if (data_set_cache == NULL)
   {
-    ERROR ("java plugin: ctoj_value_list_add_value: "
-        "Cannot find method `void addValue (Number)'.");
-    return (-1);
+    data_set_cache = c_avl_create ((void *) strcmp);
+    if (data_set_cache == NULL)
+    {
+      pthread_mutex_unlock (&data_set_cache_lock);
+      ERROR ("java plugin: ctoj_data_set_cached: c_avl_create failed.");
+      return (NULL);
+    }
+  }
+
+  /* The number of data sources is compared in case the type has been
+   * re-defined. */
+  status = c_avl_get (data_set_cache, ds->type, (void *) &entry);
+  if ((status == 0) && (entry->ds_num == ds->ds_num))
+  {
+    pthread_mutex_unlock (&data_set_cache_lock);
+    return (entry->object);
+  }
+
+  o_dataset = ctoj_data_set (jvm_env, ds);
+  if (o_dataset == NULL)
+  {
+    pthread_mutex_unlock (&data_set_cache_lock);
+    return (NULL);
+  }
+
+  if (status == 0)
+  {
+    /* Objects handed out earlier may still be in use, so the old global
+     * reference is kept until shutdown. */
+    WARNING ("java plugin: ctoj_data_set_cached: The number of data sources "
+        "of type \"%s\" changed.", ds->type);
+  }
+  else
+  {
+    key = strdup (ds->type);
+    entry = malloc (sizeof (*entry));
+    if ((key == NULL) || (entry == NULL)
+        || (c_avl_insert (data_set_cache, key, entry) != 0))
+    {
+      pthread_mutex_unlock (&data_set_cache_lock);
+      ERROR ("java plugin: ctoj_data_set_cached: Adding \"%s\" to the cache "
+          "failed.", ds->type);
+      sfree (key);
+      sfree (entry);
+      (*jvm_env)->DeleteLocalRef (jvm_env, o_dataset);
+      return (NULL);
+    }
   }
 
+  entry->object = (*jvm_env)->NewGlobalRef (jvm_env, o_dataset);
+  entry->ds_num = ds->ds_num;
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_dataset);
+
+  pthread_mutex_unlock (&data_set_cache_lock);
+
+  return (entry->object);
+} /* }}} jobject ctoj_data_set_cached */
+
+static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
+    value_t value, int ds_type, jobject object_ptr)
+{
+  jobject o_number;
+
   o_number = ctoj_value_to_number (jvm_env, value, ds_type);
   if (o_number == NULL)
   {
@@ -696,7 +657,9 @@ static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
     return (-1);
   }
 
-  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_addvalue, o_number);
+  /* Call the `void addValue (Number n)' method. */
+  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr,
+      cache.m_valuelist_addvalue, o_number);
 
   (*jvm_env)->DeleteLocalRef (jvm_env, o_number);
 
@@ -704,36 +667,22 @@ static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
 } /* }}} int ctoj_value_list_add_value */
 
 static int ctoj_value_list_add_data_set (JNIEnv *jvm_env, /* {{{ */
-    jclass c_valuelist, jobject o_valuelist, const data_set_t *ds)
+    jobject o_valuelist, const data_set_t *ds)
 {
-  jmethodID m_setdataset;
   jobject o_dataset;
 
-  /* Look for the `void setDataSource (List<DataSource> ds)' method. */
-  m_setdataset = (*jvm_env)->GetMethodID (jvm_env, c_valuelist,
-      "setDataSet", "(Lorg/collectd/api/DataSet;)V");
-  if (m_setdataset == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list_add_data_set: "
-        "Cannot find the `void setDataSet (DataSet)' method.");
-    return (-1);
-  }
-
-  /* Create a DataSet object. */
-  o_dataset = ctoj_data_set (jvm_env, ds);
+  /* Look up the shared DataSet object. */
+  o_dataset = ctoj_data_set_cached (jvm_env, ds);
   if (o_dataset == NULL)
   {
     ERROR ("java plugin: ctoj_value_list_add_data_set: "
-        "ctoj_data_set (%s) failed.", ds->type);
+        "ctoj_data_set_cached (%s) failed.", ds->type);
     return (-1);
   }
 
-  /* Actually call the method. */
+  /* Call the `void setDataSet (DataSet ds)' method. */
   (*jvm_env)->CallVoidMethod (jvm_env,
-      o_valuelist, m_setdataset, o_dataset);
-
-  /* Decrease reference counter on the List<DataSource> object. */
-  (*jvm_env)->DeleteLocalRef (jvm_env, o_dataset);
+      o_valuelist, cache.m_valuelist_setdataset, o_dataset);
 
   return (0);
 } /* }}} int ctoj_value_list_add_data_set */
@@ -742,36 +691,13 @@ static int ctoj_value_list_add_data_set (JNIEnv *jvm_env, /* {{{ */
 static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
     const data_set_t *ds, const value_list_t *vl)
 {
-  jclass c_valuelist;
-  jmethodID m_valuelist_constructor;
   jobject o_valuelist;
   int status;
   int i;
 
-  /* First, create a new ValueList instance..
-   * Look up the class.. */
-  c_valuelist = (*jvm_env)->FindClass (jvm_env,
-      "org/collectd/api/ValueList");
-  if (c_valuelist == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list: "
-        "FindClass (org/collectd/api/ValueList) failed.");
-    return (NULL);
-  }
-
-  /* Lookup the `ValueList ()' constructor. */
-  m_valuelist_constructor = (*jvm_env)->GetMethodID (jvm_env, c_valuelist,
-      "<init>", "()V");
-  if (m_valuelist_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list: Cannot find the "
-        "`ValueList ()' constructor.");
-    return (NULL);
-  }
-
   /* Create a new instance. */
-  o_valuelist = (*jvm_env)->NewObject (jvm_env, c_valuelist,
-      m_valuelist_constructor);
+  o_valuelist = (*jvm_env)->NewObject (jvm_env, cache.c_valuelist,
+      cache.m_valuelist_constructor);
   if (o_valuelist == NULL)
   {
     ERROR ("java plugin: ctoj_value_list: Creating a new ValueList instance "
@@ -779,8 +705,7 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
     return (NULL);
   }
 
-  status = ctoj_value_list_add_data_set (jvm_env,
-      c_valuelist, o_valuelist, ds);
+  status = ctoj_value_list_add_data_set (jvm_env, o_valuelist, ds);
   if (status != 0)
   {
     ERROR ("java plugin: ctoj_value_list: "
@@ -790,9 +715,8 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
   }
 
   /* Set the strings.. */
-#define SET_STRING(str,method_name) do { \
-  status = ctoj_string (jvm_env, str, \
-      c_valuelist, o_valuelist, method_name); \
+#define SET_STRING(str,method_name,method_id) do { \
+  status = ctoj_string (jvm_env, str, o_valuelist, method_id); \
   if (status != 0) { \
     ERROR ("java plugin: ctoj_value_list: ctoj_string (%s) failed.", \
         method_name); \
@@ -800,39 +724,30 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
     return (NULL); \
   } } while (0)
 
-  SET_STRING (vl->host,            "setHost");
-  SET_STRING (vl->plugin,          "setPlugin");
-  SET_STRING (vl->plugin_instance, "setPluginInstance");
-  SET_STRING (vl->type,            "setType");
-  SET_STRING (vl->type_instance,   "setTypeInstance");
+  SET_STRING (vl->host,            "setHost",
+      cache.m_valuelist_sethost);
+  SET_STRING (vl->plugin,          "setPlugin",
+      cache.m_valuelist_setplugin);
+  SET_STRING (vl->plugin_instance, "setPluginInstance",
+      cache.m_valuelist_setplugininstance);
+  SET_STRING (vl->type,            "setType",
+      cache.m_valuelist_settype);
+  SET_STRING (vl->type_instance,   "setTypeInstance",
+      cache.m_valuelist_settypeinstance);
 
 #undef SET_STRING
 
-  /* Set the `time' member. Java stores time in milliseconds. */
-  status = ctoj_long (jvm_env, (jlong) CDTIME_T_TO_MS (vl->time),
-      c_valuelist, o_valuelist, "setTime");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: ctoj_long (setTime) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
-
-  /* Set the `interval' member.. */
-  status = ctoj_long (jvm_env,
-      (jlong) CDTIME_T_TO_MS (vl->interval),
-      c_valuelist, o_valuelist, "setInterval");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: ctoj_long (setInterval) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
+  /* Set the `time' and `interval' members. Java stores time in
+   * milliseconds. */
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      cache.m_valuelist_settime, (jlong) CDTIME_T_TO_MS (vl->time));
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      cache.m_valuelist_setinterval, (jlong) CDTIME_T_TO_MS (vl->interval));
 
   for (i = 0; i < vl->values_len; i++)
   {
     status = ctoj_value_list_add_value (jvm_env, vl->values[i], ds->ds[i].type,
-        c_valuelist, o_valuelist);
+        o_valuelist);
     if (status != 0)
     {
       ERROR ("java plugin: ctoj_value_list: "
@@ -849,35 +764,12 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
 static jobject ctoj_notification (JNIEnv *jvm_env, /* {{{ */
     const notification_t *n)
 {
-  jclass c_notification;
-  jmethodID m_constructor;
   jobject o_notification;
   int status;
 
-  /* First, create a new Notification instance..
-   * Look up the class.. */
-  c_notification = (*jvm_env)->FindClass (jvm_env,
-      "org/collectd/api/Notification");
-  if (c_notification == NULL)
-  {
-    ERROR ("java plugin: ctoj_notification: "
-        "FindClass (org/collectd/api/Notification) failed.");
-    return (NULL);
-  }
-
-  /* Lookup the `Notification ()' constructor. */
-  m_constructor = (*jvm_env)->GetMethodID (jvm_env, c_notification,
-      "<init>", "()V");
-  if (m_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_notification: Cannot find the "
-        "`Notification ()' constructor.");
-    return (NULL);
-  }
-
   /* Create a new instance. */
-  o_notification = (*jvm_env)->NewObject (jvm_env, c_notification,
-      m_constructor);
+  o_notification = (*jvm_env)->NewObject (jvm_env, cache.c_notification,
+      cache.m_notification_constructor);
   if (o_notification == NULL)
   {
     ERROR ("java plugin: ctoj_notification: Creating a new Notification "
@@ -886,9 +778,8 @@ static jobject ctoj_notification (JNIEnv *jvm_env, /* {{{ */
   }
 
   /* Set the strings.. */
-#define SET_STRING(str,method_name) do { \
-  status = ctoj_string (jvm_env, str, \
-      c_notification, o_notification, method_name); \
+#define SET_STRING(str,method_name,method_id) do { \
+  status = ctoj_string (jvm_env, str, o_notification, method_id); \
   if (status != 0) { \
     ERROR ("java plugin: ctoj_notification: ctoj_string (%s) failed.", \
         method_name); \
@@ -896,34 +787,28 @@ static jobject ctoj_notification (JNIEnv *jvm_env, /* {{{ */
     return (NULL); \
   } } while (0)
 
-  SET_STRING (n->host,            "setHost");
-  SET_STRING (n->plugin,          "setPlugin");
-  SET_STRING (n->plugin_instance, "setPluginInstance");
-  SET_STRING (n->type,            "setType");
-  SET_STRING (n->type_instance,   "setTypeInstance");
-  SET_STRING (n->message,         "setMessage");
+  SET_STRING (n->host,            "setHost",
+      cache.m_notification_sethost);
+  SET_STRING (n->plugin,          "setPlugin",
+      cache.m_notification_setplugin);
+  SET_STRING (n->plugin_instance, "setPluginInstance",
+      cache.m_notification_setplugininstance);
+  SET_STRING (n->type,            "setType",
+      cache.m_notification_settype);
+  SET_STRING (n->type_instance,   "setTypeInstance",
+      cache.m_notification_settypeinstance);
+  SET_STRING (n->message,         "setMessage",
+      cache.m_notification_setmessage);
 
 #undef SET_STRING
 
   /* Set the `time' member. Java stores time in milliseconds. */
-  status = ctoj_long (jvm_env, ((jlong) n->time) * ((jlong) 1000),
-      c_notification, o_notification, "setTime");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_notification: ctoj_long (setTime) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_notification);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_notification,
+      cache.m_notification_settime, ((jlong) n->time) * ((jlong) 1000));
 
   /* Set the `severity' member.. */
-  status = ctoj_int (jvm_env, (jint) n->severity,
-      c_notification, o_notification, "setSeverity");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_notification: ctoj_int (setSeverity) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_notification);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_notification,
+      cache.m_notification_setseverity, (jint) n->severity);
 
   return (o_notification);
 } /* }}} jobject ctoj_notification */
@@ -1451,6 +1336,64 @@ static jint JNICALL cjni_api_register_write (JNIEnv *jvm_env, /* {{{ */
   return (0);
 } /* }}} jint cjni_api_register_write */
 
+static jint JNICALL cjni_api_register_write_batch (JNIEnv *jvm_env, /* {{{ */
+    jobject this, jobject o_name, jobject o_write, jint batch_size)
+{
+  user_data_t ud;
+  cjni_write_batch_t *wb;
+  cjni_callback_info_t *cbi;
+  char read_name[512];
+
+  if (batch_size < 1)
+  {
+    ERROR ("java plugin: cjni_api_register_write_batch: Invalid batch size "
+        "%i.", (int) batch_size);
+    return (-1);
+  }
+
+  cbi = cjni_callback_info_create (jvm_env, o_name, o_write,
+      CB_TYPE_WRITE_BATCH);
+  if (cbi == NULL)
+    return (-1);
+
+  wb = malloc (sizeof (*wb));
+  if (wb == NULL)
+  {
+    ERROR ("java plugin: cjni_api_register_write_batch: malloc failed.");
+    cjni_callback_info_destroy (cbi);
+    return (-1);
+  }
+  memset (wb, 0, sizeof (*wb));
+  wb->cbi = cbi;
+  wb->batch = NULL;
+  wb->batch_size = (jsize) batch_size;
+  wb->batch_fill = 0;
+  pthread_mutex_init (&wb->lock, /* attr = */ NULL);
+
+  DEBUG ("java plugin: Registering new write batch callback: %s (%i)",
+      cbi->name, (int) batch_size);
+
+  memset (&ud, 0, sizeof (ud));
+  ud.data = (void *) wb;
+  ud.free_func = cjni_write_batch_destroy;
+
+  plugin_register_write (cbi->name, cjni_write_batch, &ud);
+
+  /* Flushing sends the pending values to Java. */
+  ud.free_func = NULL;
+  plugin_register_flush (cbi->name, cjni_write_batch_flush, &ud);
+
+  /* Java plugins tend to use one name for all their callbacks, so the read
+   * callback gets a name of its own. */
+  ssnprintf (read_name, sizeof (read_name), "%s.write_batch", cbi->name);
+  plugin_register_complex_read (/* group = */ NULL, read_name,
+      cjni_write_batch_read, /* interval = */ NULL, &ud);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_write);
+
+  return (0);
+} /* }}} jint cjni_api_register_write_batch */
+
 static jint JNICALL cjni_api_register_flush (JNIEnv *jvm_env, /* {{{ */
     jobject this, jobject o_name, jobject o_flush)
 {
@@ -1661,6 +1604,10 @@ static JNINativeMethod jni_api_functions[] = /* {{{ */
     "(Ljava/lang/String;Lorg/collectd/api/CollectdWriteInterface;)I",
     cjni_api_register_write },
 
+  { "registerWriteBatch",
+    "(Ljava/lang/String;Lorg/collectd/api/CollectdWriteBatchInterface;I)I",
+    cjni_api_register_write_batch },
+
   { "registerFlush",
     "(Ljava/lang/String;Lorg/collectd/api/CollectdFlushInterface;)I",
     cjni_api_register_flush },
@@ -1760,6 +1707,11 @@ static cjni_callback_info_t *cjni_callback_info_create (JNIEnv *jvm_env, /* {{{
         "Lorg/collectd/api/CollectdTargetInterface;";
       break;
 
+    case CB_TYPE_WRITE_BATCH:
+      method_name = "writeBatch";
+      method_signature = "([Lorg/collectd/api/ValueList;)I";
+      break;
+
     default:
       ERROR ("java plugin: cjni_callback_info_create: Unknown type: %#x",
           type);
@@ -1949,6 +1901,133 @@ static int cjni_init_native (JNIEnv *jvm_env) /* {{{ */
   return (0);
 } /* }}} int cjni_init_native */
 
+/* Look up the classes and methods stored in `cache'. */
+static int cjni_cache_init (JNIEnv *jvm_env) /* {{{ */
+{
+  jclass tmp;
+
+#define CACHE_CLASS(var,name) do { \
+  tmp = (*jvm_env)->FindClass (jvm_env, name); \
+  if (tmp == NULL) { \
+    ERROR ("java plugin: cjni_cache_init: FindClass (%s) failed.", name); \
+    return (-1); \
+  } \
+  cache.var = (*jvm_env)->NewGlobalRef (jvm_env, tmp); \
+  (*jvm_env)->DeleteLocalRef (jvm_env, tmp); \
+  if (cache.var == NULL) { \
+    ERROR ("java plugin: cjni_cache_init: NewGlobalRef (%s) failed.", name); \
+    return (-1); \
+  } } while (0)
+
+#define CACHE_METHOD(var,class,name,signature) do { \
+  cache.var = (*jvm_env)->GetMethodID (jvm_env, cache.class, \
+      name, signature); \
+  if (cache.var == NULL) { \
+    ERROR ("java plugin: cjni_cache_init: Cannot find the `%s' method " \
+        "with signature `%s'.", name, signature); \
+    return (-1); \
+  } } while (0)
+
+  CACHE_CLASS (c_long, "java/lang/Long");
+  CACHE_METHOD (m_long_constructor, c_long, "<init>", "(J)V");
+
+  CACHE_CLASS (c_double, "java/lang/Double");
+  CACHE_METHOD (m_double_constructor, c_double, "<init>", "(D)V");
+
+  CACHE_CLASS (c_datasource, "org/collectd/api/DataSource");
+  CACHE_METHOD (m_datasource_constructor, c_datasource, "<init>", "()V");
+  CACHE_METHOD (m_datasource_setname, c_datasource,
+      "setName", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_datasource_settype, c_datasource, "setType", "(I)V");
+  CACHE_METHOD (m_datasource_setmin, c_datasource, "setMin", "(D)V");
+  CACHE_METHOD (m_datasource_setmax, c_datasource, "setMax", "(D)V");
+
+  CACHE_CLASS (c_dataset, "org/collectd/api/DataSet");
+  CACHE_METHOD (m_dataset_constructor, c_dataset,
+      "<init>", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_dataset_adddatasource, c_dataset,
+      "addDataSource", "(Lorg/collectd/api/DataSource;)V");
+
+  CACHE_CLASS (c_valuelist, "org/collectd/api/ValueList");
+  CACHE_METHOD (m_valuelist_constructor, c_valuelist, "<init>", "()V");
+  CACHE_METHOD (m_valuelist_sethost, c_valuelist,
+      "setHost", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_valuelist_setplugin, c_valuelist,
+      "setPlugin", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_valuelist_setplugininstance, c_valuelist,
+      "setPluginInstance", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_valuelist_settype, c_valuelist,
+      "setType", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_valuelist_settypeinstance, c_valuelist,
+      "setTypeInstance", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_valuelist_settime, c_valuelist, "setTime", "(J)V");
+  CACHE_METHOD (m_valuelist_setinterval, c_valuelist, "setInterval", "(J)V");
+  CACHE_METHOD (m_valuelist_addvalue, c_valuelist,
+      "addValue", "(Ljava/lang/Number;)V");
+  CACHE_METHOD (m_valuelist_setdataset, c_valuelist,
+      "setDataSet", "(Lorg/collectd/api/DataSet;)V");
+
+  CACHE_CLASS (c_notification, "org/collectd/api/Notification");
+  CACHE_METHOD (m_notification_constructor, c_notification, "<init>", "()V");
+  CACHE_METHOD (m_notification_sethost, c_notification,
+      "setHost", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_notification_setplugin, c_notification,
+      "setPlugin", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_notification_setplugininstance, c_notification,
+      "setPluginInstance", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_notification_settype, c_notification,
+      "setType", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_notification_settypeinstance, c_notification,
+      "setTypeInstance", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_notification_setmessage, c_notification,
+      "setMessage", "(Ljava/lang/String;)V");
+  CACHE_METHOD (m_notification_settime, c_notification, "setTime", "(J)V");
+  CACHE_METHOD (m_notification_setseverity, c_notification,
+      "setSeverity", "(I)V");
+
+#undef CACHE_METHOD
+#undef CACHE_CLASS
+
+  return (0);
+} /* }}} int cjni_cache_init */
+
+/* Release the global references held by `cache' and `data_set_cache'. */
+static void cjni_cache_free (JNIEnv *jvm_env) /* {{{ */
+{
+  char *key;
+  cjni_data_set_t *entry;
+
+#define FREE_CLASS(var) do { \
+  if (cache.var != NULL) \
+    (*jvm_env)->DeleteGlobalRef (jvm_env, cache.var); \
+  } while (0)
+
+  FREE_CLASS (c_long);
+  FREE_CLASS (c_double);
+  FREE_CLASS (c_datasource);
+  FREE_CLASS (c_dataset);
+  FREE_CLASS (c_valuelist);
+  FREE_CLASS (c_notification);
+
+#undef FREE_CLASS
+
+  memset (&cache, 0, sizeof (cache));
+
+  pthread_mutex_lock (&data_set_cache_lock);
+  if (data_set_cache != NULL)
+  {
+    while (c_avl_pick (data_set_cache, (void *) &key, (void *) &entry) == 0)
+    {
+      (*jvm_env)->DeleteGlobalRef (jvm_env, entry->object);
+      sfree (key);
+      sfree (entry);
+    }
+    c_avl_destroy (data_set_cache);
+    data_set_cache = NULL;
+  }
+  pthread_mutex_unlock (&data_set_cache_lock);
+} /* }}} void cjni_cache_free */
+
 /* Create the JVM. This is called when the first thread tries to access the JVM
  * via cjni_thread_attach. */
 static int cjni_create_jvm (void) /* {{{ */
@@ -2004,6 +2083,13 @@ static int cjni_create_jvm (void) /* {{{ */
     return (-1);
   }
 
+  status = cjni_cache_init (jvm_env);
+  if (status != 0)
+  {
+    ERROR ("java plugin: cjni_create_jvm: cjni_cache_init failed.");
+    return (-1);
+  }
+
   DEBUG ("java plugin: The JVM has been created.");
   return (0);
 } /* }}} int cjni_create_jvm */
@@ -2701,6 +2787,254 @@ static int cjni_notification (const notification_t *n, /* {{{ */
   return (ret_status);
 } /* }}} int cjni_notification */
 
+/* Takes the current batch out of `wb' and returns it as a local reference, or
+ * NULL if there is nothing to send. A batch which isn't full is copied to an
+ * array of matching length, so Java doesn't see empty elements.
+ * NOTE: You must hold wb->lock when calling this function! */
+static jobjectArray cjni_write_batch_take_nolock (JNIEnv *jvm_env, /* {{{ */
+    cjni_write_batch_t *wb)
+{
+  jobjectArray o_batch;
+  jsize i;
+
+  if ((wb->batch == NULL) || (wb->batch_fill == 0))
+    return (NULL);
+
+  if (wb->batch_fill == wb->batch_size)
+  {
+    o_batch = (*jvm_env)->NewLocalRef (jvm_env, wb->batch);
+  }
+  else
+  {
+    o_batch = (*jvm_env)->NewObjectArray (jvm_env, wb->batch_fill,
+        cache.c_valuelist, /* initial element = */ NULL);
+    if (o_batch == NULL)
+    {
+      ERROR ("java plugin: cjni_write_batch_take_nolock: NewObjectArray "
+          "failed. Dropping %i value lists.", (int) wb->batch_fill);
+    }
+    else
+    {
+      for (i = 0; i < wb->batch_fill; i++)
+      {
+        jobject o_vl;
+
+        o_vl = (*jvm_env)->GetObjectArrayElement (jvm_env, wb->batch, i);
+        (*jvm_env)->SetObjectArrayElement (jvm_env, o_batch, i, o_vl);
+        (*jvm_env)->DeleteLocalRef (jvm_env, o_vl);
+      }
+    }
+  }
+
+  (*jvm_env)->DeleteGlobalRef (jvm_env, wb->batch);
+  wb->batch = NULL;
+  wb->batch_fill = 0;
+
+  return (o_batch);
+} /* }}} jobjectArray cjni_write_batch_take_nolock */
+
+/* Call the CB_TYPE_WRITE_BATCH callback with the array `o_batch'. */
+static int cjni_write_batch_send (JNIEnv *jvm_env, /* {{{ */
+    cjni_write_batch_t *wb, jobjectArray o_batch)
+{
+  int ret_status;
+
+  if (o_batch == NULL)
+    return (0);
+
+  ret_status = (*jvm_env)->CallIntMethod (jvm_env,
+      wb->cbi->object, wb->cbi->method, o_batch);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_batch);
+
+  return (ret_status);
+} /* }}} int cjni_write_batch_send */
+
+/* Add a value list to the batch of the CB_TYPE_WRITE_BATCH callback pointed to
+ * by the `user_data_t' pointer and call the callback if the batch is full or
+ * older than the interval. */
+static int cjni_write_batch (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    user_data_t *ud)
+{
+  JNIEnv *jvm_env;
+  cjni_write_batch_t *wb;
+  jobject o_vl;
+  jobjectArray o_batch;
+  cdtime_t now;
+  int status;
+  int ret_status;
+
+  if (jvm == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch: jvm == NULL");
+    return (-1);
+  }
+
+  if ((ud == NULL) || (ud->data == NULL))
+  {
+    ERROR ("java plugin: cjni_write_batch: Invalid user data.");
+    return (-1);
+  }
+
+  jvm_env = cjni_thread_attach ();
+  if (jvm_env == NULL)
+    return (-1);
+
+  wb = (cjni_write_batch_t *) ud->data;
+
+  o_vl = ctoj_value_list (jvm_env, ds, vl);
+  if (o_vl == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch: ctoj_value_list failed.");
+    cjni_thread_detach ();
+    return (-1);
+  }
+
+  now = cdtime ();
+  o_batch = NULL;
+
+  pthread_mutex_lock (&wb->lock);
+
+  if (wb->batch == NULL)
+  {
+    jobjectArray tmp;
+
+    tmp = (*jvm_env)->NewObjectArray (jvm_env, wb->batch_size,
+        cache.c_valuelist, /* initial element = */ NULL);
+    if (tmp != NULL)
+    {
+      wb->batch = (*jvm_env)->NewGlobalRef (jvm_env, tmp);
+      (*jvm_env)->DeleteLocalRef (jvm_env, tmp);
+    }
+
+    if (wb->batch == NULL)
+    {
+      pthread_mutex_unlock (&wb->lock);
+      ERROR ("java plugin: cjni_write_batch: Creating an array of %i "
+          "elements failed.", (int) wb->batch_size);
+      (*jvm_env)->DeleteLocalRef (jvm_env, o_vl);
+      cjni_thread_detach ();
+      return (-1);
+    }
+
+    wb->batch_fill = 0;
+    wb->batch_init_time = now;
+  }
+
+  (*jvm_env)->SetObjectArrayElement (jvm_env, wb->batch, wb->batch_fill, o_vl);
+  wb->batch_fill++;
+
+  if ((wb->batch_fill >= wb->batch_size)
+      || ((wb->batch_init_time + plugin_get_interval ()) <= now))
+    o_batch = cjni_write_batch_take_nolock (jvm_env, wb);
+
+  pthread_mutex_unlock (&wb->lock);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_vl);
+
+  /* Java is called without holding the lock, so other threads can keep
+   * adding values to the next batch. */
+  ret_status = cjni_write_batch_send (jvm_env, wb, o_batch);
+
+  status = cjni_thread_detach ();
+  if (status != 0)
+  {
+    ERROR ("java plugin: cjni_write_batch: cjni_thread_detach failed.");
+    return (-1);
+  }
+
+  return (ret_status);
+} /* }}} int cjni_write_batch */
+
+/* Send the pending values of a CB_TYPE_WRITE_BATCH callback. */
+static int cjni_write_batch_flush (cdtime_t timeout, /* {{{ */
+    const char *identifier __attribute__((unused)), user_data_t *ud)
+{
+  JNIEnv *jvm_env;
+  cjni_write_batch_t *wb;
+  jobjectArray o_batch;
+  int status;
+  int ret_status;
+
+  if (jvm == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch_flush: jvm == NULL");
+    return (-1);
+  }
+
+  if ((ud == NULL) || (ud->data == NULL))
+  {
+    ERROR ("java plugin: cjni_write_batch_flush: Invalid user data.");
+    return (-1);
+  }
+
+  jvm_env = cjni_thread_attach ();
+  if (jvm_env == NULL)
+    return (-1);
+
+  wb = (cjni_write_batch_t *) ud->data;
+  o_batch = NULL;
+
+  /* timeout == 0  => flush unconditionally */
+  pthread_mutex_lock (&wb->lock);
+  if ((wb->batch != NULL)
+      && ((timeout == 0) || ((wb->batch_init_time + timeout) <= cdtime ())))
+    o_batch = cjni_write_batch_take_nolock (jvm_env, wb);
+  pthread_mutex_unlock (&wb->lock);
+
+  ret_status = cjni_write_batch_send (jvm_env, wb, o_batch);
+
+  status = cjni_thread_detach ();
+  if (status != 0)
+  {
+    ERROR ("java plugin: cjni_write_batch_flush: cjni_thread_detach failed.");
+    return (-1);
+  }
+
+  return (ret_status);
+} /* }}} int cjni_write_batch_flush */
+
+/* Send the pending values of a CB_TYPE_WRITE_BATCH callback once per
+ * interval. */
+static int cjni_write_batch_read (user_data_t *ud) /* {{{ */
+{
+  return (cjni_write_batch_flush (/* timeout = */ 0,
+        /* identifier = */ NULL, ud));
+} /* }}} int cjni_write_batch_read */
+
+static void cjni_write_batch_destroy (void *arg) /* {{{ */
+{
+  cjni_write_batch_t *wb;
+
+  DEBUG ("java plugin: cjni_write_batch_destroy (arg = %p);", arg);
+
+  if (arg == NULL)
+    return;
+
+  wb = (cjni_write_batch_t *) arg;
+
+  /* When shutting down, the JVM is gone already. The pending values have been
+   * flushed before that. */
+  if ((jvm != NULL) && (wb->batch != NULL))
+  {
+    JNIEnv *jvm_env;
+
+    jvm_env = cjni_thread_attach ();
+    if (jvm_env != NULL)
+    {
+      (*jvm_env)->DeleteGlobalRef (jvm_env, wb->batch);
+      cjni_thread_detach ();
+    }
+  }
+  wb->batch = NULL;
+
+  cjni_callback_info_destroy (wb->cbi);
+  wb->cbi = NULL;
+
+  pthread_mutex_destroy (&wb->lock);
+  sfree (wb);
+} /* }}} void cjni_write_batch_destroy */
+
 /* Callbacks for matches implemented in Java */
 static int cjni_match_target_create (const oconfig_item_t *ci, /* {{{ */
     void **user_data)
@@ -2898,10 +3232,11 @@ static int cjni_match_target_invoke (const data_set_t *ds, /* {{{ */
     return (-1);
   }
 
-  o_ds = ctoj_data_set (jvm_env, ds);
+  o_ds = ctoj_data_set_cached (jvm_env, ds);
   if (o_ds == NULL)
   {
-    ERROR ("java plugin: cjni_match_target_invoke: ctoj_value_list failed.");
+    ERROR ("java plugin: cjni_match_target_invoke: ctoj_data_set_cached "
+        "failed.");
     cjni_thread_detach ();
     return (-1);
   }
@@ -2927,12 +3262,18 @@ static int cjni_match_target_invoke (const data_set_t *ds, /* {{{ */
     else /* if (status == 0) */
     {
       /* plugin_dispatch_values assures that this is dynamically allocated
-       * memory. */
+       * memory when filter chains are in use, see filter_chain.h. */
       sfree (vl->values);
 
+      /* The identifier and the meta data are not part of the Java object;
+       * keep the ones the daemon passed in. */
+      new_vl.meta = vl->meta;
+      new_vl.ident = vl->ident;
+
       /* This will replace the vl->values pointer to a new, dynamically
        * allocated piece of memory. */
       memcpy (vl, &new_vl, sizeof (*vl));
+      ident_vl_update (vl);
     }
   } /* if (cbi->type == CB_TYPE_TARGET) */
 
@@ -3047,6 +3388,8 @@ static int cjni_shutdown (void) /* {{{ */
   java_classes_list_len = 0;
   sfree (java_classes_list);
 
+  cjni_cache_free (jvm_env);
+
   /* Destroy the JVM */
   DEBUG ("java plugin: Destroying the JVM.");
   (*jvm)->DestroyJavaVM (jvm);
@@ -28,6 +28,7 @@
 
 #include "collectd.h"
 #include "filter_chain.h"
+#include "utils_match.h"
 
 #include <sys/types.h>
 #include <regex.h>
@@ -45,6 +46,8 @@ struct mr_regex_s
 {
 	regex_t re;
 	char *re_str;
+	/* Part of every matching string, see match_literal(). */
+	char literal[DATA_MAX_NAME_LEN];
 
 	mr_regex_t *next;
 };
@@ -103,9 +106,12 @@ static int mr_match_regexen (mr_regex_t *re_head, /* {{{ */
 	{
 		int status;
 
-		status = regexec (&re->re, string,
-				/* nmatch = */ 0, /* pmatch = */ NULL,
-				/* eflags = */ 0);
+		if ((re->literal[0] != 0) && (strstr (string, re->literal) == NULL))
+			status = REG_NOMATCH;
+		else
+			status = regexec (&re->re, string,
+					/* nmatch = */ 0, /* pmatch = */ NULL,
+					/* eflags = */ 0);
 		if (status == 0)
 		{
 			DEBUG ("regex match: Regular expression `%s' matches `%s'.",
@@ -123,6 +129,45 @@ static int mr_match_regexen (mr_regex_t *re_head, /* {{{ */
 	return (FC_MATCH_MATCHES);
 } /* }}} int mr_match_regexen */
 
+/* If the regular expression `re_str' only matches one exact string, e.g.
+ * "^cpu$", copies that string to `buffer' and returns zero. */
+static int mr_regex_exact (char *buffer, size_t buffer_size, /* {{{ */
+		const char *re_str)
+{
+	size_t re_len;
+	size_t i;
+	size_t j;
+
+	re_len = strlen (re_str);
+	if ((re_len < 2) || (re_str[0] != '^') || (re_str[re_len - 1] != '$'))
+		return (-1);
+
+	j = 0;
+	for (i = 1; i < re_len - 1; i++)
+	{
+		char c = re_str[i];
+
+		if (c == '\\')
+		{
+			/* Only escaped punctuation is a literal character. */
+			i++;
+			c = re_str[i];
+			if ((i >= re_len - 1) || isalnum ((int) c))
+				return (-1);
+		}
+		else if (strchr (".[]()*+?{}|^$", c) != NULL)
+			return (-1);
+
+		if (j >= buffer_size - 1)
+			return (-1);
+		buffer[j] = c;
+		j++;
+	}
+	buffer[j] = 0;
+
+	return (0);
+} /* }}} int mr_regex_exact */
+
 static int mr_config_add_regex (mr_regex_t **re_head, /* {{{ */
 		oconfig_item_t *ci)
 {
@@ -164,6 +209,7 @@ static int mr_config_add_regex (mr_regex_t **re_head, /* {{{ */
 		free (re);
 		return (-1);
 	}
+	match_literal (re->literal, sizeof (re->literal), re->re_str);
 
 	if (*re_head == NULL)
 	{
@@ -262,6 +308,37 @@ static int mr_destroy (void **user_data) /* {{{ */
 	return (0);
 } /* }}} int mr_destroy */
 
+/* Tells the filter chain which plugin and type names can match at all, so it
+ * can skip the rule for other value lists. */
+static int mr_hint (match_hint_t *hint, void **user_data) /* {{{ */
+{
+	mr_match_t *m;
+	mr_regex_t *re;
+
+	if ((user_data == NULL) || (*user_data == NULL))
+		return (-1);
+
+	m = *user_data;
+	if (m->invert)
+		return (0);
+
+	for (re = m->plugin; re != NULL; re = re->next)
+		if (mr_regex_exact (hint->plugin, sizeof (hint->plugin),
+					re->re_str) == 0)
+			break;
+	if (re == NULL)
+		hint->plugin[0] = 0;
+
+	for (re = m->type; re != NULL; re = re->next)
+		if (mr_regex_exact (hint->type, sizeof (hint->type),
+					re->re_str) == 0)
+			break;
+	if (re == NULL)
+		hint->type[0] = 0;
+
+	return (0);
+} /* }}} int mr_hint */
+
 static int mr_match (const data_set_t __attribute__((unused)) *ds, /* {{{ */
 		const value_list_t *vl,
 		notification_meta_t __attribute__((unused)) **meta,
@@ -306,6 +383,7 @@ void module_register (void)
 	mproc.create  = mr_create;
 	mproc.destroy = mr_destroy;
 	mproc.match   = mr_match;
+	mproc.hint    = mr_hint;
 	fc_register_match ("regex", mproc);
 } /* module_register */
 
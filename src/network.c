@@ -23,6 +23,7 @@
  **/
 
 #define _BSD_SOURCE /* For struct ip_mreq */
+#define _GNU_SOURCE /* For recvmmsg and sendmmsg */
 
 #include "collectd.h"
 #include "plugin.h"
@@ -32,6 +33,7 @@
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
+#include "utils_ident.h"
 
 #include "network.h"
 
@@ -117,17 +119,31 @@ struct sockent_client
 	gcry_cipher_hd_t cypher;
 	unsigned char password_hash[32];
 #endif
+#if HAVE_SENDMMSG
+	/* Plain text servers with the same address family, interface and
+	 * address type (unicast or multicast) are sent to with one system
+	 * call, using the socket of the first of them, the group leader. See
+	 * network_send_groups_init. */
+	_Bool send_group_leader;
+	_Bool send_group_member;
+#endif
 };
 
+struct receive_queue_s;
+
 struct sockent_server
 {
 	int *fd;
 	size_t fd_num;
+	/* Number of sockets opened per address; see `ReceiveThreads'. */
+	int receive_threads_num;
+	/* One queue (and dispatch thread) per `DispatchThreads'. */
+	struct receive_queue_s *queues;
+	size_t queues_num;
 #if HAVE_LIBGCRYPT
 	int security_level;
 	char *auth_file;
 	fbhash_t *userdb;
-	gcry_cipher_hd_t cypher;
 #endif
 };
 
@@ -267,11 +283,44 @@ struct receive_list_entry_s
 {
   char *data;
   int  data_len;
-  int  fd;
+  sockent_t *se;
   struct receive_list_entry_s *next;
 };
 typedef struct receive_list_entry_s receive_list_entry_t;
 
+/* Maximum number of packets received or sent with one system call. */
+#define NETWORK_BATCH_SIZE 32
+/* Maximum number of unused packet buffers kept for reuse. */
+#define RECEIVE_FREE_LIST_MAX 1024
+
+/* Each dispatch thread works off its own queue. Packets are assigned to a
+ * queue based on the sender's address, so that packets from one sender are
+ * always handled in order. */
+struct receive_queue_s
+{
+  receive_list_entry_t *head;
+  receive_list_entry_t *tail;
+  uint64_t              length;
+  pthread_mutex_t       lock;
+  pthread_cond_t        cond;
+  pthread_t             thread_id;
+  int                   thread_running;
+};
+typedef struct receive_queue_s receive_queue_t;
+
+/* Each receive thread polls its own set of sockets. If a `Listen' block has
+ * more than one receive thread, its addresses are opened once per thread using
+ * SO_REUSEPORT and the kernel distributes the packets between the sockets. */
+struct receive_thread_s
+{
+  struct pollfd *pollfd;
+  sockent_t    **sockent;
+  size_t         pollfd_num;
+  pthread_t      thread_id;
+  int            thread_running;
+};
+typedef struct receive_thread_s receive_thread_t;
+
 /*
  * Private variables
  */
@@ -283,23 +332,21 @@ static int network_config_stats = 0;
 
 static sockent_t *sending_sockets = NULL;
 
-static receive_list_entry_t *receive_list_head = NULL;
-static receive_list_entry_t *receive_list_tail = NULL;
-static pthread_mutex_t       receive_list_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t        receive_list_cond = PTHREAD_COND_INITIALIZER;
-static uint64_t              receive_list_length = 0;
-
 static sockent_t     *listen_sockets = NULL;
-static struct pollfd *listen_sockets_pollfd = NULL;
 static size_t         listen_sockets_num = 0;
 
+static receive_thread_t *receive_threads = NULL;
+static size_t            receive_threads_num = 0;
+
+/* Entries of dispatched packets are put on this list and re-used by the
+ * receive threads, so packets don't have to be allocated individually. */
+static receive_list_entry_t *receive_free_list = NULL;
+static size_t                receive_free_list_length = 0;
+static pthread_mutex_t       receive_free_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* The receive and dispatch threads will run as long as `listen_loop' is set to
  * zero. */
 static int       listen_loop = 0;
-static int       receive_thread_running = 0;
-static pthread_t receive_thread_id;
-static int       dispatch_thread_running = 0;
-static pthread_t dispatch_thread_id;
 
 /* Buffer in which to-be-sent network packets are constructed. */
 static char            *send_buffer;
@@ -309,11 +356,11 @@ static value_list_t     send_buffer_vl = VALUE_LIST_STATIC;
 static pthread_mutex_t  send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* XXX: These counters are incremented from one place only. The spot in which
- * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
- * example). Only if neither is true, the stats_lock is acquired. The counters
- * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
+ * the values are incremented is either locked by some lock (send_buffer_lock
+ * for example) or the stats_lock is acquired. Since there may be multiple
+ * receive and dispatch threads, the receive-side counters are protected by
+ * stats_lock. The counters are always read without holding a lock in the hope
+ * that writing 8 bytes to memory is an atomic operation. */
 static derive_t stats_octets_rx  = 0;
 static derive_t stats_octets_tx  = 0;
 static derive_t stats_packets_rx = 0;
@@ -426,7 +473,9 @@ static int network_dispatch_values (value_list_t *vl, /* {{{ */
     DEBUG ("network plugin: network_dispatch_values: "
 	"NOT dispatching %s.", name);
 #endif
+    pthread_mutex_lock (&stats_lock);
     stats_values_not_dispatched++;
+    pthread_mutex_unlock (&stats_lock);
     return (0);
   }
 
@@ -461,7 +510,9 @@ static int network_dispatch_values (value_list_t *vl, /* {{{ */
   }
 
   plugin_dispatch_values_secure (vl);
+  pthread_mutex_lock (&stats_lock);
   stats_values_dispatched++;
+  pthread_mutex_unlock (&stats_lock);
 
   meta_data_destroy (vl->meta);
   vl->meta = NULL;
@@ -493,6 +544,48 @@ static int network_dispatch_notification (notification_t *n) /* {{{ */
 } /* }}} int network_dispatch_notification */
 
 #if HAVE_LIBGCRYPT
+/* The cipher handle used for decrypting received packets is kept per thread,
+ * so that multiple dispatch threads can decrypt packets at the same time. The
+ * key is set for every packet anyway, so the handle isn't tied to a socket. */
+static pthread_key_t  server_cypher_key;
+static pthread_once_t server_cypher_once = PTHREAD_ONCE_INIT;
+
+static void server_cypher_destroy (void *arg) /* {{{ */
+{
+  gcry_cipher_hd_t *cypher = arg;
+
+  if (*cypher != NULL)
+    gcry_cipher_close (*cypher);
+  sfree (cypher);
+} /* }}} void server_cypher_destroy */
+
+static void server_cypher_key_create (void) /* {{{ */
+{
+  pthread_key_create (&server_cypher_key, server_cypher_destroy);
+} /* }}} void server_cypher_key_create */
+
+static gcry_cipher_hd_t *server_cypher_get (void) /* {{{ */
+{
+  gcry_cipher_hd_t *cypher;
+
+  pthread_once (&server_cypher_once, server_cypher_key_create);
+
+  cypher = pthread_getspecific (server_cypher_key);
+  if (cypher != NULL)
+    return (cypher);
+
+  cypher = malloc (sizeof (*cypher));
+  if (cypher == NULL)
+  {
+    ERROR ("network plugin: malloc failed.");
+    return (NULL);
+  }
+  *cypher = NULL;
+
+  pthread_setspecific (server_cypher_key, cypher);
+  return (cypher);
+} /* }}} gcry_cipher_hd_t *server_cypher_get */
+
 static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
     const void *iv, size_t iv_size, const char *username)
 {
@@ -510,7 +603,9 @@ static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
   {
 	  char *secret;
 
-	  cyper_ptr = &se->data.server.cypher;
+	  cyper_ptr = server_cypher_get ();
+	  if (cyper_ptr == NULL)
+		  return (NULL);
 
 	  if (username == NULL)
 		  return (NULL);
@@ -1617,11 +1712,28 @@ static void free_sockent_server (struct sockent_server *ses) /* {{{ */
   }
 
   sfree (ses->fd);
+
+  if (ses->queues != NULL)
+  {
+    for (i = 0; i < ses->queues_num; i++)
+    {
+      receive_queue_t *q = ses->queues + i;
+
+      while (q->head != NULL)
+      {
+        receive_list_entry_t *next = q->head->next;
+        sfree (q->head);
+        q->head = next;
+      }
+
+      pthread_mutex_destroy (&q->lock);
+      pthread_cond_destroy (&q->cond);
+    }
+    sfree (ses->queues);
+  }
 #if HAVE_LIBGCRYPT
   sfree (ses->auth_file);
   fbh_destroy (ses->userdb);
-  if (ses->cypher != NULL)
-    gcry_cipher_close (ses->cypher);
 #endif
 } /* }}} void free_sockent_server */
 
@@ -1817,7 +1929,8 @@ static int network_set_interface (const sockent_t *se, const struct addrinfo *ai
 	return (0);
 } /* }}} network_set_interface */
 
-static int network_bind_socket (int fd, const struct addrinfo *ai, const int interface_idx)
+static int network_bind_socket (int fd, const struct addrinfo *ai,
+		const int interface_idx, _Bool reuse_port)
 {
 #if KERNEL_SOLARIS
 	char loop   = 0;
@@ -1835,6 +1948,19 @@ static int network_bind_socket (int fd, const struct addrinfo *ai, const int int
 		return (-1);
 	}
 
+#ifdef SO_REUSEPORT
+	/* let the kernel distribute packets between multiple sockets */
+	if (reuse_port && (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT,
+				&yes, sizeof(yes)) == -1)) {
+                char errbuf[1024];
+                ERROR ("network plugin: setsockopt (reuseport): %s",
+                                sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+#else
+	assert (!reuse_port);
+#endif
+
 	DEBUG ("fd = %i; calling `bind'", fd);
 
 	if (bind (fd, ai->ai_addr, ai->ai_addrlen) == -1)
@@ -1969,6 +2095,22 @@ static int network_bind_socket (int fd, const struct addrinfo *ai, const int int
 	return (0);
 } /* int network_bind_socket */
 
+static _Bool network_addr_is_multicast (const struct sockaddr *sa) /* {{{ */
+{
+	if (sa->sa_family == AF_INET)
+	{
+		const struct sockaddr_in *addr = (const struct sockaddr_in *) sa;
+		return (IN_MULTICAST (ntohl (addr->sin_addr.s_addr)));
+	}
+	else if (sa->sa_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *addr = (const struct sockaddr_in6 *) sa;
+		return (IN6_IS_ADDR_MULTICAST (&addr->sin6_addr));
+	}
+
+	return (0);
+} /* }}} _Bool network_addr_is_multicast */
+
 /* Initialize a sockent structure. `type' must be either `SOCKENT_TYPE_CLIENT'
  * or `SOCKENT_TYPE_SERVER' */
 static int sockent_init (sockent_t *se, int type) /* {{{ */
@@ -1988,11 +2130,13 @@ static int sockent_init (sockent_t *se, int type) /* {{{ */
 	{
 		se->type = SOCKENT_TYPE_SERVER;
 		se->data.server.fd = NULL;
+		se->data.server.receive_threads_num = 1;
+		se->data.server.queues = NULL;
+		se->data.server.queues_num = 1;
 #if HAVE_LIBGCRYPT
 		se->data.server.security_level = SECURITY_LEVEL_NONE;
 		se->data.server.auth_file = NULL;
 		se->data.server.userdb = NULL;
-		se->data.server.cypher = NULL;
 #endif
 	}
 	else
@@ -2107,38 +2251,56 @@ static int sockent_open (sockent_t *se) /* {{{ */
 
 		if (se->type == SOCKENT_TYPE_SERVER) /* {{{ */
 		{
-			int *tmp;
-
-			tmp = realloc (se->data.server.fd,
-					sizeof (*tmp) * (se->data.server.fd_num + 1));
-			if (tmp == NULL)
-			{
-				ERROR ("network plugin: realloc failed.");
-				continue;
-			}
-			se->data.server.fd = tmp;
-			tmp = se->data.server.fd + se->data.server.fd_num;
+			int sockets_num = se->data.server.receive_threads_num;
+			int i;
 
-			*tmp = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
-					ai_ptr->ai_protocol);
-			if (*tmp < 0)
+			/* Every socket that joined a multicast group receives
+			 * its own copy of each packet, so open only one. */
+			if ((sockets_num > 1) && network_addr_is_multicast (ai_ptr->ai_addr))
 			{
-				char errbuf[1024];
-				ERROR ("network plugin: socket(2) failed: %s",
-						sstrerror (errno, errbuf,
-							sizeof (errbuf)));
-				continue;
+				NOTICE ("network plugin: Multicast groups "
+						"are received by one thread only, "
+						"ignoring the `ReceiveThreads' option.");
+				sockets_num = 1;
 			}
 
-			status = network_bind_socket (*tmp, ai_ptr, se->interface);
-			if (status != 0)
+			for (i = 0; i < sockets_num; i++)
 			{
-				close (*tmp);
-				*tmp = -1;
-				continue;
+				int *tmp;
+
+				tmp = realloc (se->data.server.fd,
+						sizeof (*tmp) * (se->data.server.fd_num + 1));
+				if (tmp == NULL)
+				{
+					ERROR ("network plugin: realloc failed.");
+					break;
+				}
+				se->data.server.fd = tmp;
+				tmp = se->data.server.fd + se->data.server.fd_num;
+
+				*tmp = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+						ai_ptr->ai_protocol);
+				if (*tmp < 0)
+				{
+					char errbuf[1024];
+					ERROR ("network plugin: socket(2) failed: %s",
+							sstrerror (errno, errbuf,
+								sizeof (errbuf)));
+					break;
+				}
+
+				status = network_bind_socket (*tmp, ai_ptr,
+						se->interface,
+						/* reuse_port = */ (sockets_num > 1));
+				if (status != 0)
+				{
+					close (*tmp);
+					*tmp = -1;
+					break;
+				}
+
+				se->data.server.fd_num++;
 			}
-
-			se->data.server.fd_num++;
 			continue;
 		} /* }}} if (se->type == SOCKENT_TYPE_SERVER) */
 		else /* if (se->type == SOCKENT_TYPE_CLIENT) {{{ */
@@ -2195,39 +2357,131 @@ static int sockent_open (sockent_t *se) /* {{{ */
 	return (0);
 } /* }}} int sockent_open */
 
-/* Add a sockent to the global list of sockets */
-static int sockent_add (sockent_t *se) /* {{{ */
+/* Allocate the dispatch queues of a server sockent. */
+static int sockent_init_queues (sockent_t *se) /* {{{ */
 {
-	sockent_t *last_ptr;
+	struct sockent_server *ses = &se->data.server;
+	size_t i;
 
-	if (se == NULL)
+	assert (ses->queues == NULL);
+	assert (ses->queues_num > 0);
+
+	ses->queues = calloc (ses->queues_num, sizeof (*ses->queues));
+	if (ses->queues == NULL)
+	{
+		ERROR ("network plugin: calloc failed.");
 		return (-1);
+	}
 
-	if (se->type == SOCKENT_TYPE_SERVER)
+	for (i = 0; i < ses->queues_num; i++)
 	{
-		struct pollfd *tmp;
-		size_t i;
+		receive_queue_t *q = ses->queues + i;
+
+		q->head = NULL;
+		q->tail = NULL;
+		q->length = 0;
+		pthread_mutex_init (&q->lock, /* attr = */ NULL);
+		pthread_cond_init (&q->cond, /* attr = */ NULL);
+		q->thread_running = 0;
+	}
+
+	return (0);
+} /* }}} int sockent_init_queues */
+
+/* Distribute the file descriptors of a server sockent among the receive
+ * threads. The n-th socket opened for an address goes to the n-th thread. */
+static int receive_threads_add (sockent_t *se) /* {{{ */
+{
+	struct sockent_server *ses = &se->data.server;
+	size_t threads_num;
+	size_t i;
+
+	threads_num = (size_t) ses->receive_threads_num;
+	if (threads_num > ses->fd_num)
+		threads_num = ses->fd_num;
+	if (threads_num < 1)
+		threads_num = 1;
+
+	if (receive_threads_num < threads_num)
+	{
+		receive_thread_t *tmp;
 
-		tmp = realloc (listen_sockets_pollfd,
-				sizeof (*tmp) * (listen_sockets_num
-					+ se->data.server.fd_num));
+		tmp = realloc (receive_threads, sizeof (*tmp) * threads_num);
 		if (tmp == NULL)
 		{
 			ERROR ("network plugin: realloc failed.");
 			return (-1);
 		}
-		listen_sockets_pollfd = tmp;
-		tmp = listen_sockets_pollfd + listen_sockets_num;
+		receive_threads = tmp;
+		memset (receive_threads + receive_threads_num, 0,
+				sizeof (*tmp) * (threads_num - receive_threads_num));
+		receive_threads_num = threads_num;
+	}
+
+	/* Make room for the new sockets first, so a failure doesn't leave
+	 * references to this sockent behind. */
+	for (i = 0; i < threads_num; i++)
+	{
+		receive_thread_t *rt = receive_threads + i;
+		size_t new_num = rt->pollfd_num + (ses->fd_num / threads_num) + 1;
+		struct pollfd *tmp_pollfd;
+		sockent_t **tmp_sockent;
 
-		for (i = 0; i < se->data.server.fd_num; i++)
+		tmp_pollfd = realloc (rt->pollfd, sizeof (*tmp_pollfd) * new_num);
+		if (tmp_pollfd == NULL)
 		{
-			memset (tmp + i, 0, sizeof (*tmp));
-			tmp[i].fd = se->data.server.fd[i];
-			tmp[i].events = POLLIN | POLLPRI;
-			tmp[i].revents = 0;
+			ERROR ("network plugin: realloc failed.");
+			return (-1);
 		}
+		rt->pollfd = tmp_pollfd;
+
+		tmp_sockent = realloc (rt->sockent, sizeof (*tmp_sockent) * new_num);
+		if (tmp_sockent == NULL)
+		{
+			ERROR ("network plugin: realloc failed.");
+			return (-1);
+		}
+		rt->sockent = tmp_sockent;
+	}
+
+	for (i = 0; i < ses->fd_num; i++)
+	{
+		receive_thread_t *rt = receive_threads + (i % threads_num);
+		struct pollfd *pfd = rt->pollfd + rt->pollfd_num;
+
+		memset (pfd, 0, sizeof (*pfd));
+		pfd->fd = ses->fd[i];
+		pfd->events = POLLIN | POLLPRI;
+		pfd->revents = 0;
+
+		rt->sockent[rt->pollfd_num] = se;
+		rt->pollfd_num++;
+	}
+
+	listen_sockets_num += ses->fd_num;
+
+	return (0);
+} /* }}} int receive_threads_add */
+
+/* Add a sockent to the global list of sockets */
+static int sockent_add (sockent_t *se) /* {{{ */
+{
+	sockent_t *last_ptr;
+
+	if (se == NULL)
+		return (-1);
 
-		listen_sockets_num += se->data.server.fd_num;
+	if (se->type == SOCKENT_TYPE_SERVER)
+	{
+		int status;
+
+		status = sockent_init_queues (se);
+		if (status != 0)
+			return (status);
+
+		status = receive_threads_add (se);
+		if (status != 0)
+			return (status);
 
 		if (listen_sockets == NULL)
 		{
@@ -2253,203 +2507,332 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	return (0);
 } /* }}} int sockent_add */
 
-static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
+/* Returns an entry to the free list or frees it if the list is full. */
+static void receive_entry_put (receive_list_entry_t *ent) /* {{{ */
+{
+  if (ent == NULL)
+    return;
+
+  pthread_mutex_lock (&receive_free_list_lock);
+  if (receive_free_list_length < RECEIVE_FREE_LIST_MAX)
+  {
+    ent->next = receive_free_list;
+    receive_free_list = ent;
+    receive_free_list_length++;
+    ent = NULL;
+  }
+  pthread_mutex_unlock (&receive_free_list_lock);
+
+  sfree (ent);
+} /* }}} void receive_entry_put */
+
+/* Fills `ents' with `ents_num' unused entries, taking them from the free list
+ * if possible. The packet buffer is allocated along with the entry. */
+static int receive_entries_get (receive_list_entry_t **ents, /* {{{ */
+    size_t ents_num)
 {
+  size_t i = 0;
+
+  pthread_mutex_lock (&receive_free_list_lock);
+  while ((i < ents_num) && (receive_free_list != NULL))
+  {
+    ents[i] = receive_free_list;
+    receive_free_list = receive_free_list->next;
+    receive_free_list_length--;
+    i++;
+  }
+  pthread_mutex_unlock (&receive_free_list_lock);
+
+  for (; i < ents_num; i++)
+  {
+    ents[i] = malloc (sizeof (*ents[i]) + network_config_packet_size);
+    if (ents[i] == NULL)
+    {
+      ERROR ("network plugin: malloc failed.");
+      while (i > 0)
+      {
+        i--;
+        receive_entry_put (ents[i]);
+        ents[i] = NULL;
+      }
+      return (-1);
+    }
+    ents[i]->data = (char *) (ents[i] + 1);
+  }
+
+  for (i = 0; i < ents_num; i++)
+  {
+    ents[i]->data_len = 0;
+    ents[i]->se = NULL;
+    ents[i]->next = NULL;
+  }
+
+  return (0);
+} /* }}} int receive_entries_get */
+
+static void *dispatch_thread (void *arg) /* {{{ */
+{
+  receive_queue_t *q = arg;
+
   while (42)
   {
     receive_list_entry_t *ent;
-    sockent_t *se;
 
     /* Lock and wait for more data to come in */
-    pthread_mutex_lock (&receive_list_lock);
+    pthread_mutex_lock (&q->lock);
     while ((listen_loop == 0)
-        && (receive_list_head == NULL))
-      pthread_cond_wait (&receive_list_cond, &receive_list_lock);
+        && (q->head == NULL))
+      pthread_cond_wait (&q->cond, &q->lock);
 
     /* Remove the head entry and unlock */
-    ent = receive_list_head;
+    ent = q->head;
     if (ent != NULL)
-      receive_list_head = ent->next;
-    receive_list_length--;
-    pthread_mutex_unlock (&receive_list_lock);
+    {
+      q->head = ent->next;
+      if (q->head == NULL)
+        q->tail = NULL;
+      q->length--;
+    }
+    pthread_mutex_unlock (&q->lock);
 
     /* Check whether we are supposed to exit. We do NOT check `listen_loop'
      * because we dispatch all missing packets before shutting down. */
     if (ent == NULL)
       break;
 
-    /* Look for the correct `sockent_t' */
-    se = listen_sockets;
-    while (se != NULL)
-    {
-      size_t i;
-
-      for (i = 0; i < se->data.server.fd_num; i++)
-        if (se->data.server.fd[i] == ent->fd)
-          break;
-
-      if (i < se->data.server.fd_num)
-        break;
-
-      se = se->next;
-    }
-
-    if (se == NULL)
-    {
-      ERROR ("network plugin: Got packet from FD %i, but can't "
-          "find an appropriate socket entry.",
-          ent->fd);
-      sfree (ent->data);
-      sfree (ent);
-      continue;
-    }
-
-    parse_packet (se, ent->data, ent->data_len, /* flags = */ 0,
+    parse_packet (ent->se, ent->data, ent->data_len, /* flags = */ 0,
 	/* username = */ NULL);
-    sfree (ent->data);
-    sfree (ent);
+    receive_entry_put (ent);
   } /* while (42) */
 
   return (NULL);
 } /* }}} void *dispatch_thread */
 
-static int network_receive (void) /* {{{ */
+/* Hashes the sender's address. This is used to select the dispatch queue, so
+ * all packets of one sender are handled by the same dispatch thread. */
+static uint32_t network_addr_hash (const struct sockaddr_storage *ss) /* {{{ */
 {
-	char buffer[network_config_packet_size];
-	int  buffer_len;
+	const unsigned char *ptr;
+	size_t ptr_len;
+	uint16_t port;
+	uint32_t hash = 2166136261U;
+	size_t i;
 
-	int i;
+	if (ss->ss_family == AF_INET)
+	{
+		const struct sockaddr_in *sa = (const struct sockaddr_in *) ss;
+		ptr = (const unsigned char *) &sa->sin_addr;
+		ptr_len = sizeof (sa->sin_addr);
+		port = sa->sin_port;
+	}
+	else if (ss->ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *sa = (const struct sockaddr_in6 *) ss;
+		ptr = (const unsigned char *) &sa->sin6_addr;
+		ptr_len = sizeof (sa->sin6_addr);
+		port = sa->sin6_port;
+	}
+	else
+	{
+		return (0);
+	}
+
+	/* FNV-1a */
+	for (i = 0; i < ptr_len; i++)
+	{
+		hash ^= (uint32_t) ptr[i];
+		hash *= 16777619U;
+	}
+	hash ^= (uint32_t) port;
+	hash *= 16777619U;
+
+	return (hash);
+} /* }}} uint32_t network_addr_hash */
+
+/* Receives up to `ents_num' packets from `fd' into the buffers of `ents' and
+ * stores the senders' addresses in `addrs'. Returns the number of packets
+ * received, zero if no packet was available or less than zero on error. */
+static int network_recv_batch (int fd, receive_list_entry_t **ents, /* {{{ */
+		struct sockaddr_storage *addrs, int ents_num)
+{
+#if HAVE_RECVMMSG
+	struct mmsghdr msgs[NETWORK_BATCH_SIZE];
+	struct iovec   iovs[NETWORK_BATCH_SIZE];
 	int status;
+	int i;
+
+	assert (ents_num <= NETWORK_BATCH_SIZE);
+
+	memset (msgs, 0, sizeof (msgs));
+	for (i = 0; i < ents_num; i++)
+	{
+		iovs[i].iov_base = ents[i]->data;
+		iovs[i].iov_len = network_config_packet_size;
+
+		msgs[i].msg_hdr.msg_name = addrs + i;
+		msgs[i].msg_hdr.msg_namelen = sizeof (addrs[i]);
+		msgs[i].msg_hdr.msg_iov = iovs + i;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* poll(2) told us there's at least one packet; don't block waiting
+	 * for the batch to fill up. */
+	status = recvmmsg (fd, msgs, (unsigned int) ents_num, MSG_DONTWAIT,
+			/* timeout = */ NULL);
+	if (status < 0)
+	{
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+				|| (errno == EINTR))
+			return (0);
+		return (-1);
+	}
+
+	for (i = 0; i < status; i++)
+		ents[i]->data_len = (int) msgs[i].msg_len;
+
+	return (status);
+#else /* if !HAVE_RECVMMSG */
+	socklen_t addrlen = sizeof (addrs[0]);
+	ssize_t status;
+
+	assert (ents_num >= 1);
+
+	status = recvfrom (fd, ents[0]->data, network_config_packet_size,
+			0 /* no flags */,
+			(struct sockaddr *) addrs, &addrlen);
+	if (status < 0)
+	{
+		if (errno == EINTR)
+			return (0);
+		return (-1);
+	}
+
+	ents[0]->data_len = (int) status;
+	return (1);
+#endif /* !HAVE_RECVMMSG */
+} /* }}} int network_recv_batch */
 
-	receive_list_entry_t *private_list_head;
-	receive_list_entry_t *private_list_tail;
-	uint64_t              private_list_length;
+static int network_receive (receive_thread_t *rt) /* {{{ */
+{
+	receive_list_entry_t *ents[NETWORK_BATCH_SIZE];
+	struct sockaddr_storage addrs[NETWORK_BATCH_SIZE];
+
+	size_t i;
+	int status = 0;
 
-        assert (listen_sockets_num > 0);
+	assert (rt->pollfd_num > 0);
 
-	private_list_head = NULL;
-	private_list_tail = NULL;
-	private_list_length = 0;
+	/* Keep a full batch of unused entries around, so the packets can be
+	 * received directly into their final buffers. */
+	if (receive_entries_get (ents, NETWORK_BATCH_SIZE) != 0)
+		return (-1);
 
 	while (listen_loop == 0)
 	{
-		status = poll (listen_sockets_pollfd, listen_sockets_num, -1);
+		derive_t octets_rx = 0;
+		derive_t packets_rx = 0;
+
+		status = poll (rt->pollfd, rt->pollfd_num, -1);
 
 		if (status <= 0)
 		{
 			char errbuf[1024];
 			if (errno == EINTR)
+			{
+				status = 0;
 				continue;
+			}
 			ERROR ("poll failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			return (-1);
+			status = -1;
+			break;
 		}
 
-		for (i = 0; (i < listen_sockets_num) && (status > 0); i++)
+		for (i = 0; (i < rt->pollfd_num) && (status > 0); i++)
 		{
-			receive_list_entry_t *ent;
+			sockent_t *se;
+			int packets_num;
+			int j;
 
-			if ((listen_sockets_pollfd[i].revents
+			if ((rt->pollfd[i].revents
 						& (POLLIN | POLLPRI)) == 0)
 				continue;
 			status--;
 
-			buffer_len = recv (listen_sockets_pollfd[i].fd,
-					buffer, sizeof (buffer),
-					0 /* no flags */);
-			if (buffer_len < 0)
+			packets_num = network_recv_batch (rt->pollfd[i].fd,
+					ents, addrs, NETWORK_BATCH_SIZE);
+			if (packets_num < 0)
 			{
 				char errbuf[1024];
 				ERROR ("recv failed: %s",
 						sstrerror (errno, errbuf,
 							sizeof (errbuf)));
-				return (-1);
+				status = -1;
+				break;
 			}
 
-			stats_octets_rx += ((uint64_t) buffer_len);
-			stats_packets_rx++;
-
-			/* TODO: Possible performance enhancement: Do not free
-			 * these entries in the dispatch thread but put them in
-			 * another list, so we don't have to allocate more and
-			 * more of these structures. */
-			ent = malloc (sizeof (receive_list_entry_t));
-			if (ent == NULL)
-			{
-				ERROR ("network plugin: malloc failed.");
-				return (-1);
-			}
-			memset (ent, 0, sizeof (receive_list_entry_t));
-			ent->data = malloc (network_config_packet_size);
-			if (ent->data == NULL)
+			se = rt->sockent[i];
+			for (j = 0; j < packets_num; j++)
 			{
-				sfree (ent);
-				ERROR ("network plugin: malloc failed.");
-				return (-1);
-			}
-			ent->fd = listen_sockets_pollfd[i].fd;
-			ent->next = NULL;
+				receive_list_entry_t *ent = ents[j];
+				receive_queue_t *q;
 
-			memcpy (ent->data, buffer, buffer_len);
-			ent->data_len = buffer_len;
+				octets_rx += ((derive_t) ent->data_len);
+				packets_rx++;
 
-			if (private_list_head == NULL)
-				private_list_head = ent;
-			else
-				private_list_tail->next = ent;
-			private_list_tail = ent;
-			private_list_length++;
+				ent->se = se;
+				ent->next = NULL;
 
-			/* Do not block here. Blocking here has led to
-			 * insufficient performance in the past. */
-			if (pthread_mutex_trylock (&receive_list_lock) == 0)
-			{
-				assert (((receive_list_head == NULL) && (receive_list_length == 0))
-						|| ((receive_list_head != NULL) && (receive_list_length != 0)));
+				q = se->data.server.queues;
+				if (se->data.server.queues_num > 1)
+					q += network_addr_hash (addrs + j)
+						% se->data.server.queues_num;
 
-				if (receive_list_head == NULL)
-					receive_list_head = private_list_head;
+				/* Each dispatch thread has its own queue, so
+				 * there is little contention on this lock. */
+				pthread_mutex_lock (&q->lock);
+				if (q->head == NULL)
+					q->head = ent;
 				else
-					receive_list_tail->next = private_list_head;
-				receive_list_tail = private_list_tail;
-				receive_list_length += private_list_length;
+					q->tail->next = ent;
+				q->tail = ent;
+				q->length++;
+				pthread_cond_signal (&q->cond);
+				pthread_mutex_unlock (&q->lock);
 
-				pthread_cond_signal (&receive_list_cond);
-				pthread_mutex_unlock (&receive_list_lock);
+				ents[j] = NULL;
+			}
 
-				private_list_head = NULL;
-				private_list_tail = NULL;
-				private_list_length = 0;
+			if ((packets_num > 0)
+					&& (receive_entries_get (ents,
+							(size_t) packets_num) != 0))
+			{
+				/* The remaining entries can't be used in
+				 * a batch anymore. */
+				for (j = packets_num; j < NETWORK_BATCH_SIZE; j++)
+					receive_entry_put (ents[j]);
+				return (-1);
 			}
-		} /* for (listen_sockets_pollfd) */
-	} /* while (listen_loop == 0) */
+		} /* for (rt->pollfd) */
 
-	/* Make sure everything is dispatched before exiting. */
-	if (private_list_head != NULL)
-	{
-		pthread_mutex_lock (&receive_list_lock);
+		pthread_mutex_lock (&stats_lock);
+		stats_octets_rx += octets_rx;
+		stats_packets_rx += packets_rx;
+		pthread_mutex_unlock (&stats_lock);
 
-		if (receive_list_head == NULL)
-			receive_list_head = private_list_head;
-		else
-			receive_list_tail->next = private_list_head;
-		receive_list_tail = private_list_tail;
-		receive_list_length += private_list_length;
+		if (status < 0)
+			break;
+	} /* while (listen_loop == 0) */
 
-		private_list_head = NULL;
-		private_list_tail = NULL;
-		private_list_length = 0;
+	for (i = 0; i < NETWORK_BATCH_SIZE; i++)
+		receive_entry_put (ents[i]);
 
-		pthread_cond_signal (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
-	}
-
-	return (0);
+	return ((status < 0) ? -1 : 0);
 } /* }}} int network_receive */
 
-static void *receive_thread (void __attribute__((unused)) *arg)
+static void *receive_thread (void *arg)
 {
-	return (network_receive () ? (void *) 1 : (void *) 0);
+	return (network_receive (arg) ? (void *) 1 : (void *) 0);
 } /* void *receive_thread */
 
 static void network_init_buffer (void)
@@ -2461,11 +2844,145 @@ static void network_init_buffer (void)
 	memset (&send_buffer_vl, 0, sizeof (send_buffer_vl));
 } /* int network_init_buffer */
 
+#if HAVE_SENDMMSG
+static _Bool network_send_is_plain (const sockent_t *se) /* {{{ */
+{
+#if HAVE_LIBGCRYPT
+	return (se->data.client.security_level == SECURITY_LEVEL_NONE);
+#else
+	return (1);
+#endif
+} /* }}} _Bool network_send_is_plain */
+
+/* Returns true if `a' and `b' can be sent to using the same socket. Their
+ * sockets only differ in the destination address then: network_set_ttl and
+ * network_set_interface configure a socket depending on the address family
+ * and on whether the destination is a multicast group. The TTL itself is a
+ * global option and the same for all servers. */
+static _Bool network_send_group_match (const sockent_t *a, /* {{{ */
+		const sockent_t *b)
+{
+	return (network_send_is_plain (a) && network_send_is_plain (b)
+			&& (a->interface == b->interface)
+			&& (a->data.client.addr->ss_family
+				== b->data.client.addr->ss_family)
+			&& (network_addr_is_multicast (
+					(struct sockaddr *) a->data.client.addr)
+				== network_addr_is_multicast (
+					(struct sockaddr *) b->data.client.addr)));
+} /* }}} _Bool network_send_group_match */
+
+/* Determine which servers are sent to using the socket of another server. */
+static void network_send_groups_init (void) /* {{{ */
+{
+	sockent_t *se;
+
+	for (se = sending_sockets; se != NULL; se = se->next)
+	{
+		sockent_t *other;
+
+		if (se->data.client.send_group_member
+				|| !network_send_is_plain (se))
+			continue;
+
+		for (other = se->next; other != NULL; other = other->next)
+		{
+			if (other->data.client.send_group_member
+					|| !network_send_group_match (se, other))
+				continue;
+
+			se->data.client.send_group_leader = 1;
+			other->data.client.send_group_member = 1;
+		}
+	}
+} /* }}} void network_send_groups_init */
+
+static void network_sendmmsg (int fd, /* {{{ */
+		struct mmsghdr *msgs, unsigned int msgs_num)
+{
+	unsigned int offset = 0;
+
+	while (offset < msgs_num)
+	{
+		int status;
+
+		status = sendmmsg (fd, msgs + offset, msgs_num - offset,
+				/* flags = */ 0);
+		if (status < 0)
+		{
+			char errbuf[1024];
+			if (errno == EINTR)
+				continue;
+			ERROR ("network plugin: sendmmsg failed: %s",
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			/* Skip the message that failed and go on with the
+			 * other servers. */
+			offset++;
+			continue;
+		}
+
+		offset += (unsigned int) status;
+	}
+} /* }}} void network_sendmmsg */
+
+/* Sends `buffer' to the group leader `se' and all the members of its group. */
+static void network_send_buffer_group (const sockent_t *se, /* {{{ */
+		const char *buffer, size_t buffer_size)
+{
+	struct mmsghdr msgs[NETWORK_BATCH_SIZE];
+	struct iovec iov;
+	const sockent_t *other;
+	unsigned int msgs_num = 0;
+
+	iov.iov_base = (void *) buffer;
+	iov.iov_len = buffer_size;
+
+	for (other = se; other != NULL; other = other->next)
+	{
+		struct msghdr *hdr;
+
+		if ((other != se) && (!other->data.client.send_group_member
+					|| !network_send_group_match (se, other)))
+			continue;
+
+		memset (msgs + msgs_num, 0, sizeof (msgs[msgs_num]));
+		hdr = &msgs[msgs_num].msg_hdr;
+		hdr->msg_name = other->data.client.addr;
+		hdr->msg_namelen = other->data.client.addrlen;
+		hdr->msg_iov = &iov;
+		hdr->msg_iovlen = 1;
+		msgs_num++;
+
+		if (msgs_num >= NETWORK_BATCH_SIZE)
+		{
+			network_sendmmsg (se->data.client.fd, msgs, msgs_num);
+			msgs_num = 0;
+		}
+	}
+
+	if (msgs_num > 0)
+		network_sendmmsg (se->data.client.fd, msgs, msgs_num);
+} /* }}} void network_send_buffer_group */
+#endif /* HAVE_SENDMMSG */
+
 static void networt_send_buffer_plain (const sockent_t *se, /* {{{ */
 		const char *buffer, size_t buffer_size)
 {
 	int status;
 
+#if HAVE_SENDMMSG
+	/* The buffer has been sent using the group leader's socket. */
+	if (se->data.client.send_group_member)
+		return;
+
+	if (se->data.client.send_group_leader)
+	{
+		network_send_buffer_group (se, buffer, buffer_size);
+		return;
+	}
+#endif
+
 	while (42)
 	{
 		status = sendto (se->data.client.fd, buffer, buffer_size,
@@ -2762,11 +3279,10 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 	if (!check_send_okay (vl))
 	{
 #if COLLECT_DEBUG
-	  char name[6*DATA_MAX_NAME_LEN];
-	  FORMAT_VL (name, sizeof (name), vl);
-	  name[sizeof (name) - 1] = 0;
+	  char buffer[6*DATA_MAX_NAME_LEN];
+	  const char *name = ident_vl_name (vl, buffer, sizeof (buffer));
 	  DEBUG ("network plugin: network_write: "
-	      "NOT sending %s.", name);
+	      "NOT sending %s.", (name != NULL) ? name : vl->type);
 #endif
 	  /* Counter is not protected by another lock and may be reached by
 	   * multiple threads */
@@ -2902,6 +3418,27 @@ static int network_config_set_interface (const oconfig_item_t *ci, /* {{{ */
   return (0);
 } /* }}} int network_config_set_interface */
 
+static int network_config_set_threads (const oconfig_item_t *ci, /* {{{ */
+    int *ret_value)
+{
+  int tmp = 0;
+  int status;
+
+  status = cf_util_get_int (ci, &tmp);
+  if (status != 0)
+    return (status);
+
+  if (tmp < 1)
+  {
+    WARNING ("network plugin: The `%s' config option needs a positive "
+        "number.", ci->key);
+    return (-1);
+  }
+
+  *ret_value = tmp;
+  return (0);
+} /* }}} int network_config_set_threads */
+
 static int network_config_set_buffer_size (const oconfig_item_t *ci) /* {{{ */
 {
   int tmp;
@@ -2977,6 +3514,7 @@ static int network_config_set_security_level (oconfig_item_t *ci, /* {{{ */
 static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
 {
   sockent_t *se;
+  int dispatch_threads = 1;
   int status;
   int i;
 
@@ -3016,6 +3554,11 @@ static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
     if (strcasecmp ("Interface", child->key) == 0)
       network_config_set_interface (child,
           &se->interface);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+      network_config_set_threads (child,
+          &se->data.server.receive_threads_num);
+    else if (strcasecmp ("DispatchThreads", child->key) == 0)
+      network_config_set_threads (child, &dispatch_threads);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3023,6 +3566,17 @@ static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
     }
   }
 
+  se->data.server.queues_num = (size_t) dispatch_threads;
+
+#ifndef SO_REUSEPORT
+  if (se->data.server.receive_threads_num > 1)
+  {
+    WARNING ("network plugin: SO_REUSEPORT is not available on this system. "
+        "Using one receive thread only.");
+    se->data.server.receive_threads_num = 1;
+  }
+#endif
+
 #if HAVE_LIBGCRYPT
   if ((se->data.server.security_level > SECURITY_LEVEL_NONE)
       && (se->data.server.auth_file == NULL))
@@ -3243,30 +3797,65 @@ static int network_notification (const notification_t *n,
 
 static int network_shutdown (void)
 {
+	sockent_t *se;
+	size_t i;
+
 	listen_loop++;
 
-	/* Kill the listening thread */
-	if (receive_thread_running != 0)
+	/* Kill the listening threads */
+	for (i = 0; i < receive_threads_num; i++)
 	{
+		receive_thread_t *rt = receive_threads + i;
+
+		if (rt->thread_running == 0)
+			continue;
+
 		INFO ("network plugin: Stopping receive thread.");
-		pthread_kill (receive_thread_id, SIGTERM);
-		pthread_join (receive_thread_id, NULL /* no return value */);
-		memset (&receive_thread_id, 0, sizeof (receive_thread_id));
-		receive_thread_running = 0;
+		pthread_kill (rt->thread_id, SIGTERM);
+		pthread_join (rt->thread_id, NULL /* no return value */);
+		memset (&rt->thread_id, 0, sizeof (rt->thread_id));
+		rt->thread_running = 0;
 	}
 
-	/* Shutdown the dispatching thread */
-	if (dispatch_thread_running != 0)
+	/* Shutdown the dispatching threads. They process all queued packets
+	 * before exiting. */
+	for (se = listen_sockets; se != NULL; se = se->next)
 	{
-		INFO ("network plugin: Stopping dispatch thread.");
-		pthread_mutex_lock (&receive_list_lock);
-		pthread_cond_broadcast (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
-		pthread_join (dispatch_thread_id, /* ret = */ NULL);
-		dispatch_thread_running = 0;
+		for (i = 0; i < se->data.server.queues_num; i++)
+		{
+			receive_queue_t *q = se->data.server.queues + i;
+
+			if (q->thread_running == 0)
+				continue;
+
+			INFO ("network plugin: Stopping dispatch thread.");
+			pthread_mutex_lock (&q->lock);
+			pthread_cond_broadcast (&q->cond);
+			pthread_mutex_unlock (&q->lock);
+			pthread_join (q->thread_id, /* ret = */ NULL);
+			q->thread_running = 0;
+		}
 	}
 
 	sockent_destroy (listen_sockets);
+	listen_sockets = NULL;
+
+	for (i = 0; i < receive_threads_num; i++)
+	{
+		sfree (receive_threads[i].pollfd);
+		sfree (receive_threads[i].sockent);
+	}
+	sfree (receive_threads);
+	receive_threads_num = 0;
+	listen_sockets_num = 0;
+
+	while (receive_free_list != NULL)
+	{
+		receive_list_entry_t *next = receive_free_list->next;
+		sfree (receive_free_list);
+		receive_free_list = next;
+	}
+	receive_free_list_length = 0;
 
 	if (send_buffer_fill > 0)
 		flush_buffer ();
@@ -3296,6 +3885,7 @@ static int network_stats_read (void) /* {{{ */
 	derive_t copy_receive_list_length;
 	value_list_t vl = VALUE_LIST_INIT;
 	value_t values[2];
+	sockent_t *se;
 
 	copy_octets_rx = stats_octets_rx;
 	copy_octets_tx = stats_octets_tx;
@@ -3305,7 +3895,15 @@ static int network_stats_read (void) /* {{{ */
 	copy_values_not_dispatched = stats_values_not_dispatched;
 	copy_values_sent = stats_values_sent;
 	copy_values_not_sent = stats_values_not_sent;
-	copy_receive_list_length = receive_list_length;
+	copy_receive_list_length = 0;
+	for (se = listen_sockets; se != NULL; se = se->next)
+	{
+		size_t i;
+
+		for (i = 0; i < se->data.server.queues_num; i++)
+			copy_receive_list_length +=
+				(derive_t) se->data.server.queues[i].length;
+	}
 
 	/* Initialize `vl' */
 	vl.values = values;
@@ -3362,6 +3960,8 @@ static int network_stats_read (void) /* {{{ */
 static int network_init (void)
 {
 	static _Bool have_init = 0;
+	sockent_t *se;
+	size_t i;
 
 	/* Check if we were already initialized. If so, just return - there's
 	 * nothing more to do (for now, that is). */
@@ -3399,6 +3999,9 @@ static int network_init (void)
 	/* setup socket(s) and so on */
 	if (sending_sockets != NULL)
 	{
+#if HAVE_SENDMMSG
+		network_send_groups_init ();
+#endif
 		plugin_register_write ("network", network_write,
 				/* user_data = */ NULL);
 		plugin_register_notification ("network", network_notification,
@@ -3406,38 +4009,43 @@ static int network_init (void)
 	}
 
 	/* If no threads need to be started, return here. */
-	if ((listen_sockets_num == 0)
-			|| ((dispatch_thread_running != 0)
-				&& (receive_thread_running != 0)))
+	if (listen_sockets_num == 0)
 		return (0);
 
-	if (dispatch_thread_running == 0)
+	for (se = listen_sockets; se != NULL; se = se->next)
 	{
-		int status;
-		status = plugin_thread_create (&dispatch_thread_id,
-				NULL /* no attributes */,
-				dispatch_thread,
-				NULL /* no argument */);
-		if (status != 0)
-		{
-			char errbuf[1024];
-			ERROR ("network: pthread_create failed: %s",
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-		}
-		else
+		for (i = 0; i < se->data.server.queues_num; i++)
 		{
-			dispatch_thread_running = 1;
+			receive_queue_t *q = se->data.server.queues + i;
+			int status;
+
+			status = plugin_thread_create (&q->thread_id,
+					NULL /* no attributes */,
+					dispatch_thread,
+					q /* receive queue */);
+			if (status != 0)
+			{
+				char errbuf[1024];
+				ERROR ("network: pthread_create failed: %s",
+						sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+			}
+			else
+			{
+				q->thread_running = 1;
+			}
 		}
 	}
 
-	if (receive_thread_running == 0)
+	for (i = 0; i < receive_threads_num; i++)
 	{
+		receive_thread_t *rt = receive_threads + i;
 		int status;
-		status = plugin_thread_create (&receive_thread_id,
+
+		status = plugin_thread_create (&rt->thread_id,
 				NULL /* no attributes */,
 				receive_thread,
-				NULL /* no argument */);
+				rt /* receive thread */);
 		if (status != 0)
 		{
 			char errbuf[1024];
@@ -3447,7 +4055,7 @@ static int network_init (void)
 		}
 		else
 		{
-			receive_thread_running = 1;
+			rt->thread_running = 1;
 		}
 	}
 
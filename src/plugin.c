@@ -36,6 +36,7 @@
 #include "utils_llist.h"
 #include "utils_heap.h"
 #include "utils_cache.h"
+#include "utils_ident.h"
 #include "filter_chain.h"
 
 /*
@@ -69,6 +70,41 @@ struct read_func_s
 };
 typedef struct read_func_s read_func_t;
 
+/* Each read thread has its own heap of read functions, so the threads don't
+ * contend for a single lock. A thread that has nothing to do takes overdue
+ * read functions from threads which are busy running a callback. */
+struct read_thread_s
+{
+	pthread_t thread;
+	c_heap_t *heap;
+	/* Number of read functions owned by this thread, including the one
+	 * being read. */
+	int entries_num;
+	_Bool busy;
+	/* Set while the thread looks for work or waits for some. */
+	_Bool idle;
+	/* Set by a thread which became busy with read functions pending, so the
+	 * idle thread re-evaluates when it has to wake up. */
+	_Bool wakeup;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+typedef struct read_thread_s read_thread_t;
+
+/* Number of values stored in a write queue element itself. Value lists with
+ * more values than this need an extra allocation. */
+#define WRITE_QUEUE_VALUES_NUM 8
+
+struct write_queue_s;
+typedef struct write_queue_s write_queue_t;
+struct write_queue_s
+{
+	value_list_t vl;
+	value_t values[WRITE_QUEUE_VALUES_NUM];
+	plugin_ctx_t ctx;
+	write_queue_t *next;
+};
+
 /*
  * Private variables
  */
@@ -85,22 +121,60 @@ static fc_chain_t *post_cache_chain = NULL;
 
 static c_avl_tree_t *data_sets;
 
+/* Open addressing hash table indexing the data sets in `data_sets' by the
+ * hash of their type name, so dispatching a value list doesn't need to walk
+ * the tree. Rebuilt whenever a data set is (un)registered. Plugins may
+ * register data sets while other threads dispatch values, so the tree and the
+ * table are protected by `data_sets_lock'. */
+typedef struct data_set_entry_s
+{
+	uint32_t hash;
+	data_set_t *ds;
+} data_set_entry_t;
+static data_set_entry_t *data_sets_hash = NULL;
+static size_t            data_sets_hash_size = 0;
+static pthread_rwlock_t  data_sets_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 static char *plugindir = NULL;
 
+/* Read functions registered before the read threads are started are kept in
+ * `read_heap'. Starting the threads distributes them. */
 static c_heap_t       *read_heap = NULL;
 static llist_t        *read_list;
 static int             read_loop = 1;
 static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  read_cond = PTHREAD_COND_INITIALIZER;
-static pthread_t      *read_threads = NULL;
+static read_thread_t  *read_threads = NULL;
 static int             read_threads_num = 0;
 
+static write_queue_t  *write_queue_head;
+static write_queue_t  *write_queue_tail;
+static long            write_queue_length = 0;
+static _Bool           write_loop = 1;
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  write_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t      *write_threads = NULL;
+static int             write_threads_num = 0;
+
+/* Queue elements are recycled so that dispatching a value list doesn't need
+ * to allocate memory in the steady state. At most WRITE_FREE_MAX elements
+ * are kept around after a burst. */
+#define WRITE_FREE_MAX 1024
+static write_queue_t  *write_free_head = NULL;
+static int             write_free_num = 0;
+static pthread_mutex_t write_free_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long            write_limit_high = 0;
+static long            write_limit_low = 0;
+
 static pthread_key_t   plugin_ctx_key;
 static _Bool           plugin_ctx_key_initialized = 0;
 
 /*
  * Static functions
  */
+static int plugin_dispatch_values_internal (value_list_t *vl);
+static int plugin_compare_read_func (const void *arg0, const void *arg1);
+
 static const char *plugin_get_dir (void)
 {
 	if (plugindir == NULL)
@@ -341,212 +415,425 @@ static int plugin_load_file (char *file, uint32_t flags)
 	return (0);
 }
 
-static _Bool timeout_reached(struct timespec timeout)
+static cdtime_t read_func_next (const read_func_t *rf) /* {{{ */
 {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	return (now.tv_sec >= timeout.tv_sec && now.tv_usec >= (timeout.tv_nsec / 1000));
-}
+	return (TIMESPEC_TO_CDTIME_T (&rf->rf_next_read));
+} /* }}} cdtime_t read_func_next */
 
-static void *plugin_read_thread (void __attribute__((unused)) *args)
+/* Calls the read function and calculates the time of the next read.
+ * Returns the type of `rf' as seen before calling it. */
+static int plugin_read_func_call (read_func_t *rf) /* {{{ */
 {
-	while (read_loop != 0)
+	plugin_ctx_t old_ctx;
+	cdtime_t now;
+	int status;
+	int rf_type;
+
+	if ((rf->rf_interval.tv_sec == 0) && (rf->rf_interval.tv_nsec == 0))
 	{
-		read_func_t *rf;
-		plugin_ctx_t old_ctx;
-		cdtime_t now;
-		int status;
-		int rf_type;
-		int rc;
+		/* this should not happen, because the interval is set
+		 * for each plugin when loading it
+		 * XXX: issue a warning? */
+		now = cdtime ();
 
-		/* Get the read function that needs to be read next.
-		 * We don't need to hold "read_lock" for the heap, but we need
-		 * to call c_heap_get_root() and pthread_cond_wait() in the
-		 * same protected block. */
-		pthread_mutex_lock (&read_lock);
-		rf = c_heap_get_root (read_heap);
-		if (rf == NULL)
+		CDTIME_T_TO_TIMESPEC (plugin_get_interval (), &rf->rf_interval);
+
+		rf->rf_effective_interval = rf->rf_interval;
+
+		CDTIME_T_TO_TIMESPEC (now, &rf->rf_next_read);
+	}
+
+	/* Must hold `read_lock' when accessing `rf->rf_type'. */
+	pthread_mutex_lock (&read_lock);
+	rf_type = rf->rf_type;
+	pthread_mutex_unlock (&read_lock);
+
+	/* The entry has been marked for deletion. The linked list
+	 * entry has already been removed by `plugin_unregister_read'.
+	 * The caller has to free the `read_func_t'. */
+	if (rf_type == RF_REMOVE)
+		return (rf_type);
+
+	DEBUG ("plugin_read_thread: Handling `%s'.", rf->rf_name);
+
+	old_ctx = plugin_set_ctx (rf->rf_ctx);
+
+	if (rf_type == RF_SIMPLE)
+	{
+		int (*callback) (void);
+
+		callback = rf->rf_callback;
+		status = (*callback) ();
+	}
+	else
+	{
+		plugin_read_cb callback;
+
+		assert (rf_type == RF_COMPLEX);
+
+		callback = rf->rf_callback;
+		status = (*callback) (&rf->rf_udata);
+	}
+
+	plugin_set_ctx (old_ctx);
+
+	/* If the function signals failure, we will increase the
+	 * intervals in which it will be called. */
+	if (status != 0)
+	{
+		rf->rf_effective_interval.tv_sec *= 2;
+		rf->rf_effective_interval.tv_nsec *= 2;
+		NORMALIZE_TIMESPEC (rf->rf_effective_interval);
+
+		if (rf->rf_effective_interval.tv_sec >= 86400)
 		{
-			pthread_cond_wait (&read_cond, &read_lock);
-                        pthread_mutex_unlock (&read_lock);
-			continue;
+			rf->rf_effective_interval.tv_sec = 86400;
+			rf->rf_effective_interval.tv_nsec = 0;
 		}
-		pthread_mutex_unlock (&read_lock);
 
-		if ((rf->rf_interval.tv_sec == 0) && (rf->rf_interval.tv_nsec == 0))
-		{
-			/* this should not happen, because the interval is set
-			 * for each plugin when loading it
-			 * XXX: issue a warning? */
-			now = cdtime ();
+		NOTICE ("read-function of plugin `%s' failed. "
+				"Will suspend it for %i seconds.",
+				rf->rf_name,
+				(int) rf->rf_effective_interval.tv_sec);
+	}
+	else
+	{
+		/* Success: Restore the interval, if it was changed. */
+		rf->rf_effective_interval = rf->rf_interval;
+	}
 
-			CDTIME_T_TO_TIMESPEC (plugin_get_interval (), &rf->rf_interval);
+	/* update the ``next read due'' field */
+	now = cdtime ();
+
+	DEBUG ("plugin_read_thread: Effective interval of the "
+			"%s plugin is %i.%09i.",
+			rf->rf_name,
+			(int) rf->rf_effective_interval.tv_sec,
+			(int) rf->rf_effective_interval.tv_nsec);
+
+	/* Calculate the next (absolute) time at which this function
+	 * should be called. */
+	rf->rf_next_read.tv_sec = rf->rf_next_read.tv_sec
+		+ rf->rf_effective_interval.tv_sec;
+	rf->rf_next_read.tv_nsec = rf->rf_next_read.tv_nsec
+		+ rf->rf_effective_interval.tv_nsec;
+	NORMALIZE_TIMESPEC (rf->rf_next_read);
+
+	/* Check, if `rf_next_read' is in the past. */
+	if (read_func_next (rf) < now)
+	{
+		/* `rf_next_read' is in the past. Insert `now'
+		 * so this value doesn't trail off into the
+		 * past too much. */
+		CDTIME_T_TO_TIMESPEC (now, &rf->rf_next_read);
+	}
 
-			rf->rf_effective_interval = rf->rf_interval;
+	DEBUG ("plugin_read_thread: Next read of the %s plugin at %i.%09i.",
+			rf->rf_name,
+			(int) rf->rf_next_read.tv_sec,
+			(int) rf->rf_next_read.tv_nsec);
 
-			CDTIME_T_TO_TIMESPEC (now, &rf->rf_next_read);
-		}
+	return (rf_type);
+} /* }}} int plugin_read_func_call */
+
+/* Takes an overdue read function from another thread which is busy running a
+ * callback. If nothing is overdue, `ret_next' is set to the time at which the
+ * next read function of a busy thread will be due, or zero if there is no
+ * such function. */
+static read_func_t *plugin_read_steal (read_thread_t *self, /* {{{ */
+		cdtime_t now, cdtime_t *ret_next)
+{
+	cdtime_t next = 0;
+	int i;
+
+	for (i = 0; i < read_threads_num; i++)
+	{
+		read_thread_t *rt = read_threads + i;
+		read_func_t *rf;
+
+		if (rt == self)
+			continue;
 
-		/* sleep until this entry is due,
-		 * using pthread_cond_timedwait */
-		pthread_mutex_lock (&read_lock);
-		/* In pthread_cond_timedwait, spurious wakeups are possible
-		 * (and really happen, at least on NetBSD with > 1 CPU), thus
-		 * we need to re-evaluate the condition every time
-		 * pthread_cond_timedwait returns. */
-		rc = 0;
-		while ((read_loop != 0)
-				&& !timeout_reached(rf->rf_next_read)
-				&& rc == 0)
+		pthread_mutex_lock (&rt->lock);
+		if (!rt->busy)
 		{
-			rc = pthread_cond_timedwait (&read_cond, &read_lock,
-				&rf->rf_next_read);
+			pthread_mutex_unlock (&rt->lock);
+			continue;
 		}
 
-		/* Must hold `read_lock' when accessing `rf->rf_type'. */
-		rf_type = rf->rf_type;
-		pthread_mutex_unlock (&read_lock);
+		rf = c_heap_peek_root (rt->heap);
+		if ((rf != NULL) && (read_func_next (rf) <= now))
+		{
+			rf = c_heap_get_root (rt->heap);
+			rt->entries_num--;
+			pthread_mutex_unlock (&rt->lock);
 
-		/* Check if we're supposed to stop.. This may have interrupted
-		 * the sleep, too. */
-		if (read_loop == 0)
+			DEBUG ("plugin_read_thread: Taking `%s' from a busy thread.",
+					rf->rf_name);
+			return (rf);
+		}
+		else if ((rf != NULL)
+				&& ((next == 0) || (read_func_next (rf) < next)))
 		{
-			/* Insert `rf' again, so it can be free'd correctly */
-			c_heap_insert (read_heap, rf);
-			break;
+			next = read_func_next (rf);
 		}
+		pthread_mutex_unlock (&rt->lock);
+	}
 
-		/* The entry has been marked for deletion. The linked list
-		 * entry has already been removed by `plugin_unregister_read'.
-		 * All we have to do here is free the `read_func_t' and
-		 * continue. */
-		if (rf_type == RF_REMOVE)
-		{
-			DEBUG ("plugin_read_thread: Destroying the `%s' "
-					"callback.", rf->rf_name);
-			destroy_callback ((callback_func_t *) rf);
-			rf = NULL;
+	*ret_next = next;
+	return (NULL);
+} /* }}} read_func_t *plugin_read_steal */
+
+/* Called by `self' after it became busy. If read functions are waiting in its
+ * heap, one idle thread is woken up, so it can take them once they are due.
+ * Otherwise an idle thread whose heap is empty would wait forever. */
+static void plugin_read_wake_idle (read_thread_t *self) /* {{{ */
+{
+	_Bool pending;
+	int i;
+
+	pthread_mutex_lock (&self->lock);
+	pending = (c_heap_peek_root (self->heap) != NULL);
+	pthread_mutex_unlock (&self->lock);
+
+	if (!pending)
+		return;
+
+	for (i = 0; i < read_threads_num; i++)
+	{
+		read_thread_t *rt = read_threads + i;
+
+		if (rt == self)
 			continue;
+
+		pthread_mutex_lock (&rt->lock);
+		if (rt->idle)
+		{
+			rt->wakeup = 1;
+			pthread_cond_signal (&rt->cond);
+			pthread_mutex_unlock (&rt->lock);
+			return;
 		}
+		pthread_mutex_unlock (&rt->lock);
+	}
+} /* }}} void plugin_read_wake_idle */
 
-		DEBUG ("plugin_read_thread: Handling `%s'.", rf->rf_name);
+static void *plugin_read_thread (void *args) /* {{{ */
+{
+	read_thread_t *self = args;
 
-		old_ctx = plugin_set_ctx (rf->rf_ctx);
+	while (read_loop != 0)
+	{
+		read_func_t *rf;
+		cdtime_t now;
+		cdtime_t next;
+		cdtime_t steal_next = 0;
+		int rf_type;
 
-		if (rf_type == RF_SIMPLE)
-		{
-			int (*callback) (void);
+		now = cdtime ();
 
-			callback = rf->rf_callback;
-			status = (*callback) ();
+		pthread_mutex_lock (&self->lock);
+		rf = c_heap_peek_root (self->heap);
+		if ((rf != NULL) && (read_func_next (rf) <= now))
+		{
+			rf = c_heap_get_root (self->heap);
 		}
 		else
 		{
-			plugin_read_cb callback;
-
-			assert (rf_type == RF_COMPLEX);
-
-			callback = rf->rf_callback;
-			status = (*callback) (&rf->rf_udata);
+			/* Threads becoming busy from now on will wake us up. */
+			rf = NULL;
+			self->idle = 1;
+			self->wakeup = 0;
 		}
+		pthread_mutex_unlock (&self->lock);
 
-		plugin_set_ctx (old_ctx);
-
-		/* If the function signals failure, we will increase the
-		 * intervals in which it will be called. */
-		if (status != 0)
+		/* Nothing of our own is due: help out busy threads. */
+		if (rf == NULL)
 		{
-			rf->rf_effective_interval.tv_sec *= 2;
-			rf->rf_effective_interval.tv_nsec *= 2;
-			NORMALIZE_TIMESPEC (rf->rf_effective_interval);
-
-			if (rf->rf_effective_interval.tv_sec >= 86400)
+			rf = plugin_read_steal (self, now, &steal_next);
+			if (rf != NULL)
 			{
-				rf->rf_effective_interval.tv_sec = 86400;
-				rf->rf_effective_interval.tv_nsec = 0;
+				pthread_mutex_lock (&self->lock);
+				self->entries_num++;
+				self->idle = 0;
+				pthread_mutex_unlock (&self->lock);
 			}
-
-			NOTICE ("read-function of plugin `%s' failed. "
-					"Will suspend it for %i seconds.",
-					rf->rf_name,
-					(int) rf->rf_effective_interval.tv_sec);
 		}
-		else
+
+		if (rf == NULL)
 		{
-			/* Success: Restore the interval, if it was changed. */
-			rf->rf_effective_interval = rf->rf_interval;
+			/* Sleep until our next read function is due, until a
+			 * busy thread's read function becomes overdue or until
+			 * another thread becomes busy with read functions
+			 * pending. In pthread_cond_timedwait, spurious wakeups
+			 * are possible, so everything is re-evaluated
+			 * afterwards. */
+			pthread_mutex_lock (&self->lock);
+
+			rf = c_heap_peek_root (self->heap);
+			next = steal_next;
+			if ((rf != NULL)
+					&& ((next == 0) || (read_func_next (rf) < next)))
+				next = read_func_next (rf);
+
+			if (read_loop == 0)
+			{
+				self->idle = 0;
+				pthread_mutex_unlock (&self->lock);
+				break;
+			}
+			else if (self->wakeup)
+			{
+				/* A thread became busy after we looked. */
+			}
+			else if (next == 0)
+			{
+				pthread_cond_wait (&self->cond, &self->lock);
+			}
+			else if (next > cdtime ())
+			{
+				struct timespec ts;
+
+				CDTIME_T_TO_TIMESPEC (next, &ts);
+				pthread_cond_timedwait (&self->cond, &self->lock, &ts);
+			}
+
+			self->idle = 0;
+			pthread_mutex_unlock (&self->lock);
+			continue;
 		}
 
-		/* update the ``next read due'' field */
-		now = cdtime ();
+		pthread_mutex_lock (&self->lock);
+		self->busy = 1;
+		pthread_mutex_unlock (&self->lock);
 
-		DEBUG ("plugin_read_thread: Effective interval of the "
-				"%s plugin is %i.%09i.",
-				rf->rf_name,
-				(int) rf->rf_effective_interval.tv_sec,
-				(int) rf->rf_effective_interval.tv_nsec);
-
-		/* Calculate the next (absolute) time at which this function
-		 * should be called. */
-		rf->rf_next_read.tv_sec = rf->rf_next_read.tv_sec
-			+ rf->rf_effective_interval.tv_sec;
-		rf->rf_next_read.tv_nsec = rf->rf_next_read.tv_nsec
-			+ rf->rf_effective_interval.tv_nsec;
-		NORMALIZE_TIMESPEC (rf->rf_next_read);
-
-		/* Check, if `rf_next_read' is in the past. */
-		if (TIMESPEC_TO_CDTIME_T (&rf->rf_next_read) < now)
+		plugin_read_wake_idle (self);
+
+		rf_type = plugin_read_func_call (rf);
+
+		pthread_mutex_lock (&self->lock);
+		self->busy = 0;
+		if (rf_type == RF_REMOVE)
 		{
-			/* `rf_next_read' is in the past. Insert `now'
-			 * so this value doesn't trail off into the
-			 * past too much. */
-			CDTIME_T_TO_TIMESPEC (now, &rf->rf_next_read);
-		}
+			self->entries_num--;
+			pthread_mutex_unlock (&self->lock);
 
-		DEBUG ("plugin_read_thread: Next read of the %s plugin at %i.%09i.",
-				rf->rf_name,
-				(int) rf->rf_next_read.tv_sec,
-				(int) rf->rf_next_read.tv_nsec);
+			DEBUG ("plugin_read_thread: Destroying the `%s' "
+					"callback.", rf->rf_name);
+			destroy_callback ((callback_func_t *) rf);
+			continue;
+		}
 
 		/* Re-insert this read function into the heap again. */
-		c_heap_insert (read_heap, rf);
+		c_heap_insert (self->heap, rf);
+		pthread_mutex_unlock (&self->lock);
 	} /* while (read_loop) */
 
 	pthread_exit (NULL);
 	return ((void *) 0);
-} /* void *plugin_read_thread */
+} /* }}} void *plugin_read_thread */
+
+/* Adds a read function to the thread with the fewest read functions and
+ * wakes up only that thread. Must be called with `read_lock' held and the
+ * read threads running. */
+static int plugin_read_thread_add (read_func_t *rf) /* {{{ */
+{
+	read_thread_t *rt = read_threads;
+	int status;
+	int i;
 
-static void start_read_threads (int num)
+	for (i = 1; i < read_threads_num; i++)
+		if (read_threads[i].entries_num < rt->entries_num)
+			rt = read_threads + i;
+
+	pthread_mutex_lock (&rt->lock);
+	status = c_heap_insert (rt->heap, rf);
+	if (status == 0)
+	{
+		rt->entries_num++;
+		pthread_cond_signal (&rt->cond);
+	}
+	pthread_mutex_unlock (&rt->lock);
+
+	return (status);
+} /* }}} int plugin_read_thread_add */
+
+static void start_read_threads (int num) /* {{{ */
 {
 	int i;
 
+	pthread_mutex_lock (&read_lock);
+
 	if (read_threads != NULL)
+	{
+		pthread_mutex_unlock (&read_lock);
 		return;
+	}
 
-	read_threads = (pthread_t *) calloc (num, sizeof (pthread_t));
+	read_threads = calloc (num, sizeof (*read_threads));
 	if (read_threads == NULL)
 	{
+		pthread_mutex_unlock (&read_lock);
 		ERROR ("plugin: start_read_threads: calloc failed.");
 		return;
 	}
 
-	read_threads_num = 0;
 	for (i = 0; i < num; i++)
 	{
-		if (pthread_create (read_threads + read_threads_num, NULL,
-					plugin_read_thread, NULL) == 0)
+		read_thread_t *rt = read_threads + i;
+
+		rt->heap = c_heap_create (plugin_compare_read_func);
+		if (rt->heap == NULL)
 		{
-			read_threads_num++;
+			ERROR ("plugin: start_read_threads: c_heap_create failed.");
+			break;
 		}
-		else
+		rt->entries_num = 0;
+		rt->busy = 0;
+		rt->idle = 0;
+		rt->wakeup = 0;
+		pthread_mutex_init (&rt->lock, /* attr = */ NULL);
+		pthread_cond_init (&rt->cond, /* attr = */ NULL);
+	}
+	read_threads_num = i;
+
+	if (read_threads_num == 0)
+	{
+		sfree (read_threads);
+		pthread_mutex_unlock (&read_lock);
+		return;
+	}
+
+	/* Distribute the registered read functions round-robin in the order
+	 * in which they are due, so threads don't all start at once. */
+	i = 0;
+	while (42)
+	{
+		read_func_t *rf;
+
+		rf = c_heap_get_root (read_heap);
+		if (rf == NULL)
+			break;
+
+		c_heap_insert (read_threads[i].heap, rf);
+		read_threads[i].entries_num++;
+		i = (i + 1) % read_threads_num;
+	}
+
+	for (i = 0; i < read_threads_num; i++)
+	{
+		if (pthread_create (&read_threads[i].thread, NULL,
+					plugin_read_thread, read_threads + i) != 0)
 		{
 			ERROR ("plugin: start_read_threads: pthread_create failed.");
-			return;
+			read_threads[i].thread = (pthread_t) 0;
 		}
 	} /* for (i) */
-} /* void start_read_threads */
 
-static void stop_read_threads (void)
+	pthread_mutex_unlock (&read_lock);
+} /* }}} void start_read_threads */
+
+static void stop_read_threads (void) /* {{{ */
 {
 	int i;
 
@@ -557,21 +844,460 @@ static void stop_read_threads (void)
 
 	pthread_mutex_lock (&read_lock);
 	read_loop = 0;
-	DEBUG ("plugin: stop_read_threads: Signalling `read_cond'");
-	pthread_cond_broadcast (&read_cond);
 	pthread_mutex_unlock (&read_lock);
 
+	DEBUG ("plugin: stop_read_threads: Signalling the read threads");
+	for (i = 0; i < read_threads_num; i++)
+	{
+		pthread_mutex_lock (&read_threads[i].lock);
+		pthread_cond_signal (&read_threads[i].cond);
+		pthread_mutex_unlock (&read_threads[i].lock);
+	}
+
 	for (i = 0; i < read_threads_num; i++)
 	{
-		if (pthread_join (read_threads[i], NULL) != 0)
+		if (read_threads[i].thread == (pthread_t) 0)
+			continue;
+
+		if (pthread_join (read_threads[i].thread, NULL) != 0)
 		{
 			ERROR ("plugin: stop_read_threads: pthread_join failed.");
 		}
-		read_threads[i] = (pthread_t) 0;
+		read_threads[i].thread = (pthread_t) 0;
+	}
+
+	/* Move all read functions back to `read_heap', so they are free'd
+	 * by `destroy_read_heap'. */
+	pthread_mutex_lock (&read_lock);
+	for (i = 0; i < read_threads_num; i++)
+	{
+		read_thread_t *rt = read_threads + i;
+		read_func_t *rf;
+
+		while ((rf = c_heap_get_root (rt->heap)) != NULL)
+			c_heap_insert (read_heap, rf);
+
+		c_heap_destroy (rt->heap);
+		pthread_mutex_destroy (&rt->lock);
+		pthread_cond_destroy (&rt->cond);
 	}
 	sfree (read_threads);
 	read_threads_num = 0;
-} /* void stop_read_threads */
+	pthread_mutex_unlock (&read_lock);
+} /* }}} void stop_read_threads */
+
+static void plugin_write_queue_free (write_queue_t *q) /* {{{ */
+{
+	if (q == NULL)
+		return;
+
+	ident_release (q->vl.ident);
+	q->vl.ident = NULL;
+	meta_data_destroy (q->vl.meta);
+	q->vl.meta = NULL;
+	if (q->vl.values != q->values)
+		sfree (q->vl.values);
+	q->vl.values = NULL;
+
+	pthread_mutex_lock (&write_free_lock);
+	if (write_free_num < WRITE_FREE_MAX)
+	{
+		q->next = write_free_head;
+		write_free_head = q;
+		write_free_num++;
+		q = NULL;
+	}
+	pthread_mutex_unlock (&write_free_lock);
+
+	sfree (q);
+} /* }}} void plugin_write_queue_free */
+
+/* Returns a write queue element holding a deep copy of `vl_orig'. */
+static write_queue_t *plugin_write_queue_alloc (value_list_t const *vl_orig) /* {{{ */
+{
+	write_queue_t *q;
+
+	if (vl_orig == NULL)
+		return (NULL);
+
+	pthread_mutex_lock (&write_free_lock);
+	q = write_free_head;
+	if (q != NULL)
+	{
+		write_free_head = q->next;
+		write_free_num--;
+	}
+	pthread_mutex_unlock (&write_free_lock);
+
+	if (q == NULL)
+	{
+		q = malloc (sizeof (*q));
+		if (q == NULL)
+			return (NULL);
+	}
+
+	memcpy (&q->vl, vl_orig, sizeof (q->vl));
+	q->ctx = plugin_get_ctx ();
+	q->next = NULL;
+
+	/* Don't keep references to the caller's memory: the copy may be handled
+	 * by another thread long after the caller has returned. */
+	q->vl.values = NULL;
+	q->vl.meta = NULL;
+	q->vl.ident = NULL;
+
+	/* Targets in the filter chains may free `values' and replace it with
+	 * their own array (see "Targets" in filter_chain.h), so the values are
+	 * only stored in the element itself if no chain is configured. */
+	if ((vl_orig->values_len <= STATIC_ARRAY_SIZE (q->values))
+			&& (pre_cache_chain == NULL) && (post_cache_chain == NULL))
+		q->vl.values = q->values;
+	else
+	{
+		q->vl.values = calloc (vl_orig->values_len, sizeof (*q->vl.values));
+		if (q->vl.values == NULL)
+		{
+			plugin_write_queue_free (q);
+			return (NULL);
+		}
+	}
+	memcpy (q->vl.values, vl_orig->values,
+			vl_orig->values_len * sizeof (*q->vl.values));
+
+	if (vl_orig->meta != NULL)
+	{
+		q->vl.meta = meta_data_clone (vl_orig->meta);
+		if (q->vl.meta == NULL)
+		{
+			plugin_write_queue_free (q);
+			return (NULL);
+		}
+	}
+
+	if (q->vl.time == 0)
+		q->vl.time = cdtime ();
+
+	/* Fill in the interval from the thread context while we're still in
+	 * the context of the dispatching plugin. */
+	if (q->vl.interval <= 0)
+	{
+		if (q->ctx.interval != 0)
+			q->vl.interval = q->ctx.interval;
+		else
+		{
+			char name[6 * DATA_MAX_NAME_LEN];
+			FORMAT_VL (name, sizeof (name), &q->vl);
+			ERROR ("plugin_write_queue_alloc: Unable to determine "
+					"interval from context for "
+					"value list \"%s\". "
+					"This indicates a broken plugin. "
+					"Please report this problem to the "
+					"collectd mailing list or at "
+					"<http://collectd.org/bugs/>.", name);
+			q->vl.interval = cf_get_default_interval ();
+		}
+	}
+
+	return (q);
+} /* }}} write_queue_t *plugin_write_queue_alloc */
+
+/* Appends `q' to the write queue. Returns non-zero if no write threads are
+ * running, in which case the caller has to handle the element itself. */
+static int plugin_write_enqueue (write_queue_t *q) /* {{{ */
+{
+	pthread_mutex_lock (&write_lock);
+
+	if ((write_loop == 0) || (write_threads_num == 0))
+	{
+		pthread_mutex_unlock (&write_lock);
+		return (ENOTCONN);
+	}
+
+	if (write_queue_tail == NULL)
+	{
+		write_queue_head = q;
+		write_queue_tail = q;
+	}
+	else
+	{
+		write_queue_tail->next = q;
+		write_queue_tail = q;
+	}
+	write_queue_length++;
+
+	pthread_cond_signal (&write_cond);
+	pthread_mutex_unlock (&write_lock);
+
+	return (0);
+} /* }}} int plugin_write_enqueue */
+
+/* Blocks until an element is available. Returns NULL once the write threads
+ * have been told to stop _and_ the queue has been drained. */
+static write_queue_t *plugin_write_dequeue (void) /* {{{ */
+{
+	write_queue_t *q;
+
+	pthread_mutex_lock (&write_lock);
+
+	while ((write_loop != 0) && (write_queue_head == NULL))
+		pthread_cond_wait (&write_cond, &write_lock);
+
+	q = write_queue_head;
+	if (q != NULL)
+	{
+		write_queue_head = q->next;
+		if (write_queue_head == NULL)
+			write_queue_tail = NULL;
+		write_queue_length--;
+		q->next = NULL;
+	}
+
+	pthread_mutex_unlock (&write_lock);
+
+	return (q);
+} /* }}} write_queue_t *plugin_write_dequeue */
+
+static void *plugin_write_thread (void __attribute__((unused)) *args) /* {{{ */
+{
+	while (42)
+	{
+		write_queue_t *q;
+		plugin_ctx_t old_ctx;
+
+		q = plugin_write_dequeue ();
+		if (q == NULL)
+			break;
+
+		old_ctx = plugin_set_ctx (q->ctx);
+		plugin_dispatch_values_internal (&q->vl);
+		plugin_set_ctx (old_ctx);
+
+		plugin_write_queue_free (q);
+	}
+
+	pthread_exit (NULL);
+	return ((void *) 0);
+} /* }}} void *plugin_write_thread */
+
+static void start_write_threads (int num) /* {{{ */
+{
+	int i;
+
+	if (write_threads != NULL)
+		return;
+
+	write_threads = (pthread_t *) calloc (num, sizeof (pthread_t));
+	if (write_threads == NULL)
+	{
+		ERROR ("plugin: start_write_threads: calloc failed.");
+		return;
+	}
+
+	pthread_mutex_lock (&write_lock);
+	write_loop = 1;
+	write_threads_num = 0;
+	for (i = 0; i < num; i++)
+	{
+		if (pthread_create (write_threads + write_threads_num, NULL,
+					plugin_write_thread, NULL) == 0)
+		{
+			write_threads_num++;
+		}
+		else
+		{
+			ERROR ("plugin: start_write_threads: pthread_create failed.");
+			break;
+		}
+	} /* for (i) */
+	pthread_mutex_unlock (&write_lock);
+} /* }}} void start_write_threads */
+
+static void stop_write_threads (void) /* {{{ */
+{
+	int i;
+
+	if (write_threads == NULL)
+		return;
+
+	INFO ("collectd: Stopping %i write threads.", write_threads_num);
+
+	/* The write threads exit after the queue has been drained, so no data
+	 * that made it into the queue is lost. */
+	pthread_mutex_lock (&write_lock);
+	write_loop = 0;
+	DEBUG ("plugin: stop_write_threads: Signalling `write_cond'");
+	pthread_cond_broadcast (&write_cond);
+	pthread_mutex_unlock (&write_lock);
+
+	for (i = 0; i < write_threads_num; i++)
+	{
+		if (pthread_join (write_threads[i], NULL) != 0)
+		{
+			ERROR ("plugin: stop_write_threads: pthread_join failed.");
+		}
+		write_threads[i] = (pthread_t) 0;
+	}
+
+	pthread_mutex_lock (&write_lock);
+	sfree (write_threads);
+	write_threads_num = 0;
+	pthread_mutex_unlock (&write_lock);
+} /* }}} void stop_write_threads */
+
+/* Returns the probability with which a value list should be dropped, based on
+ * the current length of the write queue: Below the low water mark nothing is
+ * dropped, above the high water mark everything is, and in between the
+ * probability rises linearly. */
+static double get_drop_probability (void) /* {{{ */
+{
+	long pos;
+	long size;
+	long wql;
+
+	pthread_mutex_lock (&write_lock);
+	wql = write_queue_length;
+	pthread_mutex_unlock (&write_lock);
+
+	if (wql < write_limit_low)
+		return (0.0);
+	if (wql >= write_limit_high)
+		return (1.0);
+
+	pos = 1 + wql - write_limit_low;
+	size = 1 + write_limit_high - write_limit_low;
+
+	return (((double) pos) / ((double) size));
+} /* }}} double get_drop_probability */
+
+static _Bool check_drop_value (void) /* {{{ */
+{
+	static cdtime_t last_message_time = 0;
+	static pthread_mutex_t last_message_lock = PTHREAD_MUTEX_INITIALIZER;
+
+	double p;
+	double q;
+	int status;
+
+	if (write_limit_high == 0)
+		return (0);
+
+	p = get_drop_probability ();
+	if (p == 0.0)
+		return (0);
+
+	status = pthread_mutex_trylock (&last_message_lock);
+	if (status == 0)
+	{
+		cdtime_t now;
+
+		now = cdtime ();
+		if ((now - last_message_time) > TIME_T_TO_CDTIME_T (1))
+		{
+			last_message_time = now;
+			ERROR ("plugin_dispatch_values: Low water mark "
+					"reached. Dropping %.0f%% of metrics.",
+					100.0 * p);
+		}
+		pthread_mutex_unlock (&last_message_lock);
+	}
+
+	if (p == 1.0)
+		return (1);
+
+	q = ((double) random ()) / ((double) RAND_MAX);
+	if (q < p)
+		return (1);
+	else
+		return (0);
+} /* }}} _Bool check_drop_value */
+
+/* Must be called with `data_sets_lock' held for writing. */
+static void data_sets_hash_update (void) /* {{{ */
+{
+	data_set_entry_t *table;
+	size_t table_size;
+	c_avl_iterator_t *iter;
+	char *key;
+	data_set_t *ds;
+
+	sfree (data_sets_hash);
+	data_sets_hash_size = 0;
+
+	if ((data_sets == NULL) || (c_avl_size (data_sets) == 0))
+		return;
+
+	/* Keep the load factor below one half. */
+	table_size = 16;
+	while (table_size < 2 * (size_t) c_avl_size (data_sets))
+		table_size *= 2;
+
+	table = calloc (table_size, sizeof (*table));
+	if (table == NULL)
+	{
+		ERROR ("data_sets_hash_update: calloc failed. "
+				"Falling back to tree lookups.");
+		return;
+	}
+
+	iter = c_avl_get_iterator (data_sets);
+	while (c_avl_iterator_next (iter, (void *) &key, (void *) &ds) == 0)
+	{
+		uint32_t hash = ident_hash_string (ds->type);
+		size_t idx = hash & (table_size - 1);
+
+		while (table[idx].ds != NULL)
+			idx = (idx + 1) & (table_size - 1);
+
+		table[idx].hash = hash;
+		table[idx].ds = ds;
+	}
+	c_avl_iterator_destroy (iter);
+
+	data_sets_hash = table;
+	data_sets_hash_size = table_size;
+} /* }}} void data_sets_hash_update */
+
+static data_set_t *data_sets_get (const char *type) /* {{{ */
+{
+	data_set_t *ds = NULL;
+
+	pthread_rwlock_rdlock (&data_sets_lock);
+
+	if (data_sets_hash != NULL)
+	{
+		uint32_t hash = ident_hash_string (type);
+		size_t idx = hash & (data_sets_hash_size - 1);
+
+		while (data_sets_hash[idx].ds != NULL)
+		{
+			if ((data_sets_hash[idx].hash == hash)
+					&& (strcmp (data_sets_hash[idx].ds->type, type) == 0))
+			{
+				ds = data_sets_hash[idx].ds;
+				break;
+			}
+			idx = (idx + 1) & (data_sets_hash_size - 1);
+		}
+	}
+	else if ((data_sets == NULL)
+			|| (c_avl_get (data_sets, type, (void *) &ds) != 0))
+	{
+		ds = NULL;
+	}
+
+	pthread_rwlock_unlock (&data_sets_lock);
+
+	return (ds);
+} /* }}} data_set_t *data_sets_get */
+
+/* escape_slashes() rewrites the entire buffer, but hardly any identifier
+ * contains a slash. */
+static void plugin_escape_slashes (char *buf, size_t buf_size) /* {{{ */
+{
+	buf[buf_size - 1] = 0;
+	if (strchr (buf, '/') != NULL)
+		escape_slashes (buf, (int) buf_size);
+} /* }}} void plugin_escape_slashes */
 
 /*
  * Public functions
@@ -769,7 +1495,14 @@ static int plugin_insert_read (read_func_t *rf)
 		return (-1);
 	}
 
-	status = c_heap_insert (read_heap, rf);
+	/* The first read is due right away. */
+	if ((rf->rf_next_read.tv_sec == 0) && (rf->rf_next_read.tv_nsec == 0))
+		CDTIME_T_TO_TIMESPEC (cdtime (), &rf->rf_next_read);
+
+	if (read_threads_num > 0)
+		status = plugin_read_thread_add (rf);
+	else
+		status = c_heap_insert (read_heap, rf);
 	if (status != 0)
 	{
 		pthread_mutex_unlock (&read_lock);
@@ -781,8 +1514,6 @@ static int plugin_insert_read (read_func_t *rf)
 	/* This does not fail. */
 	llist_append (read_list, le);
 
-	/* Wake up all the read threads. */
-	pthread_cond_broadcast (&read_cond);
 	pthread_mutex_unlock (&read_lock);
 	return (0);
 } /* int plugin_insert_read */
@@ -939,21 +1670,10 @@ int plugin_register_shutdown (const char *name,
 int plugin_register_data_set (const data_set_t *ds)
 {
 	data_set_t *ds_copy;
+	data_set_t *ds_old = NULL;
+	int status;
 	int i;
 
-	if ((data_sets != NULL)
-			&& (c_avl_get (data_sets, ds->type, NULL) == 0))
-	{
-		NOTICE ("Replacing DS `%s' with another version.", ds->type);
-		plugin_unregister_data_set (ds->type);
-	}
-	else if (data_sets == NULL)
-	{
-		data_sets = c_avl_create ((int (*) (const void *, const void *)) strcmp);
-		if (data_sets == NULL)
-			return (-1);
-	}
-
 	ds_copy = (data_set_t *) malloc (sizeof (data_set_t));
 	if (ds_copy == NULL)
 		return (-1);
@@ -970,7 +1690,36 @@ int plugin_register_data_set (const data_set_t *ds)
 	for (i = 0; i < ds->ds_num; i++)
 		memcpy (ds_copy->ds + i, ds->ds + i, sizeof (data_source_t));
 
-	return (c_avl_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy));
+	pthread_rwlock_wrlock (&data_sets_lock);
+
+	if (data_sets == NULL)
+	{
+		data_sets = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+		if (data_sets == NULL)
+		{
+			pthread_rwlock_unlock (&data_sets_lock);
+			sfree (ds_copy->ds);
+			sfree (ds_copy);
+			return (-1);
+		}
+	}
+	else if (c_avl_remove (data_sets, ds->type, NULL, (void *) &ds_old) == 0)
+	{
+		NOTICE ("Replacing DS `%s' with another version.", ds->type);
+	}
+
+	status = c_avl_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy);
+	data_sets_hash_update ();
+
+	pthread_rwlock_unlock (&data_sets_lock);
+
+	if (ds_old != NULL)
+	{
+		sfree (ds_old->ds);
+		sfree (ds_old);
+	}
+
+	return (status);
 } /* int plugin_register_data_set */
 
 int plugin_register_log (const char *name,
@@ -1129,11 +1878,17 @@ int plugin_unregister_data_set (const char *name)
 {
 	data_set_t *ds;
 
-	if (data_sets == NULL)
-		return (-1);
+	pthread_rwlock_wrlock (&data_sets_lock);
 
-	if (c_avl_remove (data_sets, name, NULL, (void *) &ds) != 0)
+	if ((data_sets == NULL)
+			|| (c_avl_remove (data_sets, name, NULL, (void *) &ds) != 0))
+	{
+		pthread_rwlock_unlock (&data_sets_lock);
 		return (-1);
+	}
+	data_sets_hash_update ();
+
+	pthread_rwlock_unlock (&data_sets_lock);
 
 	sfree (ds->ds);
 	sfree (ds);
@@ -1166,6 +1921,37 @@ void plugin_init_all (void)
 	chain_name = global_option_get ("PostCacheChain");
 	post_cache_chain = fc_chain_get_by_name (chain_name);
 
+	write_limit_high = atol (global_option_get ("WriteQueueLimitHigh"));
+	if (write_limit_high < 0)
+	{
+		ERROR ("WriteQueueLimitHigh must be positive or zero.");
+		write_limit_high = 0;
+	}
+
+	if (global_option_get ("WriteQueueLimitLow") != NULL)
+		write_limit_low = atol (global_option_get ("WriteQueueLimitLow"));
+	else
+		write_limit_low = write_limit_high / 2;
+	if (write_limit_low < 0)
+	{
+		ERROR ("WriteQueueLimitLow must be positive or zero.");
+		write_limit_low = write_limit_high / 2;
+	}
+	else if (write_limit_low > write_limit_high)
+	{
+		ERROR ("WriteQueueLimitLow must not be larger than "
+				"WriteQueueLimitHigh.");
+		write_limit_low = write_limit_high;
+	}
+
+	/* Start write-threads before the init callbacks, so values dispatched
+	 * from there are queued, too. */
+	{
+		int num;
+
+		num = atoi (global_option_get ("WriteThreads"));
+		start_write_threads ((num > 0) ? num : 5);
+	}
 
 	if ((list_init == NULL) && (read_heap == NULL))
 		return;
@@ -1397,6 +2183,20 @@ void plugin_shutdown_all (void)
 
 	stop_read_threads ();
 
+	/* Drain the write queue before any of the write plugins are shut
+	 * down. */
+	stop_write_threads ();
+
+	pthread_mutex_lock (&write_free_lock);
+	while (write_free_head != NULL)
+	{
+		write_queue_t *q = write_free_head;
+		write_free_head = q->next;
+		sfree (q);
+	}
+	write_free_num = 0;
+	pthread_mutex_unlock (&write_free_lock);
+
 	destroy_all_callbacks (&list_init);
 
 	pthread_mutex_lock (&read_lock);
@@ -1490,32 +2290,16 @@ int plugin_dispatch_missing (const value_list_t *vl) /* {{{ */
   return (0);
 } /* int }}} plugin_dispatch_missing */
 
-int plugin_dispatch_values (value_list_t *vl)
+/* Runs the filter chains, updates the value cache and calls the write
+ * callbacks. `vl' is a private copy created by plugin_write_queue_alloc(), so
+ * matches and targets may modify it as they please. */
+static int plugin_dispatch_values_internal (value_list_t *vl)
 {
 	int status;
 	static c_complain_t no_write_complaint = C_COMPLAIN_INIT_STATIC;
 
-	value_t *saved_values;
-	int      saved_values_len;
-
 	data_set_t *ds;
 
-	int free_meta_data = 0;
-
-	if ((vl == NULL) || (vl->type[0] == 0)
-			|| (vl->values == NULL) || (vl->values_len < 1))
-	{
-		ERROR ("plugin_dispatch_values: Invalid value list "
-				"from plugin %s.", vl->plugin);
-		return (-1);
-	}
-
-	/* Free meta data only if the calling function didn't specify any. In
-	 * this case matches and targets may add some and the calling function
-	 * may not expect (and therefore free) that data. */
-	if (vl->meta == NULL)
-		free_meta_data = 1;
-
 	if (list_write == NULL)
 		c_complain_once (LOG_WARNING, &no_write_complaint,
 				"plugin_dispatch_values: No write callback has been "
@@ -1530,7 +2314,8 @@ int plugin_dispatch_values (value_list_t *vl)
 		return (-1);
 	}
 
-	if (c_avl_get (data_sets, vl->type, (void *) &ds) != 0)
+	ds = data_sets_get (vl->type);
+	if (ds == NULL)
 	{
 		char ident[6 * DATA_MAX_NAME_LEN];
 
@@ -1541,30 +2326,6 @@ int plugin_dispatch_values (value_list_t *vl)
 		return (-1);
 	}
 
-	if (vl->time == 0)
-		vl->time = cdtime ();
-
-	if (vl->interval <= 0)
-	{
-		plugin_ctx_t ctx = plugin_get_ctx ();
-
-		if (ctx.interval != 0)
-			vl->interval = ctx.interval;
-		else
-		{
-			char name[6 * DATA_MAX_NAME_LEN];
-			FORMAT_VL (name, sizeof (name), vl);
-			ERROR ("plugin_dispatch_values: Unable to determine "
-					"interval from context for "
-					"value list \"%s\". "
-					"This indicates a broken plugin. "
-					"Please report this problem to the "
-					"collectd mailing list or at "
-					"<http://collectd.org/bugs/>.", name);
-			vl->interval = cf_get_default_interval ();
-		}
-	}
-
 	DEBUG ("plugin_dispatch_values: time = %.3f; interval = %.3f; "
 			"host = %s; "
 			"plugin = %s; plugin_instance = %s; "
@@ -1596,36 +2357,11 @@ int plugin_dispatch_values (value_list_t *vl)
 	}
 #endif
 
-	escape_slashes (vl->host, sizeof (vl->host));
-	escape_slashes (vl->plugin, sizeof (vl->plugin));
-	escape_slashes (vl->plugin_instance, sizeof (vl->plugin_instance));
-	escape_slashes (vl->type, sizeof (vl->type));
-	escape_slashes (vl->type_instance, sizeof (vl->type_instance));
-
-	/* Copy the values. This way, we can assure `targets' that they get
-	 * dynamically allocated values, which they can free and replace if
-	 * they like. */
-	if ((pre_cache_chain != NULL) || (post_cache_chain != NULL))
-	{
-		saved_values     = vl->values;
-		saved_values_len = vl->values_len;
-
-		vl->values = (value_t *) calloc (vl->values_len,
-				sizeof (*vl->values));
-		if (vl->values == NULL)
-		{
-			ERROR ("plugin_dispatch_values: calloc failed.");
-			vl->values = saved_values;
-			return (-1);
-		}
-		memcpy (vl->values, saved_values,
-				vl->values_len * sizeof (*vl->values));
-	}
-	else /* if ((pre == NULL) && (post == NULL)) */
-	{
-		saved_values     = NULL;
-		saved_values_len = 0;
-	}
+	plugin_escape_slashes (vl->host, sizeof (vl->host));
+	plugin_escape_slashes (vl->plugin, sizeof (vl->plugin));
+	plugin_escape_slashes (vl->plugin_instance, sizeof (vl->plugin_instance));
+	plugin_escape_slashes (vl->type, sizeof (vl->type));
+	plugin_escape_slashes (vl->type_instance, sizeof (vl->type_instance));
 
 	if (pre_cache_chain != NULL)
 	{
@@ -1638,19 +2374,15 @@ int plugin_dispatch_values (value_list_t *vl)
 					status, status);
 		}
 		else if (status == FC_TARGET_STOP)
-		{
-			/* Restore the state of the value_list so that plugins
-			 * don't get confused.. */
-			if (saved_values != NULL)
-			{
-				free (vl->values);
-				vl->values     = saved_values;
-				vl->values_len = saved_values_len;
-			}
 			return (0);
-		}
 	}
 
+	/* Resolve the identifier once the pre-cache chain had a chance to
+	 * change it. The cache and the write plugins can then use the interned
+	 * identifier instead of formatting and comparing strings. */
+	if (vl->ident == NULL)
+		vl->ident = ident_get (vl);
+
 	/* Update the value cache */
 	uc_update (ds, vl);
 
@@ -1668,68 +2400,52 @@ int plugin_dispatch_values (value_list_t *vl)
 	else
 		fc_default_action (ds, vl);
 
-	/* Restore the state of the value_list so that plugins don't get
-	 * confused.. */
-	if (saved_values != NULL)
-	{
-		free (vl->values);
-		vl->values     = saved_values;
-		vl->values_len = saved_values_len;
-	}
-
-	if ((free_meta_data != 0) && (vl->meta != NULL))
-	{
-		meta_data_destroy (vl->meta);
-		vl->meta = NULL;
-	}
-
 	return (0);
-} /* int plugin_dispatch_values */
+} /* int plugin_dispatch_values_internal */
 
-int plugin_dispatch_values_secure (const value_list_t *vl)
+int plugin_dispatch_values (value_list_t *vl)
 {
-  value_list_t vl_copy;
-  int status;
-
-  if (vl == NULL)
-    return EINVAL;
-
-  memcpy (&vl_copy, vl, sizeof (vl_copy));
+	write_queue_t *q;
+	int status;
 
-  /* Write callbacks must not change the values and meta pointers, so we can
-   * savely skip copying those and make this more efficient. */
-  if ((pre_cache_chain == NULL) && (post_cache_chain == NULL))
-    return (plugin_dispatch_values (&vl_copy));
+	if ((vl == NULL) || (vl->type[0] == 0)
+			|| (vl->values == NULL) || (vl->values_len < 1))
+	{
+		ERROR ("plugin_dispatch_values: Invalid value list "
+				"from plugin %s.",
+				(vl != NULL) ? vl->plugin : "(null)");
+		return (-1);
+	}
 
-  /* Set pointers to NULL, just to be on the save side. */
-  vl_copy.values = NULL;
-  vl_copy.meta = NULL;
+	if (check_drop_value ())
+		return (0);
 
-  vl_copy.values = malloc (sizeof (*vl_copy.values) * vl->values_len);
-  if (vl_copy.values == NULL)
-  {
-    ERROR ("plugin_dispatch_values_secure: malloc failed.");
-    return (ENOMEM);
-  }
-  memcpy (vl_copy.values, vl->values, sizeof (*vl_copy.values) * vl->values_len);
+	q = plugin_write_queue_alloc (vl);
+	if (q == NULL)
+	{
+		ERROR ("plugin_dispatch_values: plugin_write_queue_alloc failed.");
+		return (ENOMEM);
+	}
 
-  if (vl->meta != NULL)
-  {
-    vl_copy.meta = meta_data_clone (vl->meta);
-    if (vl_copy.meta == NULL)
-    {
-      ERROR ("plugin_dispatch_values_secure: meta_data_clone failed.");
-      free (vl_copy.values);
-      return (ENOMEM);
-    }
-  } /* if (vl->meta) */
+	status = plugin_write_enqueue (q);
+	if (status == 0)
+		return (0);
 
-  status = plugin_dispatch_values (&vl_copy);
+	/* The write threads are not running (yet or anymore), e.g. because
+	 * we're still initializing or already shutting down. Handle the value
+	 * list in this thread. */
+	status = plugin_dispatch_values_internal (&q->vl);
+	plugin_write_queue_free (q);
 
-  meta_data_destroy (vl_copy.meta);
-  free (vl_copy.values);
+	return (status);
+} /* int plugin_dispatch_values */
 
-  return (status);
+int plugin_dispatch_values_secure (const value_list_t *vl)
+{
+	/* plugin_dispatch_values() creates a deep copy of the value list
+	 * before anything can modify it, so there is nothing left to do
+	 * here. */
+	return (plugin_dispatch_values ((value_list_t *) vl));
 } /* int plugin_dispatch_values_secure */
 
 int plugin_dispatch_notification (const notification_t *notif)
@@ -1854,7 +2570,8 @@ const data_set_t *plugin_get_ds (const char *name)
 {
 	data_set_t *ds;
 
-	if (c_avl_get (data_sets, name, (void *) &ds) != 0)
+	ds = data_sets_get (name);
+	if (ds == NULL)
 	{
 		DEBUG ("No such dataset registered: %s", name);
 		return (NULL);
@@ -84,6 +84,9 @@ union value_u
 };
 typedef union value_u value_t;
 
+struct identifier_s;
+typedef struct identifier_s identifier_t;
+
 struct value_list_s
 {
 	value_t *values;
@@ -96,12 +99,17 @@ struct value_list_s
 	char     type[DATA_MAX_NAME_LEN];
 	char     type_instance[DATA_MAX_NAME_LEN];
 	meta_data_t *meta;
+	/* Interned identifier, see "utils_ident.h". Set by the daemon before
+	 * the value list is passed to the value cache and write plugins;
+	 * ignored in value lists passed to plugin_dispatch_values(). */
+	identifier_t *ident;
 };
 typedef struct value_list_s value_list_t;
 
 #define VALUE_LIST_INIT { NULL, 0, 0, plugin_get_interval (), \
-	"localhost", "", "", "", "", NULL }
-#define VALUE_LIST_STATIC { NULL, 0, 0, 0, "localhost", "", "", "", "", NULL }
+	"localhost", "", "", "", "", NULL, NULL }
+#define VALUE_LIST_STATIC { NULL, 0, 0, 0, "localhost", "", "", "", "", \
+	NULL, NULL }
 
 struct data_source_s
 {
@@ -318,9 +326,11 @@ int plugin_unregister_notification (const char *name);
  *
  * DESCRIPTION
  *  This function is called by reading processes with the values they've
- *  aquired. The function fetches the data-set definition (that has been
+ *  aquired. The value list is copied and appended to the write queue; one of
+ *  the write threads then fetches the data-set definition (that has been
  *  registered using `plugin_register_data_set') and calls _all_ registered
- *  write-functions.
+ *  write-functions. The caller keeps ownership of `vl' and may reuse or free
+ *  it as soon as this function returns.
  *
  * ARGUMENTS
  *  `vl'        Value list of the values that have been read by a `read'
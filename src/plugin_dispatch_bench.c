@@ -0,0 +1,176 @@
+/**
+ * collectd - src/plugin_dispatch_bench.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Measures the cost of looking up data sets and of dispatching a value list
+ * through plugin_dispatch_values() to a write callback which does nothing.
+ * The data set lookup is compared with a lookup in an AVL tree, which is
+ * what plugin.c used before the hash table.
+ *
+ * Usage: plugin_dispatch_bench [<types> [<identifiers> [<iterations>]]]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_avltree.h"
+#include "utils_cache.h"
+
+/* Usually defined in collectd.c. */
+char hostname_g[DATA_MAX_NAME_LEN];
+cdtime_t interval_g;
+int  timeout_g;
+
+static int bench_write (const data_set_t __attribute__((unused)) *ds,
+    const value_list_t __attribute__((unused)) *vl,
+    user_data_t __attribute__((unused)) *ud)
+{
+  return (0);
+}
+
+static double ns_per_op (cdtime_t begin, cdtime_t end, long ops) /* {{{ */
+{
+  return (1e9 * CDTIME_T_TO_DOUBLE (end - begin) / ((double) ops));
+} /* }}} double ns_per_op */
+
+/* Dispatches `iterations' value lists, cycling through `idents_num'
+ * identifiers. */
+static void bench_dispatch (char (*type_names)[DATA_MAX_NAME_LEN], /* {{{ */
+    int types_num, int idents_num, long iterations)
+{
+  value_t value;
+  value_list_t vl = VALUE_LIST_INIT;
+  cdtime_t begin;
+  cdtime_t end;
+  long i;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "bench", sizeof (vl.plugin));
+
+  begin = cdtime ();
+  for (i = 0; i < iterations; i++)
+  {
+    long ident = i % idents_num;
+
+    value.gauge = (gauge_t) i;
+    vl.time = begin + TIME_T_TO_CDTIME_T (i / idents_num + 1);
+    vl.ident = NULL;
+    ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance), "%li",
+        ident / types_num);
+    sstrncpy (vl.type, type_names[ident % types_num], sizeof (vl.type));
+
+    plugin_dispatch_values (&vl);
+  }
+  end = cdtime ();
+  printf ("plugin_dispatch_values: %8.1f ns/value (%i identifiers)\n",
+      ns_per_op (begin, end, iterations), idents_num);
+} /* }}} void bench_dispatch */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  int types_num = 200;
+  int idents_num = 10000;
+  long iterations = 1000000;
+  char (*type_names)[DATA_MAX_NAME_LEN];
+  c_avl_tree_t *tree;
+  data_source_t dsrc = { "value", DS_TYPE_GAUGE, 0.0, NAN };
+  cdtime_t begin;
+  cdtime_t end;
+  long i;
+
+  if (argc > 1)
+    types_num = atoi (argv[1]);
+  if (argc > 2)
+    idents_num = atoi (argv[2]);
+  if (argc > 3)
+    iterations = atol (argv[3]);
+  if ((types_num < 1) || (idents_num < 1) || (iterations < 1))
+  {
+    fprintf (stderr, "Usage: %s [<types> [<identifiers> [<iterations>]]]\n",
+        argv[0]);
+    return (EXIT_FAILURE);
+  }
+
+  sstrncpy (hostname_g, "bench.example.com", sizeof (hostname_g));
+  interval_g = TIME_T_TO_CDTIME_T (10);
+  timeout_g = 2;
+  plugin_init_ctx ();
+
+  type_names = calloc ((size_t) types_num, sizeof (*type_names));
+  tree = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  assert ((type_names != NULL) && (tree != NULL));
+
+  for (i = 0; i < types_num; i++)
+  {
+    data_set_t ds;
+
+    memset (&ds, 0, sizeof (ds));
+    ssnprintf (type_names[i], sizeof (type_names[i]), "bench_type_%li", i);
+    sstrncpy (ds.type, type_names[i], sizeof (ds.type));
+    ds.ds_num = 1;
+    ds.ds = &dsrc;
+
+    assert (plugin_register_data_set (&ds) == 0);
+    assert (c_avl_insert (tree, type_names[i],
+          (void *) plugin_get_ds (type_names[i])) == 0);
+  }
+
+  uc_init ();
+  plugin_register_write ("bench", bench_write, /* user_data = */ NULL);
+
+  /* Data set lookups */
+  begin = cdtime ();
+  for (i = 0; i < iterations; i++)
+  {
+    data_set_t *ds = NULL;
+    c_avl_get (tree, type_names[i % types_num], (void *) &ds);
+    assert (ds != NULL);
+  }
+  end = cdtime ();
+  printf ("avl tree lookup:        %8.1f ns/op (%i types)\n",
+      ns_per_op (begin, end, iterations), types_num);
+
+  begin = cdtime ();
+  for (i = 0; i < iterations; i++)
+  {
+    const data_set_t *ds = plugin_get_ds (type_names[i % types_num]);
+    assert (ds != NULL);
+  }
+  end = cdtime ();
+  printf ("plugin_get_ds:          %8.1f ns/op (%i types)\n",
+      ns_per_op (begin, end, iterations), types_num);
+
+  bench_dispatch (type_names, types_num, idents_num, iterations);
+
+  c_avl_destroy (tree);
+  sfree (type_names);
+
+  return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
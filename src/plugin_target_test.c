@@ -0,0 +1,194 @@
+/**
+ * collectd - src/plugin_target_test.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Dispatches values through a pre-cache chain whose target frees
+ * `vl->values' and replaces it with an array of its own, as the Java plugin
+ * does. Checks that the write callback receives the replaced values and that
+ * the daemon doesn't free memory it doesn't own on the way.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "configfile.h"
+#include "filter_chain.h"
+#include "plugin.h"
+
+#include <pthread.h>
+
+/* Usually defined in collectd.c. */
+char hostname_g[DATA_MAX_NAME_LEN];
+cdtime_t interval_g;
+int  timeout_g;
+
+#define TEST_VALUES_NUM 1000
+
+static pthread_mutex_t received_lock = PTHREAD_MUTEX_INITIALIZER;
+static int received_num = 0;
+static int received_bad = 0;
+
+static int replace_values_invoke (const data_set_t *ds, /* {{{ */
+    value_list_t *vl,
+    notification_meta_t __attribute__((unused)) **meta,
+    void __attribute__((unused)) **user_data)
+{
+  value_t *values;
+  int i;
+
+  values = calloc ((size_t) ds->ds_num, sizeof (*values));
+  assert (values != NULL);
+  for (i = 0; i < ds->ds_num; i++)
+    values[i].gauge = (gauge_t) (42 + i);
+
+  free (vl->values);
+  vl->values = values;
+  vl->values_len = ds->ds_num;
+
+  return (FC_TARGET_CONTINUE);
+} /* }}} int replace_values_invoke */
+
+static int test_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    user_data_t __attribute__((unused)) *ud)
+{
+  int i;
+
+  pthread_mutex_lock (&received_lock);
+  received_num++;
+  for (i = 0; i < ds->ds_num; i++)
+    if (vl->values[i].gauge != (gauge_t) (42 + i))
+    {
+      received_bad++;
+      break;
+    }
+  pthread_mutex_unlock (&received_lock);
+
+  return (0);
+} /* }}} int test_write */
+
+static void configure_chain (void) /* {{{ */
+{
+  oconfig_value_t chain_name = { { "PreCache" }, OCONFIG_TYPE_STRING };
+  oconfig_value_t target_name = { { "replace_values" }, OCONFIG_TYPE_STRING };
+  oconfig_item_t target;
+  oconfig_item_t chain;
+  target_proc_t tproc;
+  int status;
+
+  memset (&tproc, 0, sizeof (tproc));
+  tproc.invoke = replace_values_invoke;
+  status = fc_register_target ("replace_values", tproc);
+  assert (status == 0);
+
+  memset (&target, 0, sizeof (target));
+  target.key = "Target";
+  target.values = &target_name;
+  target.values_num = 1;
+  target.parent = &chain;
+
+  memset (&chain, 0, sizeof (chain));
+  chain.key = "Chain";
+  chain.values = &chain_name;
+  chain.values_num = 1;
+  chain.children = &target;
+  chain.children_num = 1;
+
+  status = fc_configure (&chain);
+  assert (status == 0);
+  status = global_option_set ("PreCacheChain", "PreCache");
+  assert (status == 0);
+} /* }}} void configure_chain */
+
+static void dispatch_values (const char *type, int values_num) /* {{{ */
+{
+  value_t values[16];
+  value_list_t vl = VALUE_LIST_INIT;
+  int status;
+  int i;
+
+  assert (values_num <= STATIC_ARRAY_SIZE (values));
+  for (i = 0; i < values_num; i++)
+    values[i].gauge = -1.0;
+
+  vl.values = values;
+  vl.values_len = values_num;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "test", sizeof (vl.plugin));
+  sstrncpy (vl.type, type, sizeof (vl.type));
+
+  for (i = 0; i < TEST_VALUES_NUM; i++)
+  {
+    vl.time = TIME_T_TO_CDTIME_T (1000000 + i);
+    status = plugin_dispatch_values (&vl);
+    assert (status == 0);
+  }
+} /* }}} void dispatch_values */
+
+int main (void) /* {{{ */
+{
+  data_source_t dsrc[16];
+  data_set_t ds_small = { "test_small", 2, dsrc };
+  data_set_t ds_large = { "test_large", 16, dsrc };
+  int status;
+  int i;
+
+  sstrncpy (hostname_g, "test.example.com", sizeof (hostname_g));
+  interval_g = TIME_T_TO_CDTIME_T (10);
+  timeout_g = 2;
+  plugin_init_ctx ();
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (dsrc); i++)
+  {
+    ssnprintf (dsrc[i].name, sizeof (dsrc[i].name), "value%i", i);
+    dsrc[i].type = DS_TYPE_GAUGE;
+    dsrc[i].min = NAN;
+    dsrc[i].max = NAN;
+  }
+  status = plugin_register_data_set (&ds_small);
+  assert (status == 0);
+  status = plugin_register_data_set (&ds_large);
+  assert (status == 0);
+
+  configure_chain ();
+  plugin_register_write ("test", test_write, /* user_data = */ NULL);
+  plugin_init_all ();
+
+  /* Fits into the write queue element and used to be stored there. */
+  dispatch_values ("test_small", ds_small.ds_num);
+  /* Too large for the element, always allocated separately. */
+  dispatch_values ("test_large", ds_large.ds_num);
+
+  /* Drains the write queue. */
+  plugin_shutdown_all ();
+
+  printf ("%i value lists written, %i with wrong values\n",
+      received_num, received_bad);
+  assert (received_num == 2 * TEST_VALUES_NUM);
+  assert (received_bad == 0);
+
+  return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
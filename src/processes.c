@@ -38,6 +38,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_avltree.h"
 
 /* Include header files for the mach system, if they exist.. */
 #if HAVE_THREAD_INFO
@@ -208,6 +209,29 @@ static mach_msg_type_number_t     pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
+
+/* Remembers which of the configured processes a PID belongs to, so that
+ * matching (and reading the command line for `ProcessMatch') is only done
+ * when a PID shows up for the first time, when it has been re-used or exec'ed,
+ * and every PS_MATCH_REFRESH reads to catch changed command lines. */
+#define PS_MATCH_REFRESH 30
+
+typedef struct ps_pid_cache_s
+{
+	int pid;
+	unsigned long long starttime;
+	char name[PROCSTAT_NAME_LEN];
+
+	procstat_t **matches;
+	size_t matches_num;
+
+	unsigned int age;
+	unsigned int generation;
+	struct ps_pid_cache_s *next;
+} ps_pid_cache_t;
+
+static c_avl_tree_t *pid_cache_g = NULL;
+static unsigned int pid_cache_generation_g = 0;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -331,143 +355,152 @@ static int ps_list_match (const char *name, const char *cmdline, procstat_t *ps)
 	return (0);
 } /* int ps_list_match */
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+/* add process entry to 'instances' of 'ps' (or refresh it) */
+static void ps_list_add_entry (procstat_t *ps, procstat_entry_t *entry)
 {
-	procstat_t *ps;
 	procstat_entry_t *pse;
 
 	if (entry->id == 0)
 		return;
 
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	for (pse = ps->instances; pse != NULL; pse = pse->next)
+		if ((pse->id == entry->id) || (pse->next == NULL))
+			break;
+
+	if ((pse == NULL) || (pse->id != entry->id))
 	{
-		if ((ps_list_match (name, cmdline, ps)) == 0)
-			continue;
+		procstat_entry_t *new;
 
-		for (pse = ps->instances; pse != NULL; pse = pse->next)
-			if ((pse->id == entry->id) || (pse->next == NULL))
-				break;
+		new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
+		if (new == NULL)
+			return;
+		memset (new, 0, sizeof (procstat_entry_t));
+		new->id = entry->id;
 
-		if ((pse == NULL) || (pse->id != entry->id))
-		{
-			procstat_entry_t *new;
+		if (pse == NULL)
+			ps->instances = new;
+		else
+			pse->next = new;
 
-			new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
-			if (new == NULL)
-				return;
-			memset (new, 0, sizeof (procstat_entry_t));
-			new->id = entry->id;
+		pse = new;
+	}
 
-			if (pse == NULL)
-				ps->instances = new;
-			else
-				pse->next = new;
+	pse->age = 0;
+	pse->num_proc   = entry->num_proc;
+	pse->num_lwp    = entry->num_lwp;
+	pse->vmem_size  = entry->vmem_size;
+	pse->vmem_rss   = entry->vmem_rss;
+	pse->vmem_data  = entry->vmem_data;
+	pse->vmem_code  = entry->vmem_code;
+	pse->stack_size = entry->stack_size;
+	pse->io_rchar   = entry->io_rchar;
+	pse->io_wchar   = entry->io_wchar;
+	pse->io_syscr   = entry->io_syscr;
+	pse->io_syscw   = entry->io_syscw;
+
+	ps->num_proc   += pse->num_proc;
+	ps->num_lwp    += pse->num_lwp;
+	ps->vmem_size  += pse->vmem_size;
+	ps->vmem_rss   += pse->vmem_rss;
+	ps->vmem_data  += pse->vmem_data;
+	ps->vmem_code  += pse->vmem_code;
+	ps->stack_size += pse->stack_size;
+
+	ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
+	ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
+	ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
+	ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
+
+	if ((entry->vmem_minflt_counter == 0)
+			&& (entry->vmem_majflt_counter == 0))
+	{
+		pse->vmem_minflt_counter += entry->vmem_minflt;
+		pse->vmem_minflt = entry->vmem_minflt;
 
-			pse = new;
+		pse->vmem_majflt_counter += entry->vmem_majflt;
+		pse->vmem_majflt = entry->vmem_majflt;
+	}
+	else
+	{
+		if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
+		{
+			pse->vmem_minflt = entry->vmem_minflt_counter
+				+ (ULONG_MAX - pse->vmem_minflt_counter);
 		}
-
-		pse->age = 0;
-		pse->num_proc   = entry->num_proc;
-		pse->num_lwp    = entry->num_lwp;
-		pse->vmem_size  = entry->vmem_size;
-		pse->vmem_rss   = entry->vmem_rss;
-		pse->vmem_data  = entry->vmem_data;
-		pse->vmem_code  = entry->vmem_code;
-		pse->stack_size = entry->stack_size;
-		pse->io_rchar   = entry->io_rchar;
-		pse->io_wchar   = entry->io_wchar;
-		pse->io_syscr   = entry->io_syscr;
-		pse->io_syscw   = entry->io_syscw;
-
-		ps->num_proc   += pse->num_proc;
-		ps->num_lwp    += pse->num_lwp;
-		ps->vmem_size  += pse->vmem_size;
-		ps->vmem_rss   += pse->vmem_rss;
-		ps->vmem_data  += pse->vmem_data;
-		ps->vmem_code  += pse->vmem_code;
-		ps->stack_size += pse->stack_size;
-
-		ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
-		ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
-		ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
-		ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
-
-		if ((entry->vmem_minflt_counter == 0)
-				&& (entry->vmem_majflt_counter == 0))
+		else
 		{
-			pse->vmem_minflt_counter += entry->vmem_minflt;
-			pse->vmem_minflt = entry->vmem_minflt;
+			pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
+		}
+		pse->vmem_minflt_counter = entry->vmem_minflt_counter;
 
-			pse->vmem_majflt_counter += entry->vmem_majflt;
-			pse->vmem_majflt = entry->vmem_majflt;
+		if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
+		{
+			pse->vmem_majflt = entry->vmem_majflt_counter
+				+ (ULONG_MAX - pse->vmem_majflt_counter);
 		}
 		else
 		{
-			if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter
-					+ (ULONG_MAX - pse->vmem_minflt_counter);
-			}
-			else
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
-			}
-			pse->vmem_minflt_counter = entry->vmem_minflt_counter;
-
-			if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter
-					+ (ULONG_MAX - pse->vmem_majflt_counter);
-			}
-			else
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
-			}
-			pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+			pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
 		}
+		pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+	}
 
-		ps->vmem_minflt_counter += pse->vmem_minflt;
-		ps->vmem_majflt_counter += pse->vmem_majflt;
+	ps->vmem_minflt_counter += pse->vmem_minflt;
+	ps->vmem_majflt_counter += pse->vmem_majflt;
 
-		if ((entry->cpu_user_counter == 0)
-				&& (entry->cpu_system_counter == 0))
-		{
-			pse->cpu_user_counter += entry->cpu_user;
-			pse->cpu_user = entry->cpu_user;
+	if ((entry->cpu_user_counter == 0)
+			&& (entry->cpu_system_counter == 0))
+	{
+		pse->cpu_user_counter += entry->cpu_user;
+		pse->cpu_user = entry->cpu_user;
 
-			pse->cpu_system_counter += entry->cpu_system;
-			pse->cpu_system = entry->cpu_system;
+		pse->cpu_system_counter += entry->cpu_system;
+		pse->cpu_system = entry->cpu_system;
+	}
+	else
+	{
+		if (entry->cpu_user_counter < pse->cpu_user_counter)
+		{
+			pse->cpu_user = entry->cpu_user_counter
+				+ (ULONG_MAX - pse->cpu_user_counter);
 		}
 		else
 		{
-			if (entry->cpu_user_counter < pse->cpu_user_counter)
-			{
-				pse->cpu_user = entry->cpu_user_counter
-					+ (ULONG_MAX - pse->cpu_user_counter);
-			}
-			else
-			{
-				pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
-			}
-			pse->cpu_user_counter = entry->cpu_user_counter;
-
-			if (entry->cpu_system_counter < pse->cpu_system_counter)
-			{
-				pse->cpu_system = entry->cpu_system_counter
-					+ (ULONG_MAX - pse->cpu_system_counter);
-			}
-			else
-			{
-				pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
-			}
-			pse->cpu_system_counter = entry->cpu_system_counter;
+			pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
 		}
+		pse->cpu_user_counter = entry->cpu_user_counter;
 
-		ps->cpu_user_counter   += pse->cpu_user;
-		ps->cpu_system_counter += pse->cpu_system;
+		if (entry->cpu_system_counter < pse->cpu_system_counter)
+		{
+			pse->cpu_system = entry->cpu_system_counter
+				+ (ULONG_MAX - pse->cpu_system_counter);
+		}
+		else
+		{
+			pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
+		}
+		pse->cpu_system_counter = entry->cpu_system_counter;
 	}
-}
+
+	ps->cpu_user_counter   += pse->cpu_user;
+	ps->cpu_system_counter += pse->cpu_system;
+} /* void ps_list_add_entry */
+
+/* The Linux code uses the PID cache and calls ps_list_add_entry directly. */
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of process 'name' (or refresh it) */
+static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+{
+	procstat_t *ps;
+
+	if (entry->id == 0)
+		return;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+		if (ps_list_match (name, cmdline, ps) != 0)
+			ps_list_add_entry (ps, entry);
+} /* void ps_list_add */
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset (void)
@@ -904,7 +937,10 @@ static procstat_t *ps_read_io (int pid, procstat_t *ps)
 	return (ps);
 } /* procstat_t *ps_read_io */
 
-int ps_read_process (int pid, procstat_t *ps, char *state)
+/* Reads /proc/<pid>/stat only. Everything else is read by
+ * ps_read_process_details() for processes we're actually interested in. */
+int ps_read_process (int pid, procstat_t *ps, char *state,
+		unsigned long long *starttime)
 {
 	char  filename[64];
 	char  buffer[1024];
@@ -979,6 +1015,7 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	}
 
 	*state = fields[0][0];
+	*starttime = strtoull (fields[19], /* endptr = */ NULL, /* base = */ 10);
 
 	if (*state == 'Z')
 	{
@@ -987,10 +1024,13 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	}
 	else
 	{
-		if ( (ps->num_lwp = ps_read_tasks (pid)) == -1 )
+		/* "num_threads" is zero on kernels before 2.6. */
+		ps->num_lwp = strtoul (fields[17], /* endptr = */ NULL, /* base = */ 10);
+		if (ps->num_lwp == 0)
 		{
+			int tasks = ps_read_tasks (pid);
 			/* returns -1 => kernel 2.4 */
-			ps->num_lwp = 1;
+			ps->num_lwp = (tasks > 0) ? ((unsigned long) tasks) : 1;
 		}
 		ps->num_proc = 1;
 	}
@@ -1024,6 +1064,19 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	cpu_system_counter = cpu_system_counter * 1000000 / CONFIG_HZ;
 	vmem_rss = vmem_rss * pagesize_g;
 
+	ps->cpu_user_counter = cpu_user_counter;
+	ps->cpu_system_counter = cpu_system_counter;
+	ps->vmem_size = (unsigned long) vmem_size;
+	ps->vmem_rss = (unsigned long) vmem_rss;
+	ps->stack_size = (unsigned long) stack_size;
+
+	/* success */
+	return (0);
+} /* int ps_read_process (...) */
+
+/* Reads /proc/<pid>/status and /proc/<pid>/io */
+static void ps_read_process_details (int pid, procstat_t *ps)
+{
 	if ( (ps_read_vmem(pid, ps)) == NULL)
 	{
 		/* No VMem data */
@@ -1032,12 +1085,6 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 		DEBUG("ps_read_process: did not get vmem data for pid %i",pid);
 	}
 
-	ps->cpu_user_counter = cpu_user_counter;
-	ps->cpu_system_counter = cpu_system_counter;
-	ps->vmem_size = (unsigned long) vmem_size;
-	ps->vmem_rss = (unsigned long) vmem_rss;
-	ps->stack_size = (unsigned long) stack_size;
-
 	if ( (ps_read_io (pid, ps)) == NULL)
 	{
 		/* no io data */
@@ -1048,10 +1095,7 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 
 		DEBUG("ps_read_process: not get io data for pid %i",pid);
 	}
-
-	/* success */
-	return (0);
-} /* int ps_read_process (...) */
+} /* void ps_read_process_details */
 
 static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 {
@@ -1148,6 +1192,178 @@ static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 	return buf;
 } /* char *ps_get_cmdline (...) */
 
+static int ps_pid_cache_compare (const void *a, const void *b)
+{
+	int pid_a = *((const int *) a);
+	int pid_b = *((const int *) b);
+
+	if (pid_a < pid_b)
+		return (-1);
+	else if (pid_a > pid_b)
+		return (1);
+	return (0);
+} /* int ps_pid_cache_compare */
+
+static void ps_pid_cache_free (ps_pid_cache_t *pc)
+{
+	if (pc == NULL)
+		return;
+
+	sfree (pc->matches);
+	sfree (pc);
+} /* void ps_pid_cache_free */
+
+/* (Re-)determines the entries in list_head_g which `pc' belongs to. The
+ * command line is only read if there are regular expressions to match. */
+static void ps_pid_cache_match (ps_pid_cache_t *pc)
+{
+	procstat_t *ps;
+	char cmdline[ARG_MAX];
+	char *cmdline_ptr = NULL;
+	_Bool have_cmdline = 0;
+
+	sfree (pc->matches);
+	pc->matches_num = 0;
+	pc->age = 0;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		procstat_t **tmp;
+
+#if HAVE_REGEX_H
+		if ((ps->re != NULL) && !have_cmdline)
+		{
+			cmdline_ptr = ps_get_cmdline (pc->pid, pc->name,
+					cmdline, sizeof (cmdline));
+			have_cmdline = 1;
+		}
+#endif
+
+		if (ps_list_match (pc->name, cmdline_ptr, ps) == 0)
+			continue;
+
+		tmp = realloc (pc->matches,
+				(pc->matches_num + 1) * sizeof (*pc->matches));
+		if (tmp == NULL)
+		{
+			ERROR ("processes plugin: ps_pid_cache_match: realloc failed.");
+			continue;
+		}
+		pc->matches = tmp;
+		pc->matches[pc->matches_num] = ps;
+		pc->matches_num++;
+	}
+} /* void ps_pid_cache_match */
+
+/* Returns the cache entry of `pid', creating or re-matching it if the process
+ * is new, has been replaced or was renamed since the last read. */
+static ps_pid_cache_t *ps_pid_cache_get (int pid, const char *name,
+		unsigned long long starttime)
+{
+	ps_pid_cache_t *pc = NULL;
+
+	if (pid_cache_g == NULL)
+	{
+		pid_cache_g = c_avl_create (ps_pid_cache_compare);
+		if (pid_cache_g == NULL)
+		{
+			ERROR ("processes plugin: c_avl_create failed.");
+			return (NULL);
+		}
+	}
+
+	if (c_avl_get (pid_cache_g, &pid, (void *) &pc) != 0)
+	{
+		pc = malloc (sizeof (*pc));
+		if (pc == NULL)
+		{
+			ERROR ("processes plugin: ps_pid_cache_get: malloc failed.");
+			return (NULL);
+		}
+		memset (pc, 0, sizeof (*pc));
+		pc->pid = pid;
+		pc->starttime = starttime;
+		sstrncpy (pc->name, name, sizeof (pc->name));
+
+		if (c_avl_insert (pid_cache_g, &pc->pid, pc) != 0)
+		{
+			ERROR ("processes plugin: ps_pid_cache_get: c_avl_insert failed.");
+			sfree (pc);
+			return (NULL);
+		}
+
+		ps_pid_cache_match (pc);
+	}
+	else if ((pc->starttime != starttime)
+			|| (strcmp (pc->name, name) != 0))
+	{
+		pc->starttime = starttime;
+		sstrncpy (pc->name, name, sizeof (pc->name));
+		ps_pid_cache_match (pc);
+	}
+	else if (pc->age >= PS_MATCH_REFRESH)
+	{
+		ps_pid_cache_match (pc);
+	}
+	else
+	{
+		pc->age++;
+	}
+
+	pc->generation = pid_cache_generation_g;
+	return (pc);
+} /* ps_pid_cache_t *ps_pid_cache_get */
+
+/* Removes all PIDs which have not been seen during the current read. */
+static void ps_pid_cache_sweep (void)
+{
+	c_avl_iterator_t *iter;
+	ps_pid_cache_t *pc;
+	ps_pid_cache_t *stale = NULL;
+	void *key;
+
+	if (pid_cache_g == NULL)
+		return;
+
+	/* The tree must not be modified while iterating over it, so collect the
+	 * stale entries first. */
+	iter = c_avl_get_iterator (pid_cache_g);
+	while (c_avl_iterator_next (iter, &key, (void *) &pc) == 0)
+	{
+		if (pc->generation == pid_cache_generation_g)
+			continue;
+
+		pc->next = stale;
+		stale = pc;
+	}
+	c_avl_iterator_destroy (iter);
+
+	while (stale != NULL)
+	{
+		pc = stale;
+		stale = pc->next;
+
+		c_avl_remove (pid_cache_g, &pc->pid, NULL, NULL);
+		ps_pid_cache_free (pc);
+	}
+} /* void ps_pid_cache_sweep */
+
+/* Frees the PID cache. */
+static void ps_pid_cache_destroy (void)
+{
+	ps_pid_cache_t *pc;
+	void *key;
+
+	if (pid_cache_g == NULL)
+		return;
+
+	while (c_avl_pick (pid_cache_g, &key, (void *) &pc) == 0)
+		ps_pid_cache_free (pc);
+
+	c_avl_destroy (pid_cache_g);
+	pid_cache_g = NULL;
+} /* void ps_pid_cache_destroy */
+
 static int read_fork_rate ()
 {
 	FILE *proc_stat;
@@ -1686,17 +1902,19 @@ static int ps_read (void)
 	DIR           *proc;
 	int            pid;
 
-	char cmdline[ARG_MAX];
-
 	int        status;
 	procstat_t ps;
 	procstat_entry_t pse;
 	char       state;
+	unsigned long long starttime;
 
+	ps_pid_cache_t *pc;
 	procstat_t *ps_ptr;
+	size_t i;
 
 	running = sleeping = zombies = stopped = paging = blocked = 0;
 	ps_list_reset ();
+	pid_cache_generation_g++;
 
 	if ((proc = opendir ("/proc")) == NULL)
 	{
@@ -1714,13 +1932,33 @@ static int ps_read (void)
 		if ((pid = atoi (ent->d_name)) < 1)
 			continue;
 
-		status = ps_read_process (pid, &ps, &state);
+		status = ps_read_process (pid, &ps, &state, &starttime);
 		if (status != 0)
 		{
 			DEBUG ("ps_read_process failed: %i", status);
 			continue;
 		}
 
+		switch (state)
+		{
+			case 'R': running++;  break;
+			case 'S': sleeping++; break;
+			case 'D': blocked++;  break;
+			case 'Z': zombies++;  break;
+			case 'T': stopped++;  break;
+			case 'W': paging++;   break;
+		}
+
+		if (list_head_g == NULL)
+			continue;
+
+		pc = ps_pid_cache_get (pid, ps.name, starttime);
+		if ((pc == NULL) || (pc->matches_num == 0))
+			continue;
+
+		if (ps.num_proc != 0)
+			ps_read_process_details (pid, &ps);
+
 		pse.id       = pid;
 		pse.age      = 0;
 
@@ -1747,23 +1985,14 @@ static int ps_read (void)
 		pse.io_syscr = ps.io_syscr;
 		pse.io_syscw = ps.io_syscw;
 
-		switch (state)
-		{
-			case 'R': running++;  break;
-			case 'S': sleeping++; break;
-			case 'D': blocked++;  break;
-			case 'Z': zombies++;  break;
-			case 'T': stopped++;  break;
-			case 'W': paging++;   break;
-		}
-
-		ps_list_add (ps.name,
-				ps_get_cmdline (pid, ps.name, cmdline, sizeof (cmdline)),
-				&pse);
+		for (i = 0; i < pc->matches_num; i++)
+			ps_list_add_entry (pc->matches[i], &pse);
 	}
 
 	closedir (proc);
 
+	ps_pid_cache_sweep ();
+
 	ps_submit_state ("running",  running);
 	ps_submit_state ("sleeping", sleeping);
 	ps_submit_state ("zombies",  zombies);
@@ -2169,9 +2398,19 @@ static int ps_read (void)
 	return (0);
 } /* int ps_read */
 
+static int ps_shutdown (void)
+{
+#if KERNEL_LINUX
+	ps_pid_cache_destroy ();
+#endif
+
+	return (0);
+} /* int ps_shutdown */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("processes", ps_config);
 	plugin_register_init ("processes", ps_init);
 	plugin_register_read ("processes", ps_read);
+	plugin_register_shutdown ("processes", ps_shutdown);
 } /* void module_register */
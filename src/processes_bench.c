@@ -0,0 +1,266 @@
+/**
+ * collectd - src/processes_bench.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Measures the time the processes plugin needs for one read, depending on the
+ * number of processes on the system. The given number of sleeping child
+ * processes is started, then the plugin's read callback is called repeatedly.
+ * The first read fills the PID cache and is reported separately.
+ *
+ * The plugin is configured with `Process "init"' and, if a regular expression
+ * is given, with `ProcessMatch "bench" "<regex>"'. The children have the same
+ * command line as this program, so "processes_bench" matches all of them.
+ *
+ * The plugin interface of the daemon is replaced by the stubs below, so the
+ * cost of dispatching the values is not included.
+ *
+ * Usage: processes_bench [<processes> [<reads> [<regex>]]]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_cache.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+/* Usually defined in collectd.c. */
+char hostname_g[DATA_MAX_NAME_LEN];
+cdtime_t interval_g;
+int  timeout_g;
+
+/* Defined in processes.c. */
+void module_register (void);
+
+static int (*ps_config_cb) (oconfig_item_t *) = NULL;
+static plugin_init_cb ps_init_cb = NULL;
+static int (*ps_read_cb) (void) = NULL;
+static plugin_shutdown_cb ps_shutdown_cb = NULL;
+
+static long values_num = 0;
+
+/*
+ * Stand-ins for the plugin interface of the daemon
+ */
+int plugin_register_complex_config (const char __attribute__((unused)) *type,
+    int (*callback) (oconfig_item_t *))
+{
+  ps_config_cb = callback;
+  return (0);
+}
+
+int plugin_register_init (const char __attribute__((unused)) *name,
+    plugin_init_cb callback)
+{
+  ps_init_cb = callback;
+  return (0);
+}
+
+int plugin_register_read (const char __attribute__((unused)) *name,
+    int (*callback) (void))
+{
+  ps_read_cb = callback;
+  return (0);
+}
+
+int plugin_register_shutdown (const char __attribute__((unused)) *name,
+    plugin_shutdown_cb callback)
+{
+  ps_shutdown_cb = callback;
+  return (0);
+}
+
+int plugin_dispatch_values (value_list_t *vl)
+{
+  values_num += (long) vl->values_len;
+  return (0);
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return (interval_g);
+}
+
+/* Referenced by common.c. */
+gauge_t *uc_get_rate (const data_set_t __attribute__((unused)) *ds,
+    const value_list_t __attribute__((unused)) *vl)
+{
+  return (NULL);
+}
+
+void plugin_log (int level, const char *format, ...)
+{
+  va_list ap;
+
+  if (level > LOG_WARNING)
+    return;
+
+  va_start (ap, format);
+  vfprintf (stderr, format, ap);
+  va_end (ap);
+  fprintf (stderr, "\n");
+}
+
+static double ms_per_op (cdtime_t begin, cdtime_t end, long ops) /* {{{ */
+{
+  return (1e3 * CDTIME_T_TO_DOUBLE (end - begin) / ((double) ops));
+} /* }}} double ms_per_op */
+
+static int count_processes (void) /* {{{ */
+{
+  DIR *dh;
+  struct dirent *ent;
+  int num = 0;
+
+  dh = opendir ("/proc");
+  if (dh == NULL)
+    return (-1);
+
+  while ((ent = readdir (dh)) != NULL)
+    if (isdigit ((int) ent->d_name[0]))
+      num++;
+
+  closedir (dh);
+  return (num);
+} /* }}} int count_processes */
+
+static void configure (char *regex) /* {{{ */
+{
+  oconfig_value_t values[3];
+  oconfig_item_t children[2];
+  oconfig_item_t ci;
+
+  memset (values, 0, sizeof (values));
+  memset (children, 0, sizeof (children));
+  memset (&ci, 0, sizeof (ci));
+
+  values[0].type = OCONFIG_TYPE_STRING;
+  values[0].value.string = "init";
+  children[0].key = "Process";
+  children[0].values = values;
+  children[0].values_num = 1;
+  children[0].parent = &ci;
+
+  values[1].type = OCONFIG_TYPE_STRING;
+  values[1].value.string = "bench";
+  values[2].type = OCONFIG_TYPE_STRING;
+  values[2].value.string = regex;
+  children[1].key = "ProcessMatch";
+  children[1].values = values + 1;
+  children[1].values_num = 2;
+  children[1].parent = &ci;
+
+  ci.key = "Plugin";
+  ci.children = children;
+  ci.children_num = (regex != NULL) ? 2 : 1;
+
+  if (ps_config_cb (&ci) != 0)
+    fprintf (stderr, "Configuring the processes plugin failed.\n");
+} /* }}} void configure */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  int children_num = 1000;
+  long reads_num = 100;
+  char *regex = NULL;
+  pid_t *children;
+  cdtime_t begin;
+  cdtime_t end;
+  long i;
+
+  if (argc > 1)
+    children_num = atoi (argv[1]);
+  if (argc > 2)
+    reads_num = atol (argv[2]);
+  if (argc > 3)
+    regex = argv[3];
+  if ((children_num < 0) || (reads_num < 1))
+  {
+    fprintf (stderr, "Usage: %s [<processes> [<reads> [<regex>]]]\n",
+        argv[0]);
+    return (EXIT_FAILURE);
+  }
+
+  sstrncpy (hostname_g, "bench.example.com", sizeof (hostname_g));
+  interval_g = TIME_T_TO_CDTIME_T (10);
+  timeout_g = 2;
+
+  module_register ();
+  assert ((ps_config_cb != NULL) && (ps_init_cb != NULL)
+      && (ps_read_cb != NULL) && (ps_shutdown_cb != NULL));
+
+  children = calloc ((size_t) children_num + 1, sizeof (*children));
+  assert (children != NULL);
+
+  for (i = 0; i < children_num; i++)
+  {
+    children[i] = fork ();
+    if (children[i] < 0)
+    {
+      fprintf (stderr, "fork failed after %li children.\n", i);
+      children_num = (int) i;
+      break;
+    }
+    else if (children[i] == 0)
+    {
+      while (42)
+        pause ();
+    }
+  }
+
+  configure (regex);
+  if (ps_init_cb () != 0)
+    fprintf (stderr, "Initializing the processes plugin failed.\n");
+
+  printf ("processes:   %i (%i started by this program)\n",
+      count_processes (), children_num);
+
+  begin = cdtime ();
+  ps_read_cb ();
+  end = cdtime ();
+  printf ("first read:  %8.3f ms\n", ms_per_op (begin, end, 1));
+
+  values_num = 0;
+  begin = cdtime ();
+  for (i = 0; i < reads_num; i++)
+    ps_read_cb ();
+  end = cdtime ();
+  printf ("later reads: %8.3f ms/read (%li reads, %li values/read)\n",
+      ms_per_op (begin, end, reads_num), reads_num, values_num / reads_num);
+
+  ps_shutdown_cb ();
+
+  for (i = 0; i < children_num; i++)
+    kill (children[i], SIGKILL);
+  for (i = 0; i < children_num; i++)
+    waitpid (children[i], NULL, 0);
+  sfree (children);
+
+  return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -44,12 +44,40 @@ typedef struct cpy_callback_s {
 	struct cpy_callback_s *next;
 } cpy_callback_t;
 
+typedef struct {
+	cpy_callback_t *callback;
+	size_t batch_size;
+	/* Value lists are copied here without taking the GIL and are only
+	 * converted to Python objects when the batch is passed on. Their data
+	 * sets are looked up again then, since the types may have been
+	 * reloaded in the meantime. */
+	value_list_t *pending;
+	size_t pending_num;
+	cdtime_t pending_time;
+	/* A read callback passes on pending values once per interval, so that
+	 * they don't wait for the next value to arrive. It removes itself once
+	 * the write callback is gone. */
+	char *read_name;
+	_Bool write_registered;
+	/* The write, the flush and the read callback share this object and
+	 * each of them can be unregistered on its own. */
+	int refcount;
+	pthread_mutex_t lock;
+} cpy_write_batch_t;
+
 static char log_doc[] = "This function sends a string to all logging plugins.";
 
 static char flush_doc[] = "flush([plugin][, timeout][, identifier]) -> None\n"
 		"\n"
 		"Flushes the cache of another plugin.";
 
+static char dispatch_many_doc[] = "dispatch_many(values) -> None\n"
+		"\n"
+		"Dispatches a sequence of Values objects. This has the same effect as\n"
+		"calling dispatch() on each of them, but is a lot cheaper for read\n"
+		"callbacks that submit many values. If one of the objects is invalid\n"
+		"an exception is raised and nothing is dispatched.";
+
 static char unregister_doc[] = "Unregisters a callback. This function needs exactly one parameter either\n"
 		"the function to unregister or the callback identifier to unregister.";
 
@@ -150,6 +178,30 @@ static char reg_write_doc[] = "register_write(callback[, data][, name]) -> ident
 		"data: The optional data parameter passed to the register function.\n"
 		"    If the parameter was omitted it will be omitted here, too.";
 
+static char reg_write_batch_doc[] = "register_write_batch(callback[, batch_size][, data][, name]) -> identifier\n"
+		"\n"
+		"Register a callback function to receive values dispatched by other plugins\n"
+		"in batches.\n"
+		"'callback' is a callable object that will be called with a list of values\n"
+		"    once 'batch_size' values have been dispatched, at the latest after\n"
+		"    one interval or when a flush is requested.\n"
+		"'batch_size' is the maximum number of values passed to the callback at\n"
+		"    once. The default is 1024.\n"
+		"'data' is an optional object that will be passed back to the callback\n"
+		"    function every time it is called.\n"
+		"'name' is an optional identifier for this callback. The default name\n"
+		"    is 'python.<module>'.\n"
+		"    Every callback needs a unique identifier, so if you want to\n"
+		"    register this callback multiple time from the same module you need\n"
+		"    to specify a name here. A flush callback is registered under the\n"
+		"    same name, so it must not be used for a flush callback of your own.\n"
+		"'identifier' is the full identifier assigned to this callback.\n"
+		"\n"
+		"The callback function will be called with one or two parameters:\n"
+		"values: A list of Values objects which are copies of the dispatched values.\n"
+		"data: The optional data parameter passed to the register function.\n"
+		"    If the parameter was omitted it will be omitted here, too.";
+
 static char reg_notification_doc[] = "register_notification(callback[, data][, name]) -> identifier\n"
 		"\n"
 		"Register a callback function for notifications.\n"
@@ -331,116 +383,130 @@ static int cpy_read_callback(user_data_t *data) {
 	return 0;
 }
 
-static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
+/* Returns a new Values object with a copy of "value_list" or NULL with an
+ * exception set. You must hold the GIL to call this function! */
+
+static PyObject *cpy_build_values(const data_set_t *ds, const value_list_t *value_list) {
 	int i;
-	cpy_callback_t *c = data->data;
-	PyObject *ret, *list, *temp, *dict = NULL;
+	PyObject *list, *temp, *dict = NULL;
 	Values *v;
 
-	CPY_LOCK_THREADS
-		list = PyList_New(value_list->values_len); /* New reference. */
-		if (list == NULL) {
-			cpy_log_exception("write callback");
-			CPY_RETURN_FROM_THREADS 0;
+	list = PyList_New(value_list->values_len); /* New reference. */
+	if (list == NULL)
+		return NULL;
+	for (i = 0; i < value_list->values_len; ++i) {
+		if (ds->ds[i].type == DS_TYPE_COUNTER) {
+			if ((long) value_list->values[i].counter == value_list->values[i].counter)
+				PyList_SetItem(list, i, PyInt_FromLong(value_list->values[i].counter));
+			else
+				PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].counter));
+		} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
+			PyList_SetItem(list, i, PyFloat_FromDouble(value_list->values[i].gauge));
+		} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
+			if ((long) value_list->values[i].derive == value_list->values[i].derive)
+				PyList_SetItem(list, i, PyInt_FromLong(value_list->values[i].derive));
+			else
+				PyList_SetItem(list, i, PyLong_FromLongLong(value_list->values[i].derive));
+		} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
+			if ((long) value_list->values[i].absolute == value_list->values[i].absolute)
+				PyList_SetItem(list, i, PyInt_FromLong(value_list->values[i].absolute));
+			else
+				PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].absolute));
+		} else {
+			PyErr_Format(PyExc_RuntimeError, "Unknown value type %d.", ds->ds[i].type);
+			Py_DECREF(list);
+			return NULL;
 		}
-		for (i = 0; i < value_list->values_len; ++i) {
-			if (ds->ds[i].type == DS_TYPE_COUNTER) {
-				if ((long) value_list->values[i].counter == value_list->values[i].counter)
-					PyList_SetItem(list, i, PyInt_FromLong(value_list->values[i].counter));
-				else
-					PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].counter));
-			} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
-				PyList_SetItem(list, i, PyFloat_FromDouble(value_list->values[i].gauge));
-			} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
-				if ((long) value_list->values[i].derive == value_list->values[i].derive)
-					PyList_SetItem(list, i, PyInt_FromLong(value_list->values[i].derive));
-				else
-					PyList_SetItem(list, i, PyLong_FromLongLong(value_list->values[i].derive));
-			} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
-				if ((long) value_list->values[i].absolute == value_list->values[i].absolute)
-					PyList_SetItem(list, i, PyInt_FromLong(value_list->values[i].absolute));
+		if (PyErr_Occurred() != NULL) {
+			Py_DECREF(list);
+			return NULL;
+		}
+	}
+	dict = PyDict_New();  /* New reference. */
+	if (value_list->meta) {
+		int i, num;
+		char **table;
+		meta_data_t *meta = value_list->meta;
+
+		num = meta_data_toc(meta, &table);
+		for (i = 0; i < num; ++i) {
+			int type;
+			char *string;
+			int64_t si;
+			uint64_t ui;
+			double d;
+			_Bool b;
+			
+			type = meta_data_type(meta, table[i]);
+			if (type == MD_TYPE_STRING) {
+				if (meta_data_get_string(meta, table[i], &string))
+					continue;
+				temp = cpy_string_to_unicode_or_bytes(string);  /* New reference. */
+				free(string);
+				PyDict_SetItemString(dict, table[i], temp);
+				Py_XDECREF(temp);
+			} else if (type == MD_TYPE_SIGNED_INT) {
+				if (meta_data_get_signed_int(meta, table[i], &si))
+					continue;
+				temp = PyObject_CallFunctionObjArgs((void *) &SignedType, PyLong_FromLongLong(si), (void *) 0);  /* New reference. */
+				PyDict_SetItemString(dict, table[i], temp);
+				Py_XDECREF(temp);
+			} else if (type == MD_TYPE_UNSIGNED_INT) {
+				if (meta_data_get_unsigned_int(meta, table[i], &ui))
+					continue;
+				temp = PyObject_CallFunctionObjArgs((void *) &UnsignedType, PyLong_FromUnsignedLongLong(ui), (void *) 0);  /* New reference. */
+				PyDict_SetItemString(dict, table[i], temp);
+				Py_XDECREF(temp);
+			} else if (type == MD_TYPE_DOUBLE) {
+				if (meta_data_get_double(meta, table[i], &d))
+					continue;
+				temp = PyFloat_FromDouble(d);  /* New reference. */
+				PyDict_SetItemString(dict, table[i], temp);
+				Py_XDECREF(temp);
+			} else if (type == MD_TYPE_BOOLEAN) {
+				if (meta_data_get_boolean(meta, table[i], &b))
+					continue;
+				if (b)
+					PyDict_SetItemString(dict, table[i], Py_True);
 				else
-					PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].absolute));
-			} else {
-				Py_BEGIN_ALLOW_THREADS
-				ERROR("cpy_write_callback: Unknown value type %d.", ds->ds[i].type);
-				Py_END_ALLOW_THREADS
-				Py_DECREF(list);
-				CPY_RETURN_FROM_THREADS 0;
-			}
-			if (PyErr_Occurred() != NULL) {
-				cpy_log_exception("value building for write callback");
-				Py_DECREF(list);
-				CPY_RETURN_FROM_THREADS 0;
+					PyDict_SetItemString(dict, table[i], Py_False);
 			}
+			free(table[i]);
 		}
-		dict = PyDict_New();  /* New reference. */
-		if (value_list->meta) {
-			int i, num;
-			char **table;
-			meta_data_t *meta = value_list->meta;
-
-			num = meta_data_toc(meta, &table);
-			for (i = 0; i < num; ++i) {
-				int type;
-				char *string;
-				int64_t si;
-				uint64_t ui;
-				double d;
-				_Bool b;
-				
-				type = meta_data_type(meta, table[i]);
-				if (type == MD_TYPE_STRING) {
-					if (meta_data_get_string(meta, table[i], &string))
-						continue;
-					temp = cpy_string_to_unicode_or_bytes(string);  /* New reference. */
-					free(string);
-					PyDict_SetItemString(dict, table[i], temp);
-					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_SIGNED_INT) {
-					if (meta_data_get_signed_int(meta, table[i], &si))
-						continue;
-					temp = PyObject_CallFunctionObjArgs((void *) &SignedType, PyLong_FromLongLong(si), (void *) 0);  /* New reference. */
-					PyDict_SetItemString(dict, table[i], temp);
-					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_UNSIGNED_INT) {
-					if (meta_data_get_unsigned_int(meta, table[i], &ui))
-						continue;
-					temp = PyObject_CallFunctionObjArgs((void *) &UnsignedType, PyLong_FromUnsignedLongLong(ui), (void *) 0);  /* New reference. */
-					PyDict_SetItemString(dict, table[i], temp);
-					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_DOUBLE) {
-					if (meta_data_get_double(meta, table[i], &d))
-						continue;
-					temp = PyFloat_FromDouble(d);  /* New reference. */
-					PyDict_SetItemString(dict, table[i], temp);
-					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_BOOLEAN) {
-					if (meta_data_get_boolean(meta, table[i], &b))
-						continue;
-					if (b)
-						PyDict_SetItemString(dict, table[i], Py_True);
-					else
-						PyDict_SetItemString(dict, table[i], Py_False);
-				}
-				free(table[i]);
-			}
-			free(table);
+		free(table);
+	}
+	/* Values.__init__ would only create a list and a dict that get replaced
+	 * right away, so skip it. */
+	v = (Values *) ValuesType.tp_alloc(&ValuesType, 0); /* New reference. */
+	if (v == NULL) {
+		Py_DECREF(list);
+		Py_XDECREF(dict);
+		return NULL;
+	}
+	sstrncpy(v->data.host, value_list->host, sizeof(v->data.host));
+	sstrncpy(v->data.type, value_list->type, sizeof(v->data.type));
+	sstrncpy(v->data.type_instance, value_list->type_instance, sizeof(v->data.type_instance));
+	sstrncpy(v->data.plugin, value_list->plugin, sizeof(v->data.plugin));
+	sstrncpy(v->data.plugin_instance, value_list->plugin_instance, sizeof(v->data.plugin_instance));
+	v->data.time = CDTIME_T_TO_DOUBLE(value_list->time);
+	v->interval = CDTIME_T_TO_DOUBLE(value_list->interval);
+	v->values = list;
+	v->meta = dict;  /* Steals a reference. */
+	return (PyObject *) v;
+}
+
+static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
+	cpy_callback_t *c = data->data;
+	PyObject *ret, *v;
+
+	CPY_LOCK_THREADS
+		v = cpy_build_values(ds, value_list); /* New reference. */
+		if (v == NULL) {
+			cpy_log_exception("value building for write callback");
+			CPY_RETURN_FROM_THREADS 0;
 		}
-		v = (Values *) Values_New(); /* New reference. */
-		sstrncpy(v->data.host, value_list->host, sizeof(v->data.host));
-		sstrncpy(v->data.type, value_list->type, sizeof(v->data.type));
-		sstrncpy(v->data.type_instance, value_list->type_instance, sizeof(v->data.type_instance));
-		sstrncpy(v->data.plugin, value_list->plugin, sizeof(v->data.plugin));
-		sstrncpy(v->data.plugin_instance, value_list->plugin_instance, sizeof(v->data.plugin_instance));
-		v->data.time = CDTIME_T_TO_DOUBLE(value_list->time);
-		v->interval = CDTIME_T_TO_DOUBLE(value_list->interval);
-		Py_CLEAR(v->values);
-		v->values = list;
-		Py_CLEAR(v->meta);
-		v->meta = dict;  /* Steals a reference. */
 		ret = PyObject_CallFunctionObjArgs(c->callback, v, c->data, (void *) 0); /* New reference. */
-		Py_XDECREF(v);
+		Py_DECREF(v);
 		if (ret == NULL) {
 			cpy_log_exception("write callback");
 		} else {
@@ -450,6 +516,168 @@ static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_li
 	return 0;
 }
 
+static void cpy_pending_free(value_list_t *pending, size_t pending_num) {
+	size_t i;
+
+	if (pending == NULL)
+		return;
+	for (i = 0; i < pending_num; ++i) {
+		free(pending[i].values);
+		meta_data_destroy(pending[i].meta);
+	}
+	free(pending);
+}
+
+/* Passes a batch to the Python callback and frees it. */
+static int cpy_write_batch_send(cpy_write_batch_t *wb, value_list_t *pending, size_t pending_num) {
+	size_t i;
+	cpy_callback_t *c = wb->callback;
+	const data_set_t *ds;
+	PyObject *ret, *list, *v;
+
+	if (pending == NULL)
+		return 0;
+
+	CPY_LOCK_THREADS
+		list = PyList_New(0); /* New reference. */
+		if (list == NULL) {
+			cpy_log_exception("write batch callback");
+		} else {
+			for (i = 0; i < pending_num; ++i) {
+				ds = plugin_get_ds(pending[i].type);
+				if ((ds == NULL) || (ds->ds_num != pending[i].values_len)) {
+					WARNING("python plugin: %s: The data set of type \"%s\" "
+							"has changed, dropping its values.", c->name, pending[i].type);
+					continue;
+				}
+				v = cpy_build_values(ds, &pending[i]); /* New reference. */
+				if (v == NULL) {
+					cpy_log_exception("value building for write batch callback");
+					continue;
+				}
+				if (PyList_Append(list, v) != 0)
+					cpy_log_exception("value building for write batch callback");
+				Py_DECREF(v);
+			}
+			ret = NULL;
+			if (PyList_Size(list) > 0) {
+				ret = PyObject_CallFunctionObjArgs(c->callback, list, c->data, (void *) 0); /* New reference. */
+				if (ret == NULL)
+					cpy_log_exception("write batch callback");
+			}
+			Py_DECREF(list);
+			Py_XDECREF(ret);
+		}
+	CPY_RELEASE_THREADS
+	cpy_pending_free(pending, pending_num);
+	return 0;
+}
+
+static void cpy_write_batch_take_nolock(cpy_write_batch_t *wb, value_list_t **pending, size_t *pending_num) {
+	*pending = wb->pending;
+	*pending_num = wb->pending_num;
+	wb->pending = NULL;
+	wb->pending_num = 0;
+}
+
+static int cpy_write_batch_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
+	cpy_write_batch_t *wb = data->data;
+	value_list_t *pending = NULL, *p;
+	size_t pending_num = 0;
+	cdtime_t now = cdtime();
+
+	pthread_mutex_lock(&wb->lock);
+	if (wb->pending == NULL) {
+		wb->pending = calloc(wb->batch_size, sizeof(*wb->pending));
+		if (wb->pending == NULL) {
+			pthread_mutex_unlock(&wb->lock);
+			ERROR("python plugin: %s: calloc failed.", wb->callback->name);
+			return -1;
+		}
+		wb->pending_num = 0;
+		wb->pending_time = now;
+	}
+	p = wb->pending + wb->pending_num;
+	memcpy(p, value_list, sizeof(*p));
+	p->values = malloc(value_list->values_len * sizeof(*p->values));
+	if (p->values == NULL) {
+		pthread_mutex_unlock(&wb->lock);
+		ERROR("python plugin: %s: malloc failed.", wb->callback->name);
+		return -1;
+	}
+	memcpy(p->values, value_list->values, value_list->values_len * sizeof(*p->values));
+	p->meta = NULL;
+	if (value_list->meta != NULL)
+		p->meta = meta_data_clone(value_list->meta);
+	wb->pending_num++;
+
+	if ((wb->pending_num >= wb->batch_size)
+			|| ((wb->pending_time + plugin_get_interval()) <= now))
+		cpy_write_batch_take_nolock(wb, &pending, &pending_num);
+	pthread_mutex_unlock(&wb->lock);
+
+	/* Python is called without holding the lock, so other threads can keep
+	 * adding values to the next batch. */
+	return cpy_write_batch_send(wb, pending, pending_num);
+}
+
+static int cpy_write_batch_flush(cdtime_t timeout, const char *id, user_data_t *data) {
+	cpy_write_batch_t *wb = data->data;
+	value_list_t *pending = NULL;
+	size_t pending_num = 0;
+
+	/* timeout == 0  => flush unconditionally */
+	pthread_mutex_lock(&wb->lock);
+	if ((wb->pending != NULL)
+			&& ((timeout == 0) || ((wb->pending_time + timeout) <= cdtime())))
+		cpy_write_batch_take_nolock(wb, &pending, &pending_num);
+	pthread_mutex_unlock(&wb->lock);
+
+	return cpy_write_batch_send(wb, pending, pending_num);
+}
+
+static void cpy_write_batch_release(void *data) {
+	cpy_write_batch_t *wb = data;
+	int refcount;
+
+	pthread_mutex_lock(&wb->lock);
+	refcount = --wb->refcount;
+	pthread_mutex_unlock(&wb->lock);
+	if (refcount > 0)
+		return;
+
+	cpy_pending_free(wb->pending, wb->pending_num);
+	pthread_mutex_destroy(&wb->lock);
+	cpy_destroy_user_data(wb->callback);
+	free(wb->read_name);
+	free(wb);
+}
+
+static void cpy_write_batch_release_write(void *data) {
+	cpy_write_batch_t *wb = data;
+
+	pthread_mutex_lock(&wb->lock);
+	wb->write_registered = 0;
+	pthread_mutex_unlock(&wb->lock);
+	cpy_write_batch_release(wb);
+}
+
+static int cpy_write_batch_read(user_data_t *data) {
+	cpy_write_batch_t *wb = data->data;
+	_Bool write_registered;
+
+	pthread_mutex_lock(&wb->lock);
+	write_registered = wb->write_registered;
+	pthread_mutex_unlock(&wb->lock);
+
+	/* Values which arrived before the write callback was removed are still
+	 * passed on. */
+	if (!write_registered)
+		plugin_unregister_read(wb->read_name);
+
+	return cpy_write_batch_flush(/* timeout = */ 0, /* identifier = */ NULL, data);
+}
+
 static int cpy_notification_callback(const notification_t *notification, user_data_t *data) {
 	cpy_callback_t *c = data->data;
 	PyObject *ret, *notify;
@@ -562,6 +790,60 @@ static PyObject *cpy_flush(cpy_callback_t **list_head, PyObject *args, PyObject
 	Py_RETURN_NONE;
 }
 
+static PyObject *cpy_dispatch_many(PyObject *self, PyObject *arg) {
+	int i, size, failed = 0;
+	PyObject *seq;
+	value_list_t *value_lists;
+	value_list_t value_list_init = VALUE_LIST_INIT;
+
+	seq = PySequence_Fast(arg, "dispatch_many needs a sequence of Values objects."); /* New reference. */
+	if (seq == NULL)
+		return NULL;
+	size = (int) PySequence_Fast_GET_SIZE(seq);
+	if (size == 0) {
+		Py_DECREF(seq);
+		Py_RETURN_NONE;
+	}
+	value_lists = calloc(size, sizeof(*value_lists));
+	if (value_lists == NULL) {
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+	for (i = 0; i < size; ++i) {
+		value_lists[i] = value_list_init;
+		if (cpy_values_to_value_list(PySequence_Fast_GET_ITEM(seq, i), value_lists + i) != 0)
+			break;
+	}
+	Py_DECREF(seq);
+	if (i < size) {
+		size = i;
+		for (i = 0; i < size; ++i) {
+			meta_data_destroy(value_lists[i].meta);
+			free(value_lists[i].values);
+		}
+		free(value_lists);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for (i = 0; i < size; ++i) {
+		if (plugin_dispatch_values(value_lists + i) != 0)
+			++failed;
+	}
+	Py_END_ALLOW_THREADS
+
+	for (i = 0; i < size; ++i) {
+		meta_data_destroy(value_lists[i].meta);
+		free(value_lists[i].values);
+	}
+	free(value_lists);
+	if (failed != 0) {
+		PyErr_Format(PyExc_RuntimeError, "error dispatching %d of %d value lists, read the logs", failed, size);
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
 static PyObject *cpy_register_config(PyObject *self, PyObject *args, PyObject *kwds) {
 	return cpy_register_generic(&cpy_config_callbacks, args, kwds);
 }
@@ -650,6 +932,60 @@ static PyObject *cpy_register_write(PyObject *self, PyObject *args, PyObject *kw
 			(void *) cpy_write_callback, args, kwds);
 }
 
+static PyObject *cpy_register_write_batch(PyObject *self, PyObject *args, PyObject *kwds) {
+	char buf[512];
+	char read_name[512];
+	cpy_callback_t *c = NULL;
+	cpy_write_batch_t *wb = NULL;
+	user_data_t user_data;
+	int batch_size = 1024;
+	char *name = NULL;
+	PyObject *callback = NULL, *data = NULL;
+	static char *kwlist[] = {"callback", "batch_size", "data", "name", NULL};
+	
+	if (PyArg_ParseTupleAndKeywords(args, kwds, "O|iOet", kwlist, &callback, &batch_size, &data, NULL, &name) == 0) return NULL;
+	if (PyCallable_Check(callback) == 0) {
+		PyMem_Free(name);
+		PyErr_SetString(PyExc_TypeError, "callback needs a be a callable object.");
+		return NULL;
+	}
+	if (batch_size < 1) {
+		PyMem_Free(name);
+		PyErr_SetString(PyExc_ValueError, "batch_size needs to be positive.");
+		return NULL;
+	}
+	cpy_build_name(buf, sizeof(buf), callback, name);
+	PyMem_Free(name);
+	
+	wb = calloc(1, sizeof(*wb));
+	if (wb == NULL)
+		return PyErr_NoMemory();
+	Py_INCREF(callback);
+	Py_XINCREF(data);
+	c = malloc(sizeof(*c));
+	c->name = strdup(buf);
+	c->callback = callback;
+	c->data = data;
+	c->next = NULL;
+	wb->callback = c;
+	wb->batch_size = (size_t) batch_size;
+	snprintf(read_name, sizeof(read_name), "%s.write_batch", buf);
+	wb->read_name = strdup(read_name);
+	wb->write_registered = 1;
+	wb->refcount = 3;
+	pthread_mutex_init(&wb->lock, NULL);
+
+	memset(&user_data, 0, sizeof(user_data));
+	user_data.data = wb;
+	user_data.free_func = cpy_write_batch_release_write;
+	plugin_register_write(buf, cpy_write_batch_callback, &user_data);
+	user_data.free_func = cpy_write_batch_release;
+	plugin_register_flush(buf, cpy_write_batch_flush, &user_data);
+	plugin_register_complex_read(/* group = */ NULL, wb->read_name,
+			cpy_write_batch_read, /* interval = */ NULL, &user_data);
+	return cpy_string_to_unicode_or_bytes(buf);
+}
+
 static PyObject *cpy_register_notification(PyObject *self, PyObject *args, PyObject *kwds) {
 	return cpy_register_generic_userdata((void *) plugin_register_notification,
 			(void *) cpy_notification_callback, args, kwds);
@@ -818,11 +1154,13 @@ static PyMethodDef cpy_methods[] = {
 	{"warning", cpy_warning, METH_VARARGS, log_doc},
 	{"error", cpy_error, METH_VARARGS, log_doc},
 	{"flush", (PyCFunction) cpy_flush, METH_VARARGS | METH_KEYWORDS, flush_doc},
+	{"dispatch_many", cpy_dispatch_many, METH_O, dispatch_many_doc},
 	{"register_log", (PyCFunction) cpy_register_log, METH_VARARGS | METH_KEYWORDS, reg_log_doc},
 	{"register_init", (PyCFunction) cpy_register_init, METH_VARARGS | METH_KEYWORDS, reg_init_doc},
 	{"register_config", (PyCFunction) cpy_register_config, METH_VARARGS | METH_KEYWORDS, reg_config_doc},
 	{"register_read", (PyCFunction) cpy_register_read, METH_VARARGS | METH_KEYWORDS, reg_read_doc},
 	{"register_write", (PyCFunction) cpy_register_write, METH_VARARGS | METH_KEYWORDS, reg_write_doc},
+	{"register_write_batch", (PyCFunction) cpy_register_write_batch, METH_VARARGS | METH_KEYWORDS, reg_write_batch_doc},
 	{"register_notification", (PyCFunction) cpy_register_notification, METH_VARARGS | METH_KEYWORDS, reg_notification_doc},
 	{"register_flush", (PyCFunction) cpy_register_flush, METH_VARARGS | METH_KEYWORDS, reg_flush_doc},
 	{"register_shutdown", (PyCFunction) cpy_register_shutdown, METH_VARARGS | METH_KEYWORDS, reg_shutdown_doc},
@@ -853,6 +1191,7 @@ static int cpy_shutdown(void) {
 			Py_DECREF(ret);
 	}
 	PyErr_Print();
+	cpy_string_cache_free();
 	Py_Finalize();
 	return 0;
 }
@@ -29,6 +29,7 @@
 
 #include "collectd.h"
 #include "common.h"
+#include "utils_avltree.h"
 
 #include "cpython.h"
 
@@ -203,6 +204,70 @@ static PyObject *PluginData_getstring(PyObject *self, void *data) {
 	return cpy_string_to_unicode_or_bytes(value);
 }
 
+/* Host, plugin and type only take a handful of distinct values, so the
+ * getters hand out interned strings from this cache instead of creating a new
+ * object on every access. The GIL protects the cache. */
+#define CPY_STRING_CACHE_MAX 4096
+static c_avl_tree_t *cpy_string_cache;
+static int cpy_string_cache_num;
+
+static PyObject *cpy_string_cache_get(const char *value) {
+	PyObject *ret;
+	char *key;
+
+	if (cpy_string_cache == NULL) {
+		cpy_string_cache = c_avl_create((void *) strcmp);
+		if (cpy_string_cache == NULL)
+			return cpy_string_to_unicode_or_bytes(value);
+	}
+
+	if (c_avl_get(cpy_string_cache, value, (void *) &ret) == 0) {
+		Py_INCREF(ret);
+		return ret;
+	}
+
+	ret = cpy_string_to_unicode_or_bytes(value); /* New reference. */
+	if (ret == NULL || cpy_string_cache_num >= CPY_STRING_CACHE_MAX)
+		return ret;
+#ifdef IS_PY3K
+	if (PyUnicode_CheckExact(ret))
+		PyUnicode_InternInPlace(&ret);
+#else
+	PyString_InternInPlace(&ret);
+#endif
+	key = strdup(value);
+	if (key == NULL)
+		return ret;
+	if (c_avl_insert(cpy_string_cache, key, ret) != 0) {
+		free(key);
+		return ret;
+	}
+	Py_INCREF(ret); /* The cache's reference. */
+	++cpy_string_cache_num;
+	return ret;
+}
+
+void cpy_string_cache_free(void) {
+	char *key;
+	PyObject *value;
+
+	if (cpy_string_cache == NULL)
+		return;
+	while (c_avl_pick(cpy_string_cache, (void *) &key, (void *) &value) == 0) {
+		free(key);
+		Py_DECREF(value);
+	}
+	c_avl_destroy(cpy_string_cache);
+	cpy_string_cache = NULL;
+	cpy_string_cache_num = 0;
+}
+
+static PyObject *PluginData_getstring_cached(PyObject *self, void *data) {
+	const char *value = ((char *) self) + (intptr_t) data;
+	
+	return cpy_string_cache_get(value);
+}
+
 static int PluginData_setstring(PyObject *self, PyObject *value, void *data) {
 	char *old;
 	const char *new;
@@ -251,11 +316,11 @@ static int PluginData_settype(PyObject *self, PyObject *value, void *data) {
 }
 
 static PyGetSetDef PluginData_getseters[] = {
-	{"host", PluginData_getstring, PluginData_setstring, host_doc, (void *) offsetof(PluginData, host)},
-	{"plugin", PluginData_getstring, PluginData_setstring, plugin_doc, (void *) offsetof(PluginData, plugin)},
+	{"host", PluginData_getstring_cached, PluginData_setstring, host_doc, (void *) offsetof(PluginData, host)},
+	{"plugin", PluginData_getstring_cached, PluginData_setstring, plugin_doc, (void *) offsetof(PluginData, plugin)},
 	{"plugin_instance", PluginData_getstring, PluginData_setstring, plugin_instance_doc, (void *) offsetof(PluginData, plugin_instance)},
 	{"type_instance", PluginData_getstring, PluginData_setstring, type_instance_doc, (void *) offsetof(PluginData, type_instance)},
-	{"type", PluginData_getstring, PluginData_settype, type_doc, (void *) offsetof(PluginData, type)},
+	{"type", PluginData_getstring_cached, PluginData_settype, type_doc, (void *) offsetof(PluginData, type)},
 	{NULL}
 };
 
@@ -496,69 +561,54 @@ static meta_data_t *cpy_build_meta(PyObject *meta) {
 	return m;
 }
 
-static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
-	int i, ret;
+/* Fills in the values, meta data, time and interval of "value_list". The
+ * names have to be set already. On success the caller has to free the
+ * "values" and "meta" members, on failure an exception is set. */
+static int cpy_build_value_list(value_list_t *value_list, PyObject *values, PyObject *meta, double time, double interval) {
+	int i;
 	const data_set_t *ds;
 	int size;
 	value_t *value;
-	value_list_t value_list = VALUE_LIST_INIT;
-	PyObject *values = self->values, *meta = self->meta;
-	double time = self->data.time, interval = self->interval;
-	char *host = NULL, *plugin = NULL, *plugin_instance = NULL, *type = NULL, *type_instance = NULL;
-	
-	static char *kwlist[] = {"type", "values", "plugin_instance", "type_instance",
-			"plugin", "host", "time", "interval", "meta", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|etOetetetetddO", kwlist,
-			NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
-			NULL, &plugin, NULL, &host, &time, &interval, &meta))
-		return NULL;
 
-	sstrncpy(value_list.host, host ? host : self->data.host, sizeof(value_list.host));
-	sstrncpy(value_list.plugin, plugin ? plugin : self->data.plugin, sizeof(value_list.plugin));
-	sstrncpy(value_list.plugin_instance, plugin_instance ? plugin_instance : self->data.plugin_instance, sizeof(value_list.plugin_instance));
-	sstrncpy(value_list.type, type ? type : self->data.type, sizeof(value_list.type));
-	sstrncpy(value_list.type_instance, type_instance ? type_instance : self->data.type_instance, sizeof(value_list.type_instance));
-	FreeAll();
-	if (value_list.type[0] == 0) {
+	if (value_list->type[0] == 0) {
 		PyErr_SetString(PyExc_RuntimeError, "type not set");
-		FreeAll();
-		return NULL;
+		return -1;
 	}
-	ds = plugin_get_ds(value_list.type);
+	ds = plugin_get_ds(value_list->type);
 	if (ds == NULL) {
-		PyErr_Format(PyExc_TypeError, "Dataset %s not found", value_list.type);
-		return NULL;
+		PyErr_Format(PyExc_TypeError, "Dataset %s not found", value_list->type);
+		return -1;
 	}
 	if (values == NULL || (PyTuple_Check(values) == 0 && PyList_Check(values) == 0)) {
 		PyErr_Format(PyExc_TypeError, "values must be list or tuple");
-		return NULL;
+		return -1;
 	}
 	if (meta != NULL && meta != Py_None && !PyDict_Check(meta)) {
 		PyErr_Format(PyExc_TypeError, "meta must be a dict");
-		return NULL;
+		return -1;
 	}
 	size = (int) PySequence_Length(values);
 	if (size != ds->ds_num) {
-		PyErr_Format(PyExc_RuntimeError, "type %s needs %d values, got %i", value_list.type, ds->ds_num, size);
-		return NULL;
+		PyErr_Format(PyExc_RuntimeError, "type %s needs %d values, got %i", value_list->type, ds->ds_num, size);
+		return -1;
 	}
 	value = malloc(size * sizeof(*value));
 	for (i = 0; i < size; ++i) {
 		PyObject *item, *num;
 		item = PySequence_Fast_GET_ITEM(values, i); /* Borrowed reference. */
-		if (ds->ds->type == DS_TYPE_COUNTER) {
+		if (ds->ds[i].type == DS_TYPE_COUNTER) {
 			num = PyNumber_Long(item); /* New reference. */
 			if (num != NULL) {
 				value[i].counter = PyLong_AsUnsignedLongLong(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_GAUGE) {
+		} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
 			num = PyNumber_Float(item); /* New reference. */
 			if (num != NULL) {
 				value[i].gauge = PyFloat_AsDouble(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_DERIVE) {
+		} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
 			/* This might overflow without raising an exception.
 			 * Not much we can do about it */
 			num = PyNumber_Long(item); /* New reference. */
@@ -566,7 +616,7 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 				value[i].derive = PyLong_AsLongLong(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_ABSOLUTE) {
+		} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
 			/* This might overflow without raising an exception.
 			 * Not much we can do about it */
 			num = PyNumber_Long(item); /* New reference. */
@@ -576,28 +626,69 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 			}
 		} else {
 			free(value);
-			PyErr_Format(PyExc_RuntimeError, "unknown data type %d for %s", ds->ds->type, value_list.type);
-			return NULL;
+			PyErr_Format(PyExc_RuntimeError, "unknown data type %d for %s", ds->ds[i].type, value_list->type);
+			return -1;
 		}
 		if (PyErr_Occurred() != NULL) {
 			free(value);
-			return NULL;
+			return -1;
 		}
 	}
-	value_list.values = value;
-	value_list.meta = cpy_build_meta(meta);
-	value_list.values_len = size;
-	value_list.time = DOUBLE_TO_CDTIME_T(time);
-	value_list.interval = DOUBLE_TO_CDTIME_T(interval);
-	if (value_list.host[0] == 0)
-		sstrncpy(value_list.host, hostname_g, sizeof(value_list.host));
-	if (value_list.plugin[0] == 0)
-		sstrncpy(value_list.plugin, "python", sizeof(value_list.plugin));
+	value_list->values = value;
+	value_list->meta = cpy_build_meta(meta);
+	value_list->values_len = size;
+	value_list->time = DOUBLE_TO_CDTIME_T(time);
+	value_list->interval = DOUBLE_TO_CDTIME_T(interval);
+	if (value_list->host[0] == 0)
+		sstrncpy(value_list->host, hostname_g, sizeof(value_list->host));
+	if (value_list->plugin[0] == 0)
+		sstrncpy(value_list->plugin, "python", sizeof(value_list->plugin));
+	return 0;
+}
+
+int cpy_values_to_value_list(PyObject *obj, value_list_t *value_list) {
+	Values *self;
+
+	if (!PyObject_TypeCheck(obj, &ValuesType)) {
+		PyErr_SetString(PyExc_TypeError, "expected a collectd.Values object");
+		return -1;
+	}
+	self = (Values *) obj;
+	sstrncpy(value_list->host, self->data.host, sizeof(value_list->host));
+	sstrncpy(value_list->plugin, self->data.plugin, sizeof(value_list->plugin));
+	sstrncpy(value_list->plugin_instance, self->data.plugin_instance, sizeof(value_list->plugin_instance));
+	sstrncpy(value_list->type, self->data.type, sizeof(value_list->type));
+	sstrncpy(value_list->type_instance, self->data.type_instance, sizeof(value_list->type_instance));
+	return cpy_build_value_list(value_list, self->values, self->meta, self->data.time, self->interval);
+}
+
+static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
+	int ret;
+	value_list_t value_list = VALUE_LIST_INIT;
+	PyObject *values = self->values, *meta = self->meta;
+	double time = self->data.time, interval = self->interval;
+	char *host = NULL, *plugin = NULL, *plugin_instance = NULL, *type = NULL, *type_instance = NULL;
+	
+	static char *kwlist[] = {"type", "values", "plugin_instance", "type_instance",
+			"plugin", "host", "time", "interval", "meta", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|etOetetetetddO", kwlist,
+			NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
+			NULL, &plugin, NULL, &host, &time, &interval, &meta))
+		return NULL;
+
+	sstrncpy(value_list.host, host ? host : self->data.host, sizeof(value_list.host));
+	sstrncpy(value_list.plugin, plugin ? plugin : self->data.plugin, sizeof(value_list.plugin));
+	sstrncpy(value_list.plugin_instance, plugin_instance ? plugin_instance : self->data.plugin_instance, sizeof(value_list.plugin_instance));
+	sstrncpy(value_list.type, type ? type : self->data.type, sizeof(value_list.type));
+	sstrncpy(value_list.type_instance, type_instance ? type_instance : self->data.type_instance, sizeof(value_list.type_instance));
+	FreeAll();
+	if (cpy_build_value_list(&value_list, values, meta, time, interval) != 0)
+		return NULL;
 	Py_BEGIN_ALLOW_THREADS;
 	ret = plugin_dispatch_values(&value_list);
 	Py_END_ALLOW_THREADS;
 	meta_data_destroy(value_list.meta);
-	free(value);
+	free(value_list.values);
 	if (ret != 0) {
 		PyErr_SetString(PyExc_RuntimeError, "error dispatching values, read the logs");
 		return NULL;
@@ -606,10 +697,7 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 }
 
 static PyObject *Values_write(Values *self, PyObject *args, PyObject *kwds) {
-	int i, ret;
-	const data_set_t *ds;
-	int size;
-	value_t *value;
+	int ret;
 	value_list_t value_list = VALUE_LIST_INIT;
 	PyObject *values = self->values, *meta = self->meta;
 	double time = self->data.time, interval = self->interval;
@@ -628,80 +716,13 @@ static PyObject *Values_write(Values *self, PyObject *args, PyObject *kwds) {
 	sstrncpy(value_list.type, type ? type : self->data.type, sizeof(value_list.type));
 	sstrncpy(value_list.type_instance, type_instance ? type_instance : self->data.type_instance, sizeof(value_list.type_instance));
 	FreeAll();
-	if (value_list.type[0] == 0) {
-		PyErr_SetString(PyExc_RuntimeError, "type not set");
-		return NULL;
-	}
-	ds = plugin_get_ds(value_list.type);
-	if (ds == NULL) {
-		PyErr_Format(PyExc_TypeError, "Dataset %s not found", value_list.type);
-		return NULL;
-	}
-	if (values == NULL || (PyTuple_Check(values) == 0 && PyList_Check(values) == 0)) {
-		PyErr_Format(PyExc_TypeError, "values must be list or tuple");
+	if (cpy_build_value_list(&value_list, values, meta, time, interval) != 0)
 		return NULL;
-	}
-	size = (int) PySequence_Length(values);
-	if (size != ds->ds_num) {
-		PyErr_Format(PyExc_RuntimeError, "type %s needs %d values, got %i", value_list.type, ds->ds_num, size);
-		return NULL;
-	}
-	value = malloc(size * sizeof(*value));
-	for (i = 0; i < size; ++i) {
-		PyObject *item, *num;
-		item = PySequence_Fast_GET_ITEM(values, i); /* Borrowed reference. */
-		if (ds->ds->type == DS_TYPE_COUNTER) {
-			num = PyNumber_Long(item); /* New reference. */
-			if (num != NULL) {
-				value[i].counter = PyLong_AsUnsignedLongLong(num);
-				Py_XDECREF(num);
-			}
-		} else if (ds->ds->type == DS_TYPE_GAUGE) {
-			num = PyNumber_Float(item); /* New reference. */
-			if (num != NULL) {
-				value[i].gauge = PyFloat_AsDouble(num);
-				Py_XDECREF(num);
-			}
-		} else if (ds->ds->type == DS_TYPE_DERIVE) {
-			/* This might overflow without raising an exception.
-			 * Not much we can do about it */
-			num = PyNumber_Long(item); /* New reference. */
-			if (num != NULL) {
-				value[i].derive = PyLong_AsLongLong(num);
-				Py_XDECREF(num);
-			}
-		} else if (ds->ds->type == DS_TYPE_ABSOLUTE) {
-			/* This might overflow without raising an exception.
-			 * Not much we can do about it */
-			num = PyNumber_Long(item); /* New reference. */
-			if (num != NULL) {
-				value[i].absolute = PyLong_AsUnsignedLongLong(num);
-				Py_XDECREF(num);
-			}
-		} else {
-			free(value);
-			PyErr_Format(PyExc_RuntimeError, "unknown data type %d for %s", ds->ds->type, value_list.type);
-			return NULL;
-		}
-		if (PyErr_Occurred() != NULL) {
-			free(value);
-			return NULL;
-		}
-	}
-	value_list.values = value;
-	value_list.values_len = size;
-	value_list.time = DOUBLE_TO_CDTIME_T(time);
-	value_list.interval = DOUBLE_TO_CDTIME_T(interval);
-	value_list.meta = cpy_build_meta(meta);;
-	if (value_list.host[0] == 0)
-		sstrncpy(value_list.host, hostname_g, sizeof(value_list.host));
-	if (value_list.plugin[0] == 0)
-		sstrncpy(value_list.plugin, "python", sizeof(value_list.plugin));
 	Py_BEGIN_ALLOW_THREADS;
 	ret = plugin_write(dest, NULL, &value_list);
 	Py_END_ALLOW_THREADS;
 	meta_data_destroy(value_list.meta);
-	free(value);
+	free(value_list.values);
 	if (ret != 0) {
 		PyErr_SetString(PyExc_RuntimeError, "error dispatching values, read the logs");
 		return NULL;
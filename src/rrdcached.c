@@ -22,12 +22,61 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_avltree.h"
 #include "utils_rrdcreate.h"
 
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
 
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+#define RC_DEFAULT_PORT "42217"
+
+/* Pending updates are sent once per RC_BATCH_INTERVAL or as soon as
+ * RC_BATCH_SIZE values have accumulated, whichever comes first. */
+#define RC_BATCH_INTERVAL TIME_T_TO_CDTIME_T (1)
+#define RC_BATCH_SIZE 1000
+
+/* Files which haven't been written to for RC_FILE_TIMEOUT are forgotten, so
+ * that the next write checks for them again. The send thread looks for such
+ * files every RC_FILE_TIMEOUT / 4. */
+#define RC_FILE_TIMEOUT TIME_T_TO_CDTIME_T (3600)
+
+/*
+ * Private data types
+ */
+/* One entry per RRD file written to recently. `exists' is set once the file
+ * has been checked (and possibly created); it is cleared again when the
+ * daemon fails to update the file, e.g. because it has been removed. Values
+ * written since the last batch are collected in `pending' as a string of
+ * space separated update arguments. */
+struct rc_file_s;
+typedef struct rc_file_s rc_file_t;
+struct rc_file_s
+{
+  char *filename;
+  _Bool exists;
+  cdtime_t last_update;
+
+  char *pending;
+  size_t pending_len;
+  size_t pending_size;
+
+  _Bool dirty;
+  rc_file_t *next_dirty;
+};
+
+/* An update taken off a file by the sender. */
+typedef struct rc_update_s
+{
+  rc_file_t *file;
+  char *values;
+} rc_update_t;
+
 /*
  * Private variables
  */
@@ -49,6 +98,25 @@ static rrdcreate_config_t rrdcreate_config =
 	/* consolidation_functions_num = */ 0
 };
 
+static c_avl_tree_t   *files = NULL;
+static rc_file_t      *dirty_head = NULL;
+static rc_file_t      *dirty_tail = NULL;
+static size_t          pending_num = 0;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  files_cond = PTHREAD_COND_INITIALIZER;
+
+/* Connection used for sending batches. It is separate from the connection
+ * the RRD library keeps internally for flushing and statistics. Only
+ * accessed with `send_lock' held. */
+static int             send_fd = -1;
+static FILE           *send_fh_in = NULL;
+static FILE           *send_fh_out = NULL;
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t       send_thread;
+static _Bool           send_thread_running = 0;
+static _Bool           send_thread_loop = 0;
+
 /*
  * Prototypes.
  */
@@ -56,6 +124,7 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     user_data_t __attribute__((unused)) *user_data);
 static int rc_flush (__attribute__((unused)) cdtime_t timeout,
     const char *identifier, __attribute__((unused)) user_data_t *ud);
+static void *rc_send_thread (void *arg);
 
 static int value_list_to_string (char *buffer, int buffer_len,
     const data_set_t *ds, const value_list_t *vl)
@@ -395,18 +464,601 @@ static int rc_read (void)
 
 static int rc_init (void)
 {
+  int status;
+
   if (config_collect_stats)
     plugin_register_read ("rrdcached", rc_read);
 
+  if ((daemon_address == NULL) || send_thread_running)
+    return (0);
+
+  send_thread_loop = 1;
+  status = plugin_thread_create (&send_thread, /* attr = */ NULL,
+      rc_send_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: pthread_create failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    send_thread_loop = 0;
+    return (-1);
+  }
+  send_thread_running = 1;
+
   return (0);
 } /* int rc_init */
 
+static void rc_disconnect (void) /* {{{ */
+{
+  if (send_fh_in != NULL)
+    fclose (send_fh_in);
+  send_fh_in = NULL;
+
+  if (send_fh_out != NULL)
+    fclose (send_fh_out);
+  send_fh_out = NULL;
+
+  /* Both file handles use a copy of the descriptor. */
+  if (send_fd >= 0)
+    close (send_fd);
+  send_fd = -1;
+} /* }}} void rc_disconnect */
+
+static int rc_connect_unix (const char *path) /* {{{ */
+{
+  struct sockaddr_un sa;
+  int fd;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  sstrncpy (sa.sun_path, path, sizeof (sa.sun_path));
+
+  fd = socket (PF_UNIX, SOCK_STREAM, /* protocol = */ 0);
+  if (fd < 0)
+    return (-1);
+
+  if (connect (fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+  {
+    close (fd);
+    return (-1);
+  }
+
+  return (fd);
+} /* }}} int rc_connect_unix */
+
+static int rc_connect_network (const char *address) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  struct addrinfo *ai_ptr;
+  char node[NI_MAXHOST];
+  const char *service = RC_DEFAULT_PORT;
+  char *port;
+  int fd = -1;
+  int status;
+
+  sstrncpy (node, address, sizeof (node));
+
+  /* Accepted formats are "host", "host:port", "[address]" and
+   * "[address]:port", as with rrdc_connect(). */
+  if (node[0] == '[')
+  {
+    char *end = strchr (node, ']');
+    if (end == NULL)
+    {
+      ERROR ("rrdcached plugin: Invalid daemon address: %s", address);
+      return (-1);
+    }
+    *end = 0;
+    memmove (node, node + 1, strlen (node + 1) + 1);
+    port = end + 1;
+    if (*port == ':')
+      service = port + 1;
+  }
+  else
+  {
+    port = strrchr (node, ':');
+    if ((port != NULL) && (strchr (node, ':') == port))
+    {
+      *port = 0;
+      service = port + 1;
+    }
+  }
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+
+  status = getaddrinfo (node, service, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: getaddrinfo (%s, %s) failed: %s",
+        node, service, gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) != 0)
+    {
+      close (fd);
+      fd = -1;
+      continue;
+    }
+
+    break;
+  }
+
+  freeaddrinfo (ai_list);
+
+  return (fd);
+} /* }}} int rc_connect_network */
+
+/* Opens the connection used for sending batches, unless it is already open.
+ * Must be called with `send_lock' held. */
+static int rc_connect (void) /* {{{ */
+{
+  int fd;
+
+  if (send_fd >= 0)
+    return (0);
+
+  if (strncmp ("unix:", daemon_address, strlen ("unix:")) == 0)
+    send_fd = rc_connect_unix (daemon_address + strlen ("unix:"));
+  else if (daemon_address[0] == '/')
+    send_fd = rc_connect_unix (daemon_address);
+  else
+    send_fd = rc_connect_network (daemon_address);
+
+  if (send_fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: Connecting to %s failed: %s",
+        daemon_address, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  fd = dup (send_fd);
+  if (fd >= 0)
+  {
+    send_fh_in = fdopen (fd, "r");
+    if (send_fh_in == NULL)
+      close (fd);
+  }
+
+  fd = dup (send_fd);
+  if (fd >= 0)
+  {
+    send_fh_out = fdopen (fd, "w");
+    if (send_fh_out == NULL)
+      close (fd);
+  }
+
+  if ((send_fh_in == NULL) || (send_fh_out == NULL))
+  {
+    ERROR ("rrdcached plugin: Creating file handles for the connection "
+        "to %s failed.", daemon_address);
+    rc_disconnect ();
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rc_connect */
+
+/* Reads one line of response from the daemon and returns its numeric
+ * status. Must be called with `send_lock' held. */
+static int rc_read_response (char *buffer, size_t buffer_size, /* {{{ */
+    int *ret_status)
+{
+  char *endptr = NULL;
+
+  if (fgets (buffer, (int) buffer_size, send_fh_in) == NULL)
+  {
+    ERROR ("rrdcached plugin: Reading from %s failed.", daemon_address);
+    return (-1);
+  }
+
+  *ret_status = (int) strtol (buffer, &endptr, 10);
+  if (endptr == buffer)
+  {
+    ERROR ("rrdcached plugin: Invalid response from %s: %s",
+        daemon_address, buffer);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rc_read_response */
+
+/* Sends all updates in one BATCH command. Commands within a batch are not
+ * acknowledged one by one, so the updates are written without waiting for
+ * the daemon. Must be called with `send_lock' held. */
+static int rc_send_batch (rc_update_t *updates, size_t updates_num) /* {{{ */
+{
+  char buffer[4096];
+  int errors_num;
+  int status;
+  size_t i;
+
+  if (rc_connect () != 0)
+    return (-1);
+
+  fprintf (send_fh_out, "BATCH\n");
+  for (i = 0; i < updates_num; i++)
+    fprintf (send_fh_out, "UPDATE %s%s\n",
+        updates[i].file->filename, updates[i].values);
+  fprintf (send_fh_out, ".\n");
+
+  if (fflush (send_fh_out) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: Sending to %s failed: %s",
+        daemon_address, sstrerror (errno, errbuf, sizeof (errbuf)));
+    rc_disconnect ();
+    return (-1);
+  }
+
+  /* Response to "BATCH". */
+  if ((rc_read_response (buffer, sizeof (buffer), &status) != 0)
+      || (status < 0))
+  {
+    if (status < 0)
+      ERROR ("rrdcached plugin: BATCH command failed: %s", buffer);
+    rc_disconnect ();
+    return (-1);
+  }
+
+  /* Response to ".": the number of errors, followed by one line per
+   * failed command. */
+  if ((rc_read_response (buffer, sizeof (buffer), &errors_num) != 0)
+      || (errors_num < 0))
+  {
+    rc_disconnect ();
+    return (-1);
+  }
+
+  for (i = 0; i < (size_t) errors_num; i++)
+  {
+    long cmd_num;
+    char *msg = NULL;
+    size_t len;
+
+    if (fgets (buffer, sizeof (buffer), send_fh_in) == NULL)
+    {
+      ERROR ("rrdcached plugin: Reading from %s failed.", daemon_address);
+      rc_disconnect ();
+      return (-1);
+    }
+
+    /* Commands following "BATCH" are counted from one. */
+    cmd_num = strtol (buffer, &msg, 10) - 1;
+    len = strlen (msg);
+    while ((len > 0) && ((msg[len - 1] == '\n') || (msg[len - 1] == '\r')))
+      msg[--len] = 0;
+    if ((cmd_num >= 0) && (((size_t) cmd_num) < updates_num))
+    {
+      rc_file_t *rf = updates[cmd_num].file;
+
+      ERROR ("rrdcached plugin: Update of %s failed:%s", rf->filename, msg);
+
+      /* The file may have been removed; check again on the next write. */
+      pthread_mutex_lock (&files_lock);
+      if (config_create_files)
+        rf->exists = 0;
+      pthread_mutex_unlock (&files_lock);
+    }
+    else
+      ERROR ("rrdcached plugin: Batch command failed:%s", msg);
+  }
+
+  return (0);
+} /* }}} int rc_send_batch */
+
+/* Takes all pending updates off the files and sends them to the daemon. */
+static int rc_send_pending (void) /* {{{ */
+{
+  rc_update_t *updates;
+  size_t updates_num;
+  size_t updates_size;
+  rc_file_t *rf;
+  cdtime_t now;
+  int status;
+  size_t i;
+
+  pthread_mutex_lock (&send_lock);
+
+  pthread_mutex_lock (&files_lock);
+  updates_size = 0;
+  for (rf = dirty_head; rf != NULL; rf = rf->next_dirty)
+    updates_size++;
+
+  if (updates_size == 0)
+  {
+    pthread_mutex_unlock (&files_lock);
+    pthread_mutex_unlock (&send_lock);
+    return (0);
+  }
+
+  updates = calloc (updates_size, sizeof (*updates));
+  if (updates == NULL)
+  {
+    pthread_mutex_unlock (&files_lock);
+    pthread_mutex_unlock (&send_lock);
+    ERROR ("rrdcached plugin: calloc failed.");
+    return (-1);
+  }
+
+  now = cdtime ();
+  updates_num = 0;
+  while (dirty_head != NULL)
+  {
+    rf = dirty_head;
+    dirty_head = rf->next_dirty;
+
+    updates[updates_num].file = rf;
+    updates[updates_num].values = rf->pending;
+    updates_num++;
+
+    rf->last_update = now;
+    rf->pending = NULL;
+    rf->pending_len = 0;
+    rf->pending_size = 0;
+    rf->dirty = 0;
+    rf->next_dirty = NULL;
+  }
+  dirty_tail = NULL;
+  pending_num = 0;
+  pthread_mutex_unlock (&files_lock);
+
+  status = rc_send_batch (updates, updates_num);
+  if (status != 0)
+    ERROR ("rrdcached plugin: Sending %zu updates to %s failed. "
+        "The values have been lost.", updates_num, daemon_address);
+
+  pthread_mutex_unlock (&send_lock);
+
+  for (i = 0; i < updates_num; i++)
+    sfree (updates[i].values);
+  sfree (updates);
+
+  return (status);
+} /* }}} int rc_send_pending */
+
+static void rc_file_free (rc_file_t *rf) /* {{{ */
+{
+  if (rf == NULL)
+    return;
+
+  sfree (rf->filename);
+  sfree (rf->pending);
+  sfree (rf);
+} /* }}} void rc_file_free */
+
+/* Removes the entries of files which haven't been written to for
+ * RC_FILE_TIMEOUT. Holding `send_lock' makes sure no batch refers to them. */
+static void rc_files_expire (void) /* {{{ */
+{
+  c_avl_iterator_t *iter;
+  char *key;
+  rc_file_t *rf;
+  rc_file_t *expired = NULL;
+  cdtime_t now;
+
+  pthread_mutex_lock (&send_lock);
+  pthread_mutex_lock (&files_lock);
+  now = cdtime ();
+
+  if (files == NULL)
+  {
+    pthread_mutex_unlock (&files_lock);
+    pthread_mutex_unlock (&send_lock);
+    return;
+  }
+
+  /* The tree must not be modified while iterating over it. Expired entries
+   * are not dirty, so `next_dirty' is free to collect them. */
+  iter = c_avl_get_iterator (files);
+  while (c_avl_iterator_next (iter, (void *) &key, (void *) &rf) == 0)
+  {
+    if (rf->dirty || ((now - rf->last_update) < RC_FILE_TIMEOUT))
+      continue;
+
+    rf->next_dirty = expired;
+    expired = rf;
+  }
+  c_avl_iterator_destroy (iter);
+
+  while (expired != NULL)
+  {
+    rf = expired;
+    expired = rf->next_dirty;
+
+    c_avl_remove (files, rf->filename, NULL, NULL);
+    rc_file_free (rf);
+  }
+
+  pthread_mutex_unlock (&files_lock);
+  pthread_mutex_unlock (&send_lock);
+} /* }}} void rc_files_expire */
+
+static void *rc_send_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  cdtime_t next_expire = cdtime () + (RC_FILE_TIMEOUT / 4);
+
+  pthread_mutex_lock (&files_lock);
+  while (send_thread_loop)
+  {
+    struct timespec ts;
+
+    if (pending_num < RC_BATCH_SIZE)
+    {
+      CDTIME_T_TO_TIMESPEC (cdtime () + RC_BATCH_INTERVAL, &ts);
+      pthread_cond_timedwait (&files_cond, &files_lock, &ts);
+    }
+
+    pthread_mutex_unlock (&files_lock);
+    rc_send_pending ();
+    if (cdtime () >= next_expire)
+    {
+      rc_files_expire ();
+      next_expire = cdtime () + (RC_FILE_TIMEOUT / 4);
+    }
+    pthread_mutex_lock (&files_lock);
+  }
+  pthread_mutex_unlock (&files_lock);
+
+  return ((void *) 0);
+} /* }}} void *rc_send_thread */
+
+static int rc_compare_files (const void *a, const void *b) /* {{{ */
+{
+  return (strcmp ((const char *) a, (const char *) b));
+} /* }}} int rc_compare_files */
+
+/* Returns the entry for `filename', creating it if necessary. Must be called
+ * with `files_lock' held. */
+static rc_file_t *rc_file_get (const char *filename) /* {{{ */
+{
+  rc_file_t *rf = NULL;
+  int status;
+
+  if (files == NULL)
+  {
+    files = c_avl_create (rc_compare_files);
+    if (files == NULL)
+    {
+      ERROR ("rrdcached plugin: c_avl_create failed.");
+      return (NULL);
+    }
+  }
+
+  if (c_avl_get (files, filename, (void *) &rf) == 0)
+    return (rf);
+
+  rf = malloc (sizeof (*rf));
+  if (rf == NULL)
+  {
+    ERROR ("rrdcached plugin: malloc failed.");
+    return (NULL);
+  }
+  memset (rf, 0, sizeof (*rf));
+  rf->pending = NULL;
+  rf->next_dirty = NULL;
+  /* Without CreateFiles, existence of the file is not checked. */
+  rf->exists = config_create_files ? 0 : 1;
+  rf->last_update = cdtime ();
+
+  rf->filename = strdup (filename);
+  if (rf->filename == NULL)
+  {
+    ERROR ("rrdcached plugin: strdup failed.");
+    sfree (rf);
+    return (NULL);
+  }
+
+  status = c_avl_insert (files, rf->filename, rf);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: c_avl_insert failed.");
+    sfree (rf->filename);
+    sfree (rf);
+    return (NULL);
+  }
+
+  return (rf);
+} /* }}} rc_file_t *rc_file_get */
+
+/* Appends " <values>" to the pending updates of `rf'. Must be called with
+ * `files_lock' held. */
+static int rc_file_append (rc_file_t *rf, const char *values) /* {{{ */
+{
+  size_t values_len = strlen (values);
+  size_t required = rf->pending_len + values_len + 2;
+
+  if (required > rf->pending_size)
+  {
+    size_t new_size = (rf->pending_size == 0) ? 64 : rf->pending_size;
+    char *tmp;
+
+    while (new_size < required)
+      new_size *= 2;
+
+    tmp = realloc (rf->pending, new_size);
+    if (tmp == NULL)
+    {
+      ERROR ("rrdcached plugin: realloc failed.");
+      return (-1);
+    }
+    rf->pending = tmp;
+    rf->pending_size = new_size;
+  }
+
+  rf->pending[rf->pending_len] = ' ';
+  memcpy (rf->pending + rf->pending_len + 1, values, values_len + 1);
+  rf->pending_len += values_len + 1;
+
+  if (!rf->dirty)
+  {
+    rf->dirty = 1;
+    rf->next_dirty = NULL;
+    if (dirty_tail == NULL)
+      dirty_head = rf;
+    else
+      dirty_tail->next_dirty = rf;
+    dirty_tail = rf;
+  }
+
+  pending_num++;
+  if (pending_num >= RC_BATCH_SIZE)
+    pthread_cond_signal (&files_cond);
+
+  return (0);
+} /* }}} int rc_file_append */
+
+/* Makes sure `filename' exists, creating it if necessary. */
+static int rc_file_check (const char *filename, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
+{
+  struct stat statbuf;
+  int status;
+
+  status = stat (filename, &statbuf);
+  if (status == 0)
+    return (0);
+
+  if (errno != ENOENT)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: stat (%s) failed: %s",
+        filename, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  status = cu_rrd_create_file (filename, ds, vl, &rrdcreate_config);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
+        filename);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rc_file_check */
+
 static int rc_write (const data_set_t *ds, const value_list_t *vl,
     user_data_t __attribute__((unused)) *user_data)
 {
   char filename[PATH_MAX];
   char values[512];
-  char *values_array[2];
+  rc_file_t *rf;
+  _Bool exists;
   int status;
 
   if (daemon_address == NULL)
@@ -434,52 +1086,37 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     return (-1);
   }
 
-  values_array[0] = values;
-  values_array[1] = NULL;
-
-  if (config_create_files)
-  {
-    struct stat statbuf;
+  pthread_mutex_lock (&files_lock);
+  rf = rc_file_get (filename);
+  exists = (rf != NULL) ? rf->exists : 0;
+  pthread_mutex_unlock (&files_lock);
 
-    status = stat (filename, &statbuf);
-    if (status != 0)
-    {
-      if (errno != ENOENT)
-      {
-        char errbuf[1024];
-        ERROR ("rrdcached plugin: stat (%s) failed: %s",
-            filename, sstrerror (errno, errbuf, sizeof (errbuf)));
-        return (-1);
-      }
-
-      status = cu_rrd_create_file (filename, ds, vl, &rrdcreate_config);
-      if (status != 0)
-      {
-        ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
-            filename);
-        return (-1);
-      }
-    }
-  }
+  if (rf == NULL)
+    return (-1);
 
-  status = rrdc_connect (daemon_address);
-  if (status != 0)
+  /* The file is only checked (and possibly created) when it is first written
+   * to and after the daemon failed to update it. Don't hold the lock while
+   * doing so. */
+  if (!exists)
   {
-    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
-        daemon_address, status);
-    return (-1);
+    status = rc_file_check (filename, ds, vl);
+    if (status != 0)
+      return (-1);
   }
 
-  status = rrdc_update (filename, /* values_num = */ 1, (void *) values_array);
-  if (status != 0)
+  pthread_mutex_lock (&files_lock);
+  /* Look the entry up again, it may have expired in the meantime. */
+  rf = rc_file_get (filename);
+  if (rf == NULL)
   {
-    ERROR ("rrdcached plugin: rrdc_update (%s, [%s], 1) failed with "
-        "status %i.",
-        filename, values_array[0], status);
+    pthread_mutex_unlock (&files_lock);
     return (-1);
   }
+  rf->exists = 1;
+  status = rc_file_append (rf, values);
+  pthread_mutex_unlock (&files_lock);
 
-  return (0);
+  return (status);
 } /* int rc_write */
 
 static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
@@ -497,6 +1134,9 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
   else
     ssnprintf (filename, sizeof (filename), "%s.rrd", identifier);
 
+  /* Make sure the daemon has received all values before flushing. */
+  rc_send_pending ();
+
   status = rrdc_connect (daemon_address);
   if (status != 0)
   {
@@ -519,6 +1159,38 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
 
 static int rc_shutdown (void)
 {
+  if (send_thread_running)
+  {
+    pthread_mutex_lock (&files_lock);
+    send_thread_loop = 0;
+    pthread_cond_signal (&files_cond);
+    pthread_mutex_unlock (&files_lock);
+
+    pthread_join (send_thread, /* retval = */ NULL);
+    send_thread_running = 0;
+  }
+
+  /* Send whatever has been written since the thread's last batch. */
+  if (daemon_address != NULL)
+    rc_send_pending ();
+
+  pthread_mutex_lock (&send_lock);
+  rc_disconnect ();
+  pthread_mutex_unlock (&send_lock);
+
+  if (files != NULL)
+  {
+    char *key;
+    rc_file_t *rf;
+
+    while (c_avl_pick (files, (void *) &key, (void *) &rf) == 0)
+      rc_file_free (rf);
+    c_avl_destroy (files);
+    files = NULL;
+  }
+  dirty_head = NULL;
+  dirty_tail = NULL;
+
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
@@ -35,11 +35,22 @@
 # include <pthread.h>
 #endif
 
+/* Number of cache entries checked per call of `rrd_cache_insert' while the
+ * periodic cache flush is in progress. */
+#define RRD_CACHE_FLUSH_STEP 256
+
 /*
  * Private types
  */
+struct rrd_queue_s;
+typedef struct rrd_queue_s rrd_queue_t;
+
+struct rrd_cache_s;
+typedef struct rrd_cache_s rrd_cache_t;
 struct rrd_cache_s
 {
+	/* Same pointer as the key in the `cache' tree. */
+	char    *filename;
 	int      values_num;
 	char   **values;
 	cdtime_t first_value;
@@ -51,22 +62,46 @@ struct rrd_cache_s
 		FLAG_QUEUED = 0x01,
 		FLAG_FLUSHQ = 0x02
 	} flags;
+	/* Queue entry while FLAG_QUEUED or FLAG_FLUSHQ is set. Protected by
+	 * `cache_lock'. */
+	rrd_queue_t *queue_entry;
+
+	/* All cache entries are kept in a list, so the periodic flush can
+	 * check them a few at a time. */
+	rrd_cache_t *prev;
+	rrd_cache_t *next;
 };
-typedef struct rrd_cache_s rrd_cache_t;
 
-enum rrd_queue_dir_e
+enum rrd_queue_list_e
 {
-  QUEUE_INSERT_FRONT,
-  QUEUE_INSERT_BACK
+	QUEUE_NONE,
+	QUEUE_REGULAR,
+	QUEUE_FLUSH
 };
-typedef enum rrd_queue_dir_e rrd_queue_dir_t;
 
 struct rrd_queue_s
 {
 	char *filename;
-	struct rrd_queue_s *next;
+	/* The list this entry is linked into. Protected by the queue's lock. */
+	enum rrd_queue_list_e list;
+	rrd_queue_t *prev;
+	rrd_queue_t *next;
 };
-typedef struct rrd_queue_s rrd_queue_t;
+
+/* Files are assigned to one of the writer threads by the hash of their name,
+ * so updates of one file are always written in order. */
+struct rrd_writer_s
+{
+	rrd_queue_t    *queue_head;
+	rrd_queue_t    *queue_tail;
+	rrd_queue_t    *flushq_head;
+	rrd_queue_t    *flushq_tail;
+	pthread_t       thread;
+	_Bool           thread_running;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+};
+typedef struct rrd_writer_s rrd_writer_t;
 
 /*
  * Private variables
@@ -82,7 +117,8 @@ static const char *config_keys[] =
 	"RRATimespan",
 	"XFF",
 	"WritesPerSecond",
-	"RandomTimeout"
+	"RandomTimeout",
+	"WriteThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -105,23 +141,23 @@ static rrdcreate_config_t rrdcreate_config =
 	/* consolidation_functions_num = */ 0
 };
 
-/* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
- * ALWAYS lock `cache_lock' first! */
+/* XXX: If you need to lock both, cache_lock and a writer's lock, at the same
+ * time, ALWAYS lock `cache_lock' first! */
 static cdtime_t    cache_timeout = 0;
 static cdtime_t    cache_flush_timeout = 0;
 static cdtime_t    random_timeout = TIME_T_TO_CDTIME_T (1);
 static cdtime_t    cache_flush_last;
 static c_avl_tree_t *cache = NULL;
+static rrd_cache_t  *cache_list_head = NULL;
+static rrd_cache_t  *cache_list_tail = NULL;
+/* Next entry to be checked by the periodic flush, if one is in progress. */
+static rrd_cache_t  *cache_flush_cursor = NULL;
+static _Bool         cache_flush_running = 0;
+static cdtime_t      cache_flush_start;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static rrd_queue_t    *queue_head = NULL;
-static rrd_queue_t    *queue_tail = NULL;
-static rrd_queue_t    *flushq_head = NULL;
-static rrd_queue_t    *flushq_tail = NULL;
-static pthread_t       queue_thread;
-static int             queue_thread_running = 1;
-static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+static rrd_writer_t   *writers = NULL;
+static int             writers_num = 1;
 
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -284,8 +320,68 @@ static int value_list_to_filename (char *buffer, int buffer_len,
 	return (0);
 } /* int value_list_to_filename */
 
-static void *rrd_queue_thread (void __attribute__((unused)) *data)
+/* FNV-1a */
+static rrd_writer_t *rrd_writer_get (const char *filename) /* {{{ */
+{
+	const unsigned char *ptr;
+	uint32_t hash = 2166136261U;
+
+	for (ptr = (const unsigned char *) filename; *ptr != 0; ptr++)
+	{
+		hash ^= (uint32_t) *ptr;
+		hash *= 16777619U;
+	}
+
+	return (writers + (hash % ((uint32_t) writers_num)));
+} /* }}} rrd_writer_t *rrd_writer_get */
+
+/* XXX: You must hold the writer's lock when calling this function! */
+static void rrd_queue_link (rrd_writer_t *w, rrd_queue_t *q, /* {{{ */
+		enum rrd_queue_list_e list)
+{
+	rrd_queue_t **head = (list == QUEUE_FLUSH) ? &w->flushq_head : &w->queue_head;
+	rrd_queue_t **tail = (list == QUEUE_FLUSH) ? &w->flushq_tail : &w->queue_tail;
+
+	q->list = list;
+	q->next = NULL;
+	q->prev = *tail;
+	if (*tail == NULL)
+		*head = q;
+	else
+		(*tail)->next = q;
+	*tail = q;
+} /* }}} void rrd_queue_link */
+
+/* XXX: You must hold the writer's lock when calling this function! */
+static void rrd_queue_unlink (rrd_writer_t *w, rrd_queue_t *q) /* {{{ */
 {
+	rrd_queue_t **head;
+	rrd_queue_t **tail;
+
+	if (q->list == QUEUE_NONE)
+		return;
+
+	head = (q->list == QUEUE_FLUSH) ? &w->flushq_head : &w->queue_head;
+	tail = (q->list == QUEUE_FLUSH) ? &w->flushq_tail : &w->queue_tail;
+
+	if (q->prev == NULL)
+		*head = q->next;
+	else
+		q->prev->next = q->next;
+
+	if (q->next == NULL)
+		*tail = q->prev;
+	else
+		q->next->prev = q->prev;
+
+	q->list = QUEUE_NONE;
+	q->prev = NULL;
+	q->next = NULL;
+} /* }}} void rrd_queue_unlink */
+
+static void *rrd_queue_thread (void *data)
+{
+	rrd_writer_t *w = data;
         struct timeval tv_next_update;
         struct timeval tv_now;
 
@@ -303,21 +399,21 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 		values = NULL;
 		values_num = 0;
 
-                pthread_mutex_lock (&queue_lock);
+                pthread_mutex_lock (&w->lock);
                 /* Wait for values to arrive */
                 while (42)
                 {
                   struct timespec ts_wait;
 
-                  while ((flushq_head == NULL) && (queue_head == NULL)
+                  while ((w->flushq_head == NULL) && (w->queue_head == NULL)
                       && (do_shutdown == 0))
-                    pthread_cond_wait (&queue_cond, &queue_lock);
+                    pthread_cond_wait (&w->cond, &w->lock);
 
-                  if ((flushq_head == NULL) && (queue_head == NULL))
+                  if ((w->flushq_head == NULL) && (w->queue_head == NULL))
                     break;
 
                   /* Don't delay if there's something to flush */
-                  if (flushq_head != NULL)
+                  if (w->flushq_head != NULL)
                     break;
 
                   /* Don't delay if we're shutting down */
@@ -340,43 +436,30 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                   ts_wait.tv_sec = tv_next_update.tv_sec;
                   ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
 
-                  status = pthread_cond_timedwait (&queue_cond, &queue_lock,
+                  status = pthread_cond_timedwait (&w->cond, &w->lock,
                       &ts_wait);
                   if (status == ETIMEDOUT)
                     break;
                 } /* while (42) */
 
-                /* XXX: If you need to lock both, cache_lock and queue_lock, at
-                 * the same time, ALWAYS lock `cache_lock' first! */
+                /* XXX: If you need to lock both, cache_lock and a writer's
+                 * lock, at the same time, ALWAYS lock `cache_lock' first! */
 
                 /* We're in the shutdown phase */
-                if ((flushq_head == NULL) && (queue_head == NULL))
+                if ((w->flushq_head == NULL) && (w->queue_head == NULL))
                 {
-                  pthread_mutex_unlock (&queue_lock);
+                  pthread_mutex_unlock (&w->lock);
                   break;
                 }
 
-                if (flushq_head != NULL)
-                {
-                  /* Dequeue the first flush entry */
-                  queue_entry = flushq_head;
-                  if (flushq_head == flushq_tail)
-                    flushq_head = flushq_tail = NULL;
-                  else
-                    flushq_head = flushq_head->next;
-                }
-                else /* if (queue_head != NULL) */
-                {
-                  /* Dequeue the first regular entry */
-                  queue_entry = queue_head;
-                  if (queue_head == queue_tail)
-                    queue_head = queue_tail = NULL;
-                  else
-                    queue_head = queue_head->next;
-                }
+                /* Dequeue the first flush entry or, if there is none, the
+                 * first regular entry. */
+                queue_entry = (w->flushq_head != NULL)
+                  ? w->flushq_head : w->queue_head;
+                rrd_queue_unlink (w, queue_entry);
 
 		/* Unlock the queue again */
-		pthread_mutex_unlock (&queue_lock);
+		pthread_mutex_unlock (&w->lock);
 
 		/* We now need the cache lock so the entry isn't updated while
 		 * we make a copy of it's values */
@@ -385,7 +468,7 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 		status = c_avl_get (cache, queue_entry->filename,
 				(void *) &cache_entry);
 
-		if (status == 0)
+		if ((status == 0) && (cache_entry->queue_entry == queue_entry))
 		{
 			values = cache_entry->values;
 			values_num = cache_entry->values_num;
@@ -393,6 +476,11 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 			cache_entry->values = NULL;
 			cache_entry->values_num = 0;
 			cache_entry->flags = FLAG_NONE;
+			cache_entry->queue_entry = NULL;
+		}
+		else
+		{
+			status = -1;
 		}
 
 		pthread_mutex_unlock (&cache_lock);
@@ -404,13 +492,14 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 			continue;
 		}
 
-		/* Update `tv_next_update' */
+		/* Update `tv_next_update'. The configured rate applies to all
+		 * writer threads together. */
 		if (write_rate > 0.0) 
                 {
                   gettimeofday (&tv_now, /* timezone = */ NULL);
                   tv_next_update.tv_sec = tv_now.tv_sec;
                   tv_next_update.tv_usec = tv_now.tv_usec
-                    + ((suseconds_t) (1000000 * write_rate));
+                    + ((suseconds_t) (1000000 * write_rate * writers_num));
                   while (tv_next_update.tv_usec > 1000000)
                   {
                     tv_next_update.tv_sec++;
@@ -438,79 +527,118 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 	return ((void *) 0);
 } /* void *rrd_queue_thread */
 
-static int rrd_queue_enqueue (const char *filename,
-    rrd_queue_t **head, rrd_queue_t **tail)
+/* XXX: You must hold "cache_lock" when calling this function! */
+static int rrd_queue_enqueue (rrd_cache_t *rc, enum rrd_queue_list_e list)
 {
   rrd_queue_t *queue_entry;
+  rrd_writer_t *w;
+
+  if (writers == NULL)
+    return (-1);
 
   queue_entry = (rrd_queue_t *) malloc (sizeof (rrd_queue_t));
   if (queue_entry == NULL)
     return (-1);
 
-  queue_entry->filename = strdup (filename);
+  queue_entry->filename = strdup (rc->filename);
   if (queue_entry->filename == NULL)
   {
     free (queue_entry);
     return (-1);
   }
 
-  queue_entry->next = NULL;
+  w = rrd_writer_get (rc->filename);
 
-  pthread_mutex_lock (&queue_lock);
-
-  if (*tail == NULL)
-    *head = queue_entry;
-  else
-    (*tail)->next = queue_entry;
-  *tail = queue_entry;
+  pthread_mutex_lock (&w->lock);
+  rrd_queue_link (w, queue_entry, list);
+  pthread_cond_signal (&w->cond);
+  pthread_mutex_unlock (&w->lock);
 
-  pthread_cond_signal (&queue_cond);
-  pthread_mutex_unlock (&queue_lock);
+  rc->queue_entry = queue_entry;
+  rc->flags = (list == QUEUE_FLUSH) ? FLAG_FLUSHQ : FLAG_QUEUED;
 
   return (0);
 } /* int rrd_queue_enqueue */
 
-static int rrd_queue_dequeue (const char *filename,
-    rrd_queue_t **head, rrd_queue_t **tail)
+/* Moves the queue entry of `rc' from the regular queue to the flush queue.
+ * The cache entry points to its queue entry, so this doesn't need to search
+ * the queue.
+ * XXX: You must hold "cache_lock" when calling this function! */
+static int rrd_queue_move_to_flushq (rrd_cache_t *rc)
 {
-  rrd_queue_t *this;
-  rrd_queue_t *prev;
+  rrd_queue_t *queue_entry = rc->queue_entry;
+  rrd_writer_t *w;
+  int status = 0;
 
-  pthread_mutex_lock (&queue_lock);
+  if (queue_entry == NULL)
+    return (-1);
 
-  prev = NULL;
-  this = *head;
+  w = rrd_writer_get (rc->filename);
 
-  while (this != NULL)
+  pthread_mutex_lock (&w->lock);
+  /* If the entry isn't linked anymore, the writer thread is about to write
+   * the values anyway. */
+  if (queue_entry->list == QUEUE_REGULAR)
   {
-    if (strcmp (this->filename, filename) == 0)
-      break;
-    
-    prev = this;
-    this = this->next;
+    rrd_queue_unlink (w, queue_entry);
+    rrd_queue_link (w, queue_entry, QUEUE_FLUSH);
+    pthread_cond_signal (&w->cond);
+    rc->flags = FLAG_FLUSHQ;
   }
-
-  if (this == NULL)
+  else if (queue_entry->list == QUEUE_NONE)
   {
-    pthread_mutex_unlock (&queue_lock);
-    return (-1);
+    status = -1;
   }
+  pthread_mutex_unlock (&w->lock);
 
-  if (prev == NULL)
-    *head = this->next;
-  else
-    prev->next = this->next;
+  return (status);
+} /* int rrd_queue_move_to_flushq */
+
+/* XXX: You must hold "cache_lock" when calling this function! */
+static void rrd_cache_remove (rrd_cache_t *rc) /* {{{ */
+{
+	char *key = NULL;
 
-  if (this->next == NULL)
-    *tail = prev;
+	if (cache_flush_cursor == rc)
+		cache_flush_cursor = rc->next;
 
-  pthread_mutex_unlock (&queue_lock);
+	if (rc->prev == NULL)
+		cache_list_head = rc->next;
+	else
+		rc->prev->next = rc->next;
 
-  sfree (this->filename);
-  sfree (this);
+	if (rc->next == NULL)
+		cache_list_tail = rc->prev;
+	else
+		rc->next->prev = rc->prev;
 
-  return (0);
-} /* int rrd_queue_dequeue */
+	if (c_avl_remove (cache, rc->filename, (void *) &key, NULL) != 0)
+		DEBUG ("rrdtool plugin: c_avl_remove (%s) failed.", rc->filename);
+
+	assert (rc->values == NULL);
+	assert (rc->values_num == 0);
+
+	sfree (rc->filename);
+	sfree (rc);
+} /* }}} void rrd_cache_remove */
+
+/* Queues `rc' if its oldest value is older than `timeout' and removes it
+ * from the cache if it has no values at all.
+ * XXX: You must hold "cache_lock" when calling this function! */
+static void rrd_cache_flush_entry (rrd_cache_t *rc, /* {{{ */
+		cdtime_t now, cdtime_t timeout)
+{
+	if (rc->flags != FLAG_NONE)
+		return;
+	/* timeout == 0  =>  flush everything */
+	else if ((timeout != 0)
+			&& ((now - rc->first_value) < timeout))
+		return;
+	else if (rc->values_num > 0)
+		rrd_queue_enqueue (rc, QUEUE_REGULAR);
+	else /* ancient and no values -> waste of memory */
+		rrd_cache_remove (rc);
+} /* }}} void rrd_cache_flush_entry */
 
 /* XXX: You must hold "cache_lock" when calling this function! */
 static void rrd_cache_flush (cdtime_t timeout)
@@ -518,79 +646,59 @@ static void rrd_cache_flush (cdtime_t timeout)
 	rrd_cache_t *rc;
 	cdtime_t     now;
 
-	char **keys = NULL;
-	int    keys_num = 0;
-
-	char *key;
-	c_avl_iterator_t *iter;
-	int i;
-
 	DEBUG ("rrdtool plugin: Flushing cache, timeout = %.3f",
 			CDTIME_T_TO_DOUBLE (timeout));
 
 	now = cdtime ();
-	timeout = TIME_T_TO_CDTIME_T (timeout);
 
-	/* Build a list of entries to be flushed */
-	iter = c_avl_get_iterator (cache);
-	while (c_avl_iterator_next (iter, (void *) &key, (void *) &rc) == 0)
+	rc = cache_list_head;
+	while (rc != NULL)
 	{
-		if (rc->flags != FLAG_NONE)
-			continue;
-		/* timeout == 0  =>  flush everything */
-		else if ((timeout != 0)
-				&& ((now - rc->first_value) < timeout))
-			continue;
-		else if (rc->values_num > 0)
-		{
-			int status;
+		rrd_cache_t *next = rc->next;
 
-			status = rrd_queue_enqueue (key, &queue_head,  &queue_tail);
-			if (status == 0)
-				rc->flags = FLAG_QUEUED;
-		}
-		else /* ancient and no values -> waste of memory */
-		{
-			char **tmp = (char **) realloc ((void *) keys,
-					(keys_num + 1) * sizeof (char *));
-			if (tmp == NULL)
-			{
-				char errbuf[1024];
-				ERROR ("rrdtool plugin: "
-						"realloc failed: %s",
-						sstrerror (errno, errbuf,
-							sizeof (errbuf)));
-				c_avl_iterator_destroy (iter);
-				sfree (keys);
-				return;
-			}
-			keys = tmp;
-			keys[keys_num] = key;
-			keys_num++;
-		}
-	} /* while (c_avl_iterator_next) */
-	c_avl_iterator_destroy (iter);
-	
-	for (i = 0; i < keys_num; i++)
+		rrd_cache_flush_entry (rc, now, timeout);
+		rc = next;
+	}
+
+	/* This supersedes a periodic flush in progress. */
+	cache_flush_cursor = NULL;
+	cache_flush_running = 0;
+	cache_flush_last = now;
+} /* void rrd_cache_flush */
+
+/* Performs the periodic flush a few entries at a time, so writing values
+ * doesn't stall while the whole cache is being checked.
+ * XXX: You must hold "cache_lock" when calling this function! */
+static void rrd_cache_flush_step (void) /* {{{ */
+{
+	int i;
+
+	if (!cache_flush_running)
 	{
-		if (c_avl_remove (cache, keys[i], (void *) &key, (void *) &rc) != 0)
-		{
-			DEBUG ("rrdtool plugin: c_avl_remove (%s) failed.", keys[i]);
-			continue;
-		}
+		cdtime_t now = cdtime ();
 
-		assert (rc->values == NULL);
-		assert (rc->values_num == 0);
+		if ((now - cache_flush_last) <= cache_flush_timeout)
+			return;
 
-		sfree (rc);
-		sfree (key);
-		keys[i] = NULL;
-	} /* for (i = 0..keys_num) */
+		cache_flush_running = 1;
+		cache_flush_start = now;
+		cache_flush_cursor = cache_list_head;
+	}
 
-	sfree (keys);
+	for (i = 0; (i < RRD_CACHE_FLUSH_STEP) && (cache_flush_cursor != NULL); i++)
+	{
+		rrd_cache_t *rc = cache_flush_cursor;
 
-	cache_flush_last = now;
-} /* void rrd_cache_flush */
+		cache_flush_cursor = rc->next;
+		rrd_cache_flush_entry (rc, cache_flush_start, cache_flush_timeout);
+	}
+
+	if (cache_flush_cursor == NULL)
+	{
+		cache_flush_running = 0;
+		cache_flush_last = cache_flush_start;
+	}
+} /* }}} void rrd_cache_flush_step */
 
 static int rrd_cache_flush_identifier (cdtime_t timeout,
     const char *identifier)
@@ -631,10 +739,7 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
   }
   else if (rc->flags == FLAG_QUEUED)
   {
-    rrd_queue_dequeue (key, &queue_head, &queue_tail);
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
-    if (status == 0)
-      rc->flags = FLAG_FLUSHQ;
+    status = rrd_queue_move_to_flushq (rc);
   }
   else if ((now - rc->first_value) < timeout)
   {
@@ -642,9 +747,7 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
   }
   else if (rc->values_num > 0)
   {
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
-    if (status == 0)
-      rc->flags = FLAG_FLUSHQ;
+    status = rrd_queue_enqueue (rc, QUEUE_FLUSH);
   }
 
   return (status);
@@ -709,19 +812,29 @@ static int rrd_cache_insert (const char *filename,
 	{
 		rc = malloc (sizeof (*rc));
 		if (rc == NULL)
+		{
+			pthread_mutex_unlock (&cache_lock);
 			return (-1);
+		}
+		memset (rc, 0, sizeof (*rc));
+		rc->filename = NULL;
 		rc->values_num = 0;
 		rc->values = NULL;
 		rc->first_value = 0;
 		rc->last_value = 0;
 		rc->random_variation = rrd_get_random_variation ();
 		rc->flags = FLAG_NONE;
+		rc->queue_entry = NULL;
+		rc->prev = NULL;
+		rc->next = NULL;
 		new_rc = 1;
 	}
 
 	if (rc->last_value >= value_time)
 	{
 		pthread_mutex_unlock (&cache_lock);
+		if (new_rc == 1)
+			sfree (rc);
 		DEBUG ("rrdtool plugin: (rc->last_value = %"PRIu64") "
 				">= (value_time = %"PRIu64")",
 				rc->last_value, value_time);
@@ -733,18 +846,15 @@ static int rrd_cache_insert (const char *filename,
 	if (values_new == NULL)
 	{
 		char errbuf[1024];
-		void *cache_key = NULL;
 
 		sstrerror (errno, errbuf, sizeof (errbuf));
 
-		c_avl_remove (cache, filename, &cache_key, NULL);
+		/* Keep the entry and its values, but drop this value. */
+		if (new_rc == 1)
+			sfree (rc);
 		pthread_mutex_unlock (&cache_lock);
 
 		ERROR ("rrdtool plugin: realloc failed: %s", errbuf);
-
-		sfree (cache_key);
-		sfree (rc->values);
-		sfree (rc);
 		return (-1);
 	}
 	rc->values = values_new;
@@ -777,7 +887,15 @@ static int rrd_cache_insert (const char *filename,
 			return (-1);
 		}
 
+		rc->filename = cache_key;
 		c_avl_insert (cache, cache_key, rc);
+
+		rc->prev = cache_list_tail;
+		if (cache_list_tail == NULL)
+			cache_list_head = rc;
+		else
+			cache_list_tail->next = rc;
+		cache_list_tail = rc;
 	}
 
 	DEBUG ("rrdtool plugin: rrd_cache_insert: file = %s; "
@@ -787,16 +905,11 @@ static int rrd_cache_insert (const char *filename,
 
 	if ((rc->last_value - rc->first_value) >= (cache_timeout + rc->random_variation))
 	{
-		/* XXX: If you need to lock both, cache_lock and queue_lock, at
-		 * the same time, ALWAYS lock `cache_lock' first! */
+		/* XXX: If you need to lock both, cache_lock and a writer's
+		 * lock, at the same time, ALWAYS lock `cache_lock' first! */
 		if (rc->flags == FLAG_NONE)
 		{
-			int status;
-
-			status = rrd_queue_enqueue (filename, &queue_head, &queue_tail);
-			if (status == 0)
-				rc->flags = FLAG_QUEUED;
-
+			rrd_queue_enqueue (rc, QUEUE_REGULAR);
                         rc->random_variation = rrd_get_random_variation ();
 		}
 		else
@@ -805,9 +918,8 @@ static int rrd_cache_insert (const char *filename,
 		}
 	}
 
-	if ((cache_timeout > 0) &&
-			((cdtime () - cache_flush_last) > cache_flush_timeout))
-		rrd_cache_flush (cache_flush_timeout);
+	if (cache_timeout > 0)
+		rrd_cache_flush_step ();
 
 	pthread_mutex_unlock (&cache_lock);
 
@@ -851,6 +963,10 @@ static int rrd_cache_destroy (void) /* {{{ */
 
   c_avl_destroy (cache);
   cache = NULL;
+  cache_list_head = NULL;
+  cache_list_tail = NULL;
+  cache_flush_cursor = NULL;
+  cache_flush_running = 0;
 
   if (non_empty > 0)
   {
@@ -974,7 +1090,7 @@ static int rrd_config (const char *key, const char *value)
 					"be greater than 0.\n");
 			return (1);
 		}
-		cache_flush_timeout = tmp;
+		cache_flush_timeout = TIME_T_TO_CDTIME_T (tmp);
 	}
 	else if (strcasecmp ("DataDir", key) == 0)
 	{
@@ -1109,6 +1225,19 @@ static int rrd_config (const char *key, const char *value)
 			random_timeout = DOUBLE_TO_CDTIME_T (tmp);
 		}
 	}
+	else if (strcasecmp ("WriteThreads", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			fprintf (stderr, "rrdtool: `WriteThreads' must "
+					"be greater than 0.\n");
+			ERROR ("rrdtool: `WriteThreads' must "
+					"be greater than 0.");
+			return (1);
+		}
+		writers_num = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -1118,37 +1247,67 @@ static int rrd_config (const char *key, const char *value)
 
 static int rrd_shutdown (void)
 {
+	_Bool busy = 0;
+	int i;
+
 	pthread_mutex_lock (&cache_lock);
 	rrd_cache_flush (0);
 	pthread_mutex_unlock (&cache_lock);
 
-	pthread_mutex_lock (&queue_lock);
-	do_shutdown = 1;
-	pthread_cond_signal (&queue_cond);
-	pthread_mutex_unlock (&queue_lock);
-
-	if ((queue_thread_running != 0)
-			&& ((queue_head != NULL) || (flushq_head != NULL)))
+	if (writers == NULL)
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread. "
-				"This may take a while.");
+		rrd_cache_destroy ();
+		return (0);
 	}
-	else if (queue_thread_running != 0)
+
+	for (i = 0; i < writers_num; i++)
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread.");
+		pthread_mutex_lock (&writers[i].lock);
+		do_shutdown = 1;
+		if ((writers[i].queue_head != NULL)
+				|| (writers[i].flushq_head != NULL))
+			busy = 1;
+		pthread_cond_signal (&writers[i].cond);
+		pthread_mutex_unlock (&writers[i].lock);
 	}
 
+	if (busy)
+		INFO ("rrdtool plugin: Shutting down the queue threads. "
+				"This may take a while.");
+	else
+		INFO ("rrdtool plugin: Shutting down the queue threads.");
+
 	/* Wait for all the values to be written to disk before returning. */
-	if (queue_thread_running != 0)
+	for (i = 0; i < writers_num; i++)
 	{
-		pthread_join (queue_thread, NULL);
-		memset (&queue_thread, 0, sizeof (queue_thread));
-		queue_thread_running = 0;
-		DEBUG ("rrdtool plugin: queue_thread exited.");
+		if (!writers[i].thread_running)
+			continue;
+
+		pthread_join (writers[i].thread, NULL);
+		writers[i].thread_running = 0;
 	}
+	DEBUG ("rrdtool plugin: queue threads exited.");
 
 	rrd_cache_destroy ();
 
+	/* Entries left behind by threads which couldn't be started. */
+	for (i = 0; i < writers_num; i++)
+	{
+		rrd_queue_t *q;
+
+		while ((q = (writers[i].flushq_head != NULL)
+					? writers[i].flushq_head
+					: writers[i].queue_head) != NULL)
+		{
+			rrd_queue_unlink (writers + i, q);
+			sfree (q->filename);
+			sfree (q);
+		}
+		pthread_mutex_destroy (&writers[i].lock);
+		pthread_cond_destroy (&writers[i].cond);
+	}
+	sfree (writers);
+
 	return (0);
 } /* int rrd_shutdown */
 
@@ -1156,6 +1315,7 @@ static int rrd_init (void)
 {
 	static int init_once = 0;
 	int status;
+	int i;
 
 	if (init_once != 0)
 		return (0);
@@ -1170,6 +1330,7 @@ static int rrd_init (void)
 	cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
 	if (cache == NULL)
 	{
+		pthread_mutex_unlock (&cache_lock);
 		ERROR ("rrdtool plugin: c_avl_create failed.");
 		return (-1);
 	}
@@ -1184,14 +1345,37 @@ static int rrd_init (void)
 
 	pthread_mutex_unlock (&cache_lock);
 
-	status = plugin_thread_create (&queue_thread, /* attr = */ NULL,
-			rrd_queue_thread, /* args = */ NULL);
-	if (status != 0)
+	writers = calloc ((size_t) writers_num, sizeof (*writers));
+	if (writers == NULL)
 	{
-		ERROR ("rrdtool plugin: Cannot create queue-thread.");
+		ERROR ("rrdtool plugin: calloc failed.");
 		return (-1);
 	}
-	queue_thread_running = 1;
+
+	for (i = 0; i < writers_num; i++)
+	{
+		pthread_mutex_init (&writers[i].lock, /* attr = */ NULL);
+		pthread_cond_init (&writers[i].cond, /* attr = */ NULL);
+	}
+
+	for (i = 0; i < writers_num; i++)
+	{
+		status = plugin_thread_create (&writers[i].thread, /* attr = */ NULL,
+				rrd_queue_thread, /* args = */ writers + i);
+		if (status != 0)
+		{
+			ERROR ("rrdtool plugin: Cannot create queue-thread.");
+			return (-1);
+		}
+		writers[i].thread_running = 1;
+	}
+
+#if !HAVE_THREADSAFE_LIBRRD
+	if (writers_num > 1)
+		WARNING ("rrdtool plugin: The RRD library is not thread-safe, so "
+				"the %i queue threads cannot update files in "
+				"parallel.", writers_num);
+#endif
 
 	DEBUG ("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
 			" heartbeat = %i; rrarows = %i; xff = %lf;",
@@ -22,6 +22,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "filter_chain.h"
+#include "utils_ident.h"
 #include "utils_subst.h"
 
 #include <regex.h>
@@ -338,6 +339,9 @@ static int tr_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
   /* HANDLE_FIELD (type); */
   HANDLE_FIELD (type_instance, 1);
 
+  /* The identifier may have changed. */
+  ident_vl_update (vl);
+
   return (FC_TARGET_CONTINUE);
 } /* }}} int tr_invoke */
 
@@ -22,6 +22,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "filter_chain.h"
+#include "utils_ident.h"
 
 struct ts_data_s
 {
@@ -211,6 +212,9 @@ static int ts_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
   /* SET_FIELD (type); */
   SET_FIELD (type_instance);
 
+  /* The identifier may have changed. */
+  ident_vl_update (vl);
+
   return (FC_TARGET_CONTINUE);
 } /* }}} int ts_invoke */
 
@@ -28,6 +28,7 @@
 #include "plugin.h"
 #include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_ident.h"
 
 #include <assert.h>
 #include <pthread.h>
@@ -56,6 +57,8 @@ typedef struct threshold_s
   unsigned int flags;
   int hits;
   struct threshold_s *next;
+  /* Next threshold in the same list of `threshold_index', see below. */
+  struct threshold_s *index_next;
 } threshold_t;
 /* }}} */
 
@@ -64,6 +67,11 @@ typedef struct threshold_s
  * {{{ */
 static c_avl_tree_t   *threshold_tree = NULL;
 static pthread_mutex_t threshold_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Index used by threshold_search: Maps the type to another tree, which maps
+ * the host ("" for any host) to a list of thresholds linked by `index_next'.
+ * Only the first threshold of each `threshold_tree' entry is in the index. */
+static c_avl_tree_t   *threshold_index = NULL;
 /* }}} */
 
 /*
@@ -98,6 +106,72 @@ static threshold_t *threshold_get (const char *hostname,
     return (NULL);
 } /* }}} threshold_t *threshold_get */
 
+/*
+ * int threshold_index_add
+ *
+ * Adds a new entry of `threshold_tree' to `threshold_index'. Must be called
+ * with `threshold_lock' held.
+ */
+static int threshold_index_add (threshold_t *th)
+{ /* {{{ */
+  c_avl_tree_t *hosts = NULL;
+  threshold_t *list = NULL;
+  int status;
+
+  if (threshold_index == NULL)
+  {
+    threshold_index = c_avl_create ((void *) strcmp);
+    if (threshold_index == NULL)
+    {
+      ERROR ("threshold_index_add: c_avl_create failed.");
+      return (-1);
+    }
+  }
+
+  if (c_avl_get (threshold_index, th->type, (void *) &hosts) != 0)
+  {
+    char *type;
+
+    hosts = c_avl_create ((void *) strcmp);
+    type = strdup (th->type);
+    if ((hosts == NULL) || (type == NULL))
+    {
+      ERROR ("threshold_index_add: Out of memory.");
+      if (hosts != NULL)
+        c_avl_destroy (hosts);
+      sfree (type);
+      return (-1);
+    }
+
+    status = c_avl_insert (threshold_index, type, hosts);
+    if (status != 0)
+    {
+      ERROR ("threshold_index_add: c_avl_insert (%s) failed.", type);
+      c_avl_destroy (hosts);
+      sfree (type);
+      return (-1);
+    }
+  }
+
+  if (c_avl_get (hosts, th->host, (void *) &list) == 0)
+  {
+    /* The key is owned by the first threshold of the list. */
+    th->index_next = list->index_next;
+    list->index_next = th;
+    return (0);
+  }
+
+  th->index_next = NULL;
+  status = c_avl_insert (hosts, th->host, th);
+  if (status != 0)
+  {
+    ERROR ("threshold_index_add: c_avl_insert (%s) failed.", th->host);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int threshold_index_add */
+
 /*
  * int ut_threshold_add
  *
@@ -150,7 +224,19 @@ static int ut_threshold_add (const threshold_t *th)
 
   if (th_ptr == NULL) /* no such threshold yet */
   {
+    th_copy->next = NULL;
     status = c_avl_insert (threshold_tree, name_copy, th_copy);
+    if (status == 0)
+    {
+      status = threshold_index_add (th_copy);
+      if (status != 0)
+      {
+        /* Don't free `name_copy' and `th_copy' below, they're in the tree
+         * already. The threshold just won't ever match. */
+        pthread_mutex_unlock (&threshold_lock);
+        return (status);
+      }
+    }
   }
   else /* th_ptr points to the last threshold in the list */
   {
@@ -171,54 +257,92 @@ static int ut_threshold_add (const threshold_t *th)
   return (status);
 } /* }}} int ut_threshold_add */
 
-/* 
+/*
+ * int threshold_match
+ *
+ * Checks whether the threshold `th', which has been found in the index using
+ * the value list's type and host, matches the remaining fields of `vl'.
+ * Returns a negative value if it does not match. Otherwise, returns a score
+ * which is higher the more specific the threshold is: The plugin counts more
+ * than the plugin instance, which counts more than the type instance.
+ */
+static int threshold_match (const threshold_t *th, const value_list_t *vl)
+{ /* {{{ */
+  int score = 0;
+
+  if (th->plugin[0] != 0)
+  {
+    if (strcmp (th->plugin, vl->plugin) != 0)
+      return (-1);
+    score |= 0x04;
+  }
+  else if (th->plugin_instance[0] != 0)
+  {
+    /* A plugin instance without a plugin never matches. */
+    return (-1);
+  }
+
+  if (th->plugin_instance[0] != 0)
+  {
+    if (strcmp (th->plugin_instance, vl->plugin_instance) != 0)
+      return (-1);
+    score |= 0x02;
+  }
+
+  if (th->type_instance[0] != 0)
+  {
+    if (strcmp (th->type_instance, vl->type_instance) != 0)
+      return (-1);
+    score |= 0x01;
+  }
+
+  return (score);
+} /* }}} int threshold_match */
+
+/*
  * threshold_t *threshold_search
  *
  * Searches for a threshold configuration using all the possible variations of
  * "Host", "Plugin" and "Type" blocks. Returns NULL if no threshold could be
- * found.
- * XXX: This is likely the least efficient function in collectd.
+ * found. Values whose type has no threshold cost a single lookup; otherwise
+ * only the thresholds configured for the type and either the value's host or
+ * any host are considered. The most specific matching threshold wins, thresholds
+ * with a host being preferred over thresholds without one.
  */
 static threshold_t *threshold_search (const value_list_t *vl)
 { /* {{{ */
-  threshold_t *th;
+  c_avl_tree_t *hosts;
+  const char *host_keys[] = { vl->host, "" };
+  size_t i;
 
-  if ((th = threshold_get (vl->host, vl->plugin, vl->plugin_instance,
-	  vl->type, vl->type_instance)) != NULL)
-    return (th);
-  else if ((th = threshold_get (vl->host, vl->plugin, vl->plugin_instance,
-	  vl->type, NULL)) != NULL)
-    return (th);
-  else if ((th = threshold_get (vl->host, vl->plugin, NULL,
-	  vl->type, vl->type_instance)) != NULL)
-    return (th);
-  else if ((th = threshold_get (vl->host, vl->plugin, NULL,
-	  vl->type, NULL)) != NULL)
-    return (th);
-  else if ((th = threshold_get (vl->host, "", NULL,
-	  vl->type, vl->type_instance)) != NULL)
-    return (th);
-  else if ((th = threshold_get (vl->host, "", NULL,
-	  vl->type, NULL)) != NULL)
-    return (th);
-  else if ((th = threshold_get ("", vl->plugin, vl->plugin_instance,
-	  vl->type, vl->type_instance)) != NULL)
-    return (th);
-  else if ((th = threshold_get ("", vl->plugin, vl->plugin_instance,
-	  vl->type, NULL)) != NULL)
-    return (th);
-  else if ((th = threshold_get ("", vl->plugin, NULL,
-	  vl->type, vl->type_instance)) != NULL)
-    return (th);
-  else if ((th = threshold_get ("", vl->plugin, NULL,
-	  vl->type, NULL)) != NULL)
-    return (th);
-  else if ((th = threshold_get ("", "", NULL,
-	  vl->type, vl->type_instance)) != NULL)
-    return (th);
-  else if ((th = threshold_get ("", "", NULL,
-	  vl->type, NULL)) != NULL)
-    return (th);
+  if (threshold_index == NULL)
+    return (NULL);
+
+  if (c_avl_get (threshold_index, vl->type, (void *) &hosts) != 0)
+    return (NULL);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (host_keys); i++)
+  {
+    threshold_t *th = NULL;
+    threshold_t *best_th = NULL;
+    int best_score = -1;
+
+    if (c_avl_get (hosts, host_keys[i], (void *) &th) != 0)
+      continue;
+
+    for (; th != NULL; th = th->index_next)
+    {
+      int score = threshold_match (th, vl);
+      if (score > best_score)
+      {
+        best_score = score;
+        best_th = th;
+      }
+    }
+
+    if (best_th != NULL)
+      return (best_th);
+  }
 
   return (NULL);
 } /* }}} threshold_t *threshold_search */
@@ -880,11 +1004,9 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
   if (threshold_tree == NULL)
     return (0);
 
-  /* Is this lock really necessary? So far, thresholds are only inserted at
-   * startup. -octo */
-  pthread_mutex_lock (&threshold_lock);
+  /* Thresholds are only inserted while reading the configuration, i.e.
+   * before any write threads are started, so no lock is needed here. */
   th = threshold_search (vl);
-  pthread_mutex_unlock (&threshold_lock);
   if (th == NULL)
     return (0);
 
@@ -940,7 +1062,8 @@ static int ut_missing (const value_list_t *vl,
 { /* {{{ */
   threshold_t *th;
   cdtime_t missing_time;
-  char identifier[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  const char *identifier;
   notification_t n;
 
   /* dispatch notifications for "interesting" values only */
@@ -952,7 +1075,9 @@ static int ut_missing (const value_list_t *vl,
     return (0);
 
   missing_time = cdtime () - vl->time;
-  FORMAT_VL (identifier, sizeof (identifier), vl);
+  identifier = ident_vl_name (vl, buffer, sizeof (buffer));
+  if (identifier == NULL)
+    return (-1);
 
   NOTIFICATION_INIT_VL (&n, vl);
   ssnprintf (n.message, sizeof (n.message),
@@ -38,6 +38,7 @@
 #include <sys/un.h>
 
 #include <grp.h>
+#include <poll.h>
 
 #ifndef UNIX_PATH_MAX
 # define UNIX_PATH_MAX sizeof (((struct sockaddr_un *)0)->sun_path)
@@ -45,6 +46,50 @@
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
 
+#define US_DEFAULT_WORKER_THREADS 2
+
+/* Input buffers start small and grow up to US_MAX_LINE_LENGTH if a client
+ * sends longer lines. */
+#define US_BUFFER_SIZE_INIT 1024
+#define US_MAX_LINE_LENGTH  1048576
+
+/* Input is no longer read once this many bytes of responses are pending. The
+ * rest is read after the responses have been sent. */
+#define US_MAX_OUTPUT_PENDING 1048576
+
+/*
+ * Private data structures
+ */
+/* Connections are handled by a pool of worker threads. The server thread
+ * polls the listening socket and all idle connections. When a connection
+ * becomes readable, it is handed to a worker, which reads all available
+ * input and handles all complete lines. The responses are collected in
+ * memory and sent without blocking. Afterwards the connection is handed back
+ * to the server thread, which waits until the client has read any responses
+ * that didn't fit into the socket buffer before reading more input. A client
+ * that doesn't read its responses therefore never blocks a worker. */
+struct us_client_s;
+typedef struct us_client_s us_client_t;
+struct us_client_s
+{
+	int fd;
+
+	char *buffer;
+	size_t buffer_size;
+	size_t buffer_fill;
+
+	/* Responses not yet sent. */
+	char *outbuf;
+	size_t outbuf_fill;
+	size_t outbuf_sent;
+
+	/* Set when the client has closed its side of the connection. The
+	 * connection is closed once all responses have been sent. */
+	_Bool eof;
+
+	us_client_t *next;
+};
+
 /*
  * Private variables
  */
@@ -54,7 +99,8 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"DeleteSocket"
+	"DeleteSocket",
+	"WorkerThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -69,6 +115,23 @@ static _Bool delete_socket = 0;
 
 static pthread_t listen_thread = (pthread_t) 0;
 
+/* worker threads */
+static int        workers_num = US_DEFAULT_WORKER_THREADS;
+static pthread_t *workers = NULL;
+static int        workers_running = 0;
+
+/* Connections with pending input, waiting for a worker. */
+static us_client_t    *work_queue_head = NULL;
+static us_client_t    *work_queue_tail = NULL;
+static pthread_mutex_t work_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  work_queue_cond = PTHREAD_COND_INITIALIZER;
+
+/* Connections handed back to the server thread by the workers. The server
+ * thread is woken up by writing to `wakeup_pipe'. */
+static us_client_t    *return_queue = NULL;
+static pthread_mutex_t return_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static int             wakeup_pipe[2] = { -1, -1 };
+
 /*
  * Functions
  */
@@ -174,167 +237,518 @@ static int us_open_socket (void)
 	return (0);
 } /* int us_open_socket */
 
-static void *us_handle_client (void *arg)
+static void us_client_free (us_client_t *client) /* {{{ */
 {
-	int fdin;
-	int fdout;
-	FILE *fhin, *fhout;
+	if (client == NULL)
+		return;
+
+	DEBUG ("unixsock plugin: Closing connection on fd #%i", client->fd);
 
-	fdin = *((int *) arg);
-	free (arg);
-	arg = NULL;
+	if (client->fd >= 0)
+		close (client->fd);
+	sfree (client->buffer);
+	sfree (client->outbuf);
+	sfree (client);
+} /* }}} void us_client_free */
 
-	DEBUG ("unixsock plugin: us_handle_client: Reading from fd #%i", fdin);
+static us_client_t *us_client_create (int fd) /* {{{ */
+{
+	us_client_t *client;
+	int flags;
 
-	fdout = dup (fdin);
-	if (fdout < 0)
+	client = malloc (sizeof (*client));
+	if (client == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: dup failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		pthread_exit ((void *) 1);
+		ERROR ("unixsock plugin: malloc failed.");
+		close (fd);
+		return (NULL);
+	}
+	memset (client, 0, sizeof (*client));
+	client->fd = fd;
+	client->outbuf = NULL;
+	client->next = NULL;
+
+	client->buffer_size = US_BUFFER_SIZE_INIT;
+	client->buffer = malloc (client->buffer_size);
+	if (client->buffer == NULL)
+	{
+		ERROR ("unixsock plugin: malloc failed.");
+		us_client_free (client);
+		return (NULL);
 	}
 
-	fhin  = fdopen (fdin, "r");
-	if (fhin == NULL)
+	flags = fcntl (fd, F_GETFL);
+	if ((flags < 0) || (fcntl (fd, F_SETFL, flags | O_NONBLOCK) != 0))
 	{
 		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
+		ERROR ("unixsock plugin: fcntl failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		us_client_free (client);
+		return (NULL);
 	}
 
-	fhout = fdopen (fdout, "w");
-	if (fhout == NULL)
+	return (client);
+} /* }}} us_client_t *us_client_create */
+
+/* Sends as much of the pending output as the socket takes without blocking.
+ * Returns less than zero on error, zero if all output has been sent and
+ * greater than zero if output is still pending. */
+static int us_client_send (us_client_t *client) /* {{{ */
+{
+	while (client->outbuf_sent < client->outbuf_fill)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin); /* this closes fdin as well */
-		close (fdout);
-		pthread_exit ((void *) 1);
-		return ((void *) 1);
+		ssize_t len;
+
+		len = send (client->fd, client->outbuf + client->outbuf_sent,
+				client->outbuf_fill - client->outbuf_sent, /* flags = */ 0);
+		if (len < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return (1);
+
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					client->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+
+		client->outbuf_sent += (size_t) len;
 	}
 
-	/* change output buffer to line buffered mode */
-	if (setvbuf (fhout, NULL, _IOLBF, 0) != 0)
+	sfree (client->outbuf);
+	client->outbuf_fill = 0;
+	client->outbuf_sent = 0;
+
+	return (0);
+} /* }}} int us_client_send */
+
+static int us_handle_line (FILE *fhout, char *buffer) /* {{{ */
+{
+	char command[32];
+	size_t len;
+
+	len = strlen (buffer);
+	while ((len > 0)
+			&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
+		buffer[--len] = '\0';
+
+	if (len == 0)
+		return (0);
+
+	/* Only the first word is needed to select the handler. */
+	len = strcspn (buffer, " \t");
+	if (len >= sizeof (command))
+		len = sizeof (command) - 1;
+	memcpy (command, buffer, len);
+	command[len] = 0;
+
+	if (strcasecmp (command, "getval") == 0)
+	{
+		handle_getval (fhout, buffer);
+	}
+	else if (strcasecmp (command, "putval") == 0)
+	{
+		handle_putval (fhout, buffer);
+	}
+	else if (strcasecmp (command, "listval") == 0)
+	{
+		handle_listval (fhout, buffer);
+	}
+	else if (strcasecmp (command, "putnotif") == 0)
+	{
+		handle_putnotif (fhout, buffer);
+	}
+	else if (strcasecmp (command, "flush") == 0)
+	{
+		handle_flush (fhout, buffer);
+	}
+	else
+	{
+		if (fprintf (fhout, "-1 Unknown command: %s\n", command) < 0)
+		{
+			char errbuf[1024];
+			WARNING ("unixsock plugin: failed to write response: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+
+	return (0);
+} /* }}} int us_handle_line */
+
+/* Handles all complete lines in the client's buffer and moves the remaining
+ * partial line to the beginning of the buffer. */
+static int us_handle_lines (us_client_t *client, FILE *fhout) /* {{{ */
+{
+	char *line = client->buffer;
+	char *end = client->buffer + client->buffer_fill;
+	int status = 0;
+
+	while (line < end)
+	{
+		char *newline;
+
+		newline = memchr (line, '\n', (size_t) (end - line));
+		if (newline == NULL)
+			break;
+		*newline = 0;
+
+		status = us_handle_line (fhout, line);
+		line = newline + 1;
+		if (status != 0)
+			break;
+	}
+
+	client->buffer_fill = (size_t) (end - line);
+	if ((client->buffer_fill > 0) && (line != client->buffer))
+		memmove (client->buffer, line, client->buffer_fill);
+
+	return (status);
+} /* }}} int us_handle_lines */
+
+/* Reads the available input from the client, handles it and sends the
+ * responses as far as possible without blocking. Returns zero if the
+ * connection should be kept open and non-zero if it should be closed. */
+static int us_handle_client (us_client_t *client) /* {{{ */
+{
+	FILE *fhout;
+	char *out = NULL;
+	size_t out_size = 0;
+	int status = 0;
+
+	/* The server thread only hands over connections without pending
+	 * output. */
+	assert (client->outbuf == NULL);
+
+	fhout = open_memstream (&out, &out_size);
+	if (fhout == NULL)
 	{
 		char errbuf[1024];
-		ERROR ("unixsock plugin: setvbuf failed: %s",
+		ERROR ("unixsock plugin: open_memstream failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin);
-		fclose (fhout);
-		pthread_exit ((void *) 1);
-		return ((void *) 0);
+		return (-1);
 	}
 
 	while (42)
 	{
-		char buffer[1024];
-		char buffer_copy[1024];
-		char *fields[128];
-		int   fields_num;
-		int   len;
+		ssize_t len;
 
-		errno = 0;
-		if (fgets (buffer, sizeof (buffer), fhin) == NULL)
+		if (ftell (fhout) >= US_MAX_OUTPUT_PENDING)
+			break;
+
+		/* Always leave room for a terminating null byte. */
+		if ((client->buffer_fill + 1) >= client->buffer_size)
 		{
-			if ((errno == EINTR) || (errno == EAGAIN))
+			char *tmp;
+
+			if (client->buffer_size >= US_MAX_LINE_LENGTH)
+			{
+				WARNING ("unixsock plugin: Line on socket #%i exceeds %i "
+						"bytes. Closing connection.",
+						client->fd, US_MAX_LINE_LENGTH);
+				fprintf (fhout, "-1 Line too long.\n");
+				status = 1;
+				break;
+			}
+
+			tmp = realloc (client->buffer, 2 * client->buffer_size);
+			if (tmp == NULL)
+			{
+				ERROR ("unixsock plugin: realloc failed.");
+				status = -1;
+				break;
+			}
+			client->buffer = tmp;
+			client->buffer_size *= 2;
+		}
+
+		len = recv (client->fd, client->buffer + client->buffer_fill,
+				client->buffer_size - (client->buffer_fill + 1),
+				/* flags = */ 0);
+		if (len < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
 				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
 
-			if (errno != 0)
+			WARNING ("unixsock plugin: failed to read from socket #%i: %s",
+					client->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			status = -1;
+			break;
+		}
+		else if (len == 0)
+		{
+			/* Handle the last line even if it isn't terminated by a
+			 * newline character. */
+			if (client->buffer_fill > 0)
 			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to read from socket #%i: %s",
-						fileno (fhin),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
+				client->buffer[client->buffer_fill] = 0;
+				us_handle_line (fhout, client->buffer);
+				client->buffer_fill = 0;
 			}
+			status = 1;
 			break;
 		}
 
-		len = strlen (buffer);
-		while ((len > 0)
-				&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-			buffer[--len] = '\0';
+		client->buffer_fill += (size_t) len;
 
-		if (len == 0)
-			continue;
+		status = us_handle_lines (client, fhout);
+		if (status != 0)
+			break;
+	}
 
-		sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+	if (fclose (fhout) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: fclose failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		status = -1;
+	}
 
-		fields_num = strsplit (buffer_copy, fields,
-				sizeof (fields) / sizeof (fields[0]));
-		if (fields_num < 1)
-		{
-			fprintf (fhout, "-1 Internal error\n");
-			fclose (fhin);
-			fclose (fhout);
-			pthread_exit ((void *) 1);
-			return ((void *) 1);
-		}
+	if (status < 0)
+	{
+		sfree (out);
+		return (-1);
+	}
+	else if (status > 0)
+	{
+		/* Send the remaining responses before closing the connection. */
+		client->eof = 1;
+	}
 
-		if (strcasecmp (fields[0], "getval") == 0)
-		{
-			handle_getval (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "putval") == 0)
-		{
-			handle_putval (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "listval") == 0)
-		{
-			handle_listval (fhout, buffer);
-		}
-		else if (strcasecmp (fields[0], "putnotif") == 0)
+	if (out_size > 0)
+	{
+		client->outbuf = out;
+		client->outbuf_fill = out_size;
+		client->outbuf_sent = 0;
+	}
+	else
+	{
+		sfree (out);
+	}
+
+	status = us_client_send (client);
+	if (status < 0)
+		return (-1);
+	else if ((status == 0) && client->eof)
+		return (1);
+
+	return (0);
+} /* }}} int us_handle_client */
+
+static void *us_worker_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	pthread_mutex_lock (&work_queue_lock);
+	while (loop != 0)
+	{
+		us_client_t *client;
+		int status;
+
+		if (work_queue_head == NULL)
 		{
-			handle_putnotif (fhout, buffer);
+			pthread_cond_wait (&work_queue_cond, &work_queue_lock);
+			continue;
 		}
-		else if (strcasecmp (fields[0], "flush") == 0)
+
+		client = work_queue_head;
+		work_queue_head = client->next;
+		if (work_queue_head == NULL)
+			work_queue_tail = NULL;
+		client->next = NULL;
+
+		pthread_mutex_unlock (&work_queue_lock);
+
+		status = us_handle_client (client);
+		if (status != 0)
 		{
-			handle_flush (fhout, buffer);
+			us_client_free (client);
 		}
 		else
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
+			/* Hand the connection back to the server thread. */
+			pthread_mutex_lock (&return_queue_lock);
+			client->next = return_queue;
+			return_queue = client;
+			pthread_mutex_unlock (&return_queue_lock);
+
+			if (write (wakeup_pipe[1], "", 1) < 0)
 			{
 				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				break;
+				if (errno != EAGAIN)
+					ERROR ("unixsock plugin: write to wakeup pipe failed: %s",
+							sstrerror (errno, errbuf, sizeof (errbuf)));
 			}
 		}
-	} /* while (fgets) */
 
-	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
-	fclose (fhin);
-	fclose (fhout);
+		pthread_mutex_lock (&work_queue_lock);
+	}
+	pthread_mutex_unlock (&work_queue_lock);
 
-	pthread_exit ((void *) 0);
 	return ((void *) 0);
-} /* void *us_handle_client */
+} /* }}} void *us_worker_thread */
+
+static void us_work_queue_append (us_client_t *client) /* {{{ */
+{
+	pthread_mutex_lock (&work_queue_lock);
+
+	client->next = NULL;
+	if (work_queue_tail == NULL)
+		work_queue_head = client;
+	else
+		work_queue_tail->next = client;
+	work_queue_tail = client;
+
+	pthread_cond_signal (&work_queue_cond);
+	pthread_mutex_unlock (&work_queue_lock);
+} /* }}} void us_work_queue_append */
+
+/* The first two poll entries are the listening socket and the wakeup pipe,
+ * followed by one entry per idle connection. Idle connections are polled
+ * for input, or for room in the socket buffer if responses are pending. */
+static struct pollfd *pollfds = NULL;
+static us_client_t  **idle_clients = NULL;
+static size_t         idle_clients_num = 0;
+static size_t         idle_clients_size = 0;
+
+static int us_idle_add (us_client_t *client) /* {{{ */
+{
+	if (idle_clients_num >= idle_clients_size)
+	{
+		size_t new_size = (idle_clients_size == 0) ? 16 : 2 * idle_clients_size;
+		struct pollfd *tmp_pollfds;
+		us_client_t **tmp_clients;
+
+		tmp_pollfds = realloc (pollfds, (new_size + 2) * sizeof (*pollfds));
+		if (tmp_pollfds == NULL)
+		{
+			ERROR ("unixsock plugin: realloc failed.");
+			return (-1);
+		}
+		pollfds = tmp_pollfds;
 
-static void *us_server_thread (void __attribute__((unused)) *arg)
+		tmp_clients = realloc (idle_clients, new_size * sizeof (*idle_clients));
+		if (tmp_clients == NULL)
+		{
+			ERROR ("unixsock plugin: realloc failed.");
+			return (-1);
+		}
+		idle_clients = tmp_clients;
+		idle_clients_size = new_size;
+	}
+
+	idle_clients[idle_clients_num] = client;
+	memset (pollfds + 2 + idle_clients_num, 0, sizeof (*pollfds));
+	pollfds[2 + idle_clients_num].fd = client->fd;
+	pollfds[2 + idle_clients_num].events =
+		(client->outbuf != NULL) ? POLLOUT : POLLIN;
+	idle_clients_num++;
+
+	return (0);
+} /* }}} int us_idle_add */
+
+static void us_idle_remove (size_t idx) /* {{{ */
+{
+	assert (idx < idle_clients_num);
+
+	idle_clients_num--;
+	if (idx != idle_clients_num)
+	{
+		idle_clients[idx] = idle_clients[idle_clients_num];
+		pollfds[2 + idx] = pollfds[2 + idle_clients_num];
+	}
+} /* }}} void us_idle_remove */
+
+static void us_accept (void) /* {{{ */
+{
+	us_client_t *client;
+	int fd;
+
+	fd = accept (sock_fd, NULL, NULL);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)
+				|| (errno == ECONNABORTED))
+			return;
+
+		ERROR ("unixsock plugin: accept failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return;
+	}
+
+	DEBUG ("unixsock plugin: Accepted connection on fd #%i", fd);
+
+	client = us_client_create (fd);
+	if (client == NULL)
+		return;
+
+	if (us_idle_add (client) != 0)
+		us_client_free (client);
+} /* }}} void us_accept */
+
+static void us_return_clients (void) /* {{{ */
 {
-	int  status;
-	int *remote_fd;
-	pthread_t th;
-	pthread_attr_t th_attr;
+	us_client_t *client;
+	char buffer[64];
 
-	pthread_attr_init (&th_attr);
-	pthread_attr_setdetachstate (&th_attr, PTHREAD_CREATE_DETACHED);
+	/* Drain the wakeup pipe. */
+	while (read (wakeup_pipe[0], buffer, sizeof (buffer)) > 0)
+		/* do nothing */;
+
+	pthread_mutex_lock (&return_queue_lock);
+	client = return_queue;
+	return_queue = NULL;
+	pthread_mutex_unlock (&return_queue_lock);
+
+	while (client != NULL)
+	{
+		us_client_t *next = client->next;
+
+		client->next = NULL;
+		if (us_idle_add (client) != 0)
+			us_client_free (client);
+
+		client = next;
+	}
+} /* }}} void us_return_clients */
+
+static void *us_server_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	int status;
+	size_t i;
 
 	if (us_open_socket () != 0)
 		pthread_exit ((void *) 1);
 
+	/* Make sure the first two entries exist. */
+	idle_clients_num = 0;
+	idle_clients_size = 0;
+	pollfds = malloc (2 * sizeof (*pollfds));
+	if (pollfds == NULL)
+	{
+		ERROR ("unixsock plugin: malloc failed.");
+		close (sock_fd);
+		sock_fd = -1;
+		pthread_exit ((void *) 1);
+	}
+
 	while (loop != 0)
 	{
-		DEBUG ("unixsock plugin: Calling accept..");
-		status = accept (sock_fd, NULL, NULL);
+		memset (pollfds, 0, 2 * sizeof (*pollfds));
+		pollfds[0].fd = sock_fd;
+		pollfds[0].events = POLLIN;
+		pollfds[1].fd = wakeup_pipe[0];
+		pollfds[1].events = POLLIN;
+
+		status = poll (pollfds, (nfds_t) (2 + idle_clients_num),
+				/* timeout = */ -1);
 		if (status < 0)
 		{
 			char errbuf[1024];
@@ -342,43 +756,63 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 			if (errno == EINTR)
 				continue;
 
-			ERROR ("unixsock plugin: accept failed: %s",
+			ERROR ("unixsock plugin: poll failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (sock_fd);
-			sock_fd = -1;
-			pthread_attr_destroy (&th_attr);
-			pthread_exit ((void *) 1);
+			break;
 		}
 
-		remote_fd = (int *) malloc (sizeof (int));
-		if (remote_fd == NULL)
+		if (loop == 0)
+			break;
+
+		/* Send pending responses and hand readable connections to the
+		 * workers. Iterate backwards, because removing an entry moves the
+		 * last entry into its place. */
+		for (i = idle_clients_num; i > 0; i--)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: malloc failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (status);
-			continue;
-		}
-		*remote_fd = status;
+			us_client_t *client;
 
-		DEBUG ("Spawning child to handle connection on fd #%i", *remote_fd);
+			if (pollfds[2 + i - 1].revents == 0)
+				continue;
 
-		status = plugin_thread_create (&th, &th_attr,
-				us_handle_client, (void *) remote_fd);
-		if (status != 0)
-		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: pthread_create failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (*remote_fd);
-			free (remote_fd);
-			continue;
+			client = idle_clients[i - 1];
+			if (client->outbuf != NULL)
+			{
+				status = us_client_send (client);
+				if (status > 0)
+					continue;
+
+				if ((status < 0) || client->eof)
+				{
+					us_idle_remove (i - 1);
+					us_client_free (client);
+				}
+				else
+				{
+					pollfds[2 + i - 1].events = POLLIN;
+				}
+				continue;
+			}
+
+			us_idle_remove (i - 1);
+			us_work_queue_append (client);
 		}
+
+		if (pollfds[1].revents != 0)
+			us_return_clients ();
+
+		if (pollfds[0].revents != 0)
+			us_accept ();
 	} /* while (loop) */
 
 	close (sock_fd);
 	sock_fd = -1;
-	pthread_attr_destroy (&th_attr);
+
+	for (i = 0; i < idle_clients_num; i++)
+		us_client_free (idle_clients[i]);
+	idle_clients_num = 0;
+	idle_clients_size = 0;
+	sfree (idle_clients);
+	sfree (pollfds);
 
 	status = unlink ((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
 	if (status != 0)
@@ -390,7 +824,7 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 	}
 
 	return ((void *) 0);
-} /* void *us_server_thread */
+} /* }}} void *us_server_thread */
 
 static int us_config (const char *key, const char *val)
 {
@@ -423,6 +857,17 @@ static int us_config (const char *key, const char *val)
 		else
 			delete_socket = 0;
 	}
+	else if (strcasecmp (key, "WorkerThreads") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 1)
+		{
+			ERROR ("unixsock plugin: The \"WorkerThreads\" option requires "
+					"a positive integer.");
+			return (1);
+		}
+		workers_num = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -436,14 +881,49 @@ static int us_init (void)
 	static int have_init = 0;
 
 	int status;
+	int i;
 
 	/* Initialize only once. */
 	if (have_init != 0)
 		return (0);
 	have_init = 1;
 
+	if (pipe (wakeup_pipe) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: pipe failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl (wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
 	loop = 1;
 
+	workers = calloc ((size_t) workers_num, sizeof (*workers));
+	if (workers == NULL)
+	{
+		ERROR ("unixsock plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < workers_num; i++)
+	{
+		status = plugin_thread_create (&workers[workers_running], NULL,
+				us_worker_thread, NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			continue;
+		}
+		workers_running++;
+	}
+
+	if (workers_running == 0)
+		return (-1);
+
 	status = plugin_thread_create (&listen_thread, NULL,
 			us_server_thread, NULL);
 	if (status != 0)
@@ -461,15 +941,49 @@ static int us_shutdown (void)
 {
 	void *ret;
 
+	int i;
+
 	loop = 0;
 
 	if (listen_thread != (pthread_t) 0)
 	{
-		pthread_kill (listen_thread, SIGTERM);
+		if (write (wakeup_pipe[1], "", 1) < 0)
+			pthread_kill (listen_thread, SIGTERM);
 		pthread_join (listen_thread, &ret);
 		listen_thread = (pthread_t) 0;
 	}
 
+	pthread_mutex_lock (&work_queue_lock);
+	pthread_cond_broadcast (&work_queue_cond);
+	pthread_mutex_unlock (&work_queue_lock);
+
+	for (i = 0; i < workers_running; i++)
+		pthread_join (workers[i], /* retval = */ NULL);
+	workers_running = 0;
+	sfree (workers);
+
+	while (work_queue_head != NULL)
+	{
+		us_client_t *next = work_queue_head->next;
+		us_client_free (work_queue_head);
+		work_queue_head = next;
+	}
+	work_queue_tail = NULL;
+
+	while (return_queue != NULL)
+	{
+		us_client_t *next = return_queue->next;
+		us_client_free (return_queue);
+		return_queue = next;
+	}
+
+	if (wakeup_pipe[0] >= 0)
+		close (wakeup_pipe[0]);
+	if (wakeup_pipe[1] >= 0)
+		close (wakeup_pipe[1]);
+	wakeup_pipe[0] = -1;
+	wakeup_pipe[1] = -1;
+
 	plugin_unregister_init ("unixsock");
 	plugin_unregister_shutdown ("unixsock");
 
@@ -22,16 +22,19 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
-#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_ident.h"
 #include "meta_data.h"
 
 #include <assert.h>
 #include <pthread.h>
 
-typedef struct cache_entry_s
+typedef struct cache_entry_s cache_entry_t;
+struct cache_entry_s
 {
 	char name[6 * DATA_MAX_NAME_LEN];
+	/* Equal to `ident_hash_string (name)'. */
+	uint32_t hash;
 	int        values_num;
 	gauge_t   *values_gauge;
 	value_t   *values_raw;
@@ -61,16 +64,217 @@ typedef struct cache_entry_s
 	size_t   history_length;
 
 	meta_data_t *meta;
-} cache_entry_t;
 
-static c_avl_tree_t   *cache_tree = NULL;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+	/* Reference to the interned identifier, keeping it alive for as long as
+	 * the metric is in the cache. May be NULL. */
+	identifier_t *ident;
 
-static int cache_compare (const cache_entry_t *a, const cache_entry_t *b)
+	/* Next entry in the same bucket. */
+	cache_entry_t *next;
+};
+
+/* The cache is split into a number of independently locked shards. The shard
+ * a value list belongs to is determined by hashing its identifier, so
+ * dispatches of different metrics rarely contend for the same lock. Each
+ * shard is a hash table with separate chaining. Entries are found by their
+ * hash and the interned identifier, so the name is only compared if the
+ * caller has no identifier. */
+#define CACHE_SHARDS_NUM 64
+#define CACHE_BUCKETS_INITIAL 64
+
+typedef struct cache_shard_s
+{
+	cache_entry_t **buckets;
+	size_t          buckets_num;
+	size_t          entries_num;
+	pthread_mutex_t lock;
+} cache_shard_t;
+
+static cache_shard_t cache_shards[CACHE_SHARDS_NUM];
+static pthread_once_t cache_shards_once = PTHREAD_ONCE_INIT;
+
+/* What an entry is looked up by. `ident' may be NULL, `name' and `hash' are
+ * always set. */
+typedef struct cache_key_s
+{
+  const char *name;
+  uint32_t hash;
+  const identifier_t *ident;
+  cache_shard_t *shard;
+} cache_key_t;
+
+static void cache_shards_init (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SHARDS_NUM; i++)
+  {
+    cache_shards[i].buckets = NULL;
+    cache_shards[i].buckets_num = 0;
+    cache_shards[i].entries_num = 0;
+    pthread_mutex_init (&cache_shards[i].lock, /* attr = */ NULL);
+  }
+} /* }}} void cache_shards_init */
+
+static cache_shard_t *cache_get_shard_by_hash (uint32_t hash) /* {{{ */
+{
+  return (cache_shards + (hash % CACHE_SHARDS_NUM));
+} /* }}} cache_shard_t *cache_get_shard_by_hash */
+
+/* The shard is selected by the hash modulo the number of shards, so the
+ * remaining bits are used for selecting the bucket. */
+static size_t cache_bucket_index (const cache_shard_t *shard, /* {{{ */
+    uint32_t hash)
+{
+  return ((hash / CACHE_SHARDS_NUM) % shard->buckets_num);
+} /* }}} size_t cache_bucket_index */
+
+/* Fills `key' for looking up the cache entry named `name'. */
+static void uc_name_key (const char *name, cache_key_t *key) /* {{{ */
+{
+  key->name = name;
+  key->hash = ident_hash_string (name);
+  key->ident = NULL;
+  key->shard = cache_get_shard_by_hash (key->hash);
+} /* }}} void uc_name_key */
+
+/* Fills `key' for looking up the cache entry of `vl'. If `vl' carries an
+ * interned identifier, its name and hash are used. Otherwise the name is
+ * formatted into `buffer' and hashed. Returns zero on success. */
+static int uc_vl_key (const value_list_t *vl, /* {{{ */
+    char *buffer, size_t buffer_size, cache_key_t *key)
+{
+  if (vl->ident != NULL)
+  {
+    key->name = ident_name (vl->ident);
+    key->hash = ident_hash (vl->ident);
+    key->ident = vl->ident;
+    key->shard = cache_get_shard_by_hash (key->hash);
+    return (0);
+  }
+
+  if (ident_vl_name (vl, buffer, buffer_size) == NULL)
+    return (-1);
+  uc_name_key (buffer, key);
+  return (0);
+} /* }}} int uc_vl_key */
+
+/* Returns the entry for `key' or NULL if there is none. Must be called with
+ * `key->shard->lock' held. */
+static cache_entry_t *cache_lookup (const cache_key_t *key) /* {{{ */
+{
+  cache_shard_t *shard = key->shard;
+  cache_entry_t *ce;
+
+  if (shard->buckets_num == 0)
+    return (NULL);
+
+  for (ce = shard->buckets[cache_bucket_index (shard, key->hash)];
+      ce != NULL; ce = ce->next)
+  {
+    if (ce->hash != key->hash)
+      continue;
+
+    /* Identifiers are interned, so two identifiers have the same name if
+     * and only if they are the same object. */
+    if ((key->ident != NULL) && (ce->ident != NULL))
+    {
+      if (key->ident == ce->ident)
+        return (ce);
+      continue;
+    }
+
+    if (strcmp (ce->name, key->name) == 0)
+      return (ce);
+  }
+
+  return (NULL);
+} /* }}} cache_entry_t *cache_lookup */
+
+/* Doubles the number of buckets of `shard'. Must be called with the shard's
+ * lock held. Failure is not fatal, the chains just get longer. */
+static void cache_shard_grow (cache_shard_t *shard) /* {{{ */
 {
-  assert ((a != NULL) && (b != NULL));
-  return (strcmp (a->name, b->name));
-} /* int cache_compare */
+  cache_entry_t **buckets;
+  size_t buckets_num;
+  size_t i;
+
+  buckets_num = (shard->buckets_num == 0)
+    ? CACHE_BUCKETS_INITIAL
+    : 2 * shard->buckets_num;
+
+  buckets = calloc (buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+  {
+    ERROR ("utils_cache: cache_shard_grow: calloc failed.");
+    return;
+  }
+
+  for (i = 0; i < shard->buckets_num; i++)
+  {
+    cache_entry_t *ce = shard->buckets[i];
+
+    while (ce != NULL)
+    {
+      cache_entry_t *next = ce->next;
+      size_t idx = (ce->hash / CACHE_SHARDS_NUM) % buckets_num;
+
+      ce->next = buckets[idx];
+      buckets[idx] = ce;
+
+      ce = next;
+    }
+  }
+
+  sfree (shard->buckets);
+  shard->buckets = buckets;
+  shard->buckets_num = buckets_num;
+} /* }}} void cache_shard_grow */
+
+/* Adds `ce' to `shard'. Must be called with the shard's lock held. */
+static int cache_add (cache_shard_t *shard, cache_entry_t *ce) /* {{{ */
+{
+  size_t idx;
+
+  if (shard->entries_num >= 2 * shard->buckets_num)
+    cache_shard_grow (shard);
+  if (shard->buckets_num == 0)
+    return (-1);
+
+  idx = cache_bucket_index (shard, ce->hash);
+  ce->next = shard->buckets[idx];
+  shard->buckets[idx] = ce;
+  shard->entries_num++;
+
+  return (0);
+} /* }}} int cache_add */
+
+/* Removes the entry for `key' from the cache and returns it. Returns NULL if
+ * there is no such entry. Must be called with `key->shard->lock' held. */
+static cache_entry_t *cache_remove (const cache_key_t *key) /* {{{ */
+{
+  cache_shard_t *shard = key->shard;
+  cache_entry_t *ce;
+  cache_entry_t **prev;
+
+  ce = cache_lookup (key);
+  if (ce == NULL)
+    return (NULL);
+
+  for (prev = shard->buckets + cache_bucket_index (shard, ce->hash);
+      *prev != NULL; prev = &(*prev)->next)
+  {
+    if (*prev == ce)
+    {
+      *prev = ce->next;
+      shard->entries_num--;
+      break;
+    }
+  }
+
+  ce->next = NULL;
+  return (ce);
+} /* }}} cache_entry_t *cache_remove */
 
 static cache_entry_t *cache_alloc (int values_num)
 {
@@ -111,6 +315,7 @@ static void cache_free (cache_entry_t *ce)
   sfree (ce->values_gauge);
   sfree (ce->values_raw);
   sfree (ce->history);
+  ident_release (ce->ident);
   if (ce->meta != NULL)
   {
     meta_data_destroy (ce->meta);
@@ -135,30 +340,23 @@ static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
 } /* void uc_check_range */
 
 static int uc_insert (const data_set_t *ds, const value_list_t *vl,
-    const char *key)
+    const cache_key_t *key)
 {
   int i;
-  char *key_copy;
   cache_entry_t *ce;
 
-  /* `cache_lock' has been locked by `uc_update' */
-
-  key_copy = strdup (key);
-  if (key_copy == NULL)
-  {
-    ERROR ("uc_insert: strdup failed.");
-    return (-1);
-  }
+  /* `key->shard->lock' has been locked by `uc_update' */
 
   ce = cache_alloc (ds->ds_num);
   if (ce == NULL)
   {
-    sfree (key_copy);
     ERROR ("uc_insert: cache_alloc (%i) failed.", ds->ds_num);
     return (-1);
   }
 
-  sstrncpy (ce->name, key, sizeof (ce->name));
+  sstrncpy (ce->name, key->name, sizeof (ce->name));
+  ce->hash = key->hash;
+  ce->ident = ident_ref (vl->ident);
 
   for (i = 0; i < ds->ds_num; i++)
   {
@@ -191,6 +389,7 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
 	/* This shouldn't happen. */
 	ERROR ("uc_insert: Don't know how to handle data source type %i.",
 	    ds->ds[i].type);
+	cache_free (ce);
 	return (-1);
     } /* switch (ds->ds[i].type) */
   } /* for (i) */
@@ -203,22 +402,20 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
   ce->interval = vl->interval;
   ce->state = STATE_OKAY;
 
-  if (c_avl_insert (cache_tree, key_copy, ce) != 0)
+  if (cache_add (key->shard, ce) != 0)
   {
-    sfree (key_copy);
-    ERROR ("uc_insert: c_avl_insert failed.");
+    ERROR ("uc_insert: cache_add failed.");
+    cache_free (ce);
     return (-1);
   }
 
-  DEBUG ("uc_insert: Added %s to the cache.", key);
+  DEBUG ("uc_insert: Added %s to the cache.", key->name);
   return (0);
 } /* int uc_insert */
 
 int uc_init (void)
 {
-  if (cache_tree == NULL)
-    cache_tree = c_avl_create ((int (*) (const void *, const void *))
-	cache_compare);
+  pthread_once (&cache_shards_once, cache_shards_init);
 
   return (0);
 } /* int uc_init */
@@ -233,67 +430,69 @@ int uc_check_timeout (void)
   cdtime_t *keys_interval = NULL;
   int keys_len = 0;
 
-  char *key;
-  c_avl_iterator_t *iter;
-
   int status;
   int i;
-  
-  pthread_mutex_lock (&cache_lock);
+  size_t j;
+  size_t k;
 
   now = cdtime ();
 
-  /* Build a list of entries to be flushed */
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &ce) == 0)
+  /* Build a list of entries to be flushed. Only one shard is locked at a
+   * time, so updates of other metrics can proceed meanwhile. */
+  for (j = 0; j < CACHE_SHARDS_NUM; j++)
   {
-    char **tmp;
-    cdtime_t *tmp_time;
-
-    /* If the entry is fresh enough, continue. */
-    if ((now - ce->last_update) < (ce->interval * timeout_g))
-      continue;
+    pthread_mutex_lock (&cache_shards[j].lock);
 
-    /* If entry has not been updated, add to `keys' array */
-    tmp = (char **) realloc ((void *) keys,
-	(keys_len + 1) * sizeof (char *));
-    if (tmp == NULL)
+    for (k = 0; k < cache_shards[j].buckets_num; k++)
+    for (ce = cache_shards[j].buckets[k]; ce != NULL; ce = ce->next)
     {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys = tmp;
+      char **tmp;
+      cdtime_t *tmp_time;
 
-    tmp_time = realloc (keys_time, (keys_len + 1) * sizeof (*keys_time));
-    if (tmp_time == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_time = tmp_time;
+      /* If the entry is fresh enough, continue. */
+      if ((now - ce->last_update) < (ce->interval * timeout_g))
+	continue;
 
-    tmp_time = realloc (keys_interval, (keys_len + 1) * sizeof (*keys_interval));
-    if (tmp_time == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_interval = tmp_time;
+      /* If entry has not been updated, add to `keys' array */
+      tmp = (char **) realloc ((void *) keys,
+	  (keys_len + 1) * sizeof (char *));
+      if (tmp == NULL)
+      {
+	ERROR ("uc_check_timeout: realloc failed.");
+	continue;
+      }
+      keys = tmp;
 
-    keys[keys_len] = strdup (key);
-    if (keys[keys_len] == NULL)
-    {
-      ERROR ("uc_check_timeout: strdup failed.");
-      continue;
-    }
-    keys_time[keys_len] = ce->last_time;
-    keys_interval[keys_len] = ce->interval;
+      tmp_time = realloc (keys_time, (keys_len + 1) * sizeof (*keys_time));
+      if (tmp_time == NULL)
+      {
+	ERROR ("uc_check_timeout: realloc failed.");
+	continue;
+      }
+      keys_time = tmp_time;
+
+      tmp_time = realloc (keys_interval, (keys_len + 1) * sizeof (*keys_interval));
+      if (tmp_time == NULL)
+      {
+	ERROR ("uc_check_timeout: realloc failed.");
+	continue;
+      }
+      keys_interval = tmp_time;
 
-    keys_len++;
-  } /* while (c_avl_iterator_next) */
+      keys[keys_len] = strdup (ce->name);
+      if (keys[keys_len] == NULL)
+      {
+	ERROR ("uc_check_timeout: strdup failed.");
+	continue;
+      }
+      keys_time[keys_len] = ce->last_time;
+      keys_interval[keys_len] = ce->interval;
 
-  c_avl_iterator_destroy (iter);
-  pthread_mutex_unlock (&cache_lock);
+      keys_len++;
+    } /* for (ce) */
+
+    pthread_mutex_unlock (&cache_shards[j].lock);
+  } /* for (j = 0; j < CACHE_SHARDS_NUM; j++) */
 
   if (keys_len == 0)
     return (0);
@@ -328,26 +527,25 @@ int uc_check_timeout (void)
   /* Now actually remove all the values from the cache. We don't re-evaluate
    * the timestamp again, so in theory it is possible we remove a value after
    * it is updated here. */
-  pthread_mutex_lock (&cache_lock);
   for (i = 0; i < keys_len; i++)
   {
-    key = NULL;
-    ce = NULL;
+    cache_key_t key;
 
-    status = c_avl_remove (cache_tree, keys[i],
-	(void *) &key, (void *) &ce);
-    if (status != 0)
+    uc_name_key (keys[i], &key);
+
+    pthread_mutex_lock (&key.shard->lock);
+    ce = cache_remove (&key);
+    pthread_mutex_unlock (&key.shard->lock);
+    if (ce == NULL)
     {
-      ERROR ("uc_check_timeout: c_avl_remove (\"%s\") failed.", keys[i]);
+      ERROR ("uc_check_timeout: cache_remove (\"%s\") failed.", keys[i]);
       sfree (keys[i]);
       continue;
     }
 
     sfree (keys[i]);
-    sfree (key);
     cache_free (ce);
   } /* for (i = 0; i < keys_len; i++) */
-  pthread_mutex_unlock (&cache_lock);
 
   sfree (keys);
   sfree (keys_time);
@@ -358,24 +556,25 @@ int uc_check_timeout (void)
 
 int uc_update (const data_set_t *ds, const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
   cache_entry_t *ce = NULL;
   int status;
   int i;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("uc_update: FORMAT_VL failed.");
     return (-1);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key.shard->lock);
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0) /* entry does not yet exist */
+  ce = cache_lookup (&key);
+  if (ce == NULL) /* entry does not yet exist */
   {
-    status = uc_insert (ds, vl, name);
-    pthread_mutex_unlock (&cache_lock);
+    status = uc_insert (ds, vl, &key);
+    pthread_mutex_unlock (&key.shard->lock);
     return (status);
   }
 
@@ -384,10 +583,10 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
 
   if (ce->last_time >= vl->time)
   {
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&key.shard->lock);
     NOTICE ("uc_update: Value too old: name = %s; value time = %.3f; "
 	"last cache update = %.3f;",
-	name,
+	key.name,
 	CDTIME_T_TO_DOUBLE (vl->time),
 	CDTIME_T_TO_DOUBLE (ce->last_time));
     return (-1);
@@ -447,13 +646,13 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
 
       default:
 	/* This shouldn't happen. */
-	pthread_mutex_unlock (&cache_lock);
+	pthread_mutex_unlock (&key.shard->lock);
 	ERROR ("uc_update: Don't know how to handle data source type %i.",
 	    ds->ds[i].type);
 	return (-1);
     } /* switch (ds->ds[i].type) */
 
-    DEBUG ("uc_update: %s: ds[%i] = %lf", name, i, ce->values_gauge[i]);
+    DEBUG ("uc_update: %s: ds[%i] = %lf", key.name, i, ce->values_gauge[i]);
   } /* for (i) */
 
   /* Update the history if it exists. */
@@ -477,21 +676,23 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
   ce->last_update = cdtime ();
   ce->interval = vl->interval;
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&key.shard->lock);
 
   return (0);
 } /* int uc_update */
 
-int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num)
+static int uc_get_rate_by_key (const cache_key_t *key, /* {{{ */
+    gauge_t **ret_values, size_t *ret_values_num)
 {
   gauge_t *ret = NULL;
   size_t ret_num = 0;
   cache_entry_t *ce = NULL;
   int status = 0;
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key->shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_lookup (key);
+  if (ce != NULL)
   {
     assert (ce != NULL);
 
@@ -506,7 +707,7 @@ int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_val
       ret = (gauge_t *) malloc (ret_num * sizeof (gauge_t));
       if (ret == NULL)
       {
-        ERROR ("utils_cache: uc_get_rate_by_name: malloc failed.");
+        ERROR ("utils_cache: uc_get_rate_by_key: malloc failed.");
         status = -1;
       }
       else
@@ -517,11 +718,11 @@ int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_val
   }
   else
   {
-    DEBUG ("utils_cache: uc_get_rate_by_name: No such value: %s", name);
+    DEBUG ("utils_cache: uc_get_rate_by_key: No such value: %s", key->name);
     status = -1;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&key->shard->lock);
 
   if (status == 0)
   {
@@ -530,22 +731,31 @@ int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_val
   }
 
   return (status);
+} /* }}} int uc_get_rate_by_key */
+
+int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num)
+{
+  cache_key_t key;
+
+  uc_name_key (name, &key);
+  return (uc_get_rate_by_key (&key, ret_values, ret_values_num));
 } /* gauge_t *uc_get_rate_by_name */
 
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
   gauge_t *ret = NULL;
   size_t ret_num = 0;
   int status;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("utils_cache: uc_get_rate: FORMAT_VL failed.");
     return (NULL);
   }
 
-  status = uc_get_rate_by_name (name, &ret, &ret_num);
+  status = uc_get_rate_by_key (&key, &ret, &ret_num);
   if (status != 0)
     return (NULL);
 
@@ -563,87 +773,142 @@ gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
   return (ret);
 } /* gauge_t *uc_get_rate */
 
+/* Used by `uc_get_names' to sort the names while keeping the times aligned. */
+typedef struct uc_name_s
+{
+  char *name;
+  cdtime_t time;
+} uc_name_t;
+
+static int uc_name_compare (const void *a, const void *b) /* {{{ */
+{
+  return (strcmp (((const uc_name_t *) a)->name,
+        ((const uc_name_t *) b)->name));
+} /* }}} int uc_name_compare */
+
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
 {
-  c_avl_iterator_t *iter;
-  char *key;
   cache_entry_t *value;
 
+  uc_name_t *entries = NULL;
   char **names = NULL;
   cdtime_t *times = NULL;
   size_t number = 0;
-  size_t size_arrays = 0;
+  size_t size_entries = 0;
 
   int status = 0;
+  size_t i;
+  size_t j;
 
   if ((ret_names == NULL) || (ret_number == NULL))
     return (-1);
 
-  pthread_mutex_lock (&cache_lock);
-
-  size_arrays = (size_t) c_avl_size (cache_tree);
-  if (size_arrays < 1)
+  for (i = 0; i < CACHE_SHARDS_NUM; i++)
   {
-    /* Handle the "no values" case here, to avoid the error message when
-     * calloc() returns NULL. */
-    pthread_mutex_unlock (&cache_lock);
-    return (0);
-  }
+    cache_shard_t *shard = cache_shards + i;
+    size_t shard_size;
 
-  names = calloc (size_arrays, sizeof (*names));
-  times = calloc (size_arrays, sizeof (*times));
-  if ((names == NULL) || (times == NULL))
-  {
-    ERROR ("uc_get_names: calloc failed.");
-    sfree (names);
-    sfree (times);
-    pthread_mutex_unlock (&cache_lock);
-    return (ENOMEM);
-  }
+    pthread_mutex_lock (&shard->lock);
 
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &value) == 0)
-  {
-    /* remove missing values when list values */
-    if (value->state == STATE_MISSING)
+    /* Make room for all entries of this shard while holding its lock. */
+    shard_size = shard->entries_num;
+    if (shard_size == 0)
+    {
+      pthread_mutex_unlock (&shard->lock);
       continue;
+    }
 
-    /* c_avl_size does not return a number smaller than the number of elements
-     * returned by c_avl_iterator_next. */
-    assert (number < size_arrays);
+    if ((number + shard_size) > size_entries)
+    {
+      uc_name_t *tmp;
 
-    if (ret_times != NULL)
-      times[number] = value->last_time;
+      size_entries = number + shard_size;
 
-    names[number] = strdup (key);
-    if (names[number] == NULL)
-    {
-      status = -1;
-      break;
+      tmp = realloc (entries, size_entries * sizeof (*entries));
+      if (tmp == NULL)
+      {
+        pthread_mutex_unlock (&shard->lock);
+        status = ENOMEM;
+        break;
+      }
+      entries = tmp;
     }
 
-    number++;
-  } /* while (c_avl_iterator_next) */
+    for (j = 0; (j < shard->buckets_num) && (status == 0); j++)
+    for (value = shard->buckets[j]; value != NULL; value = value->next)
+    {
+      /* remove missing values when list values */
+      if (value->state == STATE_MISSING)
+        continue;
+
+      assert (number < size_entries);
+
+      entries[number].time = value->last_time;
+
+      entries[number].name = strdup (value->name);
+      if (entries[number].name == NULL)
+      {
+        status = -1;
+        break;
+      }
+
+      number++;
+    } /* for (value) */
 
-  c_avl_iterator_destroy (iter);
-  pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&shard->lock);
+
+    if (status != 0)
+      break;
+  } /* for (i = 0; i < CACHE_SHARDS_NUM; i++) */
+
+  if ((status == 0) && (number > 0))
+  {
+    names = malloc (number * sizeof (*names));
+    times = malloc (number * sizeof (*times));
+    if ((names == NULL) || (times == NULL))
+      status = ENOMEM;
+  }
 
   if (status != 0)
   {
-    size_t i;
-    
+    if (status == ENOMEM)
+      ERROR ("uc_get_names: malloc failed.");
+
     for (i = 0; i < number; i++)
     {
-      sfree (names[i]);
+      sfree (entries[i].name);
     }
+    sfree (entries);
     sfree (names);
+    sfree (times);
 
     return (-1);
   }
 
+  if (number == 0)
+  {
+    /* Handle the "no values" case like before: leave the return
+     * pointers untouched. */
+    sfree (entries);
+    *ret_number = 0;
+    return (0);
+  }
+
+  /* The shards hold the entries in hash order. Return them sorted by name,
+   * as the single tree used to. */
+  qsort (entries, number, sizeof (*entries), uc_name_compare);
+  for (i = 0; i < number; i++)
+  {
+    names[i] = entries[i].name;
+    times[i] = entries[i].time;
+  }
+  sfree (entries);
+
   *ret_names = names;
   if (ret_times != NULL)
     *ret_times = times;
+  else
+    sfree (times);
   *ret_number = number;
 
   return (0);
@@ -651,74 +916,77 @@ int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
 
 int uc_get_state (const data_set_t *ds, const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key.shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_lookup (&key);
+  if (ce != NULL)
   {
     assert (ce != NULL);
     ret = ce->state;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&key.shard->lock);
 
   return (ret);
 } /* int uc_get_state */
 
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key.shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_lookup (&key);
+  if (ce != NULL)
   {
     assert (ce != NULL);
     ret = ce->state;
     ce->state = state;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&key.shard->lock);
 
   return (ret);
 } /* int uc_set_state */
 
-int uc_get_history_by_name (const char *name,
+static int uc_get_history_by_key (const cache_key_t *key, /* {{{ */
     gauge_t *ret_history, size_t num_steps, size_t num_ds)
 {
   cache_entry_t *ce = NULL;
   size_t i;
-  int status = 0;
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key->shard->lock);
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0)
+  ce = cache_lookup (key);
+  if (ce == NULL)
   {
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&key->shard->lock);
     return (-ENOENT);
   }
 
   if (((size_t) ce->values_num) != num_ds)
   {
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&key->shard->lock);
     return (-EINVAL);
   }
 
@@ -733,7 +1001,7 @@ int uc_get_history_by_name (const char *name,
 	* num_steps * ce->values_num);
     if (tmp == NULL)
     {
-      pthread_mutex_unlock (&cache_lock);
+      pthread_mutex_unlock (&key->shard->lock);
       return (-ENOMEM);
     }
 
@@ -764,98 +1032,114 @@ int uc_get_history_by_name (const char *name,
 	sizeof (*ret_history) * num_ds);
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&key->shard->lock);
 
   return (0);
+} /* }}} int uc_get_history_by_key */
+
+int uc_get_history_by_name (const char *name,
+    gauge_t *ret_history, size_t num_steps, size_t num_ds)
+{
+  cache_key_t key;
+
+  uc_name_key (name, &key);
+  return (uc_get_history_by_key (&key, ret_history, num_steps, num_ds));
 } /* int uc_get_history_by_name */
 
 int uc_get_history (const data_set_t *ds, const value_list_t *vl,
     gauge_t *ret_history, size_t num_steps, size_t num_ds)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("utils_cache: uc_get_history: FORMAT_VL failed.");
     return (-1);
   }
 
-  return (uc_get_history_by_name (name, ret_history, num_steps, num_ds));
+  return (uc_get_history_by_key (&key, ret_history, num_steps, num_ds));
 } /* int uc_get_history */
 
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
   cache_entry_t *ce = NULL;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key.shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_lookup (&key);
+  if (ce != NULL)
   {
     assert (ce != NULL);
     ret = ce->hits;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&key.shard->lock);
 
   return (ret);
 } /* int uc_get_hits */
 
 int uc_set_hits (const data_set_t *ds, const value_list_t *vl, int hits)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key.shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_lookup (&key);
+  if (ce != NULL)
   {
     assert (ce != NULL);
     ret = ce->hits;
     ce->hits = hits;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&key.shard->lock);
 
   return (ret);
 } /* int uc_set_hits */
 
 int uc_inc_hits (const data_set_t *ds, const value_list_t *vl, int step)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
   cache_entry_t *ce = NULL;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key.shard->lock);
 
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_lookup (&key);
+  if (ce != NULL)
   {
     assert (ce != NULL);
     ret = ce->hits;
     ce->hits = ret + step;
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&key.shard->lock);
 
   return (ret);
 } /* int uc_inc_hits */
@@ -863,26 +1147,27 @@ int uc_inc_hits (const data_set_t *ds, const value_list_t *vl, int step)
 /*
  * Meta data interface
  */
-/* XXX: This function will acquire `cache_lock' but will not free it! */
-static meta_data_t *uc_get_meta (const value_list_t *vl) /* {{{ */
+/* XXX: This function will acquire the lock of the shard returned in
+ * `ret_shard' but will not free it! */
+static meta_data_t *uc_get_meta (const value_list_t *vl, /* {{{ */
+    cache_shard_t **ret_shard)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  char buffer[6 * DATA_MAX_NAME_LEN];
+  cache_key_t key;
   cache_entry_t *ce = NULL;
-  int status;
 
-  status = FORMAT_VL (name, sizeof (name), vl);
-  if (status != 0)
+  if (uc_vl_key (vl, buffer, sizeof (buffer), &key) != 0)
   {
     ERROR ("utils_cache: uc_get_meta: FORMAT_VL failed.");
     return (NULL);
   }
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_mutex_lock (&key.shard->lock);
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0)
+  ce = cache_lookup (&key);
+  if (ce == NULL)
   {
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&key.shard->lock);
     return (NULL);
   }
   assert (ce != NULL);
@@ -891,7 +1176,9 @@ static meta_data_t *uc_get_meta (const value_list_t *vl) /* {{{ */
     ce->meta = meta_data_create ();
 
   if (ce->meta == NULL)
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&key.shard->lock);
+  else
+    *ret_shard = key.shard;
 
   return (ce->meta);
 } /* }}} meta_data_t *uc_get_meta */
@@ -900,11 +1187,12 @@ static meta_data_t *uc_get_meta (const value_list_t *vl) /* {{{ */
  * shorter.. */
 #define UC_WRAP(wrap_function) { \
   meta_data_t *meta; \
+  cache_shard_t *shard = NULL; \
   int status; \
-  meta = uc_get_meta (vl); \
+  meta = uc_get_meta (vl, &shard); \
   if (meta == NULL) return (-1); \
   status = wrap_function (meta, key); \
-  pthread_mutex_unlock (&cache_lock); \
+  pthread_mutex_unlock (&shard->lock); \
   return (status); \
 }
 int uc_meta_data_exists (const value_list_t *vl, const char *key)
@@ -918,11 +1206,12 @@ int uc_meta_data_delete (const value_list_t *vl, const char *key)
  * two argumetns. */
 #define UC_WRAP(wrap_function) { \
   meta_data_t *meta; \
+  cache_shard_t *shard = NULL; \
   int status; \
-  meta = uc_get_meta (vl); \
+  meta = uc_get_meta (vl, &shard); \
   if (meta == NULL) return (-1); \
   status = wrap_function (meta, key, value); \
-  pthread_mutex_unlock (&cache_lock); \
+  pthread_mutex_unlock (&shard->lock); \
   return (status); \
 }
 int uc_meta_data_add_string (const value_list_t *vl,
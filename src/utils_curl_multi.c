@@ -0,0 +1,484 @@
+/**
+ * collectd - src/utils_curl_multi.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_curl_multi.h"
+
+#include <pthread.h>
+
+/* Upper bound for waiting in curl_multi_wait() while transfers are in flight
+ * and while idle. The wakeup pipe interrupts the wait when a request is
+ * submitted or cancelled, so these are only a safety net. */
+#define UCM_MAX_WAIT_MS 100
+#define UCM_IDLE_WAIT_MS 1000
+
+struct ucm_request_s
+{
+  CURL *curl;
+  ucm_callback_t callback;
+  void *user_data;
+
+  /* Protected by `ucm_lock'. */
+  _Bool busy;
+  _Bool cancel;
+  ucm_request_t *queue_next;
+  ucm_request_t *cancel_next;
+
+  /* Only used by the transfer thread. */
+  _Bool active;
+  ucm_request_t *active_prev;
+  ucm_request_t *active_next;
+};
+
+static pthread_mutex_t ucm_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled whenever a request stops being busy. */
+static pthread_cond_t ucm_cond = PTHREAD_COND_INITIALIZER;
+static ucm_request_t *ucm_queue_head = NULL;
+static ucm_request_t *ucm_queue_tail = NULL;
+static ucm_request_t *ucm_cancel_head = NULL;
+static pthread_t ucm_thread;
+static _Bool ucm_thread_running = 0;
+static _Bool ucm_thread_stop = 0;
+static int ucm_wakeup_pipe[2] = { -1, -1 };
+
+/* Only used by the transfer thread once it is running. */
+static CURLM *ucm_multi = NULL;
+static ucm_request_t *ucm_active_head = NULL;
+
+static void ucm_wakeup (void) /* {{{ */
+{
+  if (write (ucm_wakeup_pipe[1], "", 1) < 0)
+  {
+    char errbuf[1024];
+    if (errno != EAGAIN)
+      ERROR ("utils_curl_multi: write to wakeup pipe failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+} /* }}} void ucm_wakeup */
+
+static void ucm_active_remove (ucm_request_t *req) /* {{{ */
+{
+  if (req->active_prev == NULL)
+    ucm_active_head = req->active_next;
+  else
+    req->active_prev->active_next = req->active_next;
+
+  if (req->active_next != NULL)
+    req->active_next->active_prev = req->active_prev;
+
+  req->active = 0;
+  req->active_prev = NULL;
+  req->active_next = NULL;
+} /* }}} void ucm_active_remove */
+
+static void ucm_request_idle (ucm_request_t *req) /* {{{ */
+{
+  pthread_mutex_lock (&ucm_lock);
+  req->busy = 0;
+  pthread_cond_broadcast (&ucm_cond);
+  pthread_mutex_unlock (&ucm_lock);
+} /* }}} void ucm_request_idle */
+
+static void ucm_request_finish (ucm_request_t *req, CURLcode status) /* {{{ */
+{
+  req->callback (req->curl, status, req->user_data);
+  ucm_request_idle (req);
+} /* }}} void ucm_request_finish */
+
+static void ucm_add_requests (ucm_request_t *queue) /* {{{ */
+{
+  while (queue != NULL)
+  {
+    ucm_request_t *req = queue;
+    CURLMcode status;
+
+    queue = req->queue_next;
+    req->queue_next = NULL;
+
+    curl_easy_setopt (req->curl, CURLOPT_PRIVATE, (void *) req);
+
+    status = curl_multi_add_handle (ucm_multi, req->curl);
+    if (status != CURLM_OK)
+    {
+      ERROR ("utils_curl_multi: curl_multi_add_handle failed: %s",
+          curl_multi_strerror (status));
+      ucm_request_finish (req, CURLE_FAILED_INIT);
+      continue;
+    }
+
+    req->active = 1;
+    req->active_prev = NULL;
+    req->active_next = ucm_active_head;
+    if (ucm_active_head != NULL)
+      ucm_active_head->active_prev = req;
+    ucm_active_head = req;
+  }
+} /* }}} void ucm_add_requests */
+
+/* Aborts the transfers of the cancelled requests. Must be called after the
+ * queue has been passed to `ucm_add_requests', so that every cancelled
+ * request is either active or has finished already. */
+static void ucm_cancel_requests (ucm_request_t *cancel) /* {{{ */
+{
+  while (cancel != NULL)
+  {
+    ucm_request_t *req = cancel;
+
+    pthread_mutex_lock (&ucm_lock);
+    cancel = req->cancel_next;
+    req->cancel_next = NULL;
+    req->cancel = 0;
+    pthread_mutex_unlock (&ucm_lock);
+
+    if (!req->active)
+      continue;
+
+    curl_multi_remove_handle (ucm_multi, req->curl);
+    ucm_active_remove (req);
+    ucm_request_idle (req);
+  }
+} /* }}} void ucm_cancel_requests */
+
+/* Lets libcurl do its work and calls the callbacks of finished transfers. */
+static void ucm_perform (void) /* {{{ */
+{
+  CURLMsg *msg;
+  CURLMcode status;
+  int running = 0;
+  int msgs_left = 0;
+
+  do
+    status = curl_multi_perform (ucm_multi, &running);
+  while (status == CURLM_CALL_MULTI_PERFORM);
+
+  if (status != CURLM_OK)
+    ERROR ("utils_curl_multi: curl_multi_perform failed: %s",
+        curl_multi_strerror (status));
+
+  while ((msg = curl_multi_info_read (ucm_multi, &msgs_left)) != NULL)
+  {
+    ucm_request_t *req;
+    char *private = NULL;
+    CURL *curl;
+    CURLcode result;
+
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    /* `msg' is invalidated by removing the handle. */
+    curl = msg->easy_handle;
+    result = msg->data.result;
+
+    curl_easy_getinfo (curl, CURLINFO_PRIVATE, &private);
+    req = (ucm_request_t *) private;
+
+    curl_multi_remove_handle (ucm_multi, curl);
+    if (req == NULL)
+      continue;
+
+    ucm_active_remove (req);
+    ucm_request_finish (req, result);
+  }
+} /* }}} void ucm_perform */
+
+/* Waits until one of libcurl's sockets or the wakeup pipe becomes ready or
+ * libcurl's timeout expires. Unlike select(2), curl_multi_wait handles file
+ * descriptors beyond FD_SETSIZE. */
+static void ucm_wait (void) /* {{{ */
+{
+  struct curl_waitfd wakeup_fd;
+  CURLMcode status;
+  int timeout_ms;
+  int numfds = 0;
+
+  memset (&wakeup_fd, 0, sizeof (wakeup_fd));
+  wakeup_fd.fd = ucm_wakeup_pipe[0];
+  wakeup_fd.events = CURL_WAIT_POLLIN;
+
+  /* libcurl shortens the timeout if it needs to be called earlier. */
+  timeout_ms = (ucm_active_head == NULL) ? UCM_IDLE_WAIT_MS : UCM_MAX_WAIT_MS;
+
+  status = curl_multi_wait (ucm_multi, &wakeup_fd, /* extra_nfds = */ 1,
+      timeout_ms, &numfds);
+  if (status != CURLM_OK)
+  {
+    ERROR ("utils_curl_multi: curl_multi_wait failed: %s",
+        curl_multi_strerror (status));
+    return;
+  }
+
+  if (wakeup_fd.revents != 0)
+  {
+    char buffer[64];
+
+    while (read (ucm_wakeup_pipe[0], buffer, sizeof (buffer)) > 0)
+      /* do nothing */;
+  }
+} /* }}} void ucm_wait */
+
+static void *ucm_thread_main (void __attribute__((unused)) *arg) /* {{{ */
+{
+  pthread_mutex_lock (&ucm_lock);
+  while (!ucm_thread_stop)
+  {
+    ucm_request_t *queue;
+    ucm_request_t *cancel;
+
+    queue = ucm_queue_head;
+    ucm_queue_head = NULL;
+    ucm_queue_tail = NULL;
+    cancel = ucm_cancel_head;
+    ucm_cancel_head = NULL;
+    pthread_mutex_unlock (&ucm_lock);
+
+    ucm_add_requests (queue);
+    ucm_cancel_requests (cancel);
+    ucm_perform ();
+    ucm_wait ();
+
+    pthread_mutex_lock (&ucm_lock);
+  }
+  pthread_mutex_unlock (&ucm_lock);
+
+  /* Abort all transfers still in flight. */
+  while (ucm_active_head != NULL)
+  {
+    ucm_request_t *req = ucm_active_head;
+
+    curl_multi_remove_handle (ucm_multi, req->curl);
+    ucm_active_remove (req);
+    ucm_request_idle (req);
+  }
+
+  return ((void *) 0);
+} /* }}} void *ucm_thread_main */
+
+/* Must be called with `ucm_lock' held. */
+static int ucm_thread_start (void) /* {{{ */
+{
+  int status;
+
+  if (pipe (ucm_wakeup_pipe) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("utils_curl_multi: pipe failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+  fcntl (ucm_wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl (ucm_wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
+  ucm_multi = curl_multi_init ();
+  if (ucm_multi == NULL)
+  {
+    ERROR ("utils_curl_multi: curl_multi_init failed.");
+    close (ucm_wakeup_pipe[0]);
+    close (ucm_wakeup_pipe[1]);
+    ucm_wakeup_pipe[0] = -1;
+    ucm_wakeup_pipe[1] = -1;
+    return (-1);
+  }
+
+#ifdef CURLPIPE_MULTIPLEX
+  /* Send concurrent requests to the same server over one HTTP/2
+   * connection, if the server supports it. */
+  curl_multi_setopt (ucm_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+  ucm_thread_stop = 0;
+  status = plugin_thread_create (&ucm_thread, /* attr = */ NULL,
+      ucm_thread_main, /* arg = */ NULL);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("utils_curl_multi: pthread_create failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    curl_multi_cleanup (ucm_multi);
+    ucm_multi = NULL;
+    close (ucm_wakeup_pipe[0]);
+    close (ucm_wakeup_pipe[1]);
+    ucm_wakeup_pipe[0] = -1;
+    ucm_wakeup_pipe[1] = -1;
+    return (-1);
+  }
+
+  ucm_thread_running = 1;
+  return (0);
+} /* }}} int ucm_thread_start */
+
+ucm_request_t *ucm_request_create (CURL *curl, /* {{{ */
+    ucm_callback_t callback, void *user_data)
+{
+  ucm_request_t *req;
+
+  if ((curl == NULL) || (callback == NULL))
+    return (NULL);
+
+  req = malloc (sizeof (*req));
+  if (req == NULL)
+  {
+    ERROR ("utils_curl_multi: malloc failed.");
+    return (NULL);
+  }
+  memset (req, 0, sizeof (*req));
+
+  req->curl = curl;
+  req->callback = callback;
+  req->user_data = user_data;
+
+  return (req);
+} /* }}} ucm_request_t *ucm_request_create */
+
+void ucm_request_destroy (ucm_request_t *req) /* {{{ */
+{
+  if (req == NULL)
+    return;
+
+  assert (!req->busy);
+  sfree (req);
+} /* }}} void ucm_request_destroy */
+
+int ucm_submit (ucm_request_t *req) /* {{{ */
+{
+  if (req == NULL)
+    return (-1);
+
+  pthread_mutex_lock (&ucm_lock);
+
+  /* A cancelled request may still be on the cancel list after its transfer
+   * finished. */
+  if (req->busy || req->cancel)
+  {
+    pthread_mutex_unlock (&ucm_lock);
+    return (EBUSY);
+  }
+
+  if (!ucm_thread_running && (ucm_thread_start () != 0))
+  {
+    pthread_mutex_unlock (&ucm_lock);
+    return (-1);
+  }
+
+  req->busy = 1;
+  req->queue_next = NULL;
+  if (ucm_queue_tail == NULL)
+    ucm_queue_head = req;
+  else
+    ucm_queue_tail->queue_next = req;
+  ucm_queue_tail = req;
+
+  pthread_mutex_unlock (&ucm_lock);
+
+  ucm_wakeup ();
+  return (0);
+} /* }}} int ucm_submit */
+
+_Bool ucm_request_busy (ucm_request_t *req) /* {{{ */
+{
+  _Bool busy;
+
+  if (req == NULL)
+    return (0);
+
+  pthread_mutex_lock (&ucm_lock);
+  busy = req->busy;
+  pthread_mutex_unlock (&ucm_lock);
+
+  return (busy);
+} /* }}} _Bool ucm_request_busy */
+
+void ucm_request_cancel (ucm_request_t *req) /* {{{ */
+{
+  if (req == NULL)
+    return;
+
+  pthread_mutex_lock (&ucm_lock);
+  if (!req->busy)
+  {
+    pthread_mutex_unlock (&ucm_lock);
+    return;
+  }
+
+  /* A request is only busy while the transfer thread is running. */
+  if (!req->cancel)
+  {
+    req->cancel = 1;
+    req->cancel_next = ucm_cancel_head;
+    ucm_cancel_head = req;
+  }
+  pthread_mutex_unlock (&ucm_lock);
+
+  ucm_wakeup ();
+
+  pthread_mutex_lock (&ucm_lock);
+  while (req->busy)
+    pthread_cond_wait (&ucm_cond, &ucm_lock);
+  pthread_mutex_unlock (&ucm_lock);
+} /* }}} void ucm_request_cancel */
+
+void ucm_shutdown (void) /* {{{ */
+{
+  pthread_mutex_lock (&ucm_lock);
+  if (!ucm_thread_running)
+  {
+    pthread_mutex_unlock (&ucm_lock);
+    return;
+  }
+  ucm_thread_stop = 1;
+  pthread_mutex_unlock (&ucm_lock);
+
+  ucm_wakeup ();
+  pthread_join (ucm_thread, /* retval = */ NULL);
+
+  pthread_mutex_lock (&ucm_lock);
+  /* Requests which never made it to the transfer thread. */
+  while (ucm_queue_head != NULL)
+  {
+    ucm_request_t *req = ucm_queue_head;
+    ucm_queue_head = req->queue_next;
+    req->queue_next = NULL;
+    req->busy = 0;
+  }
+  ucm_queue_tail = NULL;
+  while (ucm_cancel_head != NULL)
+  {
+    ucm_request_t *req = ucm_cancel_head;
+    ucm_cancel_head = req->cancel_next;
+    req->cancel_next = NULL;
+    req->cancel = 0;
+  }
+  pthread_cond_broadcast (&ucm_cond);
+  ucm_thread_running = 0;
+  ucm_thread_stop = 0;
+  pthread_mutex_unlock (&ucm_lock);
+
+  curl_multi_cleanup (ucm_multi);
+  ucm_multi = NULL;
+
+  close (ucm_wakeup_pipe[0]);
+  close (ucm_wakeup_pipe[1]);
+  ucm_wakeup_pipe[0] = -1;
+  ucm_wakeup_pipe[1] = -1;
+} /* }}} void ucm_shutdown */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
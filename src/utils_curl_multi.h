@@ -0,0 +1,89 @@
+/**
+ * collectd - src/utils_curl_multi.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_CURL_MULTI_H
+#define UTILS_CURL_MULTI_H 1
+
+#include <curl/curl.h>
+
+/*
+ * Background transfers
+ *
+ * Performs transfers of cURL easy handles on a single thread using the
+ * "multi" interface of libcurl, so that a read callback can start a transfer
+ * and return right away instead of blocking a read thread until the server
+ * responded. Since all transfers share one multi handle, connections are kept
+ * alive and reused between reads.
+ */
+
+struct ucm_request_s;
+typedef struct ucm_request_s ucm_request_t;
+
+/* Called from the transfer thread when a transfer has finished. `status' is
+ * the result of the transfer, i.e. what `curl_easy_perform' would have
+ * returned. */
+typedef void (*ucm_callback_t) (CURL *curl, CURLcode status, void *user_data);
+
+/*
+ * NAME
+ *   ucm_request_create
+ *
+ * DESCRIPTION
+ *   Creates a request object for the easy handle `curl'. The handle is
+ *   configured by the caller as usual. Each time the request is submitted,
+ *   the handle is transferred and `callback' is called with `user_data' when
+ *   the transfer is complete.
+ */
+ucm_request_t *ucm_request_create (CURL *curl, ucm_callback_t callback,
+    void *user_data);
+
+/* Destroys the request object. The easy handle is not touched. The request
+ * must not be in flight; call `ucm_request_cancel' first if in doubt. */
+void ucm_request_destroy (ucm_request_t *req);
+
+/* Aborts the transfer of `req' if it is in flight, without calling its
+ * callback. If the callback is running, waits for it to return. Other
+ * requests are not affected. */
+void ucm_request_cancel (ucm_request_t *req);
+
+/*
+ * NAME
+ *   ucm_submit
+ *
+ * DESCRIPTION
+ *   Starts the transfer of `req' in the background. The transfer thread is
+ *   started on first use.
+ *
+ * RETURN VALUE
+ *   Zero on success, EBUSY if the previous transfer of `req' is still in
+ *   flight and -1 on other errors.
+ */
+int ucm_submit (ucm_request_t *req);
+
+/* Returns true while a transfer of `req' is in flight, i.e. from
+ * `ucm_submit' until the callback has returned. */
+_Bool ucm_request_busy (ucm_request_t *req);
+
+/* Stops the transfer thread. Transfers which are still in flight are aborted
+ * without calling their callbacks. Calling this more than once is fine. */
+void ucm_shutdown (void);
+
+#endif /* UTILS_CURL_MULTI_H */
@@ -0,0 +1,368 @@
+/**
+ * collectd - src/utils_ident.c
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_ident.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+/* The interning table is a hash table with separate chaining. Like the value
+ * cache it is split into shards with their own lock. */
+#define IDENT_SHARDS_NUM 64
+#define IDENT_BUCKETS_INITIAL 64
+
+struct identifier_s
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash;
+  size_t refcount;
+  identifier_t *next;
+};
+
+typedef struct ident_shard_s
+{
+  identifier_t  **buckets;
+  size_t          buckets_num;
+  size_t          entries_num;
+  pthread_mutex_t lock;
+} ident_shard_t;
+
+static ident_shard_t ident_shards[IDENT_SHARDS_NUM];
+static pthread_once_t ident_shards_once = PTHREAD_ONCE_INIT;
+
+static void ident_shards_init (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < IDENT_SHARDS_NUM; i++)
+  {
+    ident_shards[i].buckets = NULL;
+    ident_shards[i].buckets_num = 0;
+    ident_shards[i].entries_num = 0;
+    pthread_mutex_init (&ident_shards[i].lock, /* attr = */ NULL);
+  }
+} /* }}} void ident_shards_init */
+
+static ident_shard_t *ident_get_shard (uint32_t hash) /* {{{ */
+{
+  pthread_once (&ident_shards_once, ident_shards_init);
+  return (ident_shards + (hash % IDENT_SHARDS_NUM));
+} /* }}} ident_shard_t *ident_get_shard */
+
+/* FNV-1a */
+static uint32_t ident_hash_update (uint32_t hash, const char *str) /* {{{ */
+{
+  const unsigned char *ptr;
+
+  for (ptr = (const unsigned char *) str; *ptr != 0; ptr++)
+  {
+    hash ^= (uint32_t) *ptr;
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} uint32_t ident_hash_update */
+
+#define IDENT_HASH_INIT 2166136261U
+
+/* Computes the same hash as `ident_hash_string' would for the formatted
+ * identifier, without actually formatting it. */
+static uint32_t ident_hash_vl (const value_list_t *vl) /* {{{ */
+{
+  uint32_t hash = IDENT_HASH_INIT;
+
+  hash = ident_hash_update (hash, vl->host);
+  hash = ident_hash_update (hash, "/");
+  hash = ident_hash_update (hash, vl->plugin);
+  if (vl->plugin_instance[0] != 0)
+  {
+    hash = ident_hash_update (hash, "-");
+    hash = ident_hash_update (hash, vl->plugin_instance);
+  }
+  hash = ident_hash_update (hash, "/");
+  hash = ident_hash_update (hash, vl->type);
+  if (vl->type_instance[0] != 0)
+  {
+    hash = ident_hash_update (hash, "-");
+    hash = ident_hash_update (hash, vl->type_instance);
+  }
+
+  return (hash);
+} /* }}} uint32_t ident_hash_vl */
+
+/* Returns a pointer to the first character after `prefix' in `str' or NULL if
+ * `str' doesn't start with `prefix'. */
+static const char *ident_skip (const char *str, const char *prefix) /* {{{ */
+{
+  while (*prefix != 0)
+  {
+    if (*str != *prefix)
+      return (NULL);
+    str++;
+    prefix++;
+  }
+
+  return (str);
+} /* }}} const char *ident_skip */
+
+/* Compares the formatted name `name' with the identifier of `vl' without
+ * formatting the latter. */
+static _Bool ident_matches (const char *name, const value_list_t *vl) /* {{{ */
+{
+  const char *ptr = name;
+
+#define SKIP(str) do { \
+  ptr = ident_skip (ptr, (str)); \
+  if (ptr == NULL) return (0); \
+} while (0)
+
+  SKIP (vl->host);
+  SKIP ("/");
+  SKIP (vl->plugin);
+  if (vl->plugin_instance[0] != 0)
+  {
+    SKIP ("-");
+    SKIP (vl->plugin_instance);
+  }
+  SKIP ("/");
+  SKIP (vl->type);
+  if (vl->type_instance[0] != 0)
+  {
+    SKIP ("-");
+    SKIP (vl->type_instance);
+  }
+#undef SKIP
+
+  return (*ptr == 0);
+} /* }}} _Bool ident_matches */
+
+/* Doubles the number of buckets of `shard'. Must be called with the shard's
+ * lock held. Failure is not fatal, the chains just get longer. */
+static void ident_shard_grow (ident_shard_t *shard) /* {{{ */
+{
+  identifier_t **buckets;
+  size_t buckets_num;
+  size_t i;
+
+  buckets_num = (shard->buckets_num == 0)
+    ? IDENT_BUCKETS_INITIAL
+    : 2 * shard->buckets_num;
+
+  buckets = calloc (buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+  {
+    ERROR ("utils_ident: ident_shard_grow: calloc failed.");
+    return;
+  }
+
+  for (i = 0; i < shard->buckets_num; i++)
+  {
+    identifier_t *ident = shard->buckets[i];
+
+    while (ident != NULL)
+    {
+      identifier_t *next = ident->next;
+      /* The shard is selected by the hash modulo the number of shards, so
+       * use the remaining bits for selecting the bucket. */
+      size_t idx = (ident->hash / IDENT_SHARDS_NUM) % buckets_num;
+
+      ident->next = buckets[idx];
+      buckets[idx] = ident;
+
+      ident = next;
+    }
+  }
+
+  sfree (shard->buckets);
+  shard->buckets = buckets;
+  shard->buckets_num = buckets_num;
+} /* }}} void ident_shard_grow */
+
+identifier_t *ident_get (const value_list_t *vl) /* {{{ */
+{
+  ident_shard_t *shard;
+  identifier_t *ident;
+  uint32_t hash;
+  size_t idx;
+
+  if (vl == NULL)
+    return (NULL);
+
+  hash = ident_hash_vl (vl);
+  shard = ident_get_shard (hash);
+
+  pthread_mutex_lock (&shard->lock);
+
+  if (shard->buckets_num != 0)
+  {
+    idx = (hash / IDENT_SHARDS_NUM) % shard->buckets_num;
+    for (ident = shard->buckets[idx]; ident != NULL; ident = ident->next)
+    {
+      if ((ident->hash == hash) && ident_matches (ident->name, vl))
+      {
+        ident->refcount++;
+        pthread_mutex_unlock (&shard->lock);
+        return (ident);
+      }
+    }
+  }
+
+  /* Not found: create a new identifier. */
+  if (shard->entries_num >= 2 * shard->buckets_num)
+    ident_shard_grow (shard);
+
+  if (shard->buckets_num == 0)
+  {
+    pthread_mutex_unlock (&shard->lock);
+    return (NULL);
+  }
+
+  ident = malloc (sizeof (*ident));
+  if (ident == NULL)
+  {
+    pthread_mutex_unlock (&shard->lock);
+    ERROR ("utils_ident: ident_get: malloc failed.");
+    return (NULL);
+  }
+  memset (ident, 0, sizeof (*ident));
+
+  if (FORMAT_VL (ident->name, sizeof (ident->name), vl) != 0)
+  {
+    pthread_mutex_unlock (&shard->lock);
+    ERROR ("utils_ident: ident_get: FORMAT_VL failed.");
+    sfree (ident);
+    return (NULL);
+  }
+  ident->hash = hash;
+  ident->refcount = 1;
+
+  idx = (hash / IDENT_SHARDS_NUM) % shard->buckets_num;
+  ident->next = shard->buckets[idx];
+  shard->buckets[idx] = ident;
+  shard->entries_num++;
+
+  pthread_mutex_unlock (&shard->lock);
+
+  return (ident);
+} /* }}} identifier_t *ident_get */
+
+identifier_t *ident_ref (identifier_t *ident) /* {{{ */
+{
+  ident_shard_t *shard;
+
+  if (ident == NULL)
+    return (NULL);
+
+  shard = ident_get_shard (ident->hash);
+
+  pthread_mutex_lock (&shard->lock);
+  assert (ident->refcount > 0);
+  ident->refcount++;
+  pthread_mutex_unlock (&shard->lock);
+
+  return (ident);
+} /* }}} identifier_t *ident_ref */
+
+void ident_release (identifier_t *ident) /* {{{ */
+{
+  ident_shard_t *shard;
+  identifier_t **prev;
+  size_t idx;
+
+  if (ident == NULL)
+    return;
+
+  shard = ident_get_shard (ident->hash);
+
+  pthread_mutex_lock (&shard->lock);
+
+  assert (ident->refcount > 0);
+  ident->refcount--;
+  if (ident->refcount > 0)
+  {
+    pthread_mutex_unlock (&shard->lock);
+    return;
+  }
+
+  /* Last reference is gone: unlink and free the identifier. */
+  idx = (ident->hash / IDENT_SHARDS_NUM) % shard->buckets_num;
+  for (prev = shard->buckets + idx; *prev != NULL; prev = &(*prev)->next)
+  {
+    if (*prev == ident)
+    {
+      *prev = ident->next;
+      shard->entries_num--;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock (&shard->lock);
+
+  sfree (ident);
+} /* }}} void ident_release */
+
+const char *ident_name (const identifier_t *ident) /* {{{ */
+{
+  assert (ident != NULL);
+  return (ident->name);
+} /* }}} const char *ident_name */
+
+uint32_t ident_hash (const identifier_t *ident) /* {{{ */
+{
+  assert (ident != NULL);
+  return (ident->hash);
+} /* }}} uint32_t ident_hash */
+
+uint32_t ident_hash_string (const char *name) /* {{{ */
+{
+  return (ident_hash_update (IDENT_HASH_INIT, name));
+} /* }}} uint32_t ident_hash_string */
+
+const char *ident_vl_name (const value_list_t *vl, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  if (vl->ident != NULL)
+    return (ident_name (vl->ident));
+
+  if (FORMAT_VL (buffer, buffer_size, vl) != 0)
+    return (NULL);
+  return (buffer);
+} /* }}} const char *ident_vl_name */
+
+void ident_vl_update (value_list_t *vl) /* {{{ */
+{
+  identifier_t *old;
+
+  if ((vl == NULL) || (vl->ident == NULL))
+    return;
+
+  old = vl->ident;
+  if (ident_matches (ident_name (old), vl))
+    return;
+
+  vl->ident = ident_get (vl);
+  ident_release (old);
+} /* }}} void ident_vl_update */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,86 @@
+/**
+ * collectd - src/utils_ident.h
+ * Copyright (C) 2026  agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#ifndef UTILS_IDENT_H
+#define UTILS_IDENT_H 1
+
+#include "plugin.h"
+
+/*
+ * Interned identifiers
+ *
+ * Every distinct "host/plugin-plugin_instance/type-type_instance" tuple is
+ * represented by exactly one `identifier_t' object, which holds the formatted
+ * name and its hash. Two value lists refer to the same metric if and only if
+ * their identifier pointers are equal, so code holding an identifier can
+ * compare, hash and print it without formatting or comparing strings.
+ *
+ * Identifiers are reference counted. The value cache holds a reference for as
+ * long as the metric is in the cache, so the identifier of an active metric is
+ * only created once.
+ */
+
+/*
+ * NAME
+ *   ident_get
+ *
+ * DESCRIPTION
+ *   Returns the interned identifier of the value list `vl', creating it if
+ *   necessary. The returned identifier has to be released using
+ *   `ident_release' when it is no longer needed. Returns NULL on failure.
+ */
+identifier_t *ident_get (const value_list_t *vl);
+
+/* Acquires an additional reference to `ident' and returns it. */
+identifier_t *ident_ref (identifier_t *ident);
+
+/* Releases a reference acquired by `ident_get' or `ident_ref'. */
+void ident_release (identifier_t *ident);
+
+/* Returns the identifier formatted as with `FORMAT_VL'. */
+const char *ident_name (const identifier_t *ident);
+
+/* Returns the hash of the identifier. This is equal to
+ * `ident_hash_string (ident_name (ident))'. */
+uint32_t ident_hash (const identifier_t *ident);
+
+/* Hashes an identifier given in its string representation. */
+uint32_t ident_hash_string (const char *name);
+
+/* Returns the name of `vl'. If `vl' carries an identifier, its name is
+ * returned without formatting anything. Otherwise the name is formatted into
+ * `buffer' using `FORMAT_VL' and `buffer' is returned. Returns NULL on
+ * failure. */
+const char *ident_vl_name (const value_list_t *vl,
+    char *buffer, size_t buffer_size);
+
+/*
+ * NAME
+ *   ident_vl_update
+ *
+ * DESCRIPTION
+ *   Re-resolves `vl->ident' after any of the identifier fields of `vl' have
+ *   been changed, e.g. by a target. If `vl' doesn't carry an identifier, this
+ *   is a no-op.
+ */
+void ident_vl_update (value_list_t *vl);
+
+#endif /* UTILS_IDENT_H */
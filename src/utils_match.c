@@ -26,22 +26,54 @@
 
 #include "utils_match.h"
 
-#include <regex.h>
-
 #define UTILS_MATCH_FLAGS_FREE_USER_DATA 0x01
 #define UTILS_MATCH_FLAGS_EXCLUDE_REGEX 0x02
+#define UTILS_MATCH_FLAGS_NOSUB 0x04
+
+/* Longest string any line matching a regex must contain. Used to skip the
+ * (comparatively expensive) regexec(3) for most lines which don't match. */
+#define UTILS_MATCH_LITERAL_LEN 64
 
 struct cu_match_s
 {
   regex_t regex;
   regex_t excluderegex;
+  char literal[UTILS_MATCH_LITERAL_LEN];
+  char excludeliteral[UTILS_MATCH_LITERAL_LEN];
   int flags;
 
   int (*callback) (const char *str, char * const *matches, size_t matches_num,
       void *user_data);
+  int (*offsets_callback) (const char *str, const regmatch_t *matches,
+      size_t matches_num, void *user_data);
   void *user_data;
 };
 
+/* A set of matches is applied using an Aho-Corasick automaton built from the
+ * literals of the matches: A single pass over the string determines which
+ * literals it contains and thus which regular expressions may match. */
+#define MATCH_SET_NO_STATE (-1)
+
+struct cu_match_set_s
+{
+  cu_match_t **matches;
+  size_t matches_num;
+
+  /* Automaton; rebuilt by `match_set_build' when `dirty' is set. Transitions
+   * into states which have matches on their suffix chain are stored as the
+   * one's complement of the state, so the scan only needs to look at other
+   * tables when something was found. */
+  _Bool dirty;
+  int *transitions;     /* states_num * 256 */
+  int *state_match;     /* first match whose literal ends in this state */
+  int *state_next;      /* next state on the suffix chain with a match */
+  int *match_next;      /* next match with the same literal */
+  size_t states_num;
+
+  /* Per-apply scratch space: Which matches have their literal in `str'. */
+  _Bool *candidate;
+};
+
 /*
  * Private functions
  */
@@ -70,21 +102,184 @@ static char *match_substr (const char *str, int begin, int end)
   return (ret);
 } /* char *match_substr */
 
-static int default_callback (const char __attribute__((unused)) *str,
-    char * const *matches, size_t matches_num, void *user_data)
+/* Copies the sub-match `m' of `str' into `buffer', truncating it if
+ * necessary. Returns NULL if the sub-expression didn't match. */
+static const char *match_substr_buffer (char *buffer, size_t buffer_size,
+    const char *str, const regmatch_t *m)
+{
+  size_t len;
+
+  if ((m->rm_so < 0) || (m->rm_eo < m->rm_so))
+    return (NULL);
+
+  len = (size_t) (m->rm_eo - m->rm_so);
+  if (len >= buffer_size)
+    len = buffer_size - 1;
+
+  memcpy (buffer, str + m->rm_so, len);
+  buffer[len] = 0;
+
+  return (buffer);
+} /* const char *match_substr_buffer */
+
+/* Only the top level of the expression is considered and expressions using
+ * alternation are given up on. The result may be shorter than possible, but
+ * is never wrong. */
+void match_literal (char *buffer, size_t buffer_size, const char *regex)
+{
+  char current[UTILS_MATCH_LITERAL_LEN];
+  size_t current_len = 0;
+  size_t best_len = 0;
+  _Bool last_literal = 0;
+  int depth = 0;
+  size_t i;
+
+  assert (buffer_size > 0);
+  buffer[0] = 0;
+
+#define END_RUN do { \
+  if (current_len > best_len) \
+  { \
+    best_len = (current_len < buffer_size) ? current_len : buffer_size - 1; \
+    memcpy (buffer, current, best_len); \
+    buffer[best_len] = 0; \
+  } \
+  current_len = 0; \
+  last_literal = 0; \
+} while (0)
+
+  for (i = 0; regex[i] != 0; i++)
+  {
+    char c = regex[i];
+
+    if (c == '[')
+    {
+      END_RUN;
+      i++;
+      /* A leading '^' negates, a leading ']' is literal. */
+      if (regex[i] == '^')
+	i++;
+      if (regex[i] == ']')
+	i++;
+      while ((regex[i] != 0) && (regex[i] != ']'))
+      {
+	/* Skip "[:class:]", "[=equiv=]" and "[.coll.]" as a whole. */
+	if ((regex[i] == '[') && ((regex[i + 1] == ':')
+	      || (regex[i + 1] == '=') || (regex[i + 1] == '.')))
+	{
+	  char delim = regex[i + 1];
+	  i += 2;
+	  while ((regex[i] != 0)
+	      && !((regex[i] == delim) && (regex[i + 1] == ']')))
+	    i++;
+	  if (regex[i] == 0)
+	    break;
+	  i++;
+	}
+	i++;
+      }
+      if (regex[i] == 0)
+	break;
+      continue;
+    }
+    else if (c == '\\')
+    {
+      char next = regex[i + 1];
+
+      if (next == 0)
+	break;
+      i++;
+
+      /* "\|" may be alternation, too. */
+      if (next == '|')
+      {
+	buffer[0] = 0;
+	return;
+      }
+
+      if ((depth == 0) && (strchr (".[]()*+?{}^$\\", next) != NULL))
+      {
+	if (current_len < sizeof (current))
+	  current[current_len++] = next;
+	last_literal = 1;
+      }
+      else
+	END_RUN;
+      continue;
+    }
+    else if (c == '(')
+    {
+      END_RUN;
+      depth++;
+      continue;
+    }
+    else if (c == ')')
+    {
+      END_RUN;
+      if (depth > 0)
+	depth--;
+      continue;
+    }
+
+    if (depth > 0)
+      continue;
+
+    if (c == '|')
+    {
+      buffer[0] = 0;
+      return;
+    }
+    else if ((c == '*') || (c == '?') || (c == '{'))
+    {
+      /* The preceding character is optional. */
+      if (last_literal && (current_len > 0))
+	current_len--;
+      END_RUN;
+
+      /* Skip the bounds of an interval expression. */
+      if (c == '{')
+      {
+	while ((regex[i + 1] != 0) && (regex[i] != '}'))
+	  i++;
+      }
+    }
+    else if ((c == '+') || (c == '.') || (c == '^') || (c == '$'))
+    {
+      END_RUN;
+    }
+    else
+    {
+      if (current_len < sizeof (current))
+	current[current_len++] = c;
+      last_literal = 1;
+    }
+  }
+
+  END_RUN;
+#undef END_RUN
+} /* void match_literal */
+
+static int default_callback (const char *str,
+    const regmatch_t *matches, size_t matches_num, void *user_data)
 {
   cu_match_value_t *data = (cu_match_value_t *) user_data;
+  /* Only numbers are parsed from the sub-match, so this is plenty. */
+  char buffer[256];
+  const char *submatch = NULL;
+
+  if (matches_num >= 2)
+    submatch = match_substr_buffer (buffer, sizeof (buffer), str, matches + 1);
 
   if (data->ds_type & UTILS_MATCH_DS_TYPE_GAUGE)
   {
     gauge_t value;
     char *endptr = NULL;
 
-    if (matches_num < 2)
+    if (submatch == NULL)
       return (-1);
 
-    value = (gauge_t) strtod (matches[1], &endptr);
-    if (matches[1] == endptr)
+    value = (gauge_t) strtod (submatch, &endptr);
+    if (submatch == endptr)
       return (-1);
 
     if ((data->values_num == 0)
@@ -128,11 +323,11 @@ static int default_callback (const char __attribute__((unused)) *str,
       return (0);
     }
 
-    if (matches_num < 2)
+    if (submatch == NULL)
       return (-1);
 
-    value = (counter_t) strtoull (matches[1], &endptr, 0);
-    if (matches[1] == endptr)
+    value = (counter_t) strtoull (submatch, &endptr, 0);
+    if (submatch == endptr)
       return (-1);
 
     if (data->ds_type & UTILS_MATCH_CF_COUNTER_SET)
@@ -159,11 +354,11 @@ static int default_callback (const char __attribute__((unused)) *str,
       return (0);
     }
 
-    if (matches_num < 2)
+    if (submatch == NULL)
       return (-1);
 
-    value = (derive_t) strtoll (matches[1], &endptr, 0);
-    if (matches[1] == endptr)
+    value = (derive_t) strtoll (submatch, &endptr, 0);
+    if (submatch == endptr)
       return (-1);
 
     if (data->ds_type & UTILS_MATCH_CF_DERIVE_SET)
@@ -183,11 +378,11 @@ static int default_callback (const char __attribute__((unused)) *str,
     absolute_t value;
     char *endptr = NULL;
 
-    if (matches_num < 2)
+    if (submatch == NULL)
       return (-1);
 
-    value = (absolute_t) strtoull (matches[1], &endptr, 0);
-    if (matches[1] == endptr)
+    value = (absolute_t) strtoull (submatch, &endptr, 0);
+    if (submatch == endptr)
       return (-1);
 
     if (data->ds_type & UTILS_MATCH_CF_ABSOLUTE_SET)
@@ -209,18 +404,16 @@ static int default_callback (const char __attribute__((unused)) *str,
   return (0);
 } /* int default_callback */
 
-/*
- * Public functions
- */
-cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
-		int (*callback) (const char *str,
-		  char * const *matches, size_t matches_num, void *user_data),
-		void *user_data)
+/* Allocates a match object and compiles the regular expressions. If `nosub'
+ * is true, the positions of sub-matches are not needed, which allows for a
+ * faster regexec(3). */
+static cu_match_t *match_create (const char *regex, const char *excluderegex,
+    _Bool nosub)
 {
   cu_match_t *obj;
   int status;
 
-  DEBUG ("utils_match: match_create_callback: regex = %s, excluderegex = %s",
+  DEBUG ("utils_match: match_create: regex = %s, excluderegex = %s",
 	 regex, excluderegex);
 
   obj = (cu_match_t *) malloc (sizeof (cu_match_t));
@@ -228,37 +421,81 @@ cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
     return (NULL);
   memset (obj, '\0', sizeof (cu_match_t));
 
-  status = regcomp (&obj->regex, regex, REG_EXTENDED | REG_NEWLINE);
+  status = regcomp (&obj->regex, regex,
+      REG_EXTENDED | REG_NEWLINE | (nosub ? REG_NOSUB : 0));
   if (status != 0)
   {
     ERROR ("Compiling the regular expression \"%s\" failed.", regex);
     sfree (obj);
     return (NULL);
   }
+  if (nosub)
+    obj->flags |= UTILS_MATCH_FLAGS_NOSUB;
+  match_literal (obj->literal, sizeof (obj->literal), regex);
 
   if (excluderegex && strcmp(excluderegex, "") != 0) {
-    status = regcomp (&obj->excluderegex, excluderegex, REG_EXTENDED);
+    status = regcomp (&obj->excluderegex, excluderegex,
+	REG_EXTENDED | REG_NOSUB);
     if (status != 0)
     {
 	ERROR ("Compiling the excluding regular expression \"%s\" failed.",
 	       excluderegex);
+	regfree (&obj->regex);
 	sfree (obj);
 	return (NULL);
     }
     obj->flags |= UTILS_MATCH_FLAGS_EXCLUDE_REGEX;
+    match_literal (obj->excludeliteral, sizeof (obj->excludeliteral),
+	excluderegex);
   }
 
+  return (obj);
+} /* cu_match_t *match_create */
+
+/*
+ * Public functions
+ */
+cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
+		int (*callback) (const char *str,
+		  char * const *matches, size_t matches_num, void *user_data),
+		void *user_data)
+{
+  cu_match_t *obj;
+
+  obj = match_create (regex, excluderegex, /* nosub = */ 0);
+  if (obj == NULL)
+    return (NULL);
+
   obj->callback = callback;
   obj->user_data = user_data;
 
   return (obj);
 } /* cu_match_t *match_create_callback */
 
+cu_match_t *match_create_callback_offsets (const char *regex,
+		const char *excluderegex,
+		int (*callback) (const char *str,
+		  const regmatch_t *matches, size_t matches_num, void *user_data),
+		void *user_data)
+{
+  cu_match_t *obj;
+
+  obj = match_create (regex, excluderegex, /* nosub = */ 0);
+  if (obj == NULL)
+    return (NULL);
+
+  obj->offsets_callback = callback;
+  obj->user_data = user_data;
+
+  return (obj);
+} /* cu_match_t *match_create_callback_offsets */
+
 cu_match_t *match_create_simple (const char *regex,
 				 const char *excluderegex, int match_ds_type)
 {
   cu_match_value_t *user_data;
   cu_match_t *obj;
+  _Bool nosub = 0;
 
   user_data = (cu_match_value_t *) malloc (sizeof (cu_match_value_t));
   if (user_data == NULL)
@@ -266,14 +503,22 @@ cu_match_t *match_create_simple (const char *regex,
   memset (user_data, '\0', sizeof (cu_match_value_t));
   user_data->ds_type = match_ds_type;
 
-  obj = match_create_callback (regex, excluderegex,
-			       default_callback, user_data);
+  /* Counting lines doesn't need the sub-match. */
+  if (((match_ds_type & UTILS_MATCH_DS_TYPE_COUNTER)
+	&& (match_ds_type & UTILS_MATCH_CF_COUNTER_INC))
+      || ((match_ds_type & UTILS_MATCH_DS_TYPE_DERIVE)
+	&& (match_ds_type & UTILS_MATCH_CF_DERIVE_INC)))
+    nosub = 1;
+
+  obj = match_create (regex, excluderegex, nosub);
   if (obj == NULL)
   {
     sfree (user_data);
     return (NULL);
   }
 
+  obj->offsets_callback = default_callback;
+  obj->user_data = user_data;
   obj->flags |= UTILS_MATCH_FLAGS_FREE_USER_DATA;
 
   return (obj);
@@ -289,23 +534,29 @@ void match_destroy (cu_match_t *obj)
     sfree (obj->user_data);
   }
 
+  regfree (&obj->regex);
+  if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX)
+    regfree (&obj->excluderegex);
+
   sfree (obj);
 } /* void match_destroy */
 
-int match_apply (cu_match_t *obj, const char *str)
+/* Runs the regular expressions of `obj' and the callback. The caller has
+ * checked that `str' contains `obj->literal'. */
+static int match_apply_regex (cu_match_t *obj, const char *str)
 {
   int status;
   regmatch_t re_match[32];
+  size_t re_match_num;
   char *matches[32];
   size_t matches_num;
   size_t i;
 
-  if ((obj == NULL) || (str == NULL))
-    return (-1);
-
-  if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX) {
+  if ((obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX)
+      && ((obj->excludeliteral[0] == 0)
+	|| (strstr (str, obj->excludeliteral) != NULL))) {
     status = regexec (&obj->excluderegex, str,
-		      STATIC_ARRAY_SIZE (re_match), re_match,
+		      /* nmatch = */ 0, /* pmatch = */ NULL,
 		      /* eflags = */ 0);
     /* Regex did match, so exclude this line */
     if (status == 0) {
@@ -314,16 +565,38 @@ int match_apply (cu_match_t *obj, const char *str)
     }
   }
 
+  /* Only ask for as many sub-matches as the regex has: Each one makes
+   * regexec(3) do more work. */
+  if (obj->flags & UTILS_MATCH_FLAGS_NOSUB)
+    re_match_num = 0;
+  else
+  {
+    re_match_num = obj->regex.re_nsub + 1;
+    if (re_match_num > STATIC_ARRAY_SIZE (re_match))
+      re_match_num = STATIC_ARRAY_SIZE (re_match);
+  }
+
   status = regexec (&obj->regex, str,
-      STATIC_ARRAY_SIZE (re_match), re_match,
+      re_match_num, (re_match_num > 0) ? re_match : NULL,
       /* eflags = */ 0);
 
   /* Regex did not match */
   if (status != 0)
     return (0);
 
+  if (obj->offsets_callback != NULL)
+  {
+    status = obj->offsets_callback (str, re_match, re_match_num,
+	obj->user_data);
+    if (status != 0)
+    {
+      ERROR ("utils_match: match_apply: callback failed.");
+    }
+    return (status);
+  }
+
   memset (matches, '\0', sizeof (matches));
-  for (matches_num = 0; matches_num < STATIC_ARRAY_SIZE (matches); matches_num++)
+  for (matches_num = 0; matches_num < re_match_num; matches_num++)
   {
     if ((re_match[matches_num].rm_so < 0)
 	|| (re_match[matches_num].rm_eo < 0))
@@ -357,6 +630,18 @@ int match_apply (cu_match_t *obj, const char *str)
   }
 
   return (status);
+} /* int match_apply_regex */
+
+int match_apply (cu_match_t *obj, const char *str)
+{
+  if ((obj == NULL) || (str == NULL))
+    return (-1);
+
+  /* Lines not containing the literal part of the regex can't match. */
+  if ((obj->literal[0] != 0) && (strstr (str, obj->literal) == NULL))
+    return (0);
+
+  return (match_apply_regex (obj, str));
 } /* int match_apply */
 
 void *match_get_user_data (cu_match_t *obj)
@@ -366,4 +651,253 @@ void *match_get_user_data (cu_match_t *obj)
   return (obj->user_data);
 } /* void *match_get_user_data */
 
+/*
+ * Match sets
+ */
+static void match_set_free_automaton (cu_match_set_t *set) /* {{{ */
+{
+  sfree (set->transitions);
+  sfree (set->state_match);
+  sfree (set->state_next);
+  sfree (set->match_next);
+  sfree (set->candidate);
+  set->states_num = 0;
+} /* }}} void match_set_free_automaton */
+
+static int match_set_build (cu_match_set_t *set) /* {{{ */
+{
+  size_t states_max = 1;
+  int *queue;
+  size_t queue_head;
+  size_t queue_tail;
+  size_t i;
+
+  match_set_free_automaton (set);
+
+  for (i = 0; i < set->matches_num; i++)
+    states_max += strlen (set->matches[i]->literal);
+
+  set->transitions = malloc (states_max * 256 * sizeof (*set->transitions));
+  set->state_match = malloc (states_max * sizeof (*set->state_match));
+  set->state_next = malloc (states_max * sizeof (*set->state_next));
+  set->match_next = malloc (set->matches_num * sizeof (*set->match_next));
+  set->candidate = calloc (set->matches_num, sizeof (*set->candidate));
+  queue = malloc (states_max * sizeof (*queue));
+  if ((set->transitions == NULL) || (set->state_match == NULL)
+      || (set->state_next == NULL) || (set->match_next == NULL)
+      || (set->candidate == NULL) || (queue == NULL))
+  {
+    ERROR ("utils_match: match_set_build: malloc failed.");
+    match_set_free_automaton (set);
+    sfree (queue);
+    return (-1);
+  }
+
+  for (i = 0; i < states_max * 256; i++)
+    set->transitions[i] = MATCH_SET_NO_STATE;
+  for (i = 0; i < states_max; i++)
+  {
+    set->state_match[i] = MATCH_SET_NO_STATE;
+    set->state_next[i] = MATCH_SET_NO_STATE;
+  }
+  set->states_num = 1;
+
+  /* Insert all literals into a trie. */
+  for (i = 0; i < set->matches_num; i++)
+  {
+    const unsigned char *ptr = (const unsigned char *) set->matches[i]->literal;
+    int state = 0;
+
+    set->match_next[i] = MATCH_SET_NO_STATE;
+    if (*ptr == 0)
+      continue;
+
+    for (; *ptr != 0; ptr++)
+    {
+      int *next = set->transitions + (state * 256 + *ptr);
+
+      if (*next == MATCH_SET_NO_STATE)
+      {
+	*next = (int) set->states_num;
+	set->states_num++;
+      }
+      state = *next;
+    }
+
+    /* Append to the state's list so matches are reported in order. */
+    if (set->state_match[state] == MATCH_SET_NO_STATE)
+      set->state_match[state] = (int) i;
+    else
+    {
+      int m = set->state_match[state];
+      while (set->match_next[m] != MATCH_SET_NO_STATE)
+	m = set->match_next[m];
+      set->match_next[m] = (int) i;
+    }
+  }
+
+  /* Turn the trie into a DFA, breadth first. `state_next' temporarily holds
+   * the failure link, i.e. the state of the longest proper suffix. */
+  queue_head = 0;
+  queue_tail = 0;
+  for (i = 0; i < 256; i++)
+  {
+    int *next = set->transitions + i;
+
+    if (*next == MATCH_SET_NO_STATE)
+      *next = 0;
+    else
+    {
+      set->state_next[*next] = 0;
+      queue[queue_tail++] = *next;
+    }
+  }
+
+  while (queue_head < queue_tail)
+  {
+    int state = queue[queue_head++];
+    int fail = set->state_next[state];
+
+    for (i = 0; i < 256; i++)
+    {
+      int *next = set->transitions + (state * 256 + i);
+      int fail_next = set->transitions[fail * 256 + i];
+
+      if (*next == MATCH_SET_NO_STATE)
+	*next = fail_next;
+      else
+      {
+	set->state_next[*next] = fail_next;
+	queue[queue_tail++] = *next;
+      }
+    }
+  }
+
+  /* Replace the failure links by links to the next state on the suffix chain
+   * which has matches attached. Again breadth first, so that the links of all
+   * shorter suffixes are final. */
+  for (i = 0; i < queue_tail; i++)
+  {
+    int state = queue[i];
+    int fail = set->state_next[state];
+
+    if ((fail != 0) && (set->state_match[fail] == MATCH_SET_NO_STATE))
+      set->state_next[state] = set->state_next[fail];
+    else if (fail == 0)
+      set->state_next[state] = MATCH_SET_NO_STATE;
+  }
+
+  /* Mark transitions into states with matches, see above. */
+  for (i = 0; i < set->states_num * 256; i++)
+  {
+    int next = set->transitions[i];
+
+    if ((set->state_match[next] != MATCH_SET_NO_STATE)
+	|| (set->state_next[next] != MATCH_SET_NO_STATE))
+      set->transitions[i] = ~next;
+  }
+
+  sfree (queue);
+  set->dirty = 0;
+  return (0);
+} /* }}} int match_set_build */
+
+cu_match_set_t *match_set_create (void) /* {{{ */
+{
+  cu_match_set_t *set;
+
+  set = malloc (sizeof (*set));
+  if (set == NULL)
+    return (NULL);
+  memset (set, 0, sizeof (*set));
+
+  return (set);
+} /* }}} cu_match_set_t *match_set_create */
+
+void match_set_destroy (cu_match_set_t *set) /* {{{ */
+{
+  if (set == NULL)
+    return;
+
+  match_set_free_automaton (set);
+  sfree (set->matches);
+  sfree (set);
+} /* }}} void match_set_destroy */
+
+int match_set_add (cu_match_set_t *set, cu_match_t *match) /* {{{ */
+{
+  cu_match_t **tmp;
+
+  if ((set == NULL) || (match == NULL))
+    return (-1);
+
+  tmp = realloc (set->matches, (set->matches_num + 1) * sizeof (*tmp));
+  if (tmp == NULL)
+    return (-1);
+  set->matches = tmp;
+
+  set->matches[set->matches_num] = match;
+  set->matches_num++;
+  set->dirty = 1;
+
+  return (0);
+} /* }}} int match_set_add */
+
+int match_set_apply (cu_match_set_t *set, const char *str) /* {{{ */
+{
+  const unsigned char *ptr;
+  int state;
+  int status = 0;
+  size_t i;
+
+  if ((set == NULL) || (str == NULL))
+    return (-1);
+
+  if (set->dirty && (match_set_build (set) != 0))
+  {
+    /* Fall back to applying the matches one by one. */
+    for (i = 0; i < set->matches_num; i++)
+      if (match_apply (set->matches[i], str) != 0)
+	status = -1;
+    return (status);
+  }
+
+  memset (set->candidate, 0, set->matches_num * sizeof (*set->candidate));
+
+  state = 0;
+  for (ptr = (const unsigned char *) str; *ptr != 0; ptr++)
+  {
+    int s;
+
+    state = set->transitions[state * 256 + *ptr];
+    if (state >= 0)
+      continue;
+    state = ~state;
+
+    s = (set->state_match[state] != MATCH_SET_NO_STATE)
+      ? state : set->state_next[state];
+    for (; s != MATCH_SET_NO_STATE; s = set->state_next[s])
+    {
+      int m;
+
+      for (m = set->state_match[s]; m != MATCH_SET_NO_STATE;
+	  m = set->match_next[m])
+	set->candidate[m] = 1;
+    }
+  }
+
+  for (i = 0; i < set->matches_num; i++)
+  {
+    cu_match_t *obj = set->matches[i];
+
+    if ((obj->literal[0] != 0) && !set->candidate[i])
+      continue;
+
+    if (match_apply_regex (obj, str) != 0)
+      status = -1;
+  }
+
+  return (status);
+} /* }}} int match_set_apply */
+
 /* vim: set sw=2 sts=2 ts=8 : */
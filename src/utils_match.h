@@ -25,6 +25,8 @@
 
 #include "plugin.h"
 
+#include <regex.h>
+
 /*
  * Defines
  */
@@ -56,6 +58,9 @@
 struct cu_match_s;
 typedef struct cu_match_s cu_match_t;
 
+struct cu_match_set_s;
+typedef struct cu_match_set_s cu_match_set_t;
+
 struct cu_match_value_s
 {
   int ds_type;
@@ -90,6 +95,23 @@ cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
 		  char * const *matches, size_t matches_num, void *user_data),
 		void *user_data);
 
+/*
+ * NAME
+ *  match_create_callback_offsets
+ *
+ * DESCRIPTION
+ *  Like `match_create_callback', but the (sub-)matches are not copied: The
+ *  callback receives the offsets of the entire match (matches[0]) and of every
+ *  sub-expression into `str', as returned by regexec(3). Sub-expressions which
+ *  didn't participate in the match have an `rm_so' of -1. Since nothing is
+ *  allocated per line, this is the interface to use for busy logs.
+ */
+cu_match_t *match_create_callback_offsets (const char *regex,
+		const char *excluderegex,
+		int (*callback) (const char *str,
+		  const regmatch_t *matches, size_t matches_num, void *user_data),
+		void *user_data);
+
 /*
  * NAME
  *  match_create_simple
@@ -150,6 +172,50 @@ int match_apply (cu_match_t *obj, const char *str);
  */
 void *match_get_user_data (cu_match_t *obj);
 
+/*
+ * NAME
+ *  match_literal
+ *
+ * DESCRIPTION
+ *  Stores the longest string which every string matching the extended
+ *  regular expression `regex' contains in `buffer'. If no such string can be
+ *  determined, `buffer' is set to the empty string. Checking for this string
+ *  with strstr(3) is a cheap way to reject most non-matching strings before
+ *  calling regexec(3).
+ */
+void match_literal (char *buffer, size_t buffer_size, const char *regex);
+
+/*
+ * NAME
+ *  match_set_create
+ *
+ * DESCRIPTION
+ *  Creates an empty set of matches. Applying the set to a string has the same
+ *  effect as calling `match_apply' for each match in the order they were
+ *  added, but the string is only scanned once to find out which regular
+ *  expressions may match it; only those are run. This makes a difference
+ *  when many matches are applied to the same string, e.g. the lines of a
+ *  log file.
+ *  Sets are not thread-safe.
+ */
+cu_match_set_t *match_set_create (void);
+
+/* Destroys the set. The matches added to it are NOT destroyed. */
+void match_set_destroy (cu_match_set_t *set);
+
+/* Appends `match' to `set'. Returns zero on success. */
+int match_set_add (cu_match_set_t *set, cu_match_t *match);
+
+/*
+ * NAME
+ *  match_set_apply
+ *
+ * DESCRIPTION
+ *  Applies all matches of the set to `str', see above. Returns zero if all
+ *  callbacks succeeded and non-zero otherwise.
+ */
+int match_set_apply (cu_match_set_t *set, const char *str);
+
 #endif /* UTILS_MATCH_H */
 
 /* vim: set sw=2 sts=2 ts=8 : */
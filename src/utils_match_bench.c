@@ -0,0 +1,196 @@
+/**
+ * collectd - src/utils_match_bench.c
+ * Copyright (C) 2026  agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+/*
+ * Measures the cost of applying many regular expressions to the lines of an
+ * access log, as the tail plugin does. Compared are
+ *
+ *   - regexec(3) for every regular expression,
+ *   - match_apply() for every match, which checks the literal of the regular
+ *     expression with strstr(3) first, and
+ *   - match_set_apply() with all matches in one set.
+ *
+ * The first regular expression matches one line in ten, the others match no
+ * line. All three variants must report the same number of matches.
+ *
+ * Usage: utils_match_bench [<regexes> [<lines>]]
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_cache.h"
+#include "utils_match.h"
+
+/* Usually defined in collectd.c. */
+char hostname_g[DATA_MAX_NAME_LEN];
+cdtime_t interval_g;
+int  timeout_g;
+
+/* Stand-ins for the daemon, referenced by common.c. */
+void plugin_log (int level, const char *format, ...)
+{
+  va_list ap;
+
+  if (level > LOG_WARNING)
+    return;
+
+  va_start (ap, format);
+  vfprintf (stderr, format, ap);
+  va_end (ap);
+  fprintf (stderr, "\n");
+}
+
+gauge_t *uc_get_rate (const data_set_t __attribute__((unused)) *ds,
+    const value_list_t __attribute__((unused)) *vl)
+{
+  return (NULL);
+}
+
+static long matches_num = 0;
+
+static int bench_callback (const char __attribute__((unused)) *str,
+    const regmatch_t __attribute__((unused)) *matches,
+    size_t __attribute__((unused)) matches_num_,
+    void __attribute__((unused)) *user_data)
+{
+  matches_num++;
+  return (0);
+}
+
+static double ns_per_op (cdtime_t begin, cdtime_t end, long ops) /* {{{ */
+{
+  return (1e9 * CDTIME_T_TO_DOUBLE (end - begin) / ((double) ops));
+} /* }}} double ns_per_op */
+
+static void print_result (const char *name, /* {{{ */
+    cdtime_t begin, cdtime_t end, long lines_num)
+{
+  printf ("%-16s %8.1f ns/line (%li matches)\n", name,
+      ns_per_op (begin, end, lines_num), matches_num);
+  matches_num = 0;
+} /* }}} void print_result */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  int regexes_num = 30;
+  long lines_num = 200000;
+  char (*lines)[256];
+  regex_t *regexes;
+  cu_match_t **matches;
+  cu_match_set_t *set;
+  regmatch_t regmatch[2];
+  cdtime_t begin;
+  cdtime_t end;
+  long i;
+  int j;
+
+  if (argc > 1)
+    regexes_num = atoi (argv[1]);
+  if (argc > 2)
+    lines_num = atol (argv[2]);
+  if ((regexes_num < 1) || (lines_num < 1))
+  {
+    fprintf (stderr, "Usage: %s [<regexes> [<lines>]]\n", argv[0]);
+    return (EXIT_FAILURE);
+  }
+
+  lines = calloc ((size_t) lines_num, sizeof (*lines));
+  regexes = calloc ((size_t) regexes_num, sizeof (*regexes));
+  matches = calloc ((size_t) regexes_num, sizeof (*matches));
+  set = match_set_create ();
+  assert ((lines != NULL) && (regexes != NULL) && (matches != NULL)
+      && (set != NULL));
+
+  for (i = 0; i < lines_num; i++)
+    ssnprintf (lines[i], sizeof (lines[i]), "192.0.2.%li - - "
+        "[16/Oct/2026:12:00:00 +0000] \"GET /static/page%li.html HTTP/1.1\" "
+        "%i %li \"-\" \"Mozilla/5.0 (X11; Linux x86_64)\"",
+        i % 256, i % 1000, ((i % 10) == 0) ? 404 : 200, 1000 + (i % 5000));
+
+  for (j = 0; j < regexes_num; j++)
+  {
+    char regex[128];
+
+    if (j == 0)
+      sstrncpy (regex, "\" 404 ([0-9]+)", sizeof (regex));
+    else
+      ssnprintf (regex, sizeof (regex),
+          "GET /api/v1/endpoint%i/([0-9]+)", j);
+
+    if (regcomp (&regexes[j], regex, REG_EXTENDED) != 0)
+    {
+      fprintf (stderr, "regcomp (%s) failed.\n", regex);
+      return (EXIT_FAILURE);
+    }
+
+    matches[j] = match_create_callback_offsets (regex,
+        /* excluderegex = */ NULL, bench_callback, /* user_data = */ NULL);
+    if ((matches[j] == NULL) || (match_set_add (set, matches[j]) != 0))
+    {
+      fprintf (stderr, "Creating the match for %s failed.\n", regex);
+      return (EXIT_FAILURE);
+    }
+  }
+
+  printf ("%i regexes, %li lines\n", regexes_num, lines_num);
+
+  begin = cdtime ();
+  for (i = 0; i < lines_num; i++)
+    for (j = 0; j < regexes_num; j++)
+      if (regexec (&regexes[j], lines[i], STATIC_ARRAY_SIZE (regmatch),
+            regmatch, /* eflags = */ 0) == 0)
+        matches_num++;
+  end = cdtime ();
+  print_result ("regexec:", begin, end, lines_num);
+
+  begin = cdtime ();
+  for (i = 0; i < lines_num; i++)
+    for (j = 0; j < regexes_num; j++)
+      match_apply (matches[j], lines[i]);
+  end = cdtime ();
+  print_result ("match_apply:", begin, end, lines_num);
+
+  begin = cdtime ();
+  for (i = 0; i < lines_num; i++)
+    match_set_apply (set, lines[i]);
+  end = cdtime ();
+  print_result ("match_set_apply:", begin, end, lines_num);
+
+  match_set_destroy (set);
+  for (j = 0; j < regexes_num; j++)
+  {
+    match_destroy (matches[j]);
+    regfree (&regexes[j]);
+  }
+  sfree (matches);
+  sfree (regexes);
+  sfree (lines);
+
+  return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
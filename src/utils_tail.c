@@ -29,17 +29,26 @@
 #include "common.h"
 #include "utils_tail.h"
 
+/* Size of the buffer data is read into. Lines longer than this are split. */
+#define CU_TAIL_BUFFER_SIZE 65536
+
 struct cu_tail_s
 {
 	char  *file;
-	FILE  *fh;
+	int    fd;
 	struct stat stat;
+
+	/* Data read from `fd'. The bytes between `buffer_pos' and `buffer_fill'
+	 * have not been handed out yet. */
+	char  *buffer;
+	size_t buffer_pos;
+	size_t buffer_fill;
 };
 
 static int cu_tail_reopen (cu_tail_t *obj)
 {
   int seek_end = 0;
-  FILE *fh;
+  int fd;
   struct stat stat_buf;
   int status;
 
@@ -54,22 +63,23 @@ static int cu_tail_reopen (cu_tail_t *obj)
   }
 
   /* The file is already open.. */
-  if ((obj->fh != NULL) && (stat_buf.st_ino == obj->stat.st_ino))
+  if ((obj->fd >= 0) && (stat_buf.st_ino == obj->stat.st_ino))
   {
     /* Seek to the beginning if file was truncated */
     if (stat_buf.st_size < obj->stat.st_size)
     {
       INFO ("utils_tail: File `%s' was truncated.", obj->file);
-      status = fseek (obj->fh, 0, SEEK_SET);
-      if (status != 0)
+      if (lseek (obj->fd, 0, SEEK_SET) == ((off_t) -1))
       {
 	char errbuf[1024];
-	ERROR ("utils_tail: fseek (%s) failed: %s", obj->file,
+	ERROR ("utils_tail: lseek (%s) failed: %s", obj->file,
 	    sstrerror (errno, errbuf, sizeof (errbuf)));
-	fclose (obj->fh);
-	obj->fh = NULL;
+	close (obj->fd);
+	obj->fd = -1;
 	return (-1);
       }
+      memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
+      return (0);
     }
     memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
     return (1);
@@ -80,36 +90,151 @@ static int cu_tail_reopen (cu_tail_t *obj)
   if ((obj->stat.st_ino == 0) || (obj->stat.st_ino == stat_buf.st_ino))
     seek_end = 1;
 
-  fh = fopen (obj->file, "r");
-  if (fh == NULL)
+  fd = open (obj->file, O_RDONLY);
+  if (fd < 0)
   {
     char errbuf[1024];
-    ERROR ("utils_tail: fopen (%s) failed: %s", obj->file,
+    ERROR ("utils_tail: open (%s) failed: %s", obj->file,
 	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
 
   if (seek_end != 0)
   {
-    status = fseek (fh, 0, SEEK_END);
-    if (status != 0)
+    if (lseek (fd, 0, SEEK_END) == ((off_t) -1))
     {
       char errbuf[1024];
-      ERROR ("utils_tail: fseek (%s) failed: %s", obj->file,
+      ERROR ("utils_tail: lseek (%s) failed: %s", obj->file,
 	  sstrerror (errno, errbuf, sizeof (errbuf)));
-      fclose (fh);
+      close (fd);
       return (-1);
     }
   }
 
-  if (obj->fh != NULL)
-    fclose (obj->fh);
-  obj->fh = fh;
+  if (obj->fd >= 0)
+    close (obj->fd);
+  obj->fd = fd;
   memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
 
   return (0);
 } /* int cu_tail_reopen */
 
+/* Moves pending data to the front of the buffer and reads as much as fits
+ * after it. Returns the number of bytes read, zero on EOF and -1 on error. */
+static ssize_t cu_tail_fill (cu_tail_t *obj) /* {{{ */
+{
+  ssize_t status;
+
+  if (obj->buffer_pos > 0)
+  {
+    memmove (obj->buffer, obj->buffer + obj->buffer_pos,
+	obj->buffer_fill - obj->buffer_pos);
+    obj->buffer_fill -= obj->buffer_pos;
+    obj->buffer_pos = 0;
+  }
+
+  /* Keep one byte for the terminating null byte. */
+  do
+  {
+    status = read (obj->fd, obj->buffer + obj->buffer_fill,
+	(CU_TAIL_BUFFER_SIZE - 1) - obj->buffer_fill);
+  } while ((status < 0) && (errno == EINTR));
+
+  if (status < 0)
+  {
+    char errbuf[1024];
+    WARNING ("utils_tail: read (%s) returned an error: %s", obj->file,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (obj->fd);
+    obj->fd = -1;
+    /* The file is re-opened at its end, so pending data is useless. */
+    obj->buffer_pos = 0;
+    obj->buffer_fill = 0;
+    return (-1);
+  }
+
+  obj->buffer_fill += (size_t) status;
+  return (status);
+} /* }}} ssize_t cu_tail_fill */
+
+/* Hands out the next line in the buffer, reading more data if required. The
+ * line includes the newline, if any, and is not null-terminated. If it
+ * doesn't end in a newline, there is room for a null byte behind it. Returns
+ * one if a line was found, zero on EOF and less than zero on error. */
+static int cu_tail_next_line (cu_tail_t *obj, /* {{{ */
+    char **ret_line, size_t *ret_len)
+{
+  int status;
+
+  if (obj->buffer == NULL)
+  {
+    obj->buffer = malloc (CU_TAIL_BUFFER_SIZE);
+    if (obj->buffer == NULL)
+    {
+      ERROR ("utils_tail: malloc failed.");
+      return (-1);
+    }
+    obj->buffer_pos = 0;
+    obj->buffer_fill = 0;
+  }
+
+  if (obj->fd < 0)
+  {
+    status = cu_tail_reopen (obj);
+    if (status < 0)
+      return (status);
+  }
+  assert (obj->fd >= 0);
+
+  while (42)
+  {
+    char *line = obj->buffer + obj->buffer_pos;
+    size_t pending = obj->buffer_fill - obj->buffer_pos;
+    char *newline;
+    ssize_t read_status;
+
+    newline = memchr (line, '\n', pending);
+    if (newline != NULL)
+    {
+      *ret_line = line;
+      *ret_len = (size_t) (newline - line) + 1;
+      obj->buffer_pos += *ret_len;
+      return (1);
+    }
+
+    /* The buffer is full and doesn't contain a newline: Hand out what we
+     * have. */
+    if (obj->buffer_fill >= (CU_TAIL_BUFFER_SIZE - 1) && (obj->buffer_pos == 0))
+      break;
+
+    read_status = cu_tail_fill (obj);
+    if (read_status > 0)
+      continue;
+    else if (read_status < 0)
+      return (-1);
+
+    /* EOF -> check if the file was moved away or truncated and reopen the
+     * file if so. */
+    status = cu_tail_reopen (obj);
+    if (status < 0)
+      return (status);
+    /* file end reached and file not reopened -> nothing more to read. An
+     * incomplete line is kept until the rest of it has been written. */
+    else if (status > 0)
+      return (0);
+
+    /* The file has been re-opened or rewound. The old file will not be
+     * continued, so hand out a pending incomplete line first. */
+    if (obj->buffer_fill > obj->buffer_pos)
+      break;
+  } /* while (42) */
+
+  *ret_line = obj->buffer + obj->buffer_pos;
+  *ret_len = obj->buffer_fill - obj->buffer_pos;
+  obj->buffer_pos = obj->buffer_fill;
+  return (1);
+} /* }}} int cu_tail_next_line */
+
 cu_tail_t *cu_tail_create (const char *file)
 {
 	cu_tail_t *obj;
@@ -126,15 +251,17 @@ cu_tail_t *cu_tail_create (const char *file)
 		return (NULL);
 	}
 
-	obj->fh = NULL;
+	obj->fd = -1;
+	obj->buffer = NULL;
 
 	return (obj);
 } /* cu_tail_t *cu_tail_create */
 
 int cu_tail_destroy (cu_tail_t *obj)
 {
-	if (obj->fh != NULL)
-		fclose (obj->fh);
+	if (obj->fd >= 0)
+		close (obj->fd);
+	free (obj->buffer);
 	free (obj->file);
 	free (obj);
 
@@ -143,6 +270,8 @@ int cu_tail_destroy (cu_tail_t *obj)
 
 int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
 {
+  char *line;
+  size_t len;
   int status;
 
   if (buflen < 1)
@@ -152,96 +281,53 @@ int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
     return (-1);
   }
 
-  if (obj->fh == NULL)
-  {
-    status = cu_tail_reopen (obj);
-    if (status < 0)
-      return (status);
-  }
-  assert (obj->fh != NULL);
-
-  /* Try to read from the filehandle. If that succeeds, everything appears to
-   * be fine and we can return. */
-  clearerr (obj->fh);
-  if (fgets (buf, buflen, obj->fh) != NULL)
-  {
-    buf[buflen - 1] = 0;
-    return (0);
-  }
-
-  /* Check if we encountered an error */
-  if (ferror (obj->fh) != 0)
-  {
-    /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
-    fclose (obj->fh);
-    obj->fh = NULL;
-  }
-  /* else: eof -> check if the file was moved away and reopen the new file if
-   * so.. */
-
-  status = cu_tail_reopen (obj);
-  /* error -> return with error */
+  status = cu_tail_next_line (obj, &line, &len);
   if (status < 0)
     return (status);
-  /* file end reached and file not reopened -> nothing more to read */
-  else if (status > 0)
+  else if (status == 0)
   {
     buf[0] = 0;
     return (0);
   }
 
-  /* If we get here: file was re-opened and there may be more to read.. Let's
-   * try again. */
-  if (fgets (buf, buflen, obj->fh) != NULL)
-  {
-    buf[buflen - 1] = 0;
-    return (0);
-  }
-
-  if (ferror (obj->fh) != 0)
+  /* Leave the part that doesn't fit into `buf' for the next call. */
+  if (len > ((size_t) buflen) - 1)
   {
-    char errbuf[1024];
-    WARNING ("utils_tail: fgets (%s) returned an error: %s", obj->file,
-	sstrerror (errno, errbuf, sizeof (errbuf)));
-    fclose (obj->fh);
-    obj->fh = NULL;
-    return (-1);
+    obj->buffer_pos -= len - (((size_t) buflen) - 1);
+    len = ((size_t) buflen) - 1;
   }
 
-  /* EOf, well, apparently the new file is empty.. */
-  buf[0] = 0;
+  memcpy (buf, line, len);
+  buf[len] = 0;
   return (0);
 } /* int cu_tail_readline */
 
-int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-		void *data)
+int cu_tail_read (cu_tail_t *obj, tailfunc_t *callback, void *data)
 {
 	int status;
 
 	while (42)
 	{
+		char *line;
 		size_t len;
 
-		status = cu_tail_readline (obj, buf, buflen);
-		if (status != 0)
+		status = cu_tail_next_line (obj, &line, &len);
+		if (status < 0)
 		{
-			ERROR ("utils_tail: cu_tail_read: cu_tail_readline "
+			ERROR ("utils_tail: cu_tail_read: cu_tail_next_line "
 					"failed.");
 			break;
 		}
 
 		/* check for EOF */
-		if (buf[0] == 0)
+		if (status == 0)
 			break;
 
-		len = strlen (buf);
-		while (len > 0) {
-			if (buf[len - 1] != '\n')
-				break;
-			buf[len - 1] = '\0';
-		}
+		if ((len > 0) && (line[len - 1] == '\n'))
+			len--;
+		line[len] = 0;
 
-		status = callback (data, buf, buflen);
+		status = callback (data, line, (int) len);
 		if (status != 0)
 		{
 			ERROR ("utils_tail: cu_tail_read: callback returned "
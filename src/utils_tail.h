@@ -30,6 +30,9 @@
 struct cu_tail_s;
 typedef struct cu_tail_s cu_tail_t;
 
+/* Called for each line read by `cu_tail_read'. `buf' points to the line
+ * (without the trailing newline) inside the tail object's buffer and is only
+ * valid until the callback returns. `buflen' is the length of the line. */
 typedef int tailfunc_t(void *data, char *buf, int buflen);
 
 /*
@@ -64,20 +67,25 @@ int cu_tail_destroy (cu_tail_t *obj);
  *
  * You can check if the EOF condition is reached by looking at the buffer: If
  * the length of the string stored in the buffer is zero, EOF occurred.
- * Otherwise at least the newline character will be in the buffer.
+ * Otherwise at least the newline character will be in the buffer, unless the
+ * line was longer than `buflen'. In that case the rest of the line is
+ * returned by the next call.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
 int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen);
 
 /*
- * cu_tail_readline
+ * cu_tail_read
  *
- * Reads from the file until eof condition or an error is encountered.
+ * Reads from the file until eof condition or an error is encountered and
+ * calls `callback' for each line. The file is read in large blocks and the
+ * lines are split up in place, i.e. no data is copied per line. A line which
+ * has not been terminated by a newline yet is kept back until the rest of it
+ * has been written, unless the file was rotated in the meantime.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
-int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-		void *data);
+int cu_tail_read (cu_tail_t *obj, tailfunc_t *callback, void *data);
 
 #endif /* UTILS_TAIL_H */
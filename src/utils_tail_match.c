@@ -31,6 +31,11 @@
 #include "utils_tail.h"
 #include "utils_tail_match.h"
 
+/* Scanning a line for the literals of a match set has a fixed cost, while
+ * match_apply() checks one literal per match. Only with many matches is the
+ * set faster, see utils_match_bench. */
+#define TAIL_MATCH_SET_MIN 40
+
 struct cu_tail_match_simple_s
 {
   char plugin[DATA_MAX_NAME_LEN];
@@ -56,6 +61,10 @@ struct cu_tail_match_s
 
   cu_tail_match_match_t *matches;
   size_t matches_num;
+
+  /* All matches of `matches', applied in one go. If this is NULL, the
+   * matches are applied one after another. */
+  cu_match_set_t *match_set;
 };
 
 /*
@@ -105,6 +114,12 @@ static int tail_callback (void *data, char *buf,
   cu_tail_match_t *obj = (cu_tail_match_t *) data;
   size_t i;
 
+  if ((obj->match_set != NULL) && (obj->matches_num >= TAIL_MATCH_SET_MIN))
+  {
+    match_set_apply (obj->match_set, buf);
+    return (0);
+  }
+
   for (i = 0; i < obj->matches_num; i++)
     match_apply (obj->matches[i].match, buf);
 
@@ -130,6 +145,9 @@ cu_tail_match_t *tail_match_create (const char *filename)
     return (NULL);
   }
 
+  /* Not fatal, see tail_callback. */
+  obj->match_set = match_set_create ();
+
   return (obj);
 } /* cu_tail_match_t *tail_match_create */
 
@@ -146,6 +164,9 @@ void tail_match_destroy (cu_tail_match_t *obj)
     obj->tail = NULL;
   }
 
+  match_set_destroy (obj->match_set);
+  obj->match_set = NULL;
+
   for (i = 0; i < obj->matches_num; i++)
   {
     cu_tail_match_match_t *match = obj->matches + i;
@@ -187,6 +208,13 @@ int tail_match_add_match (cu_tail_match_t *obj, cu_match_t *match,
   temp->submit = submit_match;
   temp->free = free_user_data;
 
+  if ((obj->match_set != NULL)
+      && (match_set_add (obj->match_set, match) != 0))
+  {
+    match_set_destroy (obj->match_set);
+    obj->match_set = NULL;
+  }
+
   return (0);
 } /* int tail_match_add_match */
 
@@ -235,12 +263,10 @@ int tail_match_add_match_simple (cu_tail_match_t *obj,
 
 int tail_match_read (cu_tail_match_t *obj)
 {
-  char buffer[4096];
   int status;
   size_t i;
 
-  status = cu_tail_read (obj->tail, buffer, sizeof (buffer), tail_callback,
-      (void *) obj);
+  status = cu_tail_read (obj->tail, tail_callback, (void *) obj);
   if (status != 0)
   {
     ERROR ("tail_match: cu_tail_read failed.");
@@ -46,6 +46,7 @@
 #include "configfile.h"
 
 #include "utils_cache.h"
+#include "utils_complain.h"
 #include "utils_parse_option.h"
 #include "utils_format_graphite.h"
 
@@ -53,6 +54,7 @@
 #include <pthread.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 
 #ifndef WG_DEFAULT_NODE
@@ -72,9 +74,36 @@
 # define WG_SEND_BUF_SIZE 1428
 #endif
 
+#ifndef WG_DEFAULT_MAX_BACKLOG
+# define WG_DEFAULT_MAX_BACKLOG 1048576
+#endif
+
+/* In milliseconds. */
+#ifndef WG_DEFAULT_TIMEOUT
+# define WG_DEFAULT_TIMEOUT 1000
+#endif
+
+/* Maximum number of buffers passed to the kernel with one system call. */
+#define WG_MAX_IOV 16
+
+/* Delay between reconnect attempts. Doubled after each failure. */
+#define WG_RECONNECT_DELAY_MIN TIME_T_TO_CDTIME_T (1)
+#define WG_RECONNECT_DELAY_MAX TIME_T_TO_CDTIME_T (64)
+
 /*
  * Private variables
  */
+struct wg_buffer_s
+{
+    char   data[WG_SEND_BUF_SIZE];
+    size_t fill;
+    struct wg_buffer_s *next;
+};
+typedef struct wg_buffer_s wg_buffer_t;
+
+/* The write callback only fills buffers and appends them to a queue. A
+ * separate thread per <Carbon> block sends the queued buffers, so a slow or
+ * unreachable carbon server doesn't block the write threads. */
 struct wg_callback
 {
     int      sock_fd;
@@ -89,79 +118,33 @@ struct wg_callback
     _Bool    separate_instances;
     _Bool    always_append_ds;
 
-    char     send_buf[WG_SEND_BUF_SIZE];
-    size_t   send_buf_free;
-    size_t   send_buf_fill;
+    /* In milliseconds, zero for none. */
+    int      timeout;
+
+    /* Buffer currently being filled. */
+    wg_buffer_t *send_buf;
     cdtime_t send_buf_init_time;
 
+    /* Buffers waiting to be sent. */
+    wg_buffer_t *queue_head;
+    wg_buffer_t *queue_tail;
+    size_t   queue_length;
+    size_t   queue_max;
+    c_complain_t queue_complaint;
+
     pthread_mutex_t send_lock;
+    pthread_cond_t  send_cond;
+    pthread_t       send_thread;
+    _Bool           send_thread_running;
+    _Bool           send_thread_stop;
 };
 
 
 /*
  * Functions
  */
-static void wg_reset_buffer (struct wg_callback *cb)
-{
-    memset (cb->send_buf, 0, sizeof (cb->send_buf));
-    cb->send_buf_free = sizeof (cb->send_buf);
-    cb->send_buf_fill = 0;
-    cb->send_buf_init_time = cdtime ();
-}
-
-static int wg_send_buffer (struct wg_callback *cb)
-{
-    ssize_t status = 0;
-
-    status = swrite (cb->sock_fd, cb->send_buf, strlen (cb->send_buf));
-    if (status < 0)
-    {
-        char errbuf[1024];
-        ERROR ("write_graphite plugin: send failed with status %zi (%s)",
-                status, sstrerror (errno, errbuf, sizeof (errbuf)));
-
-
-        close (cb->sock_fd);
-        cb->sock_fd = -1;
-
-        return (-1);
-    }
-
-    return (0);
-}
-
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
-{
-    int status;
-
-    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
-            "send_buf_fill = %zu;",
-            (double)timeout,
-            cb->send_buf_fill);
-
-    /* timeout == 0  => flush unconditionally */
-    if (timeout > 0)
-    {
-        cdtime_t now;
-
-        now = cdtime ();
-        if ((cb->send_buf_init_time + timeout) > now)
-            return (0);
-    }
-
-    if (cb->send_buf_fill <= 0)
-    {
-        cb->send_buf_init_time = cdtime ();
-        return (0);
-    }
-
-    status = wg_send_buffer (cb);
-    wg_reset_buffer (cb);
-
-    return (status);
-}
-
+/* Must be called with the sender thread being the only thread using the
+ * socket. */
 static int wg_callback_init (struct wg_callback *cb)
 {
     struct addrinfo ai_hints;
@@ -200,6 +183,19 @@ static int wg_callback_init (struct wg_callback *cb)
         if (cb->sock_fd < 0)
             continue;
 
+        /* The timeout applies to connecting and sending. Without it, a
+         * server which stops reading blocks the sender thread, and with it
+         * the shutdown, indefinitely. */
+        if (cb->timeout > 0)
+        {
+            struct timeval tv;
+
+            tv.tv_sec = cb->timeout / 1000;
+            tv.tv_usec = (cb->timeout % 1000) * 1000;
+            setsockopt (cb->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+            setsockopt (cb->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+        }
+
         status = connect (cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
         if (status != 0)
         {
@@ -219,11 +215,271 @@ static int wg_callback_init (struct wg_callback *cb)
         ERROR ("write_graphite plugin: Connecting to %s:%s failed. "
                 "The last error was: %s", node, service,
                 sstrerror (errno, errbuf, sizeof (errbuf)));
-        close (cb->sock_fd);
         return (-1);
     }
 
-    wg_reset_buffer (cb);
+    return (0);
+}
+
+/* Sends the list of buffers `buffers' using as few system calls as possible.
+ * On failure, the connection is closed. */
+static int wg_send_buffers (struct wg_callback *cb, wg_buffer_t *buffers)
+{
+    struct iovec iov[WG_MAX_IOV];
+    int iov_num = 0;
+    int iov_idx = 0;
+    wg_buffer_t *buf;
+
+    for (buf = buffers; buf != NULL; buf = buf->next)
+    {
+        assert (iov_num < WG_MAX_IOV);
+        iov[iov_num].iov_base = buf->data;
+        iov[iov_num].iov_len = buf->fill;
+        iov_num++;
+    }
+
+    while (iov_idx < iov_num)
+    {
+        ssize_t status;
+
+        status = writev (cb->sock_fd, iov + iov_idx, iov_num - iov_idx);
+        if (status < 0)
+        {
+            char errbuf[1024];
+
+            if (errno == EINTR)
+                continue;
+
+            ERROR ("write_graphite plugin: send failed with status %zi (%s)",
+                    status, sstrerror (errno, errbuf, sizeof (errbuf)));
+
+            close (cb->sock_fd);
+            cb->sock_fd = -1;
+
+            return (-1);
+        }
+
+        /* Skip over the data that has been written. */
+        while ((iov_idx < iov_num) && (((size_t) status) >= iov[iov_idx].iov_len))
+        {
+            status -= iov[iov_idx].iov_len;
+            iov_idx++;
+        }
+        if (status > 0)
+        {
+            iov[iov_idx].iov_base = ((char *) iov[iov_idx].iov_base) + status;
+            iov[iov_idx].iov_len -= (size_t) status;
+        }
+    }
+
+    return (0);
+}
+
+static void wg_free_buffers (wg_buffer_t *buf)
+{
+    while (buf != NULL)
+    {
+        wg_buffer_t *next = buf->next;
+        sfree (buf);
+        buf = next;
+    }
+}
+
+/* Drops the oldest queued buffers until the queue is within its limit.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static void wg_queue_limit_nolock (struct wg_callback *cb)
+{
+    size_t dropped = 0;
+
+    while (cb->queue_length > cb->queue_max)
+    {
+        wg_buffer_t *buf = cb->queue_head;
+
+        cb->queue_head = buf->next;
+        if (cb->queue_head == NULL)
+            cb->queue_tail = NULL;
+        cb->queue_length--;
+
+        sfree (buf);
+        dropped++;
+    }
+
+    if (dropped > 0)
+        c_complain (LOG_WARNING, &cb->queue_complaint,
+                "write_graphite plugin: [%s]:%s: Backlog is full, "
+                "dropping the oldest data.",
+                cb->node != NULL ? cb->node : WG_DEFAULT_NODE,
+                cb->service != NULL ? cb->service : WG_DEFAULT_SERVICE);
+}
+
+/* Moves the current buffer to the queue and wakes up the sender thread.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static void wg_enqueue_nolock (struct wg_callback *cb)
+{
+    wg_buffer_t *buf = cb->send_buf;
+
+    if ((buf == NULL) || (buf->fill == 0))
+        return;
+
+    cb->send_buf = NULL;
+
+    buf->next = NULL;
+    if (cb->queue_tail == NULL)
+        cb->queue_head = buf;
+    else
+        cb->queue_tail->next = buf;
+    cb->queue_tail = buf;
+    cb->queue_length++;
+
+    wg_queue_limit_nolock (cb);
+
+    pthread_cond_signal (&cb->send_cond);
+}
+
+static void *wg_send_thread (void *arg)
+{
+    struct wg_callback *cb = arg;
+    cdtime_t reconnect_delay = WG_RECONNECT_DELAY_MIN;
+    cdtime_t next_attempt = 0;
+
+    pthread_mutex_lock (&cb->send_lock);
+    while (42)
+    {
+        wg_buffer_t *buffers;
+        wg_buffer_t *last;
+        int buffers_num;
+        int status;
+
+        /* Wait for data and, after a failure, for the reconnect delay to
+         * pass. When shutting down, one last attempt is made right away. */
+        while (!cb->send_thread_stop)
+        {
+            if (cb->queue_head == NULL)
+            {
+                pthread_cond_wait (&cb->send_cond, &cb->send_lock);
+            }
+            else if (cdtime () < next_attempt)
+            {
+                struct timespec ts;
+
+                CDTIME_T_TO_TIMESPEC (next_attempt, &ts);
+                pthread_cond_timedwait (&cb->send_cond, &cb->send_lock, &ts);
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (cb->queue_head == NULL)
+            break;
+
+        /* Take up to WG_MAX_IOV buffers off the queue. */
+        buffers = cb->queue_head;
+        last = buffers;
+        buffers_num = 1;
+        while ((last->next != NULL) && (buffers_num < WG_MAX_IOV))
+        {
+            last = last->next;
+            buffers_num++;
+        }
+        cb->queue_head = last->next;
+        if (cb->queue_head == NULL)
+            cb->queue_tail = NULL;
+        cb->queue_length -= (size_t) buffers_num;
+        last->next = NULL;
+
+        pthread_mutex_unlock (&cb->send_lock);
+
+        status = wg_callback_init (cb);
+        if (status == 0)
+            status = wg_send_buffers (cb, buffers);
+
+        pthread_mutex_lock (&cb->send_lock);
+
+        if (status == 0)
+        {
+            wg_free_buffers (buffers);
+            reconnect_delay = WG_RECONNECT_DELAY_MIN;
+            next_attempt = 0;
+            continue;
+        }
+
+        if (cb->send_thread_stop)
+        {
+            ERROR ("write_graphite plugin: [%s]:%s: Discarding unsent data "
+                    "on shutdown.",
+                    cb->node != NULL ? cb->node : WG_DEFAULT_NODE,
+                    cb->service != NULL ? cb->service : WG_DEFAULT_SERVICE);
+            wg_free_buffers (buffers);
+            wg_free_buffers (cb->queue_head);
+            cb->queue_head = NULL;
+            cb->queue_tail = NULL;
+            cb->queue_length = 0;
+            break;
+        }
+
+        /* Put the buffers back to the front of the queue. Buffers which
+         * have been sent in part are sent again completely, because the
+         * connection has been closed. */
+        last->next = cb->queue_head;
+        cb->queue_head = buffers;
+        if (cb->queue_tail == NULL)
+            cb->queue_tail = last;
+        cb->queue_length += (size_t) buffers_num;
+        wg_queue_limit_nolock (cb);
+
+        next_attempt = cdtime () + reconnect_delay;
+        reconnect_delay *= 2;
+        if (reconnect_delay > WG_RECONNECT_DELAY_MAX)
+            reconnect_delay = WG_RECONNECT_DELAY_MAX;
+    }
+    pthread_mutex_unlock (&cb->send_lock);
+
+    return (NULL);
+}
+
+/* NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_start_thread_nolock (struct wg_callback *cb)
+{
+    int status;
+
+    if (cb->send_thread_running)
+        return (0);
+
+    status = plugin_thread_create (&cb->send_thread, /* attr = */ NULL,
+            wg_send_thread, cb);
+    if (status != 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_graphite plugin: pthread_create failed: %s",
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        return (-1);
+    }
+
+    cb->send_thread_running = 1;
+    return (0);
+}
+
+/* NOTE: You must hold cb->send_lock when calling this function! */
+static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
+{
+    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
+            "send_buf_fill = %zu;",
+            (double)timeout,
+            (cb->send_buf != NULL) ? cb->send_buf->fill : 0);
+
+    /* timeout == 0  => flush unconditionally */
+    if (timeout > 0)
+    {
+        cdtime_t now;
+
+        now = cdtime ();
+        if ((cb->send_buf_init_time + timeout) > now)
+            return (0);
+    }
+
+    wg_enqueue_nolock (cb);
 
     return (0);
 }
@@ -238,17 +494,30 @@ static void wg_callback_free (void *data)
     cb = data;
 
     pthread_mutex_lock (&cb->send_lock);
-
     wg_flush_nolock (/* timeout = */ 0, cb);
+    cb->send_thread_stop = 1;
+    pthread_cond_broadcast (&cb->send_cond);
+    pthread_mutex_unlock (&cb->send_lock);
+
+    if (cb->send_thread_running)
+    {
+        pthread_join (cb->send_thread, /* retval = */ NULL);
+        cb->send_thread_running = 0;
+    }
 
-    close(cb->sock_fd);
+    if (cb->sock_fd >= 0)
+        close (cb->sock_fd);
     cb->sock_fd = -1;
 
+    wg_free_buffers (cb->send_buf);
+    wg_free_buffers (cb->queue_head);
+
     sfree(cb->node);
     sfree(cb->service);
     sfree(cb->prefix);
     sfree(cb->postfix);
 
+    pthread_cond_destroy (&cb->send_cond);
     pthread_mutex_destroy (&cb->send_lock);
 
     sfree(cb);
@@ -267,18 +536,6 @@ static int wg_flush (cdtime_t timeout,
     cb = user_data->data;
 
     pthread_mutex_lock (&cb->send_lock);
-
-    if (cb->sock_fd < 0)
-    {
-        status = wg_callback_init (cb);
-        if (status != 0)
-        {
-            ERROR ("write_graphite plugin: wg_callback_init failed.");
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
-        }
-    }
-
     status = wg_flush_nolock (timeout, cb);
     pthread_mutex_unlock (&cb->send_lock);
 
@@ -287,49 +544,55 @@ static int wg_flush (cdtime_t timeout,
 
 static int wg_send_message (char const *message, struct wg_callback *cb)
 {
-    int status;
     size_t message_len;
+    wg_buffer_t *buf;
 
     message_len = strlen (message);
+    if (message_len >= WG_SEND_BUF_SIZE)
+    {
+        ERROR ("write_graphite plugin: Message of %zu bytes is too large "
+                "for the send buffer.", message_len);
+        return (-1);
+    }
 
     pthread_mutex_lock (&cb->send_lock);
 
-    if (cb->sock_fd < 0)
+    if (wg_start_thread_nolock (cb) != 0)
     {
-        status = wg_callback_init (cb);
-        if (status != 0)
-        {
-            ERROR ("write_graphite plugin: wg_callback_init failed.");
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
-        }
+        pthread_mutex_unlock (&cb->send_lock);
+        return (-1);
     }
 
-    if (message_len >= cb->send_buf_free)
+    if ((cb->send_buf != NULL)
+            && ((cb->send_buf->fill + message_len) >= WG_SEND_BUF_SIZE))
+        wg_enqueue_nolock (cb);
+
+    if (cb->send_buf == NULL)
     {
-        status = wg_flush_nolock (/* timeout = */ 0, cb);
-        if (status != 0)
+        cb->send_buf = malloc (sizeof (*cb->send_buf));
+        if (cb->send_buf == NULL)
         {
             pthread_mutex_unlock (&cb->send_lock);
-            return (status);
+            ERROR ("write_graphite plugin: malloc failed.");
+            return (-1);
         }
+        cb->send_buf->fill = 0;
+        cb->send_buf->next = NULL;
+        cb->send_buf_init_time = cdtime ();
     }
+    buf = cb->send_buf;
 
     /* Assert that we have enough space for this message. */
-    assert (message_len < cb->send_buf_free);
+    assert ((buf->fill + message_len) < WG_SEND_BUF_SIZE);
 
-    /* `message_len + 1' because `message_len' does not include the
-     * trailing null byte. Neither does `send_buffer_fill'. */
-    memcpy (cb->send_buf + cb->send_buf_fill,
-            message, message_len + 1);
-    cb->send_buf_fill += message_len;
-    cb->send_buf_free -= message_len;
+    memcpy (buf->data + buf->fill, message, message_len);
+    buf->fill += message_len;
 
     DEBUG ("write_graphite plugin: [%s]:%s buf %zu/%zu (%.1f %%) \"%s\"",
             cb->node,
             cb->service,
-            cb->send_buf_fill, sizeof (cb->send_buf),
-            100.0 * ((double) cb->send_buf_fill) / ((double) sizeof (cb->send_buf)),
+            buf->fill, sizeof (buf->data),
+            100.0 * ((double) buf->fill) / ((double) sizeof (buf->data)),
             message);
 
     pthread_mutex_unlock (&cb->send_lock);
@@ -356,7 +619,7 @@ static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
     if (status != 0) /* error message has been printed already. */
         return (status);
 
-    wg_send_message (buffer, cb);
+    status = wg_send_message (buffer, cb);
     if (status != 0)
     {
         ERROR ("write_graphite plugin: wg_send_message failed "
@@ -419,6 +682,7 @@ static int wg_config_carbon (oconfig_item_t *ci)
     struct wg_callback *cb;
     user_data_t user_data;
     char callback_name[DATA_MAX_NAME_LEN];
+    size_t max_backlog = WG_DEFAULT_MAX_BACKLOG;
     int i;
 
     cb = malloc (sizeof (*cb));
@@ -435,8 +699,15 @@ static int wg_config_carbon (oconfig_item_t *ci)
     cb->postfix = NULL;
     cb->escape_char = WG_DEFAULT_ESCAPE;
     cb->store_rates = 1;
+    cb->timeout = WG_DEFAULT_TIMEOUT;
+    cb->send_buf = NULL;
+    cb->queue_head = NULL;
+    cb->queue_tail = NULL;
+    cb->queue_length = 0;
+    C_COMPLAIN_INIT (&cb->queue_complaint);
 
     pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+    pthread_cond_init (&cb->send_cond, /* attr = */ NULL);
 
     for (i = 0; i < ci->children_num; i++)
     {
@@ -458,6 +729,17 @@ static int wg_config_carbon (oconfig_item_t *ci)
             cf_util_get_boolean (child, &cb->always_append_ds);
         else if (strcasecmp ("EscapeCharacter", child->key) == 0)
             config_set_char (&cb->escape_char, child);
+        else if (strcasecmp ("Timeout", child->key) == 0)
+            cf_util_get_int (child, &cb->timeout);
+        else if (strcasecmp ("MaxBacklog", child->key) == 0)
+        {
+            int tmp = 0;
+            if ((cf_util_get_int (child, &tmp) == 0) && (tmp >= 0))
+                max_backlog = tmp;
+            else
+                ERROR ("write_graphite plugin: The \"MaxBacklog\" option "
+                        "requires a non-negative integer.");
+        }
         else
         {
             ERROR ("write_graphite plugin: Invalid configuration "
@@ -465,6 +747,11 @@ static int wg_config_carbon (oconfig_item_t *ci)
         }
     }
 
+    /* Always allow at least one buffer to be queued. */
+    cb->queue_max = max_backlog / WG_SEND_BUF_SIZE;
+    if (cb->queue_max < 1)
+        cb->queue_max = 1;
+
     ssnprintf (callback_name, sizeof (callback_name), "write_graphite/%s/%s",
             cb->node != NULL ? cb->node : WG_DEFAULT_NODE,
             cb->service != NULL ? cb->service : WG_DEFAULT_SERVICE);
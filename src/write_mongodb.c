@@ -33,6 +33,8 @@
 #include "common.h"
 #include "configfile.h"
 #include "utils_cache.h"
+#include "utils_avltree.h"
+#include "utils_complain.h"
 
 #include <pthread.h>
 
@@ -43,6 +45,28 @@
 #endif
 #include <mongo.h>
 
+#define WM_DEFAULT_BATCH_SIZE 256
+#define WM_DEFAULT_BATCH_BYTES 1048576
+#define WM_DEFAULT_FLUSH_INTERVAL TIME_T_TO_CDTIME_T (1)
+
+/* Documents for one collection, inserted with a single mongo_insert_batch()
+ * call. */
+struct wm_batch_s;
+typedef struct wm_batch_s wm_batch_t;
+struct wm_batch_s
+{
+  char collection[DATA_MAX_NAME_LEN + 16];
+  /* The legacy driver's bson keeps pointers into itself, so documents must
+   * not be moved once initialized. */
+  bson **docs;
+  int docs_num;
+  int docs_size;
+  wm_batch_t *next;
+};
+
+/* The write callback only adds documents to the pending batches. A separate
+ * thread per <Node> block inserts them, so a slow server doesn't block the
+ * write threads. */
 struct wm_node_s
 {
   char name[DATA_MAX_NAME_LEN];
@@ -53,36 +77,56 @@ struct wm_node_s
 
   _Bool store_rates;
 
+  int batch_size;
+  int batch_bytes;
+  cdtime_t flush_interval;
+  int max_backlog;
+
+  /* Only used by the writer thread. */
   mongo conn[1];
+
+  /* Batches being filled, by collection name, and their combined size. */
+  c_avl_tree_t *pending;
+  int pending_docs;
+  int pending_bytes;
+  cdtime_t pending_init_time;
+
+  /* Size of the last document, used to size the next document's buffer. */
+  int doc_size_hint;
+
+  /* Batches waiting to be inserted and the number of documents in them. */
+  wm_batch_t *queue_head;
+  wm_batch_t *queue_tail;
+  int queue_docs;
+  c_complain_t queue_complaint;
+
   pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  _Bool thread_running;
+  _Bool thread_stop;
 };
 typedef struct wm_node_s wm_node_t;
 
 /*
  * Functions
  */
-static bson *wm_create_bson (const data_set_t *ds, /* {{{ */
-    const value_list_t *vl,
+/* Fills the uninitialized `ret' with the document for `vl'. `size_hint' is
+ * the expected size of the document in bytes. */
+static int wm_init_bson (bson *ret, int size_hint, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl,
     _Bool store_rates)
 {
-  bson *ret;
   gauge_t *rates;
   int i;
 
-  ret = bson_create ();
-  if (ret == NULL)
-  {
-    ERROR ("write_mongodb plugin: bson_create failed.");
-    return (NULL);
-  }
-
   if (store_rates)
   {
     rates = uc_get_rate (ds, vl);
     if (rates == NULL)
     {
       ERROR ("write_mongodb plugin: uc_get_rate() failed.");
-      return (NULL);
+      return (-1);
     }
   }
   else
@@ -90,7 +134,12 @@ static bson *wm_create_bson (const data_set_t *ds, /* {{{ */
     rates = NULL;
   }
 
+#if MONGO_MINOR >= 6
+  bson_init_size (ret, size_hint);
+#else
+  (void) size_hint;
   bson_init (ret);
+#endif
   bson_append_date (ret, "time", (bson_date_t) CDTIME_T_TO_MS (vl->time));
   bson_append_string (ret, "host", vl->host);
   bson_append_string (ret, "plugin", vl->plugin);
@@ -147,84 +196,369 @@ static bson *wm_create_bson (const data_set_t *ds, /* {{{ */
   bson_finish (ret);
 
   sfree (rates);
-  return (ret);
-} /* }}} bson *wm_create_bson */
 
-static int wm_write (const data_set_t *ds, /* {{{ */
-    const value_list_t *vl,
-    user_data_t *ud)
+  if (ret->err)
+  {
+    ERROR ("write_mongodb plugin: Creating the BSON document failed: %s",
+        (ret->errstr != NULL) ? ret->errstr : "unknown error");
+    bson_destroy (ret);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int wm_init_bson */
+
+static void wm_batch_destroy (wm_batch_t *batch) /* {{{ */
 {
-  wm_node_t *node = ud->data;
-  char collection_name[512];
-  bson *bson_record;
-  int status;
+  while (batch != NULL)
+  {
+    wm_batch_t *next = batch->next;
+    int i;
 
-  ssnprintf (collection_name, sizeof (collection_name), "collectd.%s",
-      vl->plugin);
+    for (i = 0; i < batch->docs_num; i++)
+    {
+      bson_destroy (batch->docs[i]);
+      bson_dispose (batch->docs[i]);
+    }
+    sfree (batch->docs);
+    sfree (batch);
 
-  bson_record = wm_create_bson (ds, vl, node->store_rates);
-  if (bson_record == NULL)
-    return (ENOMEM);
+    batch = next;
+  }
+} /* }}} void wm_batch_destroy */
 
-  pthread_mutex_lock (&node->lock);
+/* Must only be called from the writer thread. */
+static int wm_connect (wm_node_t *node) /* {{{ */
+{
+  int status;
 
-  if (!mongo_is_connected (node->conn))
-  {
-    INFO ("write_mongodb plugin: Connecting to [%s]:%i",
+  if (mongo_is_connected (node->conn))
+    return (0);
+
+  INFO ("write_mongodb plugin: Connecting to [%s]:%i",
+      (node->host != NULL) ? node->host : "localhost",
+      (node->port != 0) ? node->port : MONGO_DEFAULT_PORT);
+  status = mongo_connect (node->conn, node->host, node->port);
+  if (status != MONGO_OK) {
+    ERROR ("write_mongodb plugin: Connecting to [%s]:%i failed.",
         (node->host != NULL) ? node->host : "localhost",
         (node->port != 0) ? node->port : MONGO_DEFAULT_PORT);
-    status = mongo_connect (node->conn, node->host, node->port);
-    if (status != MONGO_OK) {
-      ERROR ("write_mongodb plugin: Connecting to [%s]:%i failed.",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : MONGO_DEFAULT_PORT);
-      mongo_destroy (node->conn);
-      pthread_mutex_unlock (&node->lock);
-      return (-1);
-    }
+    mongo_destroy (node->conn);
+    return (-1);
+  }
 
-    if (node->timeout > 0) {
-      status = mongo_set_op_timeout (node->conn, node->timeout);
-      if (status != MONGO_OK) {
-        WARNING ("write_mongodb plugin: mongo_set_op_timeout(%i) failed: %s",
-            node->timeout, node->conn->errstr);
-      }
+  if (node->timeout > 0) {
+    status = mongo_set_op_timeout (node->conn, node->timeout);
+    if (status != MONGO_OK) {
+      WARNING ("write_mongodb plugin: mongo_set_op_timeout(%i) failed: %s",
+          node->timeout, node->conn->errstr);
     }
   }
 
+  return (0);
+} /* }}} int wm_connect */
+
+/* Inserts all documents of `batch' with one request. Failed batches are not
+ * retried, because the server may have inserted some of the documents. */
+static int wm_insert_batch (wm_node_t *node, wm_batch_t *batch) /* {{{ */
+{
+  int status;
+
+  status = wm_connect (node);
+  if (status != 0)
+    return (status);
+
   /* Assert if the connection has been established */
   assert (mongo_is_connected (node->conn));
 
   #if MONGO_MINOR >= 6
     /* There was an API change in 0.6.0 as linked below */
     /* https://github.com/mongodb/mongo-c-driver/blob/master/HISTORY.md */
-    status = mongo_insert (node->conn, collection_name, bson_record, NULL);
+    status = mongo_insert_batch (node->conn, batch->collection,
+        (const bson **) batch->docs, batch->docs_num,
+        NULL, /* flags = */ 0);
   #else
-    status = mongo_insert (node->conn, collection_name, bson_record);
+    status = mongo_insert_batch (node->conn, batch->collection,
+        batch->docs, batch->docs_num);
   #endif
 
   if(status != MONGO_OK)
   {
-    ERROR ( "write_mongodb plugin: error inserting record: %d", node->conn->err);
+    ERROR ("write_mongodb plugin: error inserting %i records into %s: %d",
+        batch->docs_num, batch->collection, node->conn->err);
     if (node->conn->err != MONGO_BSON_INVALID)
       ERROR ("write_mongodb plugin: %s", node->conn->errstr);
-    else if (bson_record->err)
-      ERROR ("write_mongodb plugin: %s", bson_record->errstr);
 
     /* Disconnect except on data errors. */
     if ((node->conn->err != MONGO_BSON_INVALID)
         && (node->conn->err != MONGO_BSON_NOT_FINISHED))
       mongo_destroy (node->conn);
+
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int wm_insert_batch */
+
+/* Drops the oldest queued batches until the backlog is within its limit.
+ * NOTE: You must hold node->lock when calling this function! */
+static void wm_queue_limit_nolock (wm_node_t *node) /* {{{ */
+{
+  int dropped = 0;
+
+  if (node->max_backlog <= 0)
+    return;
+
+  while ((node->queue_head != NULL)
+      && (node->queue_docs > node->max_backlog))
+  {
+    wm_batch_t *batch = node->queue_head;
+
+    node->queue_head = batch->next;
+    if (node->queue_head == NULL)
+      node->queue_tail = NULL;
+    node->queue_docs -= batch->docs_num;
+    dropped += batch->docs_num;
+
+    batch->next = NULL;
+    wm_batch_destroy (batch);
+  }
+
+  if (dropped > 0)
+    c_complain (LOG_WARNING, &node->queue_complaint,
+        "write_mongodb plugin: Node \"%s\": Backlog is full, dropping the "
+        "oldest data.", node->name);
+} /* }}} void wm_queue_limit_nolock */
+
+/* Moves all pending batches to the queue and wakes up the writer thread.
+ * NOTE: You must hold node->lock when calling this function! */
+static void wm_enqueue_nolock (wm_node_t *node) /* {{{ */
+{
+  char *key;
+  wm_batch_t *batch;
+
+  if (node->pending_docs == 0)
+    return;
+
+  while (c_avl_pick (node->pending, (void *) &key, (void *) &batch) == 0)
+  {
+    batch->next = NULL;
+    if (node->queue_tail == NULL)
+      node->queue_head = batch;
+    else
+      node->queue_tail->next = batch;
+    node->queue_tail = batch;
+    node->queue_docs += batch->docs_num;
+  }
+
+  node->pending_docs = 0;
+  node->pending_bytes = 0;
+
+  wm_queue_limit_nolock (node);
+
+  pthread_cond_signal (&node->cond);
+} /* }}} void wm_enqueue_nolock */
+
+static void *wm_write_thread (void *arg) /* {{{ */
+{
+  wm_node_t *node = arg;
+
+  pthread_mutex_lock (&node->lock);
+  while (42)
+  {
+    wm_batch_t *batch;
+
+    /* Wait for a queued batch or for the pending documents to become older
+     * than `FlushInterval'. */
+    while (!node->thread_stop && (node->queue_head == NULL))
+    {
+      cdtime_t flush_time = node->pending_init_time + node->flush_interval;
+
+      if (node->pending_docs == 0)
+      {
+        pthread_cond_wait (&node->cond, &node->lock);
+      }
+      else if (flush_time <= cdtime ())
+      {
+        wm_enqueue_nolock (node);
+      }
+      else
+      {
+        struct timespec ts;
+
+        CDTIME_T_TO_TIMESPEC (flush_time, &ts);
+        pthread_cond_timedwait (&node->cond, &node->lock, &ts);
+      }
+    }
+
+    if (node->queue_head == NULL)
+      break;
+
+    batch = node->queue_head;
+    node->queue_head = batch->next;
+    if (node->queue_head == NULL)
+      node->queue_tail = NULL;
+    node->queue_docs -= batch->docs_num;
+    batch->next = NULL;
+
+    pthread_mutex_unlock (&node->lock);
+
+    wm_insert_batch (node, batch);
+    wm_batch_destroy (batch);
+
+    pthread_mutex_lock (&node->lock);
+  }
+  pthread_mutex_unlock (&node->lock);
+
+  return (NULL);
+} /* }}} void *wm_write_thread */
+
+/* NOTE: You must hold node->lock when calling this function! */
+static int wm_start_thread_nolock (wm_node_t *node) /* {{{ */
+{
+  int status;
+
+  if (node->thread_running)
+    return (0);
+
+  status = plugin_thread_create (&node->thread, /* attr = */ NULL,
+      wm_write_thread, node);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_mongodb plugin: pthread_create failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  node->thread_running = 1;
+  return (0);
+} /* }}} int wm_start_thread_nolock */
+
+/* Returns the pending batch for `collection', creating it if necessary.
+ * NOTE: You must hold node->lock when calling this function! */
+static wm_batch_t *wm_get_batch_nolock (wm_node_t *node, /* {{{ */
+    const char *collection)
+{
+  wm_batch_t *batch;
+
+  if (c_avl_get (node->pending, collection, (void *) &batch) == 0)
+    return (batch);
+
+  batch = malloc (sizeof (*batch));
+  if (batch == NULL)
+    return (NULL);
+  memset (batch, 0, sizeof (*batch));
+  sstrncpy (batch->collection, collection, sizeof (batch->collection));
+
+  if (c_avl_insert (node->pending, batch->collection, batch) != 0)
+  {
+    sfree (batch);
+    return (NULL);
   }
 
+  return (batch);
+} /* }}} wm_batch_t *wm_get_batch_nolock */
+
+static int wm_write (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl,
+    user_data_t *ud)
+{
+  wm_node_t *node = ud->data;
+  char collection_name[DATA_MAX_NAME_LEN + 16];
+  wm_batch_t *batch;
+  bson *bson_record;
+  int size_hint;
+  int status;
+
+  ssnprintf (collection_name, sizeof (collection_name), "collectd.%s",
+      vl->plugin);
+
+  pthread_mutex_lock (&node->lock);
+  size_hint = node->doc_size_hint;
   pthread_mutex_unlock (&node->lock);
 
-  /* free our resource as not to leak memory */
-  bson_dispose (bson_record);
+  bson_record = bson_create ();
+  if (bson_record == NULL)
+  {
+    ERROR ("write_mongodb plugin: bson_create failed.");
+    return (ENOMEM);
+  }
+
+  /* Build the document without holding the lock. */
+  status = wm_init_bson (bson_record, size_hint, ds, vl, node->store_rates);
+  if (status != 0)
+  {
+    bson_dispose (bson_record);
+    return (status);
+  }
+
+  pthread_mutex_lock (&node->lock);
+
+  batch = wm_get_batch_nolock (node, collection_name);
+  if ((batch != NULL) && (batch->docs_num >= batch->docs_size))
+  {
+    int docs_size = (batch->docs_size > 0) ? (2 * batch->docs_size) : 16;
+    bson **tmp;
+
+    tmp = realloc (batch->docs, docs_size * sizeof (*batch->docs));
+    if (tmp == NULL)
+    {
+      batch = NULL;
+    }
+    else
+    {
+      batch->docs = tmp;
+      batch->docs_size = docs_size;
+    }
+  }
+
+  if (batch == NULL)
+  {
+    pthread_mutex_unlock (&node->lock);
+    ERROR ("write_mongodb plugin: Allocating memory for the batch failed.");
+    bson_destroy (bson_record);
+    bson_dispose (bson_record);
+    return (ENOMEM);
+  }
+
+  batch->docs[batch->docs_num] = bson_record;
+  batch->docs_num++;
+
+  if (node->pending_docs == 0)
+    node->pending_init_time = cdtime ();
+  node->pending_docs++;
+  node->pending_bytes += bson_size (bson_record);
+  node->doc_size_hint = bson_size (bson_record);
+
+  if ((node->pending_docs >= node->batch_size)
+      || (node->pending_bytes >= node->batch_bytes))
+    wm_enqueue_nolock (node);
+
+  wm_start_thread_nolock (node);
+
+  pthread_mutex_unlock (&node->lock);
 
   return (0);
 } /* }}} int wm_write */
 
+static int wm_flush (cdtime_t timeout, /* {{{ */
+    const char __attribute__((unused)) *identifier,
+    user_data_t *ud)
+{
+  wm_node_t *node = ud->data;
+
+  pthread_mutex_lock (&node->lock);
+  /* timeout == 0  => flush unconditionally */
+  if ((node->pending_docs > 0)
+      && ((timeout == 0)
+        || ((node->pending_init_time + timeout) <= cdtime ())))
+    wm_enqueue_nolock (node);
+  pthread_mutex_unlock (&node->lock);
+
+  return (0);
+} /* }}} int wm_flush */
+
 static void wm_config_free (void *ptr) /* {{{ */
 {
   wm_node_t *node = ptr;
@@ -232,9 +566,37 @@ static void wm_config_free (void *ptr) /* {{{ */
   if (node == NULL)
     return;
 
+  pthread_mutex_lock (&node->lock);
+  if (node->pending != NULL)
+    wm_enqueue_nolock (node);
+  node->thread_stop = 1;
+  pthread_cond_broadcast (&node->cond);
+  pthread_mutex_unlock (&node->lock);
+
+  /* The writer thread inserts the remaining batches before it exits. */
+  if (node->thread_running)
+  {
+    pthread_join (node->thread, /* retval = */ NULL);
+    node->thread_running = 0;
+  }
+
   if (mongo_is_connected (node->conn))
     mongo_destroy (node->conn);
 
+  wm_batch_destroy (node->queue_head);
+  if (node->pending != NULL)
+  {
+    char *key;
+    wm_batch_t *batch;
+
+    while (c_avl_pick (node->pending, (void *) &key, (void *) &batch) == 0)
+      wm_batch_destroy (batch);
+    c_avl_destroy (node->pending);
+  }
+
+  pthread_cond_destroy (&node->cond);
+  pthread_mutex_destroy (&node->lock);
+
   sfree (node->host);
   sfree (node);
 } /* }}} void wm_config_free */
@@ -252,13 +614,27 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
   mongo_init (node->conn);
   node->host = NULL;
   node->store_rates = 1;
+  node->batch_size = WM_DEFAULT_BATCH_SIZE;
+  node->batch_bytes = WM_DEFAULT_BATCH_BYTES;
+  node->flush_interval = WM_DEFAULT_FLUSH_INTERVAL;
+  node->max_backlog = 0;
+  node->doc_size_hint = 256;
+  C_COMPLAIN_INIT (&node->queue_complaint);
   pthread_mutex_init (&node->lock, /* attr = */ NULL);
+  pthread_cond_init (&node->cond, /* attr = */ NULL);
+
+  node->pending = c_avl_create ((void *) strcmp);
+  if (node->pending == NULL)
+  {
+    wm_config_free (node);
+    return (ENOMEM);
+  }
 
   status = cf_util_get_string_buffer (ci, node->name, sizeof (node->name));
 
   if (status != 0)
   {
-    sfree (node);
+    wm_config_free (node);
     return (status);
   }
 
@@ -281,6 +657,14 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_int (child, &node->timeout);
     else if (strcasecmp ("StoreRates", child->key) == 0)
       status = cf_util_get_boolean (child, &node->store_rates);
+    else if (strcasecmp ("BatchSize", child->key) == 0)
+      status = cf_util_get_int (child, &node->batch_size);
+    else if (strcasecmp ("BatchBytes", child->key) == 0)
+      status = cf_util_get_int (child, &node->batch_bytes);
+    else if (strcasecmp ("FlushInterval", child->key) == 0)
+      status = cf_util_get_cdtime (child, &node->flush_interval);
+    else if (strcasecmp ("MaxBacklog", child->key) == 0)
+      status = cf_util_get_int (child, &node->max_backlog);
     else
       WARNING ("write_mongodb plugin: Ignoring unknown config option \"%s\".",
           child->key);
@@ -289,6 +673,28 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
       break;
   } /* for (i = 0; i < ci->children_num; i++) */
 
+  if (node->batch_size < 1)
+  {
+    WARNING ("write_mongodb plugin: Node \"%s\": BatchSize must be at least "
+        "one. Using the default of %i.", node->name, WM_DEFAULT_BATCH_SIZE);
+    node->batch_size = WM_DEFAULT_BATCH_SIZE;
+  }
+
+  if (node->batch_bytes < 1)
+  {
+    WARNING ("write_mongodb plugin: Node \"%s\": BatchBytes must be "
+        "positive. Using the default of %i.",
+        node->name, WM_DEFAULT_BATCH_BYTES);
+    node->batch_bytes = WM_DEFAULT_BATCH_BYTES;
+  }
+
+  if ((node->max_backlog > 0) && (node->max_backlog < node->batch_size))
+  {
+    WARNING ("write_mongodb plugin: Node \"%s\": MaxBacklog is smaller than "
+        "BatchSize. Setting it to %i.", node->name, node->batch_size);
+    node->max_backlog = node->batch_size;
+  }
+
   if (status == 0)
   {
     char cb_name[DATA_MAX_NAME_LEN];
@@ -301,6 +707,12 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
 
     status = plugin_register_write (cb_name, wm_write, &ud);
     INFO ("write_mongodb plugin: registered write plugin %s %d",cb_name,status);
+
+    if (status == 0)
+    {
+      ud.free_func = NULL;
+      plugin_register_flush (cb_name, wm_flush, &ud);
+    }
   }
 
   if (status != 0)
@@ -28,10 +28,50 @@
 #include "plugin.h"
 #include "common.h"
 #include "configfile.h"
+#include "utils_avltree.h"
+#include "utils_complain.h"
 
 #include <pthread.h>
-#include <credis.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netdb.h>
 
+#define WR_DEFAULT_HOST "localhost"
+#define WR_DEFAULT_PORT 6379
+#define WR_DEFAULT_BATCH_SIZE 512
+#define WR_DEFAULT_FLUSH_INTERVAL TIME_T_TO_CDTIME_T (1)
+
+/* Delay between reconnect attempts. Doubled after each failure. */
+#define WR_RECONNECT_DELAY_MIN TIME_T_TO_CDTIME_T (1)
+#define WR_RECONNECT_DELAY_MAX TIME_T_TO_CDTIME_T (64)
+
+/* Commands encoded in the Redis protocol. */
+struct wr_buffer_s
+{
+  char *data;
+  size_t size;
+  size_t fill;
+};
+typedef struct wr_buffer_s wr_buffer_t;
+
+/* A batch of value lists which is sent to the server in one go, i.e. with a
+ * single round trip. `zadd' holds one ZADD command per value list, the
+ * identifiers are collected in `members' so that a single SADD command adds
+ * each of them only once. */
+struct wr_batch_s;
+typedef struct wr_batch_s wr_batch_t;
+struct wr_batch_s
+{
+  wr_buffer_t zadd;
+  size_t values_num;
+  c_avl_tree_t *members;
+  cdtime_t init_time;
+  wr_batch_t *next;
+};
+
+/* The write callback only adds value lists to a batch. A separate thread per
+ * <Node> block sends the batches, so a slow or unreachable server doesn't
+ * block the write threads. */
 struct wr_node_s
 {
   char name[DATA_MAX_NAME_LEN];
@@ -39,15 +79,557 @@ struct wr_node_s
   char *host;
   int port;
   int timeout;
+  int batch_size;
+  cdtime_t flush_interval;
+  int max_backlog;
+
+  /* Only used by the sender thread. */
+  int sock_fd;
+
+  /* Batch currently being filled. */
+  wr_batch_t *batch;
+
+  /* Batches waiting to be sent and the number of value lists in them. */
+  wr_batch_t *queue_head;
+  wr_batch_t *queue_tail;
+  size_t queue_values;
+  c_complain_t queue_complaint;
 
-  REDIS conn;
   pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  _Bool thread_running;
+  _Bool thread_stop;
 };
 typedef struct wr_node_s wr_node_t;
 
 /*
  * Functions
  */
+static int wr_buffer_add (wr_buffer_t *buf, /* {{{ */
+    const char *data, size_t data_len)
+{
+  if ((buf->fill + data_len) > buf->size)
+  {
+    size_t size = (buf->size > 0) ? buf->size : 4096;
+    char *tmp;
+
+    while (size < (buf->fill + data_len))
+      size *= 2;
+
+    tmp = realloc (buf->data, size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    buf->data = tmp;
+    buf->size = size;
+  }
+
+  memcpy (buf->data + buf->fill, data, data_len);
+  buf->fill += data_len;
+
+  return (0);
+} /* }}} int wr_buffer_add */
+
+/* Starts a command with `argc' arguments, including the command name. */
+static int wr_buffer_add_command (wr_buffer_t *buf, size_t argc) /* {{{ */
+{
+  char tmp[32];
+
+  ssnprintf (tmp, sizeof (tmp), "*%zu\r\n", argc);
+  return (wr_buffer_add (buf, tmp, strlen (tmp)));
+} /* }}} int wr_buffer_add_command */
+
+static int wr_buffer_add_argument (wr_buffer_t *buf, /* {{{ */
+    const char *arg)
+{
+  char tmp[32];
+  size_t arg_len = strlen (arg);
+  int status;
+
+  ssnprintf (tmp, sizeof (tmp), "$%zu\r\n", arg_len);
+  status = wr_buffer_add (buf, tmp, strlen (tmp));
+  if (status == 0)
+    status = wr_buffer_add (buf, arg, arg_len);
+  if (status == 0)
+    status = wr_buffer_add (buf, "\r\n", 2);
+
+  return (status);
+} /* }}} int wr_buffer_add_argument */
+
+static wr_batch_t *wr_batch_create (void) /* {{{ */
+{
+  wr_batch_t *batch;
+
+  batch = malloc (sizeof (*batch));
+  if (batch == NULL)
+    return (NULL);
+  memset (batch, 0, sizeof (*batch));
+
+  batch->members = c_avl_create ((void *) strcmp);
+  if (batch->members == NULL)
+  {
+    sfree (batch);
+    return (NULL);
+  }
+  batch->init_time = cdtime ();
+
+  return (batch);
+} /* }}} wr_batch_t *wr_batch_create */
+
+static void wr_batch_destroy (wr_batch_t *batch) /* {{{ */
+{
+  while (batch != NULL)
+  {
+    wr_batch_t *next = batch->next;
+    char *key;
+    void *value;
+
+    while (c_avl_pick (batch->members, (void *) &key, &value) == 0)
+      sfree (key);
+    c_avl_destroy (batch->members);
+
+    sfree (batch->zadd.data);
+    sfree (batch);
+
+    batch = next;
+  }
+} /* }}} void wr_batch_destroy */
+
+/* Must only be called from the sender thread. */
+static int wr_connect (wr_node_t *node) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list;
+  struct addrinfo *ai_ptr;
+  char service[16];
+  const char *host;
+  int status;
+
+  if (node->sock_fd >= 0)
+    return (0);
+
+  host = (node->host != NULL) ? node->host : WR_DEFAULT_HOST;
+  ssnprintf (service, sizeof (service), "%i",
+      (node->port != 0) ? node->port : WR_DEFAULT_PORT);
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+
+  ai_list = NULL;
+  status = getaddrinfo (host, service, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    ERROR ("write_redis plugin: getaddrinfo (%s, %s) failed: %s",
+        host, service, gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    node->sock_fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (node->sock_fd < 0)
+      continue;
+
+    /* The timeout applies to connecting, sending and receiving. */
+    if (node->timeout > 0)
+    {
+      struct timeval tv;
+
+      tv.tv_sec = node->timeout / 1000;
+      tv.tv_usec = (node->timeout % 1000) * 1000;
+      setsockopt (node->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+      setsockopt (node->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    }
+
+    status = connect (node->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+    if (status != 0)
+    {
+      close (node->sock_fd);
+      node->sock_fd = -1;
+      continue;
+    }
+
+    break;
+  }
+
+  freeaddrinfo (ai_list);
+
+  if (node->sock_fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_redis plugin: Connecting to host \"%s\" (port %s) failed. "
+        "The last error was: %s", host, service,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int wr_connect */
+
+static void wr_disconnect (wr_node_t *node) /* {{{ */
+{
+  if (node->sock_fd >= 0)
+    close (node->sock_fd);
+  node->sock_fd = -1;
+} /* }}} void wr_disconnect */
+
+static int wr_send_all (wr_node_t *node, /* {{{ */
+    struct iovec *iov, int iov_num)
+{
+  int iov_idx = 0;
+
+  while (iov_idx < iov_num)
+  {
+    ssize_t status;
+
+    status = writev (node->sock_fd, iov + iov_idx, iov_num - iov_idx);
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+
+      ERROR ("write_redis plugin: Sending to node \"%s\" failed: %s",
+          node->name, sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+
+    /* Skip over the data that has been written. */
+    while ((iov_idx < iov_num) && (((size_t) status) >= iov[iov_idx].iov_len))
+    {
+      status -= iov[iov_idx].iov_len;
+      iov_idx++;
+    }
+    if (status > 0)
+    {
+      iov[iov_idx].iov_base = ((char *) iov[iov_idx].iov_base) + status;
+      iov[iov_idx].iov_len -= (size_t) status;
+    }
+  }
+
+  return (0);
+} /* }}} int wr_send_all */
+
+/* Reads `replies_num' replies. ZADD and SADD reply with an integer or an
+ * error, both of which are a single line. Returns non-zero if the connection
+ * has to be closed. */
+static int wr_read_replies (wr_node_t *node, size_t replies_num) /* {{{ */
+{
+  char buffer[4096];
+  char error[256] = "";
+  size_t error_fill = 0;
+  size_t errors_num = 0;
+  size_t replies = 0;
+  _Bool line_start = 1;
+  _Bool in_error = 0;
+
+  while (replies < replies_num)
+  {
+    ssize_t status;
+    ssize_t i;
+
+    status = recv (node->sock_fd, buffer, sizeof (buffer), /* flags = */ 0);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if (status <= 0)
+    {
+      char errbuf[1024];
+      ERROR ("write_redis plugin: Receiving from node \"%s\" failed: %s",
+          node->name, (status == 0) ? "Connection closed"
+          : sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+
+    for (i = 0; i < status; i++)
+    {
+      char c = buffer[i];
+
+      if (line_start)
+      {
+        line_start = 0;
+        if (c == '-')
+        {
+          errors_num++;
+          in_error = (errors_num == 1);
+          continue;
+        }
+        else if (c != ':')
+        {
+          ERROR ("write_redis plugin: Node \"%s\": Unexpected reply "
+              "type `%c'.", node->name, c);
+          return (-1);
+        }
+      }
+
+      if (c == '\n')
+      {
+        replies++;
+        line_start = 1;
+        in_error = 0;
+      }
+      else if (in_error && (c != '\r')
+          && (error_fill < (sizeof (error) - 1)))
+      {
+        error[error_fill] = c;
+        error_fill++;
+        error[error_fill] = 0;
+      }
+    }
+  }
+
+  if (errors_num > 0)
+    WARNING ("write_redis plugin: Node \"%s\": %zu of %zu commands failed. "
+        "The first error was: %s", node->name, errors_num, replies_num, error);
+
+  return (0);
+} /* }}} int wr_read_replies */
+
+/* Sends all ZADD commands of `batch' and one SADD command for the
+ * identifiers, then waits for the replies. */
+static int wr_send_batch (wr_node_t *node, wr_batch_t *batch) /* {{{ */
+{
+  wr_buffer_t sadd;
+  struct iovec iov[2];
+  int members_num;
+  int status;
+
+  memset (&sadd, 0, sizeof (sadd));
+
+  members_num = c_avl_size (batch->members);
+  status = 0;
+  if (members_num > 0)
+  {
+    c_avl_iterator_t *iter;
+    char *key;
+    void *value;
+
+    status = wr_buffer_add_command (&sadd, 2 + (size_t) members_num);
+    if (status == 0)
+      status = wr_buffer_add_argument (&sadd, "SADD");
+    if (status == 0)
+      status = wr_buffer_add_argument (&sadd, "collectd/values");
+
+    iter = c_avl_get_iterator (batch->members);
+    while ((status == 0)
+        && (c_avl_iterator_next (iter, (void *) &key, &value) == 0))
+      status = wr_buffer_add_argument (&sadd, key);
+    c_avl_iterator_destroy (iter);
+  }
+
+  if (status != 0)
+  {
+    ERROR ("write_redis plugin: Allocating memory for the SADD command "
+        "failed.");
+    sfree (sadd.data);
+    return (-1);
+  }
+
+  iov[0].iov_base = batch->zadd.data;
+  iov[0].iov_len = batch->zadd.fill;
+  iov[1].iov_base = sadd.data;
+  iov[1].iov_len = sadd.fill;
+
+  status = wr_send_all (node, iov, (members_num > 0) ? 2 : 1);
+  sfree (sadd.data);
+
+  if (status == 0)
+    status = wr_read_replies (node,
+        batch->values_num + ((members_num > 0) ? 1 : 0));
+
+  if (status != 0)
+    wr_disconnect (node);
+
+  return (status);
+} /* }}} int wr_send_batch */
+
+/* Drops the oldest queued batches until the backlog is within its limit.
+ * NOTE: You must hold node->lock when calling this function! */
+static void wr_queue_limit_nolock (wr_node_t *node) /* {{{ */
+{
+  size_t dropped = 0;
+
+  if (node->max_backlog <= 0)
+    return;
+
+  while ((node->queue_head != NULL)
+      && (node->queue_values > (size_t) node->max_backlog))
+  {
+    wr_batch_t *batch = node->queue_head;
+
+    node->queue_head = batch->next;
+    if (node->queue_head == NULL)
+      node->queue_tail = NULL;
+    node->queue_values -= batch->values_num;
+    dropped += batch->values_num;
+
+    batch->next = NULL;
+    wr_batch_destroy (batch);
+  }
+
+  if (dropped > 0)
+    c_complain (LOG_WARNING, &node->queue_complaint,
+        "write_redis plugin: Node \"%s\": Backlog is full, dropping the "
+        "oldest data.", node->name);
+} /* }}} void wr_queue_limit_nolock */
+
+/* Moves the current batch to the queue and wakes up the sender thread.
+ * NOTE: You must hold node->lock when calling this function! */
+static void wr_enqueue_nolock (wr_node_t *node) /* {{{ */
+{
+  wr_batch_t *batch = node->batch;
+
+  if ((batch == NULL) || (batch->values_num == 0))
+    return;
+
+  node->batch = NULL;
+
+  batch->next = NULL;
+  if (node->queue_tail == NULL)
+    node->queue_head = batch;
+  else
+    node->queue_tail->next = batch;
+  node->queue_tail = batch;
+  node->queue_values += batch->values_num;
+
+  wr_queue_limit_nolock (node);
+
+  pthread_cond_signal (&node->cond);
+} /* }}} void wr_enqueue_nolock */
+
+static void *wr_send_thread (void *arg) /* {{{ */
+{
+  wr_node_t *node = arg;
+  cdtime_t reconnect_delay = WR_RECONNECT_DELAY_MIN;
+  cdtime_t next_attempt = 0;
+
+  pthread_mutex_lock (&node->lock);
+  while (42)
+  {
+    wr_batch_t *batch;
+    int status;
+
+    /* Wait for a queued batch or for the current batch to become older than
+     * `FlushInterval', and after a failure for the reconnect delay to pass.
+     * When shutting down, one last attempt is made right away. */
+    while (!node->thread_stop)
+    {
+      cdtime_t now = cdtime ();
+      cdtime_t wakeup = 0;
+
+      if ((node->batch != NULL)
+          && ((node->batch->init_time + node->flush_interval) <= now))
+        wr_enqueue_nolock (node);
+
+      if (node->queue_head != NULL)
+      {
+        if (now >= next_attempt)
+          break;
+        wakeup = next_attempt;
+      }
+      else if (node->batch != NULL)
+      {
+        wakeup = node->batch->init_time + node->flush_interval;
+      }
+
+      if (wakeup == 0)
+      {
+        pthread_cond_wait (&node->cond, &node->lock);
+      }
+      else
+      {
+        struct timespec ts;
+
+        CDTIME_T_TO_TIMESPEC (wakeup, &ts);
+        pthread_cond_timedwait (&node->cond, &node->lock, &ts);
+      }
+    }
+
+    if (node->queue_head == NULL)
+      break;
+
+    batch = node->queue_head;
+    node->queue_head = batch->next;
+    if (node->queue_head == NULL)
+      node->queue_tail = NULL;
+    node->queue_values -= batch->values_num;
+    batch->next = NULL;
+
+    pthread_mutex_unlock (&node->lock);
+
+    status = wr_connect (node);
+    if (status == 0)
+      status = wr_send_batch (node, batch);
+
+    pthread_mutex_lock (&node->lock);
+
+    if (status == 0)
+    {
+      wr_batch_destroy (batch);
+      reconnect_delay = WR_RECONNECT_DELAY_MIN;
+      next_attempt = 0;
+      continue;
+    }
+
+    if (node->thread_stop)
+    {
+      ERROR ("write_redis plugin: Node \"%s\": Discarding unsent data "
+          "on shutdown.", node->name);
+      wr_batch_destroy (batch);
+      wr_batch_destroy (node->queue_head);
+      node->queue_head = NULL;
+      node->queue_tail = NULL;
+      node->queue_values = 0;
+      break;
+    }
+
+    /* Put the batch back to the front of the queue. ZADD and SADD are
+     * idempotent, so sending commands again which have already been
+     * processed by the server doesn't hurt. */
+    batch->next = node->queue_head;
+    node->queue_head = batch;
+    if (node->queue_tail == NULL)
+      node->queue_tail = batch;
+    node->queue_values += batch->values_num;
+    wr_queue_limit_nolock (node);
+
+    next_attempt = cdtime () + reconnect_delay;
+    reconnect_delay *= 2;
+    if (reconnect_delay > WR_RECONNECT_DELAY_MAX)
+      reconnect_delay = WR_RECONNECT_DELAY_MAX;
+  }
+  pthread_mutex_unlock (&node->lock);
+
+  return (NULL);
+} /* }}} void *wr_send_thread */
+
+/* NOTE: You must hold node->lock when calling this function! */
+static int wr_start_thread_nolock (wr_node_t *node) /* {{{ */
+{
+  int status;
+
+  if (node->thread_running)
+    return (0);
+
+  status = plugin_thread_create (&node->thread, /* attr = */ NULL,
+      wr_send_thread, node);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("write_redis plugin: pthread_create failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  node->thread_running = 1;
+  return (0);
+} /* }}} int wr_start_thread_nolock */
+
 static int wr_write (const data_set_t *ds, /* {{{ */
     const value_list_t *vl,
     user_data_t *ud)
@@ -55,9 +637,11 @@ static int wr_write (const data_set_t *ds, /* {{{ */
   wr_node_t *node = ud->data;
   char ident[512];
   char key[512];
+  char score[32];
   char value[512];
   size_t value_size;
   char *value_ptr;
+  size_t zadd_fill;
   int status;
   int i;
 
@@ -65,6 +649,7 @@ static int wr_write (const data_set_t *ds, /* {{{ */
   if (status != 0)
     return (status);
   ssnprintf (key, sizeof (key), "collectd/%s", ident);
+  ssnprintf (score, sizeof (score), "%"PRIu64, (uint64_t) vl->time);
 
   memset (value, 0, sizeof (value));
   value_size = sizeof (value);
@@ -103,31 +688,74 @@ static int wr_write (const data_set_t *ds, /* {{{ */
 
   pthread_mutex_lock (&node->lock);
 
-  if (node->conn == NULL)
+  if (node->batch == NULL)
   {
-    node->conn = credis_connect (node->host, node->port, node->timeout);
-    if (node->conn == NULL)
+    node->batch = wr_batch_create ();
+    if (node->batch == NULL)
     {
-      ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed.",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : 6379);
       pthread_mutex_unlock (&node->lock);
+      ERROR ("write_redis plugin: wr_batch_create failed.");
       return (-1);
     }
   }
 
-  /* "credis_zadd" doesn't handle a NULL pointer gracefully, so I'd rather
-   * have a meaningful assertion message than a normal segmentation fault. */
-  assert (node->conn != NULL);
-  status = credis_zadd (node->conn, key, (double) vl->time, value);
+  zadd_fill = node->batch->zadd.fill;
+  status = wr_buffer_add_command (&node->batch->zadd, 4);
+  if (status == 0)
+    status = wr_buffer_add_argument (&node->batch->zadd, "ZADD");
+  if (status == 0)
+    status = wr_buffer_add_argument (&node->batch->zadd, key);
+  if (status == 0)
+    status = wr_buffer_add_argument (&node->batch->zadd, score);
+  if (status == 0)
+    status = wr_buffer_add_argument (&node->batch->zadd, value);
+  if (status != 0)
+  {
+    /* Don't leave a partial command behind. */
+    node->batch->zadd.fill = zadd_fill;
+    pthread_mutex_unlock (&node->lock);
+    ERROR ("write_redis plugin: Allocating memory for the ZADD command "
+        "failed.");
+    return (-1);
+  }
+  node->batch->values_num++;
+
+  if (c_avl_get (node->batch->members, ident, NULL) != 0)
+  {
+    char *member = strdup (ident);
+
+    if ((member != NULL)
+        && (c_avl_insert (node->batch->members, member, NULL) != 0))
+      sfree (member);
+  }
+
+  if (node->batch->values_num >= (size_t) node->batch_size)
+    wr_enqueue_nolock (node);
 
-  credis_sadd (node->conn, "collectd/values", ident);
+  wr_start_thread_nolock (node);
 
   pthread_mutex_unlock (&node->lock);
 
   return (0);
 } /* }}} int wr_write */
 
+static int wr_flush (cdtime_t timeout, /* {{{ */
+    const char __attribute__((unused)) *identifier,
+    user_data_t *ud)
+{
+  wr_node_t *node = ud->data;
+
+  pthread_mutex_lock (&node->lock);
+  /* timeout == 0  => flush unconditionally */
+  if ((node->batch != NULL)
+      && ((timeout == 0)
+        || ((node->batch->init_time + timeout) <= cdtime ())))
+    wr_enqueue_nolock (node);
+  pthread_mutex_unlock (&node->lock);
+
+  return (0);
+} /* }}} int wr_flush */
+
 static void wr_config_free (void *ptr) /* {{{ */
 {
   wr_node_t *node = ptr;
@@ -135,12 +763,26 @@ static void wr_config_free (void *ptr) /* {{{ */
   if (node == NULL)
     return;
 
-  if (node->conn != NULL)
+  pthread_mutex_lock (&node->lock);
+  wr_enqueue_nolock (node);
+  node->thread_stop = 1;
+  pthread_cond_broadcast (&node->cond);
+  pthread_mutex_unlock (&node->lock);
+
+  if (node->thread_running)
   {
-    credis_close (node->conn);
-    node->conn = NULL;
+    pthread_join (node->thread, /* retval = */ NULL);
+    node->thread_running = 0;
   }
 
+  wr_disconnect (node);
+
+  wr_batch_destroy (node->batch);
+  wr_batch_destroy (node->queue_head);
+
+  pthread_cond_destroy (&node->cond);
+  pthread_mutex_destroy (&node->lock);
+
   sfree (node->host);
   sfree (node);
 } /* }}} void wr_config_free */
@@ -158,13 +800,18 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
   node->host = NULL;
   node->port = 0;
   node->timeout = 1000;
-  node->conn = NULL;
+  node->batch_size = WR_DEFAULT_BATCH_SIZE;
+  node->flush_interval = WR_DEFAULT_FLUSH_INTERVAL;
+  node->max_backlog = 0;
+  node->sock_fd = -1;
+  C_COMPLAIN_INIT (&node->queue_complaint);
   pthread_mutex_init (&node->lock, /* attr = */ NULL);
+  pthread_cond_init (&node->cond, /* attr = */ NULL);
 
   status = cf_util_get_string_buffer (ci, node->name, sizeof (node->name));
   if (status != 0)
   {
-    sfree (node);
+    wr_config_free (node);
     return (status);
   }
 
@@ -185,6 +832,12 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
     }
     else if (strcasecmp ("Timeout", child->key) == 0)
       status = cf_util_get_int (child, &node->timeout);
+    else if (strcasecmp ("BatchSize", child->key) == 0)
+      status = cf_util_get_int (child, &node->batch_size);
+    else if (strcasecmp ("FlushInterval", child->key) == 0)
+      status = cf_util_get_cdtime (child, &node->flush_interval);
+    else if (strcasecmp ("MaxBacklog", child->key) == 0)
+      status = cf_util_get_int (child, &node->max_backlog);
     else
       WARNING ("write_redis plugin: Ignoring unknown config option \"%s\".",
           child->key);
@@ -193,6 +846,20 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
       break;
   } /* for (i = 0; i < ci->children_num; i++) */
 
+  if (node->batch_size < 1)
+  {
+    WARNING ("write_redis plugin: Node \"%s\": BatchSize must be at least "
+        "one. Using the default of %i.", node->name, WR_DEFAULT_BATCH_SIZE);
+    node->batch_size = WR_DEFAULT_BATCH_SIZE;
+  }
+
+  if ((node->max_backlog > 0) && (node->max_backlog < node->batch_size))
+  {
+    WARNING ("write_redis plugin: Node \"%s\": MaxBacklog is smaller than "
+        "BatchSize. Setting it to %i.", node->name, node->batch_size);
+    node->max_backlog = node->batch_size;
+  }
+
   if (status == 0)
   {
     char cb_name[DATA_MAX_NAME_LEN];
@@ -204,6 +871,12 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
     ud.free_func = wr_config_free;
 
     status = plugin_register_write (cb_name, wr_write, &ud);
+
+    if (status == 0)
+    {
+      ud.free_func = NULL;
+      plugin_register_flush (cb_name, wr_flush, &ud);
+    }
   }
 
   if (status != 0)